@@ -404,31 +404,18 @@ static void write_figtree(stree_t * stree,
   return;
 }
 
-void allfixed_summary(FILE * fp_out, stree_t * stree)
+/* number of columns in the MCMC file (excluding the sample number) */
+static long column_count(stree_t * stree)
 {
-  long i,j,count;
-  long sample_num;
-  long rc = 0;
-  FILE * fp;
+  long i;
+  long col_count = 0;
   unsigned int snodes_total;
-  
+
   if (opt_msci)
     snodes_total = stree->tip_count + stree->inner_count + stree->hybrid_count;
   else
     snodes_total = stree->tip_count + stree->inner_count;
 
-  /* TODO: pretty-fy output */
-
-  fp = xopen(opt_mcmcfile,"r");
-
-  /* skip line containing header */
-  getnextline(fp);
-  assert(strlen(line) > 4);
-  char * header = xstrdup(line);
-
-  /* compute number of columns in the file */
-  long col_count = 0;
-
   /* compute number of theta parameters */
   if (opt_est_theta)
     for (i = 0; i < snodes_total; ++i)
@@ -456,19 +443,53 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
   if (opt_clock != BPP_CLOCK_GLOBAL)
     ++col_count;
 
+  return col_count;
+}
 
-  /* allocate storage matrix */
-  double ** matrix = (double **)xmalloc((size_t)col_count * sizeof(double *));
+static void print_row(FILE * fp_out,
+                      const char * label,
+                      double * values,
+                      long col_count)
+{
+  long i;
+
+  fprintf(stdout, "%s", label);
+  fprintf(fp_out, "%s", label);
   for (i = 0; i < col_count; ++i)
-    matrix[i] = (double *)xmalloc((size_t)opt_samples * sizeof(double));
+  {
+    fprintf(stdout, "  %f", values[i]);
+    fprintf(fp_out, "  %f", values[i]);
+  }
+  fprintf(stdout, "\n");
+  fprintf(fp_out, "\n");
+}
 
-  double * mean = (double *)xmalloc((size_t)col_count * sizeof(double));
+static void print_figtree(stree_t * stree,
+                          double * mean,
+                          double * hpd025,
+                          double * hpd975)
+{
+  if (stree->tip_count < 2) return;
 
-  double * hpd025 = (double *)xmalloc((size_t)col_count * sizeof(double));
-  double * hpd975 = (double *)xmalloc((size_t)col_count * sizeof(double));
-  double * tint = (double *)xmalloc((size_t)col_count * sizeof(double));
-  double * stdev = (double *)xmalloc((size_t)col_count * sizeof(double));
+  /* write figtree file */
+  if (!opt_msci)
+  {
+    write_figtree(stree,mean,hpd025,hpd975);
+    fprintf(stdout, "FigTree tree is in FigTree.tre\n");
+  }
+  else
+  {
+    fprintf(stderr, "FigTree tree cannot be printed for networks yet\n");
+  }
+}
 
+/* read the samples of an MCMC file, whose header line has already been read,
+   into the columns of matrix. Returns the number of records read, or -1 if
+   the file is malformed */
+static long read_samples(FILE * fp, double ** matrix, long col_count)
+{
+  long i,count;
+  long sample_num;
   long line_count = 0;
   long bad_count = 0;
   long lineno = 0;
@@ -484,7 +505,7 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
 
     /* skip sample number */
     count = get_long(p,&sample_num);
-    if (!count) goto l_unwind;
+    if (!count) return -1;
 
     p += count;
 
@@ -504,7 +525,7 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
             fprintf(stderr,
                     "ERROR: Found two consecutive records with mismatching "
                     "number of columns (lines %ld and %ld)\n", lineno-1,lineno);
-          goto l_unwind;
+          return -1;
         }
         else
         {
@@ -532,14 +553,48 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
   if (bad_count)
     fprintf(stderr, "Skipped a total of %ld erroneous records...\n", bad_count);
 
+  return line_count;
+}
+
+void allfixed_summary(FILE * fp_out, stree_t * stree)
+{
+  long i,j;
+  long rc = 0;
+  FILE * fp;
+  
+  /* TODO: pretty-fy output */
+
+  fp = xopen(opt_mcmcfile,"r");
+
+  /* skip line containing header */
+  getnextline(fp);
+  assert(strlen(line) > 4);
+  char * header = xstrdup(line);
+
+  /* compute number of columns in the file */
+  long col_count = column_count(stree);
+
+  /* allocate storage matrix */
+  double ** matrix = (double **)xmalloc((size_t)col_count * sizeof(double *));
+  for (i = 0; i < col_count; ++i)
+    matrix[i] = (double *)xmalloc((size_t)opt_samples * sizeof(double));
+
+  double * mean = (double *)xmalloc((size_t)col_count * sizeof(double));
+
+  double * hpd025 = (double *)xmalloc((size_t)col_count * sizeof(double));
+  double * hpd975 = (double *)xmalloc((size_t)col_count * sizeof(double));
+  double * tint = (double *)xmalloc((size_t)col_count * sizeof(double));
+  double * stdev = (double *)xmalloc((size_t)col_count * sizeof(double));
+  double * row = (double *)xmalloc((size_t)col_count * sizeof(double));
+
+  if (read_samples(fp,matrix,col_count) < 0)
+    goto l_unwind;
+
   fprintf(stdout, "          %s\n", header+4);
   fprintf(fp_out, "          %s\n", header+4);
-  free(header);
 
 
   /* compute means */
-  fprintf(stdout, "mean    ");
-  fprintf(fp_out, "mean    ");
   for (i = 0; i < col_count; ++i)
   {
     double sum = 0;
@@ -547,11 +602,8 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
       sum += matrix[i][j];
 
     mean[i] = sum/opt_samples;
-    fprintf(stdout, "  %f", mean[i]);
-    fprintf(fp_out, "  %f", mean[i]);
   }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
+  print_row(fp_out, "mean    ", mean, col_count);
 
   /* compute standard deviation */
   for (i = 0; i < col_count; ++i)
@@ -568,129 +620,63 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
     tint[i] = eff_ict(matrix[i],opt_samples,mean[i],stdev[i]);
 
   /* compute and print medians */
-  fprintf(stdout, "median  ");
-  fprintf(fp_out, "median  ");
   long median_line = opt_samples / 2;
 
   for (i = 0; i < col_count; ++i)
   {
     qsort(matrix[i], opt_samples, sizeof(double), cb_cmp_double);
 
-    double median = matrix[i][median_line];
+    row[i] = matrix[i][median_line];
     if ((opt_samples & 1) == 0)
     {
-      median += matrix[i][median_line-1];
-      median /= 2;
+      row[i] += matrix[i][median_line-1];
+      row[i] /= 2;
     }
-
-    fprintf(stdout, "  %f", median);
-    fprintf(fp_out, "  %f", median);
   }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
+  print_row(fp_out, "median  ", row, col_count);
 
   /* print standard deviation */
-  fprintf(stdout, "S.D     ");
-  fprintf(fp_out, "S.D     ");
-  for (i = 0; i < col_count; ++i)
-  {
-    fprintf(stdout, "  %f", stdev[i]);
-    fprintf(fp_out, "  %f", stdev[i]);
-  }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
+  print_row(fp_out, "S.D     ", stdev, col_count);
 
   /* print minimum values */
-  fprintf(stdout, "min     ");
-  fprintf(fp_out, "min     ");
   for (i = 0; i < col_count; ++i)
-  {
-    fprintf(stdout, "  %f", matrix[i][0]);
-    fprintf(fp_out, "  %f", matrix[i][0]);
-  }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
+    row[i] = matrix[i][0];
+  print_row(fp_out, "min     ", row, col_count);
 
   /* print maximum values */
-  fprintf(stdout, "max     ");
-  fprintf(fp_out, "max     ");
   for (i = 0; i < col_count; ++i)
-  {
-    fprintf(stdout, "  %f", matrix[i][opt_samples-1]);
-    fprintf(fp_out, "  %f", matrix[i][opt_samples-1]);
-  }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
+    row[i] = matrix[i][opt_samples-1];
+  print_row(fp_out, "max     ", row, col_count);
 
   /* print line at 2.5% of matrix */
-  fprintf(stdout, "2.5%%    ");
-  fprintf(fp_out, "2.5%%    ");
   for (i = 0; i < col_count; ++i)
-  {
-    fprintf(stdout, "  %f", matrix[i][(long)(opt_samples*.025)]);
-    fprintf(fp_out, "  %f", matrix[i][(long)(opt_samples*.025)]);
-  }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
+    row[i] = matrix[i][(long)(opt_samples*.025)];
+  print_row(fp_out, "2.5%    ", row, col_count);
 
   /* print line at 97.5% of matrix */
-  fprintf(stdout, "97.5%%   ");
-  fprintf(fp_out, "97.5%%   ");
   for (i = 0; i < col_count; ++i)
-  {
-    fprintf(stdout, "  %f", matrix[i][(long)(opt_samples*.975)]);
-    fprintf(fp_out, "  %f", matrix[i][(long)(opt_samples*.975)]);
-  }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
+    row[i] = matrix[i][(long)(opt_samples*.975)];
+  print_row(fp_out, "97.5%   ", row, col_count);
 
   /* compute and print HPD 2.5% and 97.5% */
   for (i = 0; i < col_count; ++i)
     hpd_interval(matrix[i],opt_samples,hpd025+i,hpd975+i,0.05);
 
   /* print 2.5% HPD */
-  fprintf(stdout, "2.5%%HPD ");
-  fprintf(fp_out, "2.5%%HPD ");
-  for (i = 0; i < col_count; ++i)
-  {
-    fprintf(stdout, "  %f", hpd025[i]);
-    fprintf(fp_out, "  %f", hpd025[i]);
-  }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
+  print_row(fp_out, "2.5%HPD ", hpd025, col_count);
 
   /* print 97.5% HPD */
-  fprintf(stdout, "97.5%%HPD");
-  fprintf(fp_out, "97.5%%HPD");
-  for (i = 0; i < col_count; ++i)
-  {
-    fprintf(stdout, "  %f", hpd975[i]);
-    fprintf(fp_out, "  %f", hpd975[i]);
-  }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
+  print_row(fp_out, "97.5%HPD", hpd975, col_count);
 
   /* print ESS */
-  fprintf(stdout, "ESS*    ");
-  fprintf(fp_out, "ESS*    ");
   for (i = 0; i < col_count; ++i)
-  {
-    fprintf(stdout, "  %f", opt_samples/tint[i]);
-    fprintf(fp_out, "  %f", opt_samples/tint[i]);
-  }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
+    row[i] = opt_samples/tint[i];
+  print_row(fp_out, "ESS*    ", row, col_count);
     
   /* print Eff */
-  fprintf(stdout, "Eff*    ");
-  fprintf(fp_out, "Eff*    ");
   for (i = 0; i < col_count; ++i)
-  {
-    fprintf(stdout, "  %f", 1/tint[i]);
-    fprintf(fp_out, "  %f", 1/tint[i]);
-  }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
+    row[i] = 1/tint[i];
+  print_row(fp_out, "Eff*    ", row, col_count);
 
   /* success */
   rc = 1;
@@ -700,25 +686,16 @@ l_unwind:
     free(matrix[i]);
   free(matrix);
 
-  if (rc && stree->tip_count > 1)
-  {
-    /* write figtree file */
-    if (!opt_msci)
-    {
-      write_figtree(stree,mean,hpd025,hpd975);
-      fprintf(stdout, "FigTree tree is in FigTree.tre\n");
-    }
-    else
-    {
-      fprintf(stderr, "FigTree tree cannot be printed for networks yet\n");
-    }
-  }
+  if (rc)
+    print_figtree(stree,mean,hpd025,hpd975);
 
+  free(header);
   free(mean);
   free(hpd025);
   free(hpd975);
   free(tint);
   free(stdev);
+  free(row);
 
   fclose(fp);
 
@@ -727,3 +704,222 @@ l_unwind:
 
 }
 
+/* read the MCMC file of an independent replicate with the same parsing as
+   allfixed_summary, and accumulate each column in a stats_t. Column labels
+   are taken from the header line. Returns the number of columns */
+long allfixed_replicate_stats(const char * filename,
+                              stree_t * stree,
+                              char *** labels,
+                              stats_t *** stats)
+{
+  long i,j;
+  long line_count;
+  FILE * fp;
+
+  fp = xopen(filename,"r");
+
+  if (!getnextline(fp) || strlen(line) <= 4)
+    fatal("Error while reading header of %s", filename);
+
+  long col_count = column_count(stree);
+
+  /* split the header, skipping the label of the sample number */
+  char ** label = (char **)xmalloc((size_t)col_count * sizeof(char *));
+  char * p = line+4;
+  for (i = 0; i < col_count; ++i)
+  {
+    size_t len = strcspn(p,"\t");
+    if (!len)
+      fatal("Header of %s has fewer than %ld columns", filename, col_count);
+
+    label[i] = (char *)xmalloc((len+1)*sizeof(char));
+    memcpy(label[i],p,len);
+    label[i][len] = 0;
+
+    p += len;
+    if (*p) ++p;
+  }
+
+  double ** matrix = (double **)xmalloc((size_t)col_count * sizeof(double *));
+  for (i = 0; i < col_count; ++i)
+    matrix[i] = (double *)xmalloc((size_t)opt_samples * sizeof(double));
+
+  line_count = read_samples(fp,matrix,col_count);
+  fclose(fp);
+  if (line_count < 0)
+    fatal("Error while reading/summarizing %s", filename);
+
+  stats_t ** st = (stats_t **)xmalloc((size_t)col_count * sizeof(stats_t *));
+  for (i = 0; i < col_count; ++i)
+  {
+    st[i] = stats_create(line_count);
+    for (j = 0; j < line_count; ++j)
+      stats_update(st[i], matrix[i][j]);
+    free(matrix[i]);
+  }
+  free(matrix);
+
+  *labels = label;
+  *stats = st;
+  return col_count;
+}
+
+/* Online summary. Each column of the MCMC file is accumulated in a stats_t as
+   samples are logged, such that the summary does not require the MCMC file
+   to be read back into memory at the end of the run */
+
+static stats_t ** online_stats = NULL;
+static long online_col_count = 0;
+
+void allfixed_online_init(stree_t * stree)
+{
+  long i;
+
+  online_col_count = column_count(stree);
+  online_stats = (stats_t **)xmalloc((size_t)online_col_count *
+                                     sizeof(stats_t *));
+  for (i = 0; i < online_col_count; ++i)
+    online_stats[i] = stats_create(opt_samples);
+}
+
+/* values are accumulated in the order they are logged in the MCMC file */
+void allfixed_online_update(stree_t * stree, gtree_t ** gtree)
+{
+  long i;
+  long col = 0;
+  unsigned int snodes_total;
+
+  if (opt_msci)
+    snodes_total = stree->tip_count + stree->inner_count + stree->hybrid_count;
+  else
+    snodes_total = stree->tip_count + stree->inner_count;
+
+  if (opt_est_theta)
+    for (i = 0; i < snodes_total; ++i)
+      if (stree->nodes[i]->theta >= 0)
+        stats_update(online_stats[col++], stree->nodes[i]->theta);
+
+  for (i = stree->tip_count; i < stree->tip_count + stree->inner_count; ++i)
+    if (stree->nodes[i]->tau)
+      stats_update(online_stats[col++], stree->nodes[i]->tau);
+
+  if (opt_msci)
+  {
+    unsigned int offset = stree->tip_count+stree->inner_count;
+    for (i = 0; i < stree->hybrid_count; ++i)
+      stats_update(online_stats[col++], stree->nodes[offset+i]->hybrid->hphi);
+  }
+
+  if (opt_est_locusrate == MUTRATE_ESTIMATE &&
+      opt_est_mubar &&
+      opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL)
+    stats_update(online_stats[col++], stree->locusrate_mubar);
+
+  if (opt_clock != BPP_CLOCK_GLOBAL)
+  {
+    if (opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL)
+      stats_update(online_stats[col++], stree->locusrate_nubar);
+    else
+      stats_update(online_stats[col++], stree->nui_sum / opt_locus_count);
+  }
+
+  if (opt_usedata)
+  {
+    double logl = 0;
+
+    for (i = 0; i < stree->locus_count; ++i)
+      logl += gtree[i]->logl;
+
+    stats_update(online_stats[col++], logl/opt_bfbeta);
+  }
+
+  assert(col == online_col_count);
+}
+
+void allfixed_online_summary(FILE * fp_out, stree_t * stree)
+{
+  long i;
+  long col_count = online_col_count;
+  int exact = 1;
+  FILE * fp;
+
+  assert(online_stats);
+
+  /* column labels are taken from the header of the MCMC file */
+  fp = xopen(opt_mcmcfile,"r");
+  if (!getnextline(fp) || strlen(line) <= 4)
+    fatal("Error while reading header of %s", opt_mcmcfile);
+  fprintf(stdout, "          %s\n", line+4);
+  fprintf(fp_out, "          %s\n", line+4);
+  fclose(fp);
+
+  double * mean = (double *)xmalloc((size_t)col_count * sizeof(double));
+  double * hpd025 = (double *)xmalloc((size_t)col_count * sizeof(double));
+  double * hpd975 = (double *)xmalloc((size_t)col_count * sizeof(double));
+  double * row = (double *)xmalloc((size_t)col_count * sizeof(double));
+
+  for (i = 0; i < col_count; ++i)
+  {
+    mean[i] = stats_mean(online_stats[i]);
+    stats_hpd(online_stats[i],0.05,hpd025+i,hpd975+i);
+    if (!stats_exact(online_stats[i]))
+      exact = 0;
+  }
+  print_row(fp_out, "mean    ", mean, col_count);
+
+  for (i = 0; i < col_count; ++i)
+    row[i] = stats_median(online_stats[i]);
+  print_row(fp_out, "median  ", row, col_count);
+
+  for (i = 0; i < col_count; ++i)
+    row[i] = stats_sd(online_stats[i]);
+  print_row(fp_out, "S.D     ", row, col_count);
+
+  for (i = 0; i < col_count; ++i)
+    row[i] = online_stats[i]->min;
+  print_row(fp_out, "min     ", row, col_count);
+
+  for (i = 0; i < col_count; ++i)
+    row[i] = online_stats[i]->max;
+  print_row(fp_out, "max     ", row, col_count);
+
+  for (i = 0; i < col_count; ++i)
+    row[i] = stats_quantile(online_stats[i],.025);
+  print_row(fp_out, "2.5%    ", row, col_count);
+
+  for (i = 0; i < col_count; ++i)
+    row[i] = stats_quantile(online_stats[i],.975);
+  print_row(fp_out, "97.5%   ", row, col_count);
+
+  print_row(fp_out, "2.5%HPD ", hpd025, col_count);
+  print_row(fp_out, "97.5%HPD", hpd975, col_count);
+
+  for (i = 0; i < col_count; ++i)
+    row[i] = online_stats[i]->n / stats_tint(online_stats[i]);
+  print_row(fp_out, "ESS*    ", row, col_count);
+
+  for (i = 0; i < col_count; ++i)
+    row[i] = 1 / stats_tint(online_stats[i]);
+  print_row(fp_out, "Eff*    ", row, col_count);
+
+  fprintf(stdout, "ESS* and Eff* estimated with batch means\n");
+  fprintf(fp_out, "ESS* and Eff* estimated with batch means\n");
+  if (!exact)
+  {
+    fprintf(stdout, "Median, quantiles and HPD intervals are approximate\n");
+    fprintf(fp_out, "Median, quantiles and HPD intervals are approximate\n");
+  }
+
+  print_figtree(stree,mean,hpd025,hpd975);
+
+  for (i = 0; i < col_count; ++i)
+    stats_destroy(online_stats[i]);
+  free(online_stats);
+  online_stats = NULL;
+  online_col_count = 0;
+
+  free(mean);
+  free(hpd025);
+  free(hpd975);
+  free(row);
+}
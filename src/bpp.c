@@ -62,13 +62,18 @@ long opt_locusrate_prior;
 long opt_locus_count;
 long opt_locus_simlen;
 long opt_max_species_count;
+long opt_mc3_chains;
+long opt_mc3_swapfreq;
 long opt_method;
 long opt_migration;
 long opt_model;
+long opt_msc_layout;
 long opt_msci;
+long opt_onlinesummary;
 long opt_onlysummary;
 long opt_partition_count;
 long opt_print_genetrees;
+long opt_powerposterior;
 long opt_print_hscalars;
 long opt_print_locusfile;
 long opt_print_locusrate;
@@ -77,6 +82,8 @@ long opt_print_rates;
 long opt_print_samples;
 long opt_qrates_fixed;
 long opt_quiet;
+long opt_replicates;
+long opt_rng;
 long opt_rate_prior;
 long opt_revolutionary_spr_method;
 long opt_revolutionary_spr_debug;
@@ -115,11 +122,13 @@ double opt_finetune_theta;
 double opt_heredity_alpha;
 double opt_heredity_beta;
 double opt_locusrate_mubar;
+double opt_mc3_heat;
 double opt_mubar_alpha;
 double opt_mubar_beta;
 double opt_mui_alpha;
 double opt_phi_alpha;
 double opt_phi_beta;
+double opt_powerposterior_alpha;
 double opt_rjmcmc_alpha;
 double opt_rjmcmc_epsilon;
 double opt_rjmcmc_mean;
@@ -134,6 +143,7 @@ double opt_vbar_beta;
 double opt_vi_alpha;
 long * opt_diploid;
 long * opt_sp_seqcount;
+char * opt_cachefile;
 char * opt_cfile;
 char * opt_concatfile;
 char * opt_constfile;
@@ -185,6 +195,7 @@ static struct option long_options[] =
   {"rev_gspr",   no_argument,       0, 0 },  /* 10 */
   {"debugrates", no_argument,       0, 0 },  /* 11 */
   {"msci-create",required_argument, 0, 0 },  /* 12 */
+  {"rng",        required_argument, 0, 0 },  /* 13 */
   { 0, 0, 0, 0 }
 };
 
@@ -298,6 +309,7 @@ void args_init(int argc, char ** argv)
   opt_vbar_beta = -1;
   opt_vi_alpha = -1;
   opt_burnin = 100;
+  opt_cachefile = NULL;
   opt_cfile = NULL;
   opt_clock = BPP_CLOCK_GLOBAL;
   opt_clock_vbar = 0;
@@ -356,6 +368,9 @@ void args_init(int argc, char ** argv)
   opt_locus_simlen = 0;
   opt_mapfile = NULL;
   opt_max_species_count = 0;
+  opt_mc3_chains = 1;
+  opt_mc3_heat = 0.1;
+  opt_mc3_swapfreq = 1;
   opt_mcmcfile = NULL;
   opt_method = -1;
   opt_migration = 0;
@@ -365,8 +380,10 @@ void args_init(int argc, char ** argv)
   opt_model = -1;
   opt_modelparafile = NULL;
   opt_msafile = NULL;
+  opt_msc_layout = BPP_MSC_LAYOUT_LOCUS;
   opt_msci = 0;
   opt_mscifile = NULL;
+  opt_onlinesummary = 0;
   opt_onlysummary = 0;
   opt_outfile = NULL;
   opt_partition_count = 0;
@@ -374,6 +391,8 @@ void args_init(int argc, char ** argv)
   opt_partition_list = NULL;
   opt_phi_alpha = 0;
   opt_phi_beta = 0;
+  opt_powerposterior = 0;
+  opt_powerposterior_alpha = 0.3;
   opt_print_genetrees = 0;
   opt_print_hscalars = 0;
   opt_print_locusfile = 0;
@@ -385,12 +404,14 @@ void args_init(int argc, char ** argv)
   opt_qrates_params = NULL;
   opt_quiet = 0;
   opt_rate_prior = BPP_BRATE_PRIOR_GAMMA;
+  opt_replicates = 1;
   opt_resume = NULL;
   opt_rev_gspr = 0;
   opt_rjmcmc_alpha = -1;
   opt_rjmcmc_epsilon = -1;
   opt_rjmcmc_mean = -1;
   opt_rjmcmc_method = -1;
+  opt_rng = BPP_RNG_XOSHIRO;
   opt_samplefreq = 10;
   opt_samples = 0;
   opt_scaling = 0;
@@ -408,7 +429,7 @@ void args_init(int argc, char ** argv)
   opt_theta_beta = 0;
   opt_threads = 1;
   opt_threads_start = 1;
-  opt_threads_step = 1;
+  opt_threads_step = 0;
   opt_treefile = NULL;
   opt_usedata = 1;
   opt_version = 0;
@@ -478,6 +499,15 @@ void args_init(int argc, char ** argv)
         opt_mscifile = xstrdup(optarg);
         break;
 
+      case 13:
+        if (!strcasecmp(optarg,"xoshiro"))
+          opt_rng = BPP_RNG_XOSHIRO;
+        else if (!strcasecmp(optarg,"legacy"))
+          opt_rng = BPP_RNG_LEGACY;
+        else
+          fatal("Invalid random number generator (%s)", optarg);
+        break;
+
       default:
         fatal("Internal error in option parsing");
     }
@@ -524,6 +554,7 @@ void args_init(int argc, char ** argv)
 
 static void dealloc_switches()
 {
+  if (opt_cachefile) free(opt_cachefile);
   if (opt_cfile) free(opt_cfile);
   if (opt_constfile) free(opt_constfile);
   if (opt_mapfile) free(opt_mapfile);
@@ -559,6 +590,7 @@ void cmd_help()
           "  --cfile FILENAME   run analysis for the specified control file\n"
           "  --resume FILENAME  resume analysis from a specified checkpoint file\n"
           "  --arch SIMD        force specific vector instruction set (default: auto)\n"
+          "  --rng NAME         random number generator: xoshiro (default) or legacy\n"
           "\n"
          );
 
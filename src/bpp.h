@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <limits.h>
+#include <float.h>
 #include <locale.h>
 #include <math.h>
 #include <sys/stat.h>
@@ -97,7 +98,7 @@
 #define VERSION_PATCH 0
 
 /* checkpoint version */
-#define VERSION_CHKP 1
+#define VERSION_CHKP 3
 
 #define PROG_VERSION "v" PLL_C2S(VERSION_MAJOR) "." PLL_C2S(VERSION_MINOR) "." \
         PLL_C2S(VERSION_PATCH)
@@ -138,6 +139,8 @@
 #define PROG_OS "win"
 #include <windows.h>
 #include <psapi.h>
+#else
+#include <sys/mman.h>
 #endif
 
 #define PROG_ARCH PROG_OS "_" PROG_CPU
@@ -230,6 +233,15 @@ extern const char * global_freqs_strings[28];
 
 #define BPP_PI  3.1415926535897932384626433832795
 
+#define BPP_RNG_LEGACY                  0
+#define BPP_RNG_XOSHIRO                 1
+
+#define BPP_MSC_LAYOUT_NODE             0
+#define BPP_MSC_LAYOUT_LOCUS            1
+
+/* number of 64-bit words holding the state of one random number generator */
+#define RNG_STATE_WORDS                 4
+
 #define THREAD_WORK_GTAGE               1
 #define THREAD_WORK_GTSPR               2
 #define THREAD_WORK_TAU                 3
@@ -238,6 +250,8 @@ extern const char * global_freqs_strings[28];
 #define THREAD_WORK_RATES               6
 #define THREAD_WORK_FREQS               7
 #define THREAD_WORK_BRATE               8
+#define THREAD_WORK_FIRSTTOUCH          9
+#define THREAD_WORK_SIMULATE           10
 
 #define BPP_MOVE_INDEX_MIN              0
 #define BPP_MOVE_GTAGE_INDEX            0
@@ -290,6 +304,10 @@ extern const char * global_freqs_strings[28];
 
 #define PLL_ATTRIB_RATE_SCALERS   (1 << 9)
 
+/* with PLL_ATTRIB_PATTERN_TIP, 4-state tips are stored as 4-bit state codes,
+   two sites per byte (low nibble first) */
+#define PLL_TIPCHAR_4X4(t,n)      (((t)[(n)>>1] >> (((n)&1)<<2)) & 0xF)
+
 #define PLL_SCALE_FACTOR 115792089237316195423570985008687907853269984665640564039457584007913129639936.0  /*  2**256 (exactly)  */
 #define PLL_SCALE_THRESHOLD (1.0/PLL_SCALE_FACTOR)
 #define PLL_SCALE_FACTOR_SQRT 340282366920938463463374607431768211456.0 /* 2**128 */
@@ -345,6 +363,22 @@ typedef struct dlist_s
   dlist_item_t * tail;
 } dlist_t;
 
+/* per-locus state of a population. The records of all populations and loci
+   live in one block owned by the species tree (see stree_alloc_locus_state)
+   and are reached through SNODE_LOCUS() */
+typedef struct snode_locus_s
+{
+  dlist_t * event;                  /* coalescent events in population */
+  int event_count;
+  int seqin_count;                  /* lineages coming in the population */
+  unsigned int gene_leaves;
+  double logpr_contrib;
+  double old_logpr_contrib;
+  double t2h;                       /* precomputed t2h (no theta) */
+  double old_t2h;                   /* storage space for rollback */
+  double brate;                     /* branch rate */
+} snode_locus_t;
+
 typedef struct snode_s
 {
   char * label;
@@ -359,7 +393,6 @@ typedef struct snode_s
   struct snode_s * right;
   struct snode_s * parent;
   unsigned int leaves;
-  unsigned int * gene_leaves;
   int prop_tau;
   int * mark;
 
@@ -371,18 +404,13 @@ typedef struct snode_s
   /* branch weight when inferring species tree */
   double weight;
 
-  /* list of per-locus coalescent events */
-  dlist_t ** event;
-
-  int * event_count;
+  /* per-locus state, locus i is at locus_state[locus_offset[i]] */
+  snode_locus_t * locus_state;
+  const size_t * locus_offset;
 
-  /* branch rate (per locus)*/
-  double * brate;
+  /* branch rate (per locus) is estimated for this population */
+  long has_brate;
 
-  /* number of lineages coming in the population */
-  int * seqin_count;
-  double * logpr_contrib;
-  double * old_logpr_contrib;
   //unsigned int * seqin_count;
   //unsigned int * seqout_count;
 
@@ -400,8 +428,6 @@ typedef struct snode_s
   long has_theta;
 
   /* no theta related variables */
-  double * t2h;                     /* per-locus precomputed t2h */
-  double * old_t2h;                 /* storage space for rollback */
   double t2h_sum;                   /* t2h sum for all loci */
   long event_count_sum;             /* sum of coalencent events count */
   double notheta_logpr_contrib;     /* MSC density contribution from pop */
@@ -416,9 +442,10 @@ typedef struct snode_s
   double hphi;                      /* genetic contribution */
   long htau;                        /* tau parameter (1: yes, 0: no) */
   struct snode_s * hybrid;          /* linked hybridization node */
-  long * hx;                        /* sum of events count and seqin_count (per msa) */
 } snode_t;
 
+#define SNODE_LOCUS(node,i) ((node)->locus_state + (node)->locus_offset[(i)])
+
 typedef struct stree_s
 {
   unsigned int tip_count;
@@ -430,6 +457,12 @@ typedef struct stree_s
 
   snode_t ** nodes;
 
+  /* per-locus state of all populations */
+  snode_locus_t * locus_state;
+  size_t * locus_offset;
+  size_t locus_state_size;
+  snode_locus_t * locus_state_old;  /* previous block while being moved */
+
   int ** pptable;
 
   snode_t * root;
@@ -620,6 +653,14 @@ typedef struct locus_s
   double * likelihood_vector;
   int unphased_length;
 
+  /* nonzero if tip data, pattern weights and diploid mappings are borrowed
+     from another locus (see locus_clone) */
+  int shared_data;
+
+  /* nonzero if the eigen decompositions point to the model-level store of
+     an empirical amino-acid model (see locus_share_eigen) */
+  int shared_eigen;
+
 } locus_t;
 
 /* Simple structure for handling PHYLIP parsing */
@@ -652,8 +693,23 @@ typedef struct phylip_s
   long lineno;
   long stripped_count;
   long stripped[256];
+
+  /* if set, lines are read from this memory region instead of fp */
+  const char * mem;
+  size_t mem_size;
+  size_t mem_pos;
 } phylip_t;
 
+typedef struct cache_s
+{
+  char * mem;
+  const char * p;
+  const char * end;
+  size_t size;
+  int mapped;
+  long msa_count;
+} cache_t;
+
 typedef struct mapping_s
 {
   char * individual;
@@ -717,6 +773,36 @@ typedef struct pair_s
   void * data;
 } pair_t;
 
+typedef struct stats_s
+{
+  /* running moments */
+  long n;
+  double mean;
+  double m2;
+  double min;
+  double max;
+
+  /* batch means */
+  long batch_size;
+  long batch_fill;
+  long batch_count;
+  double batch_sum;
+  double batch_mean;
+  double batch_m2;
+
+  /* samples not yet merged into the t-digest */
+  double * buffer;
+  long buffer_count;
+  int sorted;
+
+  /* t-digest centroids */
+  double * centroid_mean;
+  double * centroid_weight;
+  long centroid_count;
+  long centroid_max;
+  int merged;
+} stats_t;
+
 typedef struct thread_data_s
 {
   /* contains common data that are passed to all threads, and variables that
@@ -756,6 +842,22 @@ typedef struct thread_data_s
 
 } thread_data_t;
 
+/* per-thread scratch space for the gene tree and species tree moves. Each
+   thread owns one record whose arrays are indexed by species tree node index
+   and placed in their own cache lines, such that writes from one thread never
+   invalidate lines read by another */
+typedef struct thread_scratch_s
+{
+  long * hx;                /* sum of events count and seqin_count (MSci) */
+  int * mark;               /* re-entrant species tree node marks */
+  double * sortbuffer;      /* coalescent times sorting buffer */
+
+  char pad[64 - 2*sizeof(void *) - sizeof(double *)];
+} thread_scratch_t;
+
+#define SNODE_HX(node,t)        (thread_scratch[t].hx[(node)->node_index])
+#define SNODE_MARK(node,t)      (thread_scratch[t].mark[(node)->node_index])
+
 
 /* macros */
 
@@ -830,13 +932,18 @@ extern long opt_locusrate_prior;
 extern long opt_locus_count;
 extern long opt_locus_simlen;
 extern long opt_max_species_count;
+extern long opt_mc3_chains;
+extern long opt_mc3_swapfreq;
 extern long opt_method;
 extern long opt_migration;
 extern long opt_model;
+extern long opt_msc_layout;
 extern long opt_msci;
+extern long opt_onlinesummary;
 extern long opt_onlysummary;
 extern long opt_partition_count;
 extern long opt_print_genetrees;
+extern long opt_powerposterior;
 extern long opt_print_hscalars;
 extern long opt_print_locusfile;
 extern long opt_print_locusrate;
@@ -845,6 +952,8 @@ extern long opt_print_rates;
 extern long opt_print_samples;
 extern long opt_qrates_fixed;
 extern long opt_quiet;
+extern long opt_replicates;
+extern long opt_rng;
 extern long opt_rate_prior;
 extern long opt_revolutionary_spr_method;
 extern long opt_revolutionary_spr_debug;
@@ -882,11 +991,13 @@ extern double opt_finetune_theta;
 extern double opt_heredity_alpha;
 extern double opt_heredity_beta;
 extern double opt_locusrate_mubar;      /* used only in simulation */
+extern double opt_mc3_heat;
 extern double opt_mubar_alpha;
 extern double opt_mubar_beta;
 extern double opt_mui_alpha;
 extern double opt_phi_alpha;
 extern double opt_phi_beta;
+extern double opt_powerposterior_alpha;
 extern double opt_rjmcmc_alpha;
 extern double opt_rjmcmc_mean;
 extern double opt_rjmcmc_epsilon;
@@ -903,6 +1014,7 @@ extern double opt_vi_alpha;
 extern long * opt_diploid;
 extern long * opt_sp_seqcount;
 extern char * cmdline;
+extern char * opt_cachefile;
 extern char * opt_cfile;
 extern char * opt_concatfile;
 extern char * opt_constfile;
@@ -992,6 +1104,8 @@ extern long avx_present;
 extern long avx2_present;
 extern long altivec_present;
 
+extern thread_scratch_t * thread_scratch;
+
 /* functions in util.c */
 
 #ifdef _MSC_VER
@@ -1013,6 +1127,8 @@ long getusec(void);
 FILE * xopen(const char * filename, const char * mode);
 void * pll_aligned_alloc(size_t size, size_t alignment);
 void pll_aligned_free(void * ptr);
+char * xmapfile(FILE * fp, size_t size, int * mapped);
+void xunmapfile(char * mem, size_t size, int mapped);
 int xtolower(int c);
 
 /* functions in bpp.c */
@@ -1094,6 +1210,10 @@ gtree_t * gtree_clone_init(gtree_t * gtree, stree_t * stree);
 
 stree_t * stree_clone_init(stree_t * stree);
 
+stree_t * stree_clone_with_gtrees(stree_t * stree,
+                                  gtree_t ** gtree,
+                                  gtree_t *** ptr_gtree_clones);
+
 void stree_label(stree_t * stree);
 
 void stree_show_pptable(stree_t * stree, int show_taus_and_thetas);
@@ -1104,6 +1224,8 @@ void stree_init(stree_t * stree,
                 int msa_count,
                 FILE * fp_out);
 
+void stree_init_replicate(stree_t * stree);
+
 void stree_init_pptable(stree_t * stree);
 
 void stree_alloc_internals(stree_t * stree,
@@ -1111,6 +1233,21 @@ void stree_alloc_internals(stree_t * stree,
                            unsigned int gtree_inner_sum,
                            long msa_count);
 
+void stree_alloc_locus_state(stree_t * stree, long msa_count);
+
+void stree_free_locus_state(stree_t * stree);
+
+void stree_locus_state_move_begin(stree_t * stree);
+
+size_t stree_locus_state_touch(stree_t * stree, long first, long count);
+
+void stree_locus_state_move_end(stree_t * stree);
+
+long stree_locus_state_placement(stree_t * stree,
+                                 long first,
+                                 long count,
+                                 double * node_bytes);
+
 int node_is_bidirection(const snode_t * node);
 int node_is_mirror(const snode_t * node);
 int node_is_hybridization(const snode_t * node);
@@ -1187,6 +1324,7 @@ long list_delitem(list_t * list, list_item_t * item, void (*cb_dealloc)(void *))
 
 dlist_item_t * dlist_append(dlist_t * dlist, void * data);
 void dlist_clear(dlist_t * dlist, void (*cb_dealloc)(void *));
+void dlist_reset(dlist_t * dlist);
 void dlist_item_remove(dlist_item_t * item);
 void dlist_item_append(dlist_t * dlist, dlist_item_t * item);
 void dlist_item_prepend(dlist_t * dlist, dlist_item_t * item);
@@ -1231,13 +1369,19 @@ void legacy_init(void);
 void legacy_fini(void);
 double legacy_rndbeta(long index, double p, double q);
 double legacy_rndgamma(long index, double a);
-unsigned int get_legacy_rndu_status(long index);
-void set_legacy_rndu_status(long index, unsigned int x);
 void legacy_rnddirichlet(long index, double * output, double * alpha, long k);
 long legacy_rndpoisson(long index, double m);
-unsigned int * get_legacy_rndu_array(void);
-void set_legacy_rndu_array(unsigned int * x);
 double rndNormal(long index);
+void rng_alloc(long count);
+void rng_get_state(long index, uint64_t * x);
+void rng_set_state(long index, const uint64_t * x);
+void rng_seed(long seed);
+long rng_replicate_seed(long k);
+void rndu_fill(long index, double * x, long n);
+void rng_locus_init(long locus_count);
+void rng_set_step(long chain, long step);
+void rng_locus_begin(long index, long locus_index, long move);
+void rng_locus_end(long index);
 
 /* functions in gamma.c */
 
@@ -1249,12 +1393,16 @@ int pll_compute_gamma_cats(double alpha,
 
 /* functions in gtree.c */
 
-void gtree_alloc_internals(gtree_t ** gtree, long msa_count);
+void gtree_alloc_internals(stree_t * stree, gtree_t ** gtree, long msa_count);
 
 gtree_t ** gtree_init(stree_t * stree,
                       msa_t ** msalist,
                       list_t * maplist,
                       int msa_count);
+gtree_t ** gtree_init_replicate(stree_t * stree,
+                                msa_t ** msalist,
+                                list_t * maplist,
+                                int msa_count);
 void gtree_simulate_init(stree_t * stree, list_t * maplist);
 void gtree_simulate_fini(void);
 
@@ -1263,6 +1411,14 @@ char * gtree_export_newick(const gnode_t * root,
 
 void gtree_destroy(gtree_t * tree, void (*cb_destroy)(void *));
 
+gtree_t * gtree_arena_alloc(unsigned int tip_count, long hpath_len);
+
+size_t gtree_first_touch(gtree_t ** ptr_gtree, stree_t * stree, long msa_index);
+
+long gtree_numa_placement(const gtree_t * gtree,
+                          const stree_t * stree,
+                          double * node_bytes);
+
 int gtree_traverse(gnode_t * root,
                    int traversal,
                    int (*cbtrav)(gnode_t *),
@@ -1324,7 +1480,10 @@ double prop_locusrate_and_heredity(gtree_t ** gtree,
                                    locus_t ** locus,
                                    long thread_index);
 
-gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index);
+gtree_t * gtree_simulate(stree_t * stree,
+                         msa_t * msa,
+                         int msa_index,
+                         long thread_index);
 
 double prop_branch_rates_serial(gtree_t ** gtree,
                                 stree_t * stree,
@@ -1412,8 +1571,14 @@ locus_t * locus_create(unsigned int dtype,
                        unsigned int scale_buffers,
                        unsigned int attributes);
 
+locus_t * locus_clone(locus_t * locus);
+
 void locus_destroy(locus_t * locus);
 
+size_t locus_first_touch(locus_t * locus);
+
+long locus_numa_placement(locus_t * locus, double * node_bytes);
+
 int pll_set_tip_states(locus_t * locus,
                        unsigned int tip_index,
                        const unsigned int * map,
@@ -1433,6 +1598,10 @@ void pll_set_frequencies(locus_t * locus,
                          const double * frequencies);
 
 void locus_set_frequencies_and_rates(locus_t * locus);
+
+void locus_share_eigen(locus_t * locus);
+
+void locus_eigen_store_fini(void);
 void pll_set_category_rates(locus_t * locus, const double * rates);
 void locus_set_heredity_scalers(locus_t * locus, const double * heredity);
 
@@ -1498,10 +1667,55 @@ unsigned long * compress_site_patterns_diploid(char ** sequence,
                                                int * length,
                                                unsigned int ** wptr,
                                                int attrib);
+
+/* functions in cache.c */
+
+uint64_t cache_hash(stree_t * stree);
+
+FILE * cache_create(const char * filename, uint64_t hash, long msa_count);
+
+void cache_write_msa(FILE * fp,
+                     msa_t ** msa_list,
+                     unsigned int ** weights,
+                     long msa_count);
+
+void cache_write_diploid(FILE * fp,
+                         msa_t ** msa_list,
+                         unsigned int ** weights,
+                         unsigned long ** resolution_count,
+                         unsigned long ** mapping,
+                         int * unphased_length,
+                         long msa_count);
+
+void cache_finalize(FILE * fp, const char * filename);
+
+cache_t * cache_open(const char * filename, uint64_t hash);
+
+msa_t ** cache_read_msa(cache_t * cache, unsigned int *** weights_ptr);
+
+void cache_read_diploid(cache_t * cache,
+                        msa_t ** msa_list,
+                        unsigned int *** weights_ptr,
+                        unsigned long *** resolution_count_ptr,
+                        unsigned long *** mapping_ptr);
+
+void cache_close(cache_t * cache);
+
 /* functions in allfixed.c */
 
 void allfixed_summary(FILE * fp_out, stree_t * stree);
 
+long allfixed_replicate_stats(const char * filename,
+                              stree_t * stree,
+                              char *** labels,
+                              stats_t *** stats);
+
+void allfixed_online_init(stree_t * stree);
+
+void allfixed_online_update(stree_t * stree, gtree_t ** gtree);
+
+void allfixed_online_summary(FILE * fp_out, stree_t * stree);
+
 /* functions in summary.c */
 
 void bipartitions_init(char ** species, long species_count);
@@ -1510,12 +1724,26 @@ void bipartitions_update(stree_t * stree);
 
 void summary_dealloc_hashtables(void);
 
+void stree_summary_init(char ** species, long species_count);
+
+void stree_summary_update(stree_t * stree);
+
+void stree_summary_print(FILE * fp_out,
+                         char ** species_names,
+                         long species_count);
+
 void stree_summary(FILE * fp_out, char ** species_names, long species_count);
 
 long getlinecount(const char * filename);
 
 /* functions in summary11.c */
 
+void mixed_summary_init(unsigned int sp_count);
+
+void mixed_summary_update(char * line);
+
+void mixed_summary_print(FILE * fp_out);
+
 void mixed_summary(FILE * fp_out, unsigned int sp_count);
 
 /* functions in hardware.c */
@@ -1526,6 +1754,22 @@ void cpu_features_detect(void);
 
 void cpu_setarch(void);
 
+void numa_detect(void);
+
+long numa_node_count(void);
+
+long numa_node_of_cpu(long cpu);
+
+long numa_spread_core(long t);
+
+long numa_node_current(void);
+
+size_t numa_page_size(void);
+
+long numa_placement(const void * addr, size_t size, double * node_bytes);
+
+void numa_fini(void);
+
 #ifdef _MSC_VER
 int pll_ctz(unsigned int x);
 unsigned int pll_popcount(unsigned int x);
@@ -1540,6 +1784,8 @@ unsigned long ** diploid_resolve(stree_t * stree,
                                  unsigned int ** weights,
                                  int msa_count);
 
+void diploid_update_maplist(stree_t * stree, list_t * maplist);
+
 /* functions in dump.c */
 
 int checkpoint_dump(stree_t * stree,
@@ -1739,6 +1985,13 @@ void pll_core_root_likelihood_vector(unsigned int states,
                                      const unsigned int * freqs_indices,
                                      double * persite_lnl,
                                      unsigned int attrib);
+
+double pll_core_root_diploid_loglikelihood(unsigned int sites,
+                                           const double * persite_lh,
+                                           const unsigned long * resolution_count,
+                                           const unsigned long * mapping,
+                                           const unsigned int * pattern_weights,
+                                           unsigned int attrib);
 /* functions in output.c */
 
 void pll_show_pmatrix(const locus_t * locus,
@@ -2179,6 +2432,12 @@ void pll_core_root_likelihood_vec_avx2(unsigned int states,
                                        const unsigned int * pattern_weights,
                                        const unsigned int * freqs_indices,
                                        double * persite_lh);
+
+double pll_core_root_diploid_loglikelihood_avx2(unsigned int sites,
+                                                const double * persite_lh,
+                                                const unsigned long * resolution_count,
+                                                const unsigned long * mapping,
+                                                const unsigned int * pattern_weights);
 #endif
 
 /* functions in cfile_sim.c */
@@ -2189,12 +2448,32 @@ void load_cfile_sim(void);
 
 void cmd_simulate(void);
 
+/* functions in stats.c */
+
+stats_t * stats_create(long expected_samples);
+void stats_destroy(stats_t * s);
+void stats_update(stats_t * s, double x);
+double stats_mean(stats_t * s);
+double stats_sd(stats_t * s);
+double stats_tint(stats_t * s);
+double stats_quantile(stats_t * s, double q);
+double stats_median(stats_t * s);
+void stats_hpd(stats_t * s, double alpha, double * lo, double * hi);
+int stats_exact(stats_t * s);
+
 /* functions in threads.c */
 
-void threads_init(locus_t ** locus);
+void threads_init(stree_t * stree, gtree_t ** gtree, locus_t ** locus);
+void threads_locus_range(long t, long * first, long * count);
+void threads_first_touch(stree_t * stree,
+                         gtree_t ** gtree,
+                         locus_t ** locus);
 void threads_wakeup(int work_type, thread_data_t * tp);
 void threads_exit(void);
 void threads_pin_master(void);
+void threads_scratch_alloc(long snodes_count, long sortbuffer_size);
+void threads_scratch_free(void);
+void threads_parallel_for(long count, void (*cb)(void *, long), void * arg);
 
 /* functions in treeparse.c */
 
@@ -0,0 +1,455 @@
+/*
+    Copyright (C) 2016-2019 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Binary cache of preprocessed loci. The cache stores the alignments after
+   removal of ambiguous sites and site pattern compression, together with the
+   pattern weights and base frequencies (section 1), and, if sequences are
+   phased, the phased alignments, their weights, the number of resolutions of
+   each site and the mapping of resolved sites to patterns (section 2). The
+   header contains a hash of the input files and of the options the
+   preprocessing depends on, and a cache is only used if the hash matches */
+
+#define CACHE_MAGIC "BPPL"
+#define CACHE_MAGIC_BYTES 4
+#define VERSION_CACHE 1
+
+#define DUMP(x,n,fp) fwrite((void *)(x),sizeof(*(x)),n,fp)
+
+#define FNV_OFFSET UINT64_C(14695981039346656037)
+#define FNV_PRIME  UINT64_C(1099511628211)
+
+static uint64_t hash_bytes(uint64_t h, const void * x, size_t size)
+{
+  const unsigned char * p = (const unsigned char *)x;
+
+  while (size--)
+  {
+    h ^= *p++;
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+static uint64_t hash_string(uint64_t h, const char * s)
+{
+  return hash_bytes(h, s, strlen(s)+1);
+}
+
+static uint64_t hash_file(uint64_t h, const char * filename)
+{
+  int mapped;
+  long size;
+  char * mem;
+  FILE * fp = xopen(filename, "rb");
+
+  if (fseek(fp, 0, SEEK_END))
+    fatal("Unable to seek in file (%s)", filename);
+  size = ftell(fp);
+  rewind(fp);
+
+  h = hash_bytes(h, &size, sizeof(long));
+  if (size > 0)
+  {
+    mem = xmapfile(fp, (size_t)size, &mapped);
+    h = hash_bytes(h, mem, (size_t)size);
+    xunmapfile(mem, (size_t)size, mapped);
+  }
+
+  fclose(fp);
+  return h;
+}
+
+/* Hash of the inputs of the preprocessing: the sequence and map files, the
+   species labels and their phasing, and the options that select the number of
+   loci, their substitution models and the treatment of ambiguous sites. Must
+   be called before the partition list is consumed */
+uint64_t cache_hash(stree_t * stree)
+{
+  long i;
+  uint64_t h = FNV_OFFSET;
+  unsigned int version = VERSION_CACHE;
+
+  h = hash_bytes(h, &version, sizeof(unsigned int));
+  h = hash_file(h, opt_msafile);
+  if (stree->tip_count > 1)
+    h = hash_file(h, opt_mapfile);
+
+  for (i = 0; i < stree->tip_count; ++i)
+  {
+    h = hash_string(h, stree->nodes[i]->label);
+    h = hash_bytes(h, &stree->nodes[i]->diploid, sizeof(unsigned int));
+  }
+
+  h = hash_bytes(h, &opt_diploid_size, sizeof(long));
+  h = hash_bytes(h, &opt_locus_count, sizeof(long));
+  h = hash_bytes(h, &opt_cleandata, sizeof(long));
+  h = hash_bytes(h, &opt_model, sizeof(long));
+  for (i = 0; i < opt_partition_count; ++i)
+  {
+    h = hash_bytes(h, &opt_partition_list[i]->start, sizeof(long));
+    h = hash_bytes(h, &opt_partition_list[i]->end, sizeof(long));
+    h = hash_bytes(h, &opt_partition_list[i]->dtype, sizeof(long));
+    h = hash_bytes(h, &opt_partition_list[i]->model, sizeof(long));
+  }
+
+  return h;
+}
+
+/* writing */
+
+static char * tmpname(const char * filename)
+{
+  char * s = NULL;
+
+  xasprintf(&s, "%s.tmp", filename);
+  return s;
+}
+
+FILE * cache_create(const char * filename, uint64_t hash, long msa_count)
+{
+  BYTE size_type[3];
+  unsigned int version = VERSION_CACHE;
+  long phased = opt_diploid ? 1 : 0;
+  char * s = tmpname(filename);
+  FILE * fp = fopen(s, "wb");
+
+  free(s);
+  if (!fp)
+  {
+    fprintf(stderr, "WARNING: Cannot create cache file %s\n", filename);
+    return NULL;
+  }
+
+  size_type[0] = (BYTE)(sizeof(int) & 0xFF);
+  size_type[1] = (BYTE)(sizeof(long) & 0xFF);
+  size_type[2] = (BYTE)(sizeof(double) & 0xFF);
+
+  DUMP(CACHE_MAGIC, CACHE_MAGIC_BYTES, fp);
+  DUMP(&version, 1, fp);
+  DUMP(size_type, 3, fp);
+  DUMP(&hash, 1, fp);
+  DUMP(&msa_count, 1, fp);
+  DUMP(&phased, 1, fp);
+
+  return fp;
+}
+
+static void cache_write_alignment(FILE * fp, msa_t * msa)
+{
+  long i;
+
+  DUMP(&msa->count, 1, fp);
+  DUMP(&msa->length, 1, fp);
+  for (i = 0; i < msa->count; ++i)
+    DUMP(msa->label[i], strlen(msa->label[i])+1, fp);
+  for (i = 0; i < msa->count; ++i)
+    DUMP(msa->sequence[i], (size_t)(msa->length), fp);
+}
+
+/* section 1: compressed alignments and their pattern weights */
+void cache_write_msa(FILE * fp,
+                     msa_t ** msa_list,
+                     unsigned int ** weights,
+                     long msa_count)
+{
+  long i;
+  int states;
+
+  for (i = 0; i < msa_count; ++i)
+  {
+    msa_t * msa = msa_list[i];
+
+    cache_write_alignment(fp, msa);
+    DUMP(&msa->amb_sites_count, 1, fp);
+    DUMP(&msa->original_length, 1, fp);
+    DUMP(&msa->dtype, 1, fp);
+    DUMP(&msa->model, 1, fp);
+    DUMP(weights[i], (size_t)(msa->length), fp);
+
+    states = msa->freqs ? (msa->dtype == BPP_DATA_DNA ? 4 : 20) : 0;
+    DUMP(&states, 1, fp);
+    if (states)
+      DUMP(msa->freqs, (size_t)states, fp);
+  }
+}
+
+/* section 2: phased alignments A3, their pattern weights, and the mappings
+   from the sites of A1 to A2 (resolution_count) and of A2 to A3 (mapping) */
+void cache_write_diploid(FILE * fp,
+                         msa_t ** msa_list,
+                         unsigned int ** weights,
+                         unsigned long ** resolution_count,
+                         unsigned long ** mapping,
+                         int * unphased_length,
+                         long msa_count)
+{
+  long i,j;
+
+  for (i = 0; i < msa_count; ++i)
+  {
+    long resolved_length = 0;
+
+    for (j = 0; j < unphased_length[i]; ++j)
+      resolved_length += (long)(resolution_count[i][j]);
+
+    cache_write_alignment(fp, msa_list[i]);
+    DUMP(weights[i], (size_t)(msa_list[i]->length), fp);
+    DUMP(unphased_length+i, 1, fp);
+    DUMP(resolution_count[i], (size_t)(unphased_length[i]), fp);
+    DUMP(&resolved_length, 1, fp);
+    DUMP(mapping[i], (size_t)resolved_length, fp);
+  }
+}
+
+/* complete the cache file, replacing any older cache only once it was written
+   successfully */
+void cache_finalize(FILE * fp, const char * filename)
+{
+  char * s = tmpname(filename);
+  int error = ferror(fp);
+
+  if (fclose(fp) || error || rename(s, filename))
+  {
+    fprintf(stderr, "WARNING: Cannot write cache file %s\n", filename);
+    remove(s);
+  }
+
+  free(s);
+}
+
+/* reading */
+
+static void cache_get(cache_t * cache, void * dst, size_t size)
+{
+  if (size > (size_t)(cache->end - cache->p))
+    fatal("Cache file %s is corrupt", opt_cachefile);
+
+  memcpy(dst, cache->p, size);
+  cache->p += size;
+}
+
+static char * cache_get_string(cache_t * cache)
+{
+  const char * eos = memchr(cache->p, 0, (size_t)(cache->end - cache->p));
+
+  if (!eos)
+    fatal("Cache file %s is corrupt", opt_cachefile);
+
+  char * s = xstrdup(cache->p);
+  cache->p = eos+1;
+
+  return s;
+}
+
+/* Open and map the cache file. Returns NULL if there is no cache file, or if
+   it was created from different inputs */
+cache_t * cache_open(const char * filename, uint64_t hash)
+{
+  char magic[CACHE_MAGIC_BYTES] = {0};
+  BYTE size_type[3];
+  unsigned int version;
+  uint64_t file_hash;
+  long size;
+  long phased;
+  cache_t * cache;
+  FILE * fp = fopen(filename, "rb");
+
+  if (!fp) return NULL;
+
+  if (fseek(fp, 0, SEEK_END) || (size = ftell(fp)) <= 0)
+  {
+    fclose(fp);
+    return NULL;
+  }
+
+  cache = (cache_t *)xcalloc(1,sizeof(cache_t));
+  cache->size = (size_t)size;
+  cache->mem = xmapfile(fp, cache->size, &cache->mapped);
+  cache->p = cache->mem;
+  cache->end = cache->mem + cache->size;
+  fclose(fp);
+
+  size_type[0] = size_type[1] = size_type[2] = 0;
+  version = 0;
+  file_hash = 0;
+  phased = -1;
+
+  if ((size_t)size >= CACHE_MAGIC_BYTES + sizeof(unsigned int) + 3 +
+                      sizeof(uint64_t) + 2*sizeof(long))
+  {
+    cache_get(cache, magic, CACHE_MAGIC_BYTES);
+    cache_get(cache, &version, sizeof(unsigned int));
+    cache_get(cache, size_type, 3);
+    cache_get(cache, &file_hash, sizeof(uint64_t));
+    cache_get(cache, &cache->msa_count, sizeof(long));
+    cache_get(cache, &phased, sizeof(long));
+  }
+
+  if (memcmp(magic, CACHE_MAGIC, CACHE_MAGIC_BYTES) ||
+      version != VERSION_CACHE ||
+      size_type[0] != sizeof(int) ||
+      size_type[1] != sizeof(long) ||
+      size_type[2] != sizeof(double) ||
+      file_hash != hash ||
+      phased != (opt_diploid ? 1 : 0))
+  {
+    cache_close(cache);
+    return NULL;
+  }
+
+  return cache;
+}
+
+static msa_t * cache_read_alignment(cache_t * cache)
+{
+  long i;
+  msa_t * msa = (msa_t *)xcalloc(1,sizeof(msa_t));
+
+  cache_get(cache, &msa->count, sizeof(int));
+  cache_get(cache, &msa->length, sizeof(int));
+  if (msa->count <= 0 || msa->length <= 0)
+    fatal("Cache file %s is corrupt", opt_cachefile);
+
+  msa->label = (char **)xmalloc((size_t)(msa->count) * sizeof(char *));
+  for (i = 0; i < msa->count; ++i)
+    msa->label[i] = cache_get_string(cache);
+
+  msa->sequence = (char **)xmalloc((size_t)(msa->count) * sizeof(char *));
+  for (i = 0; i < msa->count; ++i)
+  {
+    msa->sequence[i] = (char *)xmalloc((size_t)(msa->length+1) * sizeof(char));
+    cache_get(cache, msa->sequence[i], (size_t)(msa->length));
+    msa->sequence[i][msa->length] = 0;
+  }
+
+  return msa;
+}
+
+/* read section 1 and return the compressed alignments */
+msa_t ** cache_read_msa(cache_t * cache, unsigned int *** weights_ptr)
+{
+  long i;
+  int states;
+  msa_t ** msa_list;
+  unsigned int ** weights;
+
+  msa_list = (msa_t **)xmalloc((size_t)(cache->msa_count) * sizeof(msa_t *));
+  weights = (unsigned int **)xmalloc((size_t)(cache->msa_count) *
+                                     sizeof(unsigned int *));
+
+  for (i = 0; i < cache->msa_count; ++i)
+  {
+    msa_t * msa = msa_list[i] = cache_read_alignment(cache);
+
+    cache_get(cache, &msa->amb_sites_count, sizeof(int));
+    cache_get(cache, &msa->original_length, sizeof(int));
+    cache_get(cache, &msa->dtype, sizeof(int));
+    cache_get(cache, &msa->model, sizeof(int));
+
+    weights[i] = (unsigned int *)xmalloc((size_t)(msa->length) *
+                                         sizeof(unsigned int));
+    cache_get(cache, weights[i], (size_t)(msa->length)*sizeof(unsigned int));
+
+    cache_get(cache, &states, sizeof(int));
+    if (states)
+    {
+      msa->freqs = (double *)xmalloc((size_t)states * sizeof(double));
+      cache_get(cache, msa->freqs, (size_t)states * sizeof(double));
+    }
+  }
+
+  *weights_ptr = weights;
+  return msa_list;
+}
+
+/* read section 2, replacing the alignments in msa_list with the phased ones */
+void cache_read_diploid(cache_t * cache,
+                        msa_t ** msa_list,
+                        unsigned int *** weights_ptr,
+                        unsigned long *** resolution_count_ptr,
+                        unsigned long *** mapping_ptr)
+{
+  long i,j;
+  long msa_count = cache->msa_count;
+  unsigned int ** weights;
+  unsigned long ** resolution_count;
+  unsigned long ** mapping;
+
+  weights = (unsigned int **)xmalloc((size_t)msa_count*sizeof(unsigned int *));
+  resolution_count = (unsigned long **)xmalloc((size_t)msa_count *
+                                               sizeof(unsigned long *));
+  mapping = (unsigned long **)xmalloc((size_t)msa_count *
+                                      sizeof(unsigned long *));
+
+  for (i = 0; i < msa_count; ++i)
+  {
+    int unphased_length;
+    long resolved_length;
+    msa_t * msa = cache_read_alignment(cache);
+
+    weights[i] = (unsigned int *)xmalloc((size_t)(msa->length) *
+                                         sizeof(unsigned int));
+    cache_get(cache, weights[i], (size_t)(msa->length)*sizeof(unsigned int));
+
+    cache_get(cache, &unphased_length, sizeof(int));
+    if (unphased_length != msa_list[i]->length)
+      fatal("Cache file %s is corrupt", opt_cachefile);
+    resolution_count[i] = (unsigned long *)xmalloc((size_t)unphased_length *
+                                                   sizeof(unsigned long));
+    cache_get(cache,
+              resolution_count[i],
+              (size_t)unphased_length * sizeof(unsigned long));
+
+    cache_get(cache, &resolved_length, sizeof(long));
+    if (resolved_length <= 0)
+      fatal("Cache file %s is corrupt", opt_cachefile);
+    mapping[i] = (unsigned long *)xmalloc((size_t)resolved_length *
+                                          sizeof(unsigned long));
+    cache_get(cache, mapping[i], (size_t)resolved_length*sizeof(unsigned long));
+
+    /* replace the sequences of A1 with those of A3 */
+    for (j = 0; j < msa_list[i]->count; ++j)
+    {
+      free(msa_list[i]->label[j]);
+      free(msa_list[i]->sequence[j]);
+    }
+    free(msa_list[i]->label);
+    free(msa_list[i]->sequence);
+
+    msa_list[i]->label = msa->label;
+    msa_list[i]->sequence = msa->sequence;
+    msa_list[i]->count = msa->count;
+    msa_list[i]->length = msa->length;
+    free(msa);
+  }
+
+  *weights_ptr = weights;
+  *resolution_count_ptr = resolution_count;
+  *mapping_ptr = mapping;
+}
+
+void cache_close(cache_t * cache)
+{
+  xunmapfile(cache->mem, cache->size, cache->mapped);
+  free(cache);
+}
@@ -1299,6 +1299,9 @@ static long parse_threads(const char * line)
   p += count;
 
   if (opt_threads_start < 1) goto l_unwind;
+
+  /* explicit placement, do not spread threads over NUMA nodes */
+  opt_threads_step = 1;
   if (is_emptyline(p))
   {
     ret = 1;
@@ -1322,6 +1325,91 @@ l_unwind:
 
 }
 
+static long parse_mc3(const char * line)
+{
+  long ret = 0;
+  char * s = xstrdup(line);
+  char * p = s;
+
+  long count;
+
+  /* read number of chains */
+  count = get_long(p, &opt_mc3_chains);
+  if (!count) goto l_unwind;
+
+  p += count;
+
+  if (opt_mc3_chains < 1) goto l_unwind;
+  if (is_emptyline(p))
+  {
+    ret = 1;
+    goto l_unwind;
+  }
+
+  /* read heating increment */
+  count = get_double(p, &opt_mc3_heat);
+  if (!count) goto l_unwind;
+
+  p += count;
+
+  if (opt_mc3_heat <= 0) goto l_unwind;
+  if (is_emptyline(p))
+  {
+    ret = 1;
+    goto l_unwind;
+  }
+
+  /* read number of MCMC iterations between swap proposals */
+  count = get_long(p, &opt_mc3_swapfreq);
+  if (!count) goto l_unwind;
+
+  p += count;
+
+  if (opt_mc3_swapfreq < 1) goto l_unwind;
+  if (is_emptyline(p))
+    ret = 1;
+
+l_unwind:
+  free(s);
+  return ret;
+}
+
+static long parse_powerposterior(const char * line)
+{
+  long ret = 0;
+  char * s = xstrdup(line);
+  char * p = s;
+
+  long count;
+
+  /* read number of steps between beta = 0 and beta = 1 */
+  count = get_long(p, &opt_powerposterior);
+  if (!count) goto l_unwind;
+
+  p += count;
+
+  if (opt_powerposterior < 1) goto l_unwind;
+  if (is_emptyline(p))
+  {
+    ret = 1;
+    goto l_unwind;
+  }
+
+  /* read alpha parameter of the Beta(alpha,1) distribution of beta values */
+  count = get_double(p, &opt_powerposterior_alpha);
+  if (!count) goto l_unwind;
+
+  p += count;
+
+  if (opt_powerposterior_alpha <= 0) goto l_unwind;
+  if (is_emptyline(p))
+    ret = 1;
+
+l_unwind:
+  free(s);
+  return ret;
+}
+
 static long parse_tauprior(const char * line)
 {
   long ret = 0;
@@ -1975,6 +2063,38 @@ static partition_t ** linearize_plist(list_t * plist, long * records)
   return pa;
 }
 
+/* returns 1 if the species tree contains a hybridization or bidirectional
+   introgression event, i.e. a node label that appears more than once */
+static int stree_is_network(const char * newick)
+{
+  int i,j;
+  int dup = 0;
+  ntree_t * tree = bpp_parse_newick_string_ntree(newick);
+  int count = tree->tip_count + tree->inner_count;
+  node_t ** nodes = (node_t **)xmalloc((size_t)count * sizeof(node_t *));
+
+  memcpy(nodes, tree->leaves, tree->tip_count * sizeof(node_t *));
+  memcpy(nodes+tree->tip_count,
+         tree->inner,
+         tree->inner_count * sizeof(node_t *));
+
+  for (i = 0; i < count && !dup; ++i)
+  {
+    if (!nodes[i]->label) continue;
+    for (j = i+1; j < count; ++j)
+      if (nodes[j]->label && !strcmp(nodes[i]->label,nodes[j]->label))
+      {
+        dup = 1;
+        break;
+      }
+  }
+
+  free(nodes);
+  ntree_destroy(tree,NULL);
+
+  return dup;
+}
+
 static void check_validity()
 {
   if (!opt_streenewick)
@@ -1992,6 +2112,53 @@ static void check_validity()
   if (!opt_usedata && opt_bfbeta != 1)
     fatal("Cannot use option option 'BayesFactorBeta' when usedata=0");
 
+  if (opt_mc3_chains > 1)
+  {
+    if (!opt_est_stree)
+      fatal("Option 'mc3' is only available when inferring the species tree "
+            "(speciestree = 1)");
+    if (!opt_usedata)
+      fatal("Option 'mc3' requires usedata = 1");
+    if (opt_checkpoint)
+      fatal("Option 'mc3' cannot be used with checkpointing");
+    if (stree_is_network(opt_streenewick))
+      fatal("Option 'mc3' is not available for the MSCi model");
+  }
+
+  if (opt_powerposterior)
+  {
+    if (opt_mc3_chains > 1)
+      fatal("Options 'powerposterior' and 'mc3' cannot be used together");
+    if (opt_method == METHOD_10)
+      fatal("Option 'powerposterior' is not available for species "
+            "delimitation with a fixed guide tree");
+    if (!opt_usedata)
+      fatal("Option 'powerposterior' requires usedata = 1");
+    if (opt_bfbeta != 1)
+      fatal("Options 'powerposterior' and 'BayesFactorBeta' cannot be used "
+            "together");
+    if (opt_checkpoint)
+      fatal("Option 'powerposterior' cannot be used with checkpointing");
+    if (stree_is_network(opt_streenewick))
+      fatal("Option 'powerposterior' is not available for the MSCi model");
+  }
+
+  if (opt_replicates > 1)
+  {
+    if (opt_mc3_chains > 1 || opt_powerposterior)
+      fatal("Option 'replicates' cannot be used together with 'mc3' or "
+            "'powerposterior'");
+    if (opt_method == METHOD_10)
+      fatal("Option 'replicates' is not available for species delimitation "
+            "with a fixed guide tree");
+    if (!opt_usedata)
+      fatal("Option 'replicates' requires usedata = 1");
+    if (opt_checkpoint)
+      fatal("Option 'replicates' cannot be used with checkpointing");
+    if (stree_is_network(opt_streenewick))
+      fatal("Option 'replicates' is not available for the MSCi model");
+  }
+
   if (opt_theta_alpha <= 1)
     fatal("Alpha value of Inv-Gamma(a,b) of thetaprior must be > 1");
 
@@ -2146,7 +2313,36 @@ void load_cfile()
       fatal("Invalid syntax when parsing file %s on line %ld",
             opt_cfile, line_count);
     
-    if (token_len == 4)
+    if (token_len == 3)
+    {
+      if (!strncasecmp(token,"mc3",3))
+      {
+        if (!parse_mc3(value))
+          fatal("Option 'mc3' expects the number of chains, and optionally "
+                "the heating increment and swap frequency (line %ld)",
+                line_count);
+        valid = 1;
+      }
+      else if (!strncasecmp(token,"rng",3))
+      {
+        char * temp;
+        if (!get_string(value,&temp))
+          fatal("Option %s expects a string (line %ld)", token, line_count);
+
+        if (!strcasecmp(temp,"xoshiro"))
+          opt_rng = BPP_RNG_XOSHIRO;
+        else if (!strcasecmp(temp,"legacy"))
+          opt_rng = BPP_RNG_LEGACY;
+        else
+          fatal("Invalid random number generator (%s) (line %ld)",
+                temp, line_count);
+
+        free(temp);
+
+        valid = 1;
+      }
+    }
+    else if (token_len == 4)
     {
       if (!strncasecmp(token,"seed",4))
       {
@@ -2338,7 +2534,13 @@ void load_cfile()
     }
     else if (token_len == 9)
     {
-      if (!strncasecmp(token,"cleandata",9))
+      if (!strncasecmp(token,"cachefile",9))
+      {
+        if (!get_string(value, &opt_cachefile))
+          fatal("Option %s expects a string (line %ld)", token, line_count);
+        valid = 1;
+      }
+      else if (!strncasecmp(token,"cleandata",9))
       {
         if (!parse_long(value,&opt_cleandata) ||
             (opt_cleandata != 0 && opt_cleandata != 1))
@@ -2352,6 +2554,23 @@ void load_cfile()
           fatal("Erroneous format of 'locusrate' (line %ld)", line_count);
         valid = 1;
       }
+      else if (!strncasecmp(token,"msclayout",9))
+      {
+        char * temp;
+        if (!get_string(value,&temp))
+          fatal("Option %s expects a string (line %ld)", token, line_count);
+
+        if (!strcasecmp(temp,"locus"))
+          opt_msc_layout = BPP_MSC_LAYOUT_LOCUS;
+        else if (!strcasecmp(temp,"node"))
+          opt_msc_layout = BPP_MSC_LAYOUT_NODE;
+        else
+          fatal("Option 'msclayout' expects 'locus' or 'node' (line %ld)",
+                line_count);
+
+        free(temp);
+        valid = 1;
+      }
     }
     else if (token_len == 10)
     {
@@ -2378,6 +2597,13 @@ void load_cfile()
                 line_count);
         valid = 1;
       }
+      else if (!strncasecmp(token,"replicates",10))
+      {
+        if (!parse_long(value,&opt_replicates) || opt_replicates < 1)
+          fatal("Option 'replicates' expects a positive integer (line %ld)",
+                line_count);
+        valid = 1;
+      }
     }
     else if (token_len == 11)
     {
@@ -2461,6 +2687,14 @@ void load_cfile()
         fatal("Not implemented (%s)", token);
         valid = 1;
       }
+      else if (!strncasecmp(token,"onlinesummary",13))
+      {
+        if (!parse_long(value,&opt_onlinesummary) ||
+            (opt_onlinesummary != 0 && opt_onlinesummary != 1))
+          fatal("Option 'onlinesummary' expects value 0 or 1 (line %ld)",
+                line_count);
+        valid = 1;
+      }
     }
     else if (token_len == 14)
     {
@@ -2470,6 +2704,14 @@ void load_cfile()
           fatal("Option %s expects a string (line %ld)", token, line_count);
         valid = 1;
       }
+      else if (!strncasecmp(token,"powerposterior",14))
+      {
+        if (!parse_powerposterior(value))
+          fatal("Option 'powerposterior' expects the number of steps, and "
+                "optionally the alpha parameter for the beta values "
+                "(line %ld)", line_count);
+        valid = 1;
+      }
     }
     else if (token_len == 15)
     {
@@ -1185,7 +1185,28 @@ void load_cfile_sim()
       fatal("Invalid syntax when parsing file %s on line %ld",
             opt_simulate, line_count);
     
-    if (token_len == 4)
+    if (token_len == 3)
+    {
+      if (!strncasecmp(token,"rng",3))
+      {
+        char * temp;
+        if (!get_string(value,&temp))
+          fatal("Option %s expects a string (line %ld)", token, line_count);
+
+        if (!strcasecmp(temp,"xoshiro"))
+          opt_rng = BPP_RNG_XOSHIRO;
+        else if (!strcasecmp(temp,"legacy"))
+          opt_rng = BPP_RNG_LEGACY;
+        else
+          fatal("Invalid random number generator (%s) (line %ld)",
+                temp, line_count);
+
+        free(temp);
+
+        valid = 1;
+      }
+    }
+    else if (token_len == 4)
     {
       if (!strncasecmp(token,"seed",4))
       {
@@ -1262,6 +1283,13 @@ void load_cfile_sim()
                 token,line_count);
         valid = 1;
       }
+      else if (!strncasecmp(token,"threads",7))
+      {
+        if (!get_long(value,&opt_threads) || opt_threads < 1)
+          fatal("Option 'threads' expects a positive integer (line %ld)",
+                line_count);
+        valid = 1;
+      }
     }
     else if (token_len == 8)
     {
@@ -21,83 +21,119 @@
 
 #include "bpp.h"
 
-static void vecswap(int i, int j, int n, char ** x, int * oi)
+/* FNV-1a fingerprint of a column of count characters */
+static uint64_t column_hash(const char * x, int count)
 {
-  while (n--)
+  uint64_t h = UINT64_C(14695981039346656037);
+
+  while (count--)
   {
-    SWAP(x[i],x[j]);
-    if (oi)
-      SWAP(oi[i],oi[j]);
-    ++i; ++j;
+    h ^= (unsigned char)(*x++);
+    h *= UINT64_C(1099511628211);
   }
+  return h;
 }
 
-static void ssort1(char ** x, int n, int depth, int * oi)
+static int cb_cmp_column(const void * a, const void * b)
 {
-  int a,b,c,d,r,v;
-
-  if (n <= 1) return;
-
-  a = rand() % n;
-
-  SWAP(x[0], x[a]);
-  if (oi)
-    SWAP(oi[0], oi[a]);
-
-  v = x[0][depth];
+  const char * x = *(const char * const *)a;
+  const char * y = *(const char * const *)b;
 
-  a = b = 1;
-  c = d = n-1;
+  return strcmp(x,y);
+}
 
-  while (1)
+/* Find the unique site patterns of the columns stored at memptr, where column i
+   starts at memptr + i*(count+1). Duplicates are detected with an
+   open-addressing hash table of column fingerprints, and only the unique
+   columns are sorted, such that patterns come out in the same lexicographic
+   order as with sorting all columns. On return, column[0..k-1] point to the
+   unique columns, weight[0..k-1] hold their multiplicities and oi[0..k-1] the
+   index of the first site exhibiting each pattern. If pattern is given,
+   pattern[i] is set to the index of the unique column site i maps to.
+   Returns k, the number of unique columns */
+static int hash_unique_columns(char * memptr,
+                               char ** column,
+                               int length,
+                               int count,
+                               unsigned int * weight,
+                               int * oi,
+                               unsigned long * pattern)
+{
+  int i,k;
+  int u = -1;
+  size_t slot;
+  size_t table_size = 1;
+  size_t stride = (size_t)(count+1);
+
+  while (table_size < 2*(size_t)length)
+    table_size <<= 1;
+
+  uint64_t * hash = (uint64_t *)xmalloc((size_t)length * sizeof(uint64_t));
+  int * table = (int *)xmalloc(table_size * sizeof(int));
+  int * site_unique = (int *)xmalloc((size_t)length * sizeof(int));
+  int * rank = (int *)xmalloc((size_t)length * sizeof(int));
+  int * first = (int *)xmalloc((size_t)length * sizeof(int));
+  unsigned int * freq = (unsigned int *)xmalloc((size_t)length *
+                                                sizeof(unsigned int));
+
+  for (slot = 0; slot < table_size; ++slot)
+    table[slot] = -1;
+
+  /* fingerprint columns; each column is a contiguous block of memory */
+  for (i = 0; i < length; ++i)
+    hash[i] = column_hash(memptr + i*stride, count);
+
+  /* insert sites in their original order, such that the first site of each
+     pattern is kept as its representative */
+  for (i = 0, k = 0; i < length; ++i)
   {
-    while (b <= c && (r = x[b][depth]-v) <= 0)
+    slot = (size_t)(hash[i] & (table_size-1));
+    while ((u = table[slot]) != -1)
     {
-      if (r == 0)
-      {
-        SWAP(x[a], x[b]);
-        if (oi)
-          SWAP(oi[a], oi[b]);
-        ++a;
-      }
-      ++b;
+      if (hash[first[u]] == hash[i] &&
+          !memcmp(memptr + first[u]*stride, memptr + i*stride, (size_t)count))
+        break;
+      slot = (slot+1) & (table_size-1);
     }
-    while (b <= c && (r = x[c][depth]-v) >= 0)
+
+    if (u == -1)
     {
-      if (r == 0)
-      {
-        SWAP(x[c], x[d]);
-        if (oi)
-          SWAP(oi[c], oi[d]);
-        --d;
-      }
-      --c;
+      u = k++;
+      table[slot] = u;
+      first[u] = i;
+      freq[u] = 0;
     }
-    if (b > c) break;
-    SWAP(x[b], x[c]);
-    if (oi)
-      SWAP(oi[b], oi[c]);
-    ++b; --c;
+    freq[u]++;
+    site_unique[i] = u;
   }
 
-  r = MIN(a,b-a); vecswap(0,b-r,r,x,oi);
-  r = MIN(d-c,n-d-1); vecswap(b,n-r,r,x,oi);
-  r = b-a; ssort1(x,r,depth,oi);
+  /* sort the unique columns */
+  for (u = 0; u < k; ++u)
+    column[u] = memptr + first[u]*stride;
+  qsort(column, (size_t)k, sizeof(char *), cb_cmp_column);
 
-  if (x[r][depth] != 0)
+  for (i = 0; i < k; ++i)
   {
-    if (oi)
-      ssort1 (x + r, a + n - d - 1, depth + 1, oi + r);
-    else
-      ssort1 (x + r, a + n - d - 1, depth + 1, NULL);
+    int site = (int)((column[i] - memptr) / (long)stride);
 
+    u = site_unique[site];
+    rank[u] = i;
+    weight[i] = freq[u];
+    oi[i] = site;
   }
 
-    r = d - c; 
-    if (oi)
-      ssort1(x+n-r,r,depth,oi+n-r);
-    else
-      ssort1(x+n-r,r,depth,NULL);
+  if (pattern)
+    for (i = 0; i < length; ++i)
+      pattern[i] = (unsigned long)rank[site_unique[i]];
+
+  free(hash);
+  free(table);
+  free(site_unique);
+  free(rank);
+  free(first);
+  free(freq);
+
+  return k;
 }
 
 static void remap_range(const unsigned int * map,
@@ -285,40 +321,19 @@ unsigned int * compress_site_patterns(char ** sequence,
     column[i][j] = 0;
   }
 
-  /* allocate space for storing original indices (before sorting sites) */
-  int * oi = (int *)xmalloc(*length * sizeof(int));
-  for (i = 0; i < *length; ++i)
-    oi[i] = i;
-
     /* do the jc69 now */
   if (attrib == COMPRESS_JC69)
     jc69_invmaps = encode_jc69(column,*length,count);
 
-  /* sort the columns and keep original indices */
-  ssort1(column, *length, 0, oi);
-
-  /* we have at least one unique site with weight 1 (the first site) */
-  int compressed_length = 1;
-  size_t ref = 0;
-  weight[ref] = 1;
-
-  /* find all unique columns and set their weights */
+  /* find all unique columns, sort them and set their weights */
   int * compressed_oi = (int *)xmalloc(*length * sizeof(int));
-
-  compressed_oi[0] = oi[0];
-  for (i = 1; i < *length; ++i)
-  {
-    if (strcmp(column[i],column[i-1]))
-    {
-      column[ref+1] = column[i];
-      compressed_oi[ref+1] = oi[i];
-      ++ref;
-      ++compressed_length;
-      weight[ref] = 1;
-    }
-    else
-      weight[ref]++;
-  }
+  int compressed_length = hash_unique_columns(memptr,
+                                              column,
+                                              *length,
+                                              count,
+                                              weight,
+                                              compressed_oi,
+                                              NULL);
 
   /* decode the jc69 encoding */
   if (attrib == COMPRESS_JC69)
@@ -369,7 +384,6 @@ unsigned int * compress_site_patterns(char ** sequence,
   /* decode sequences using inv_charmap */
   encode(sequence,inv_charmap,count,compressed_length);
 
-  free(oi);
   free(compressed_oi);
 
   return weight;
@@ -450,44 +464,19 @@ unsigned long * compress_site_patterns_diploid(char ** sequence,
     column[i][j] = 0;
   }
 
-  /* allocate space for storing original indices (before sorting sites) */
-  int * oi = (int *)xmalloc(*length * sizeof(int));
-  for (i = 0; i < *length; ++i)
-    oi[i] = i;
-
     /* do the jc69 now */
   if (attrib == COMPRESS_JC69)
     jc69_invmaps = encode_jc69(column,*length,count);
 
-  /* sort the columns and keep original indices */
-  ssort1(column, *length, 0, oi);
-
-  /*first site in uncompressed alignment maps to first site in compressed */
-  int compressed_length = 1;
-  size_t ref = 0;
-  mapping[oi[0]] = ref;
-  weight[ref] = 1;
-
-  /* find all unique columns and set their mappings A2->A3 */
+  /* find all unique columns, sort them and set their mappings A2->A3 */
   int * compressed_oi = (int *)xmalloc(*length * sizeof(int));
-
-  compressed_oi[0] = oi[0];
-  for (i = 1; i < *length; ++i)
-  {
-    if (strcmp(column[i],column[i-1]))
-    {
-      column[ref+1] = column[i];
-      compressed_oi[ref+1] = oi[i];
-      ++ref;
-      ++compressed_length;
-      weight[ref] = 1;
-    }
-    else
-      weight[ref]++;
-
-    /* map original index i in uncompressed alignment to index in compressed */
-    mapping[oi[i]] = ref;
-  }
+  int compressed_length = hash_unique_columns(memptr,
+                                              column,
+                                              *length,
+                                              count,
+                                              weight,
+                                              compressed_oi,
+                                              mapping);
 
   /* decode the jc69 encoding */
   if (attrib == COMPRESS_JC69)
@@ -540,7 +529,6 @@ unsigned long * compress_site_patterns_diploid(char ** sequence,
   /* decode sequences using inv_charmap */
   encode(sequence,inv_charmap,count,compressed_length);
 
-  free(oi);
   free(compressed_oi);
 
   return mapping;
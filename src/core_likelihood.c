@@ -340,3 +340,43 @@ void pll_core_root_likelihood_vector(unsigned int states,
   }
 }
 
+
+/* Log-likelihood of a diploid locus with unphased sequences. persite_lh holds
+   the likelihoods of the site patterns of the phased alignment, and the
+   likelihood of each unphased site is the mean over its resolution_count[i]
+   resolutions, listed consecutively in mapping */
+double pll_core_root_diploid_loglikelihood(unsigned int sites,
+                                           const double * persite_lh,
+                                           const unsigned long * resolution_count,
+                                           const unsigned long * mapping,
+                                           const unsigned int * pattern_weights,
+                                           unsigned int attrib)
+{
+  unsigned int i;
+  unsigned long j,k = 0;
+  double logl = 0;
+
+  #ifdef HAVE_AVX2
+  if (attrib & PLL_ATTRIB_ARCH_AVX2)
+  {
+    return pll_core_root_diploid_loglikelihood_avx2(sites,
+                                                    persite_lh,
+                                                    resolution_count,
+                                                    mapping,
+                                                    pattern_weights);
+  }
+  #endif
+
+  for (i = 0; i < sites; ++i)
+  {
+    double meanl = 0;
+
+    for (j = 0; j < resolution_count[i]; ++j)
+      meanl += persite_lh[mapping[k++]];
+
+    meanl /= resolution_count[i];
+
+    logl += log(meanl) * pattern_weights[i];
+  }
+  return logl;
+}
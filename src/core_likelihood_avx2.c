@@ -159,3 +159,133 @@ void pll_core_root_likelihood_vec_avx2(unsigned int states,
     #endif
   }
 }
+
+/* natural logarithm of four positive normal doubles. Uses the reduction and
+   polynomial of the fdlibm log (x = 2^e * m, sqrt(2)/2 < m <= sqrt(2)) and is
+   within 1 ulp of the libm result */
+static inline __m256d log_avx2(__m256d x)
+{
+  const __m256d one  = _mm256_set1_pd(1.0);
+  const __m256d half = _mm256_set1_pd(0.5);
+
+  __m256i xbits = _mm256_castpd_si256(x);
+
+  /* mantissa in [1,2) and biased exponent, converted to double by adding it to
+     the mantissa of 2^52 */
+  __m256d m = _mm256_castsi256_pd(
+                _mm256_or_si256(
+                  _mm256_and_si256(xbits,
+                                   _mm256_set1_epi64x(0x000FFFFFFFFFFFFFLL)),
+                  _mm256_set1_epi64x(0x3FF0000000000000LL)));
+  __m256d e = _mm256_castsi256_pd(
+                _mm256_or_si256(_mm256_srli_epi64(xbits,52),
+                                _mm256_set1_epi64x(0x4330000000000000LL)));
+  e = _mm256_sub_pd(e, _mm256_set1_pd(4503599627370496.0 + 1023.0));
+
+  /* move m to (sqrt(2)/2, sqrt(2)] */
+  __m256d big = _mm256_cmp_pd(m, _mm256_set1_pd(1.41421356237309504880),
+                              _CMP_GT_OQ);
+  m = _mm256_blendv_pd(m, _mm256_mul_pd(m,half), big);
+  e = _mm256_add_pd(e, _mm256_and_pd(big,one));
+
+  /* log(1+f) = f - hfsq + s*(hfsq+R) with s = f/(2+f) */
+  __m256d f = _mm256_sub_pd(m, one);
+  __m256d hfsq = _mm256_mul_pd(_mm256_mul_pd(half,f), f);
+  __m256d s = _mm256_div_pd(f, _mm256_add_pd(_mm256_set1_pd(2.0), f));
+  __m256d z = _mm256_mul_pd(s,s);
+  __m256d w = _mm256_mul_pd(z,z);
+
+  __m256d t1 = _mm256_fmadd_pd(w, _mm256_set1_pd(1.531383769920937332e-01),
+                                  _mm256_set1_pd(2.222219843214978396e-01));
+  t1 = _mm256_fmadd_pd(w, t1, _mm256_set1_pd(3.999999999940941908e-01));
+  t1 = _mm256_mul_pd(w, t1);
+
+  __m256d t2 = _mm256_fmadd_pd(w, _mm256_set1_pd(1.479819860511658591e-01),
+                                  _mm256_set1_pd(1.818357216161805012e-01));
+  t2 = _mm256_fmadd_pd(w, t2, _mm256_set1_pd(2.857142874366239149e-01));
+  t2 = _mm256_fmadd_pd(w, t2, _mm256_set1_pd(6.666666666666735130e-01));
+  t2 = _mm256_mul_pd(z, t2);
+
+  __m256d r = _mm256_add_pd(t1,t2);
+
+  /* e*ln2_hi - ((hfsq - (s*(hfsq+R) + e*ln2_lo)) - f) */
+  __m256d a = _mm256_fmadd_pd(s, _mm256_add_pd(hfsq,r),
+                              _mm256_mul_pd(e,
+                                _mm256_set1_pd(1.90821492927058770002e-10)));
+
+  return _mm256_sub_pd(_mm256_mul_pd(e,
+                         _mm256_set1_pd(6.93147180369123816490e-01)),
+                       _mm256_sub_pd(_mm256_sub_pd(hfsq,a), f));
+}
+
+/* mean likelihood over the resolutions of an unphased site, which start at
+   mapping[*k] */
+static inline double site_mean(const double * persite_lh,
+                               const unsigned long * mapping,
+                               unsigned long * k,
+                               unsigned long count)
+{
+  unsigned long j;
+  double sum = 0;
+
+  for (j = 0; j < count; ++j)
+    sum += persite_lh[mapping[(*k)++]];
+
+  return sum / count;
+}
+
+double pll_core_root_diploid_loglikelihood_avx2(unsigned int sites,
+                                                const double * persite_lh,
+                                                const unsigned long * resolution_count,
+                                                const unsigned long * mapping,
+                                                const unsigned int * pattern_weights)
+{
+  unsigned int i,n;
+  unsigned long k = 0;
+  double logl = 0;
+  double m0,m1,m2,m3;
+
+  const __m256d xmin = _mm256_set1_pd(DBL_MIN);
+  const __m256d xmax = _mm256_set1_pd(DBL_MAX);
+  __m256d xmm0, xmm1, xmm2;
+  __m256d xlogl = _mm256_setzero_pd();
+
+  /* the sum over the resolutions of a site is left scalar, as most sites have
+     one or two resolutions; the logarithms of the site means are taken four
+     at a time */
+  for (i = 0; i + 4 <= sites; i += 4)
+  {
+    m0 = site_mean(persite_lh, mapping, &k, resolution_count[i]);
+    m1 = site_mean(persite_lh, mapping, &k, resolution_count[i+1]);
+    m2 = site_mean(persite_lh, mapping, &k, resolution_count[i+2]);
+    m3 = site_mean(persite_lh, mapping, &k, resolution_count[i+3]);
+
+    xmm0 = _mm256_set_pd(m3,m2,m1,m0);
+    xmm1 = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)
+                                              (pattern_weights+i)));
+
+    /* zero, subnormal, infinite or NaN site likelihoods go through libm */
+    xmm2 = _mm256_or_pd(_mm256_cmp_pd(xmm0, xmin, _CMP_NGE_UQ),
+                        _mm256_cmp_pd(xmm0, xmax, _CMP_GT_OQ));
+    if (_mm256_movemask_pd(xmm2))
+    {
+      logl += log(m0) * pattern_weights[i];
+      logl += log(m1) * pattern_weights[i+1];
+      logl += log(m2) * pattern_weights[i+2];
+      logl += log(m3) * pattern_weights[i+3];
+      continue;
+    }
+
+    xlogl = _mm256_fmadd_pd(log_avx2(xmm0), xmm1, xlogl);
+  }
+
+  /* add up the elements of xlogl */
+  xmm0 = _mm256_hadd_pd(xlogl,xlogl);
+  logl += ((double *)&xmm0)[0] + ((double *)&xmm0)[2];
+
+  for (n = i; n < sites; ++n)
+    logl += log(site_mean(persite_lh, mapping, &k, resolution_count[n])) *
+            pattern_weights[n];
+
+  return logl;
+}
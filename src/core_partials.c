@@ -67,8 +67,8 @@ void pll_core_update_partial_tt_4x4(unsigned int sites,
 
   for (n = 0; n < sites; ++n)
   {
-    j = (unsigned int)(left_tipchars[n]);
-    k = (unsigned int)(right_tipchars[n]);
+    j = PLL_TIPCHAR_4X4(left_tipchars,n);
+    k = PLL_TIPCHAR_4X4(right_tipchars,n);
 
     offset = lookup;
     offset += ((j << 4) + k)*span;
@@ -177,6 +177,19 @@ void pll_core_update_partial_tt(unsigned int states,
   }
   #endif
 
+  if (states == 4)
+  {
+    pll_core_update_partial_tt_4x4(sites,
+                                   rate_cats,
+                                   parent_clv,
+                                   parent_scaler,
+                                   left_tipchars,
+                                   right_tipchars,
+                                   lookup,
+                                   attrib);
+    return;
+  }
+
   unsigned int span = states * rate_cats;
   unsigned int log2_maxstates = (unsigned int)ceil(log2(tipmap_size));
   size_t scaler_size = (attrib & PLL_ATTRIB_RATE_SCALERS) ?
@@ -301,7 +314,7 @@ void pll_core_update_partial_ti_4x4(unsigned int sites,
       {
         double terma = 0;
         double termb = 0;
-        unsigned int lstate = left_tipchars[n];
+        unsigned int lstate = PLL_TIPCHAR_4X4(left_tipchars,n);
         for (j = 0; j < states; ++j)
         {
           if (lstate & 1)
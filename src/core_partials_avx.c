@@ -600,8 +600,8 @@ void pll_core_update_partial_tt_4x4_avx(unsigned int sites,
 
   for (n = 0; n < sites; ++n)
   {
-    j = (unsigned int)(left_tipchars[n]);
-    k = (unsigned int)(right_tipchars[n]);
+    j = PLL_TIPCHAR_4X4(left_tipchars,n);
+    k = PLL_TIPCHAR_4X4(right_tipchars,n);
 
     offset = lookup;
     offset += ((j << 4) + k)*span;
@@ -1002,7 +1002,7 @@ void pll_core_update_partial_ti_4x4_avx(unsigned int sites,
 
     scale_mask = init_mask;
 
-    lstate = left_tipchar[n];
+    lstate = PLL_TIPCHAR_4X4(left_tipchar,n);
 
     unsigned int loffset = rate_cats*lstate*4;
 
@@ -743,10 +743,10 @@ void bpp_core_update_pmatrix(locus_t * locus,
 
         /* skip using branch rates on horizontal edges in hybridization events */
         if (!(pop->hybrid && pop->htau == 0))
-          node->length += (start->tau - t)*pop->brate[msa_index];
+          node->length += (start->tau - t)*SNODE_LOCUS(pop,msa_index)->brate;
         t = start->tau;
       }
-      node->length += (node->parent->time - t) * node->parent->pop->brate[msa_index];
+      node->length += (node->parent->time - t) * SNODE_LOCUS(node->parent->pop,msa_index)->brate;
 
       t = node->length;
     }
@@ -24,15 +24,58 @@
 static hashtable_t * sht;
 static hashtable_t * mht;
 
-static long * ext_qsort_arg;
+/* site index paired with its number of hets, such that singleton sites can be
+   sorted without a file-scope sort key, as loci are resolved concurrently */
+typedef struct sitehet_s
+{
+  long hets;
+  long index;
+} sitehet_t;
+
+/* The heterozygote matrix of a locus is stored by site, one bit per sequence,
+   in two bitmaps: het marks the heterozygotes that are still unresolved and
+   fixed those resolved by the heuristic of step 3 */
+#define HET_BITS         (sizeof(unsigned int) * CHAR_BIT)
+#define HET_WORDS(n)     (((n) + HET_BITS - 1) / HET_BITS)
+#define HET_GET(col,j)   (((col)[(j)/HET_BITS] >> ((j)%HET_BITS)) & 1u)
+#define HET_SET(col,j)   ((col)[(j)/HET_BITS] |= 1u << ((j)%HET_BITS))
+#define HET_CLEAR(col,j) ((col)[(j)/HET_BITS] &= ~(1u << ((j)%HET_BITS)))
+
+/* buffers of diploid_resolve_locus(), allocated once per thread for the
+   largest locus and reused for every locus the thread resolves */
+typedef struct diploid_scratch_s
+{
+  long * resolved;
+  long * singletons;      /* # singleton sites at sequence */
+  long * sitehets;        /* # heterozygotes at site */
+  long * single_indices;  /* indices of singletons with at least one het */
+  long * hets;
+  long * mapping;
+  char * newsite;
+  sitehet_t * sorted;
+  unsigned int * diploid;
+  unsigned int * het;
+  unsigned int * fixed;
+} diploid_scratch_t;
 
-static int cb_cmp_indices(const void * a, const void * b)
+typedef struct resolve_data_s
 {
-  const long * x = (long *)a;
-  const long * y = (long *)b;
+  msa_t ** msa_list;
+  unsigned int ** weights;
+  int * cleandata;
+  unsigned long ** resolution_count;
+  long msa_count;
+  long slots;
+  long max_count;
+  long max_length;
+} resolve_data_t;
 
-  return ((ext_qsort_arg[*x] < ext_qsort_arg[*y]) -
-          (ext_qsort_arg[*x] > ext_qsort_arg[*y]));
+static int cb_cmp_sitehets(const void * a, const void * b)
+{
+  const sitehet_t * x = (const sitehet_t *)a;
+  const sitehet_t * y = (const sitehet_t *)b;
+
+  return ((x->hets < y->hets) - (x->hets > y->hets));
 }
 
 static void cb_dealloc_pairlabel(void * data)
@@ -43,14 +86,11 @@ static void cb_dealloc_pairlabel(void * data)
   free(pair);
 }
 
-/* return an array of ones and zeroes indicating whether sequences in alignment
+/* fill diploid with ones and zeroes indicating whether sequences in alignment
    msa are diploids (1) or haploids (0) */
-static unsigned int * get_diploid_info(msa_t * msa, int msa_id)
+static void get_diploid_info(msa_t * msa, int msa_id, unsigned int * diploid)
 {
   long i;
-  unsigned int * diploid;
-
-  diploid = (unsigned int *)xmalloc((size_t)(msa->count)*sizeof(unsigned int));
 
   /* if we have only one species */
   if (sht == NULL && mht == NULL)
@@ -60,7 +100,7 @@ static unsigned int * get_diploid_info(msa_t * msa, int msa_id)
     for (i = 0; i < msa->count; ++i)
       diploid[i] = opt_diploid[0] ? 1 : 0;
 
-    return diploid;
+    return;
   }
 
   for (i = 0; i < msa->count; ++i)
@@ -91,7 +131,6 @@ static unsigned int * get_diploid_info(msa_t * msa, int msa_id)
 
     diploid[i] = node->diploid;
   }
-  return diploid;
 }
 
 #if 0
@@ -237,11 +276,50 @@ static unsigned int findmax(const unsigned int * map)
   return max;
 }
 
+static diploid_scratch_t * diploid_scratch_alloc(long count, long length)
+{
+  diploid_scratch_t * ds;
+  size_t words = (size_t)length * HET_WORDS((size_t)count);
+
+  ds = (diploid_scratch_t *)xmalloc(sizeof(diploid_scratch_t));
+
+  ds->resolved = (long *)xmalloc((size_t)count * sizeof(long));
+  ds->singletons = (long *)xmalloc((size_t)count * sizeof(long));
+  ds->sitehets = (long *)xmalloc((size_t)length * sizeof(long));
+  ds->single_indices = (long *)xmalloc((size_t)length * sizeof(long));
+  ds->hets = (long *)xmalloc((size_t)count * sizeof(long));
+  ds->mapping = (long *)xmalloc((size_t)count * sizeof(long));
+  ds->newsite = (char *)xmalloc((size_t)(2*count) * sizeof(char));
+  ds->sorted = (sitehet_t *)xmalloc((size_t)length * sizeof(sitehet_t));
+  ds->diploid = (unsigned int *)xmalloc((size_t)count * sizeof(unsigned int));
+  ds->het = (unsigned int *)xmalloc(words * sizeof(unsigned int));
+  ds->fixed = (unsigned int *)xmalloc(words * sizeof(unsigned int));
+
+  return ds;
+}
+
+static void diploid_scratch_free(diploid_scratch_t * ds)
+{
+  free(ds->resolved);
+  free(ds->singletons);
+  free(ds->sitehets);
+  free(ds->single_indices);
+  free(ds->hets);
+  free(ds->mapping);
+  free(ds->newsite);
+  free(ds->sorted);
+  free(ds->diploid);
+  free(ds->het);
+  free(ds->fixed);
+  free(ds);
+}
+
 static unsigned long * diploid_resolve_locus(msa_t * msa,
                                              int msa_index,
                                              unsigned int * weight,
                                              int * cleandata,
-                                             const unsigned int * map)
+                                             const unsigned int * map,
+                                             diploid_scratch_t * ds)
 {
   int card;
   long i,j,k,n,m;
@@ -250,29 +328,27 @@ static unsigned long * diploid_resolve_locus(msa_t * msa,
   unsigned int c;
   unsigned char inv_charmap[ASCII_SIZE];
   unsigned char charmap[ASCII_SIZE];
-  int * hmat;
-  int * hptr;
-  long * resolved;  
-  long * seqhets;         /* # heterozygotes at sequence */
-  long * sitehets;        /* # heterozygotes at site */
-  long * singletons;      /* # singleton sites at sequence */
-  long * single_indices;  /* indices of singletons with at least one het */
-  unsigned int * diploid;
+  long * resolved = ds->resolved;
+  long * sitehets = ds->sitehets;
+  long * singletons = ds->singletons;
+  long * single_indices = ds->single_indices;
+  sitehet_t * sorted = ds->sorted;
+  unsigned int * diploid = ds->diploid;
+  unsigned int * het = ds->het;
+  unsigned int * fixed = ds->fixed;
   char ** newlabel;
   unsigned long * resolution_count;
+  size_t words = HET_WORDS((size_t)(msa->count));
 
   *cleandata = 1;
 
-  /* allocate necessary arrays */
-  resolved = (long *)xmalloc((size_t)(msa->count) * sizeof(long));
-  seqhets = (long *)xmalloc((size_t)(msa->count) * sizeof(long));
-  singletons = (long *)xcalloc((size_t)(msa->count),sizeof(long));
-  sitehets = (long *)xcalloc((size_t)(msa->length),sizeof(long));
-  single_indices = (long *)xmalloc((size_t)(msa->length) * sizeof(long));
-  hmat = (int *)xcalloc((size_t)(msa->count*msa->length),sizeof(int));
-  hptr = hmat;
+  /* reset the buffers for the current locus */
+  memset(singletons, 0, (size_t)(msa->count) * sizeof(long));
+  memset(sitehets, 0, (size_t)(msa->length) * sizeof(long));
+  memset(het, 0, (size_t)(msa->length) * words * sizeof(unsigned int));
+  memset(fixed, 0, (size_t)(msa->length) * words * sizeof(unsigned int));
 
-  diploid = get_diploid_info(msa,msa_index);
+  get_diploid_info(msa,msa_index,diploid);
 
 
   /* if map states are out of the BYTE range, remap */
@@ -327,7 +403,7 @@ static unsigned long * diploid_resolve_locus(msa_t * msa,
           continue;
         else if (card == 2)
         {
-          hptr[j] = 1;
+          HET_SET(het + j*words, i);
           sitehets[j]++;
           resolved[i] = 0;
           unresolved_count++;
@@ -342,9 +418,6 @@ static unsigned long * diploid_resolve_locus(msa_t * msa,
           *cleandata = 0;
       }
     }
-    
-    /* move to the next row of h matrix */
-    hptr += msa->length;
   }
 
   /* 2. Create a list of indices to singleton sites with at least one het */
@@ -357,39 +430,47 @@ static unsigned long * diploid_resolve_locus(msa_t * msa,
   {
 
     /* sort list of indices by number of hets (descending order) */
-    ext_qsort_arg = sitehets;
-    qsort(single_indices,(size_t)k,sizeof(long),cb_cmp_indices);
+    for (i = 0; i < k; ++i)
+    {
+      sorted[i].hets = sitehets[single_indices[i]];
+      sorted[i].index = single_indices[i];
+    }
+    qsort(sorted,(size_t)k,sizeof(sitehet_t),cb_cmp_sitehets);
+    for (i = 0; i < k; ++i)
+      single_indices[i] = sorted[i].index;
 
     /* find most variable singleton site */
     long chosen = -1;
     for (i = 0; i < k; ++i)
     {
       long site = single_indices[i];
+      unsigned int * hcol = het + site*words;
 
-      /* find least variable sequence at site */
-      hptr = hmat;
+      /* find least variable sequence at site, visiting only its hets */
       long y = msa->length+1;
-      for (j = 0; j < msa->count; ++j)  
+      for (n = 0; n < (long)words; ++n)
       {
-        if (resolved[j] || hptr[site] == 0) 
+        unsigned int bits = hcol[n];
+        while (bits)
         {
-          hptr += msa->length;
-          continue;
-        }
-        
-        if (singletons[j] < y)
-        {
-          y = singletons[j];
-          chosen = j;
-        }
+          j = n*(long)HET_BITS + PLL_CTZ(bits);
+          bits &= bits - 1;
+
+          if (resolved[j]) continue;
 
-        hptr += msa->length;
+          if (singletons[j] < y)
+          {
+            y = singletons[j];
+            chosen = j;
+          }
+        }
       }
       
       /* we found a site to resolve */
       if (chosen >= 0)
       {
-        hmat[chosen * msa->length + site] = -1;
+        HET_CLEAR(hcol, chosen);
+        HET_SET(fixed + site*words, chosen);
         sitehets[site]--;
         resolved[chosen] = 1;
         unresolved_count--;
@@ -397,7 +478,9 @@ static unsigned long * diploid_resolve_locus(msa_t * msa,
         /* update singleton indices */
         if (sitehets[site] == 0)
         {
-          memmove(single_indices+i,single_indices+i+1,(size_t)(k-(i+1)));
+          memmove(single_indices+i,
+                  single_indices+i+1,
+                  (size_t)(k-(i+1))*sizeof(long));
           --k;
         }
         break;
@@ -441,7 +524,7 @@ static unsigned long * diploid_resolve_locus(msa_t * msa,
   for (i = 0; i < newseq_count; ++i)
     newseq[i] = (char *)xmalloc((patterns+1)*sizeof(char));
 
-  long * mapping = (long *)xmalloc((size_t)(msa->count)*sizeof(long));
+  long * mapping = ds->mapping;
   for (i=0,k=0; i < msa->count; ++i)
   {
     mapping[i] = k++;
@@ -472,26 +555,21 @@ static unsigned long * diploid_resolve_locus(msa_t * msa,
 
   /* 4c. loop through sites in heterogenous alignment A1 to generate resolved
      site patterns for alignment A2 */
-  long * hets = (long *)xmalloc((size_t)(msa->count) * sizeof(long));
+  long * hets = ds->hets;
   long q = 0;
-  char * newsite = (char *)xmalloc((size_t)newseq_count * sizeof(char));
+  char * newsite = ds->newsite;
   for (i = 0; i < msa->length; ++i)
   {
-    hptr = hmat;
+    const unsigned int * hcol = het + i*words;
+    const unsigned int * fcol = fixed + i*words;
 
     for (j=0, n=0; j < msa->count; ++j)
     {
       k = mapping[j];           /* get index of sequence j in A2 */
 
-      if (hptr[i] == 0)         /* haploid or homo */
-      {
-        newsite[k] = msa->sequence[j][i];
-        if (diploid[j])
-        {
-          newsite[k+1] = msa->sequence[j][i];
-        }
-      }
-      else if (hptr[i] == -1)    /* fixed resolution */
+      if (HET_GET(hcol,j))      /* unresolved het */
+        hets[n++] = j;
+      else if (HET_GET(fcol,j)) /* fixed resolution */
       {
         unsigned int state = map[(int)(msa->sequence[j][i])];
 
@@ -505,11 +583,14 @@ static unsigned long * diploid_resolve_locus(msa_t * msa,
         newsite[k]   = inv_charmap[state1];
         newsite[k+1] = inv_charmap[state2];
       }
-      else
-        hets[n++] = j;
-
-      /* point to next row */
-      hptr += msa->length;
+      else                      /* haploid or homo */
+      {
+        newsite[k] = msa->sequence[j][i];
+        if (diploid[j])
+        {
+          newsite[k+1] = msa->sequence[j][i];
+        }
+      }
     }
 
     assert(n == sitehets[i]);
@@ -562,21 +643,43 @@ static unsigned long * diploid_resolve_locus(msa_t * msa,
   /* 5b. compress for JC69 */
   /* This is done outside of this function */
 
-  /* free allocated memory */
-  free(hets);
-  free(mapping);
-  free(newsite);
-  free(resolved);
-  free(diploid);
-  free(seqhets);
-  free(singletons);
-  free(sitehets);
-  free(single_indices);
-  free(hmat);
-
   return resolution_count;
 }
 
+/* resolve loci t, t+slots, t+2*slots, ... reusing one set of buffers */
+static void cb_resolve_slot(void * arg, long t)
+{
+  long i;
+  resolve_data_t * rd = (resolve_data_t *)arg;
+  const unsigned int * map = NULL;
+  diploid_scratch_t * ds;
+
+  ds = diploid_scratch_alloc(rd->max_count, rd->max_length);
+
+  for (i = t; i < rd->msa_count; i += rd->slots)
+  {
+    if (rd->msa_list[i]->dtype == BPP_DATA_DNA)
+    {
+      map = pll_map_nt;
+    }
+    else if (rd->msa_list[i]->dtype == BPP_DATA_AA)
+    {
+      map = pll_map_aa;
+    }
+    else
+      assert(0);
+
+    rd->resolution_count[i] = diploid_resolve_locus(rd->msa_list[i],
+                                                    (int)i,
+                                                    rd->weights[i],
+                                                    rd->cleandata+i,
+                                                    map,
+                                                    ds);
+  }
+
+  diploid_scratch_free(ds);
+}
+
 unsigned long ** diploid_resolve(stree_t * stree,
                                  msa_t ** msa_list,
                                  list_t * maplist,
@@ -585,8 +688,8 @@ unsigned long ** diploid_resolve(stree_t * stree,
 {
   long i;
   int * cleandata;
-  const unsigned int * map = NULL;
   unsigned long ** resolution_count;
+  resolve_data_t rd;
 
   cleandata = (int *)xcalloc((size_t)msa_count,sizeof(int));
 
@@ -598,25 +701,25 @@ unsigned long ** diploid_resolve(stree_t * stree,
 
   resolution_count = (unsigned long **)xmalloc((size_t)msa_count *
                                                sizeof(unsigned long *));
+
+  /* loci are resolved independently; the hash tables are only read. Each
+     thread resolves every slots-th locus with buffers sized for the largest
+     one */
+  rd.msa_list = msa_list;
+  rd.weights = weights;
+  rd.cleandata = cleandata;
+  rd.resolution_count = resolution_count;
+  rd.msa_count = msa_count;
+  rd.slots = MIN(opt_threads,msa_count);
+  rd.max_count = 1;
+  rd.max_length = 1;
   for (i = 0; i < msa_count; ++i)
   {
-    if (msa_list[i]->dtype == BPP_DATA_DNA)
-    {
-      map = pll_map_nt;
-    }
-    else if (msa_list[i]->dtype == BPP_DATA_AA)
-    {
-      map = pll_map_aa;
-    }
-    else
-      assert(0);
-
-    resolution_count[i] = diploid_resolve_locus(msa_list[i],
-                                                (int)i,
-                                                weights[i],
-                                                cleandata+i,
-                                                map);
+    rd.max_count = MAX(rd.max_count, msa_list[i]->count);
+    rd.max_length = MAX(rd.max_length, msa_list[i]->length);
   }
+  if (rd.slots > 0)
+    threads_parallel_for(rd.slots,cb_resolve_slot,(void *)&rd);
 
   /* update map file with new labels */
   if (stree->tip_count > 1)
@@ -630,3 +733,14 @@ unsigned long ** diploid_resolve(stree_t * stree,
 
   return resolution_count;
 }
+
+/* add the labels of the phased sequences to the map list, when the phased
+   alignments are not computed by diploid_resolve() but read from a cache */
+void diploid_update_maplist(stree_t * stree, list_t * maplist)
+{
+  if (stree->tip_count == 1) return;
+
+  diploid_resolution_init(stree,maplist);
+  update_map_list(maplist);
+  diploid_resolution_fini();
+}
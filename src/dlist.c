@@ -86,6 +86,12 @@ void dlist_clear(dlist_t * dlist, void (*cb_dealloc)(void *))
   dlist->head  = dlist->tail = NULL;
 }
 
+/* empty the list without deallocating its items */
+void dlist_reset(dlist_t * dlist)
+{
+  dlist->head = dlist->tail = NULL;
+}
+
 void dlist_item_remove(dlist_item_t * item)
 {
   if (item->prev)
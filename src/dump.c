@@ -88,8 +88,13 @@ static void dump_chk_header(FILE * fp, stree_t * stree)
   DUMP(&opt_threads,1,fp);
   DUMP(&opt_threads_start,1,fp);
   DUMP(&opt_threads_step,1,fp);
-  unsigned int * rng = get_legacy_rndu_array();
-  DUMP(rng,opt_threads,fp);
+  DUMP(&opt_rng,1,fp);
+  for (i = 0; i < opt_threads; ++i)
+  {
+    uint64_t rng[RNG_STATE_WORDS];
+    rng_get_state(i,rng);
+    DUMP(rng,RNG_STATE_WORDS,fp);
+  }
 
   /* number of sections */
   unsigned int sections = 3;
@@ -487,17 +492,19 @@ static void dump_chk_section_2(FILE * fp, stree_t * stree)
   /* write number of coalescent events */
   assert(opt_locus_count == stree->locus_count);
   for (i = 0; i < total_nodes; ++i)
-    DUMP(stree->nodes[i]->event_count,opt_locus_count,fp);
+    for (j = 0; j < opt_locus_count; ++j)
+      DUMP(&(SNODE_LOCUS(stree->nodes[i],j)->event_count),1,fp);
 
   if (opt_clock != BPP_CLOCK_GLOBAL)
   {
     for (i = 0; i < total_nodes; ++i)
     {
-      if (stree->nodes[i]->brate)
+      if (stree->nodes[i]->has_brate)
       {
         valid = 1;
         DUMP(&valid,1,fp);
-        DUMP(stree->nodes[i]->brate,opt_locus_count,fp);
+        for (j = 0; j < opt_locus_count; ++j)
+          DUMP(&(SNODE_LOCUS(stree->nodes[i],j)->brate),1,fp);
       }
       else
       {
@@ -519,7 +526,8 @@ static void dump_chk_section_2(FILE * fp, stree_t * stree)
     DUMP(&(stree->notheta_sfactor),1,fp);
     for (i = 0; i < total_nodes; ++i)
     {
-      DUMP(stree->nodes[i]->t2h,opt_locus_count,fp);
+      for (j = 0; j < opt_locus_count; ++j)
+        DUMP(&(SNODE_LOCUS(stree->nodes[i],j)->t2h),1,fp);
       DUMP(&(stree->nodes[i]->t2h_sum),1,fp);
       DUMP(&(stree->nodes[i]->event_count_sum),1,fp);
       DUMP(&(stree->nodes[i]->notheta_logpr_contrib),1,fp);
@@ -531,14 +539,15 @@ static void dump_chk_section_2(FILE * fp, stree_t * stree)
   /* TODO : Perhaps write only seqin_count for tips? */
   /* write number of incoming sequences for each node */
   for (i = 0; i < total_nodes; ++i)
-    DUMP(stree->nodes[i]->seqin_count,opt_locus_count,fp);
+    for (j = 0; j < opt_locus_count; ++j)
+      DUMP(&(SNODE_LOCUS(stree->nodes[i],j)->seqin_count),1,fp);
 
   /* write event indices for each node */
   for (i = 0; i < total_nodes; ++i)
   {
     for (j = 0; j < opt_locus_count; ++j)
     {
-      dlist_item_t * di = stree->nodes[i]->event[j]->head;
+      dlist_item_t * di = SNODE_LOCUS(stree->nodes[i],j)->event->head;
       while (di)
       {
         gnode_t * gnode = (gnode_t *)(di->data);
@@ -696,13 +705,16 @@ static void dump_locus(FILE * fp, gtree_t * gtree, locus_t * locus)
     DUMP(locus->pattern_weights,locus->sites,fp);
   }
 
-  /* write tip CLVs */
+  /* write packed tip states or tip CLVs */
   for (i = 0; i < locus->tips; ++i)
   {
     unsigned int clv_index = gtree->nodes[i]->clv_index;
     long span = locus->sites * locus->states * locus->rate_cats;
     
-    DUMP(locus->clv[clv_index],span,fp);
+    if (locus->attributes & PLL_ATTRIB_PATTERN_TIP)
+      DUMP(locus->tipchars[clv_index],(locus->sites+1)/2,fp);
+    else
+      DUMP(locus->clv[clv_index],span,fp);
   }
 }
 
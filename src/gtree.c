@@ -48,7 +48,6 @@ static hashtable_t * mht;
 
 /* one sortbuffer per thread (used as space to sort coalescent times when
    computing MSC density) to avoid reallocation */
-static double ** sortbuffer_r = NULL;
 
 static gnode_t *** travbuffer = NULL;
 
@@ -252,7 +251,7 @@ void gtree_destroy(gtree_t * tree,
   unsigned int i;
   gnode_t * node;
 
-  /* deallocate all nodes */
+  /* deallocate node data and labels */
   for (i = 0; i < tree->tip_count + tree->inner_count; ++i)
   {
     node = tree->nodes[i];
@@ -260,14 +259,10 @@ void gtree_destroy(gtree_t * tree,
 
     if (node->label)
       free(node->label);
-    if (node->hpath)
-      free(node->hpath);
-
-    free(node);
   }
 
-  /* deallocate tree structure */
-  free(tree->nodes);
+  /* nodes, event items and hpath arrays live in the same block as the tree
+     structure (see gtree_arena_alloc) */
   free(tree);
 }
 
@@ -400,51 +395,163 @@ static void fill_nodes_recursive(gnode_t * node, gnode_t ** array)
   fill_nodes_recursive(node->right,array);
 }
 
-static unsigned int gtree_count_tips(gnode_t * root)
+/* Allocate a gene tree with tip_count tips in a single block that holds the
+   tree structure, the array of node pointers, the nodes, the coalescent event
+   items of the inner nodes and the hybridization path flags. The nodes are
+   laid out in creation order, i.e. tips first followed by inner nodes in the
+   order of their coalescence, such that children precede their parents as in
+   a postorder traversal. Inner node i owns event item i-tip_count for its
+   whole lifetime, and the entire tree is released with one free() */
+static size_t gtree_arena_size(unsigned int tip_count, long hpath_len)
 {
-  unsigned int count = 0;
+  unsigned int nodes_count = 2*tip_count-1;
 
-  if (root->left)
-    count += gtree_count_tips(root->left);
-  if (root->right)
-    count += gtree_count_tips(root->right);
+  return sizeof(gtree_t) +
+         nodes_count * (sizeof(gnode_t *) + sizeof(gnode_t)) +
+         (tip_count-1) * sizeof(dlist_item_t) +
+         (size_t)nodes_count * hpath_len * sizeof(int);
+}
 
-  if (!root->left && !root->right)
-    return 1;
+gtree_t * gtree_arena_alloc(unsigned int tip_count, long hpath_len)
+{
+  unsigned int i;
+  long j;
+  unsigned int nodes_count = 2*tip_count-1;
+  size_t size;
+  char * mem;
+
+  if (tip_count < 2)
+    fatal("Invalid number of tips in input tree (%u).", tip_count);
+
+  size = gtree_arena_size(tip_count, hpath_len);
+
+  mem = (char *)xcalloc(1,size);
+
+  gtree_t * tree = (gtree_t *)mem;
+  mem += sizeof(gtree_t);
+  tree->nodes = (gnode_t **)mem;
+  mem += nodes_count * sizeof(gnode_t *);
+  gnode_t * nodes = (gnode_t *)mem;
+  mem += nodes_count * sizeof(gnode_t);
+  dlist_item_t * items = (dlist_item_t *)mem;
+  mem += (tip_count-1) * sizeof(dlist_item_t);
+  int * hpath = (int *)mem;
+
+  tree->tip_count = tip_count;
+  tree->inner_count = tip_count-1;
+  tree->edge_count = 2*tip_count-2;
+  tree->root = NULL;
+
+  for (i = 0; i < nodes_count; ++i)
+  {
+    gnode_t * node = nodes+i;
+
+    tree->nodes[i] = node;
+    node->node_index = i;
+
+    if (hpath_len)
+    {
+      node->hpath = hpath + (size_t)i*hpath_len;
+      for (j = 0; j < hpath_len; ++j)
+        node->hpath[j] = BPP_HPATH_NONE;
+    }
 
-  return count;
+    if (i >= tip_count)
+    {
+      node->event = items + (i - tip_count);
+      node->event->data = node;
+    }
+  }
+
+  return tree;
 }
 
-static gtree_t * gtree_wraptree(gnode_t * root,
-                                unsigned int tip_count)
+#define ARENA_REBASE(p,old,mem) \
+  ((p) ? (void *)((mem) + ((const char *)(p) - (old))) : NULL)
+
+/* Move gene tree msa_index to a new block that is allocated and written by the
+   calling thread, such that it is placed on the NUMA node of the thread. All
+   pointers into the block are rebased, including the heads and tails of the
+   coalescent event lists of the populations for this locus (event items of a
+   locus belong to its gene tree). Returns the size of the block */
+size_t gtree_first_touch(gtree_t ** ptr_gtree, stree_t * stree, long msa_index)
 {
   unsigned int i;
+  gtree_t * old = *ptr_gtree;
+  const char * base = (const char *)old;
+  unsigned int nodes_count = old->tip_count + old->inner_count;
+  unsigned int snodes_count = stree->tip_count + stree->inner_count +
+                              stree->hybrid_count;
+  size_t size = gtree_arena_size(old->tip_count, stree->hybrid_count);
+  char * mem = (char *)xmalloc(size);
+  gtree_t * tree = (gtree_t *)mem;
 
-  gtree_t * tree = (gtree_t *)xmalloc(sizeof(gtree_t));
+  memcpy(mem, old, size);
 
-  if (tip_count < 2 && tip_count != 0)
-    fatal("Invalid number of tips in input tree (%u).", tip_count);
+  tree->nodes = (gnode_t **)ARENA_REBASE(old->nodes,base,mem);
+  tree->root = (gnode_t *)ARENA_REBASE(old->root,base,mem);
 
-  if (tip_count == 0)
+  for (i = 0; i < nodes_count; ++i)
   {
-    /* if tip counts is set to 0 then recursively count the number of tips */
-    tip_count = gtree_count_tips(root);
-    assert(tip_count);
+    gnode_t * node;
+
+    tree->nodes[i] = (gnode_t *)ARENA_REBASE(old->nodes[i],base,mem);
+    node = tree->nodes[i];
+
+    node->left = (gnode_t *)ARENA_REBASE(node->left,base,mem);
+    node->right = (gnode_t *)ARENA_REBASE(node->right,base,mem);
+    node->parent = (gnode_t *)ARENA_REBASE(node->parent,base,mem);
+    node->hpath = (int *)ARENA_REBASE(node->hpath,base,mem);
+    node->event = (dlist_item_t *)ARENA_REBASE(node->event,base,mem);
+
+    if (node->event)
+    {
+      node->event->data = node;
+      node->event->prev = (dlist_item_t *)ARENA_REBASE(node->event->prev,
+                                                       base,mem);
+      node->event->next = (dlist_item_t *)ARENA_REBASE(node->event->next,
+                                                       base,mem);
+    }
   }
 
-  tree->nodes = (gnode_t **)xmalloc((2*tip_count-1)*sizeof(gnode_t *));
-  
-  fill_nodes_recursive(root, tree->nodes);
+  for (i = 0; i < snodes_count; ++i)
+  {
+    dlist_t * event = SNODE_LOCUS(stree->nodes[i],msa_index)->event;
+
+    event->head = (dlist_item_t *)ARENA_REBASE(event->head,base,mem);
+    event->tail = (dlist_item_t *)ARENA_REBASE(event->tail,base,mem);
+  }
+
+  free(old);
+  *ptr_gtree = tree;
+
+  return size;
+}
+
+/* add the bytes of a gene tree residing on each NUMA node to node_bytes (see
+   numa_placement) */
+long gtree_numa_placement(const gtree_t * gtree,
+                          const stree_t * stree,
+                          double * node_bytes)
+{
+  return numa_placement(gtree,
+                        gtree_arena_size(gtree->tip_count,
+                                         stree->hybrid_count),
+                        node_bytes);
+}
+
+/* set the root of a gene tree whose nodes were linked by gtree_simulate, and
+   index its nodes by their CLV index */
+static void gtree_wraptree(gtree_t * tree, gnode_t * root)
+{
+  unsigned int i;
 
-  tree->tip_count = tip_count;
-  tree->edge_count = 2*tip_count-2;
-  tree->inner_count = tip_count-1;
   tree->root = root;
 
-  for (i = 0; i < 2*tip_count-1; ++i)
-    tree->nodes[i]->node_index = i;
+  fill_nodes_recursive(root, tree->nodes);
 
-  return tree;
+  for (i = 0; i < tree->tip_count + tree->inner_count; ++i)
+    tree->nodes[i]->node_index = i;
 }
 
 static void cb_dealloc_pairlabel(void * data)
@@ -896,9 +1003,9 @@ static void fill_hybrid_seqin_counts(stree_t * stree, gtree_t * gtree, int msa_i
       for (j = 0; j < gtree->tip_count; ++j)
       {
         if (gtree->nodes[j]->hpath[i] == BPP_HPATH_LEFT)
-          hnode->seqin_count[msa_index]++;
+          SNODE_LOCUS(hnode,msa_index)->seqin_count++;
         else if (gtree->nodes[j]->hpath[i] == BPP_HPATH_RIGHT)
-          mnode->seqin_count[msa_index]++;
+          SNODE_LOCUS(mnode,msa_index)->seqin_count++;
       }
 
       for (j = gtree->tip_count; j < gtree->tip_count+gtree->inner_count; ++j)
@@ -909,9 +1016,9 @@ static void fill_hybrid_seqin_counts(stree_t * stree, gtree_t * gtree, int msa_i
             x->right->hpath[i] == BPP_HPATH_NONE)
         {
           if (x->hpath[i] == BPP_HPATH_LEFT)
-            hnode->seqin_count[msa_index]++;
+            SNODE_LOCUS(hnode,msa_index)->seqin_count++;
           else if (x->hpath[i] == BPP_HPATH_RIGHT)
-            mnode->seqin_count[msa_index]++;
+            SNODE_LOCUS(mnode,msa_index)->seqin_count++;
         }
       }
     }
@@ -926,12 +1033,12 @@ static void fill_hybrid_seqin_counts(stree_t * stree, gtree_t * gtree, int msa_i
         if (gtree->nodes[j]->hpath[i] == BPP_HPATH_LEFT)
         {
           if (gtree->nodes[j]->hpath[hindex2] == BPP_HPATH_NONE)
-            hnode->seqin_count[msa_index]++;
+            SNODE_LOCUS(hnode,msa_index)->seqin_count++;
         }
         else if (gtree->nodes[j]->hpath[i] == BPP_HPATH_RIGHT)
         {
-          mnode->seqin_count[msa_index]++;
-          mnode->parent->seqin_count[msa_index]++;
+          SNODE_LOCUS(mnode,msa_index)->seqin_count++;
+          SNODE_LOCUS(mnode->parent,msa_index)->seqin_count++;
         }
       }
 
@@ -945,12 +1052,12 @@ static void fill_hybrid_seqin_counts(stree_t * stree, gtree_t * gtree, int msa_i
           if (x->hpath[i] == BPP_HPATH_LEFT)
           {
             if (x->hpath[hindex2] == BPP_HPATH_NONE)
-              hnode->seqin_count[msa_index]++;
+              SNODE_LOCUS(hnode,msa_index)->seqin_count++;
           }
           else if (x->hpath[i] == BPP_HPATH_RIGHT)
           {
-            mnode->seqin_count[msa_index]++;
-            mnode->parent->seqin_count[msa_index]++;
+            SNODE_LOCUS(mnode,msa_index)->seqin_count++;
+            SNODE_LOCUS(mnode->parent,msa_index)->seqin_count++;
           }
         }
       }
@@ -1004,8 +1111,10 @@ static void fill_seqin_counts_recursive(snode_t * node, int msa_index)
           child = node->hybrid->right;
         }
 
-        assert((child->seqin_count[msa_index] - child->event_count[msa_index]) ==
-               (node->seqin_count[msa_index] + node->hybrid->seqin_count[msa_index]));
+        assert((SNODE_LOCUS(child,msa_index)->seqin_count -
+                SNODE_LOCUS(child,msa_index)->event_count) ==
+               (SNODE_LOCUS(node,msa_index)->seqin_count +
+                SNODE_LOCUS(node->hybrid,msa_index)->seqin_count));
       }
       else
       {
@@ -1026,21 +1135,21 @@ static void fill_seqin_counts_recursive(snode_t * node, int msa_index)
     }
 
 
-    node->seqin_count[msa_index] = 0;
+    SNODE_LOCUS(node,msa_index)->seqin_count = 0;
     if (lnode)
-      node->seqin_count[msa_index] += lnode->seqin_count[msa_index] -
-                                      lnode->event_count[msa_index];
+      SNODE_LOCUS(node,msa_index)->seqin_count += SNODE_LOCUS(lnode,msa_index)->seqin_count -
+                                      SNODE_LOCUS(lnode,msa_index)->event_count;
     if (rnode)
-      node->seqin_count[msa_index] += rnode->seqin_count[msa_index] -
-                                      rnode->event_count[msa_index];
+      SNODE_LOCUS(node,msa_index)->seqin_count += SNODE_LOCUS(rnode,msa_index)->seqin_count -
+                                      SNODE_LOCUS(rnode,msa_index)->event_count;
   }
   else
   {
     /* if no networks then this is valid */
-    node->seqin_count[msa_index] = lnode->seqin_count[msa_index] +
-                                   rnode->seqin_count[msa_index] -
-                                   lnode->event_count[msa_index] -
-                                   rnode->event_count[msa_index];
+    SNODE_LOCUS(node,msa_index)->seqin_count = SNODE_LOCUS(lnode,msa_index)->seqin_count +
+                                   SNODE_LOCUS(rnode,msa_index)->seqin_count -
+                                   SNODE_LOCUS(lnode,msa_index)->event_count -
+                                   SNODE_LOCUS(rnode,msa_index)->event_count;
   }
 }
 
@@ -1069,14 +1178,19 @@ void fill_seqin_counts(stree_t * stree, gtree_t * gtree, int msa_index)
         assert(!node_is_mirror(hnode));
 
         assert(mnode->parent && mnode->parent->hybrid);
-        assert(mnode->seqin_count[msa_index] <= mnode->parent->seqin_count[msa_index]);
+        assert(SNODE_LOCUS(mnode,msa_index)->seqin_count <=
+               SNODE_LOCUS(mnode->parent,msa_index)->seqin_count);
 
         assert(hnode->right && hnode->right->hybrid);
-        assert(hnode->seqin_count[msa_index] >= hnode->right->seqin_count[msa_index]);
-
-        assert(hnode->seqin_count[msa_index] + hnode->right->hybrid->seqin_count[msa_index] ==
-               hnode->left->seqin_count[msa_index] - hnode->left->event_count[msa_index] +
-               hnode->right->hybrid->left->seqin_count[msa_index] - hnode->right->hybrid->left->event_count[msa_index]);
+        assert(SNODE_LOCUS(hnode,msa_index)->seqin_count >=
+               SNODE_LOCUS(hnode->right,msa_index)->seqin_count);
+
+        assert(SNODE_LOCUS(hnode,msa_index)->seqin_count +
+               SNODE_LOCUS(hnode->right->hybrid,msa_index)->seqin_count ==
+               SNODE_LOCUS(hnode->left,msa_index)->seqin_count -
+               SNODE_LOCUS(hnode->left,msa_index)->event_count +
+               SNODE_LOCUS(hnode->right->hybrid->left,msa_index)->seqin_count -
+               SNODE_LOCUS(hnode->right->hybrid->left,msa_index)->event_count);
       }
     }
   }
@@ -1173,7 +1287,157 @@ static void epoch_reorder(snode_t ** epoch,
   }
 }
 
-gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
+/* Sum tree over the event rates of the populations of an epoch. Leaves hold
+   the rates and each inner node the sum of its two children, such that the
+   total is available at the root and a population is selected in proportion
+   to its rate in O(log n) time. Inner nodes are recomputed from their
+   children on updates, so sums do not drift as rates change */
+typedef struct rate_tree_s
+{
+  long size;                    /* number of leaves (power of two) */
+  double * w;                   /* root at w[1], leaves at w[size..2*size-1] */
+} rate_tree_t;
+
+static void rate_tree_alloc(rate_tree_t * rt, long n)
+{
+  for (rt->size = 1; rt->size < n; rt->size <<= 1);
+  rt->w = (double *)xcalloc((size_t)(2*rt->size), sizeof(double));
+}
+
+static void rate_tree_build(rate_tree_t * rt, const double * x, long n)
+{
+  long i;
+
+  memset(rt->w + rt->size, 0, (size_t)rt->size * sizeof(double));
+  memcpy(rt->w + rt->size, x, (size_t)n * sizeof(double));
+
+  for (i = rt->size-1; i > 0; --i)
+    rt->w[i] = rt->w[2*i] + rt->w[2*i+1];
+}
+
+static void rate_tree_set(rate_tree_t * rt, long i, double x)
+{
+  i += rt->size;
+  rt->w[i] = x;
+
+  for (i >>= 1; i > 0; i >>= 1)
+    rt->w[i] = rt->w[2*i] + rt->w[2*i+1];
+}
+
+/* return the leaf in whose interval r falls, and the offset of r within it.
+   Subtrees with zero rate are never entered */
+static long rate_tree_find(const rate_tree_t * rt, double * r)
+{
+  long i = 1;
+
+  while (i < rt->size)
+  {
+    double left  = rt->w[2*i];
+    double right = rt->w[2*i+1];
+
+    if ((*r < left && left > 0) || right == 0)
+      i = 2*i;
+    else
+    {
+      *r -= left;
+      i = 2*i+1;
+    }
+  }
+
+  return i - rt->size;
+}
+
+/* coalescent and migration rates of population j in the event-driven
+   simulation. mrate[j] is the migration rate per lineage of population j in
+   the current epoch */
+static double coal_rate(const pop_t * pop)
+{
+  unsigned int k = pop->seq_count;
+
+  return (k >= 2) ? k*(k-1)/pop->snode->theta : 0;
+}
+
+static void pop_update_rates(pop_t * pop,
+                             long j,
+                             const double * mrate,
+                             rate_tree_t * ct,
+                             rate_tree_t * mt)
+{
+  rate_tree_set(ct, j, coal_rate(pop+j));
+  if (mt)
+    rate_tree_set(mt, j, pop[j].seq_count * mrate[j]);
+}
+
+/* Compute the coalescent and migration rates of the populations of an epoch.
+   For each population j, msrc[j*n+k] is the cumulative rate (per lineage) of
+   migration from the first k+1 populations into j */
+static void epoch_rates(stree_t * stree,
+                        pop_t * pop,
+                        long pop_count,
+                        double * ci,
+                        double * mrate,
+                        double * msrc,
+                        rate_tree_t * ct,
+                        rate_tree_t * mt)
+{
+  long j,k;
+  long matrix_span = stree->tip_count + stree->inner_count;
+
+  for (j = 0; j < pop_count; ++j)
+    ci[j] = coal_rate(pop+j);
+  rate_tree_build(ct, ci, pop_count);
+
+  if (!mt) return;
+
+  for (j = 0; j < pop_count; ++j)
+  {
+    long mindexj = pop[j].snode->node_index;
+    double sum = 0;
+
+    for (k = 0; k < pop_count; ++k)
+    {
+      long mindexk = pop[k].snode->node_index;
+      sum += opt_migration_matrix[mindexk * matrix_span + mindexj] /
+             pop[j].snode->theta*4;
+      msrc[j*pop_count+k] = sum;
+    }
+    mrate[j] = sum;
+
+    /* ci is reused for the migration rates of the populations */
+    ci[j] = pop[j].seq_count * sum;
+  }
+  rate_tree_build(mt, ci, pop_count);
+}
+
+/* select the source population of a lineage migrating into population j, given
+   r uniform in [0,mrate[j]) */
+static long migration_source(const double * msrc, long j, long n, double r)
+{
+  long lo = 0;
+  long hi = n-1;
+  const double * cum = msrc + j*n;
+
+  while (lo < hi)
+  {
+    long mid = lo + (hi-lo)/2;
+
+    if (r < cum[mid])
+      hi = mid;
+    else
+      lo = mid+1;
+  }
+
+  /* skip populations with zero rate in case of round-off */
+  while (lo > 0 && cum[lo] == cum[lo-1])
+    --lo;
+
+  return lo;
+}
+
+gtree_t * gtree_simulate(stree_t * stree,
+                         msa_t * msa,
+                         int msa_index,
+                         long thread_index)
 {
   int lineage_count = 0;
   int scaler_index = 0;
@@ -1185,11 +1449,34 @@ gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
   pop_t * pop;
   snode_t ** epoch;
   gnode_t * inner = NULL;
-  const long thread_index = 0;
+  gtree_t * gtree;
+  double * mrate = NULL;
+  double * msrc = NULL;
+  rate_tree_t ct;
+  rate_tree_t mt;
+  long pop_max = stree->tip_count + stree->hybrid_count;
+
+  /* The legacy generator reproduces the gene trees of previous versions, which
+     recompute the rates of all populations at each event and select
+     populations by linear search. Otherwise, events are drawn from sum trees
+     of the population rates, which are updated only for the populations
+     affected by each event, and migration rates are computed once per epoch */
+  int event_driven = (opt_rng != BPP_RNG_LEGACY);
 
   if (opt_migration)
     migrate = (double *)xmalloc((size_t)stree->tip_count * sizeof(double));
 
+  if (event_driven)
+  {
+    rate_tree_alloc(&ct, pop_max);
+    if (opt_migration)
+    {
+      rate_tree_alloc(&mt, pop_max);
+      mrate = (double *)xmalloc((size_t)pop_max * sizeof(double));
+      msrc = (double *)xmalloc((size_t)(pop_max*pop_max) * sizeof(double));
+    }
+  }
+
   /* get a list of inner nodes (epochs) */
   epoch_count = stree->inner_count;
   if (opt_msci)
@@ -1269,7 +1556,7 @@ gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
   fill_pop(pop,stree,msa,msa_index);
 
   for (i = 0; i < stree->tip_count; ++i)
-    stree->nodes[i]->seqin_count[msa_index] = pop[i].seq_count;
+    SNODE_LOCUS(stree->nodes[i],msa_index)->seqin_count = pop[i].seq_count;
 
   if (!opt_est_theta)
   {
@@ -1284,7 +1571,7 @@ gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
     {
       long seqs = 0;
       for (j = 0; j < stree->tip_count; ++j)
-        seqs += stree->nodes[j]->seqin_count[i];
+        seqs += SNODE_LOCUS(stree->nodes[j],i)->seqin_count;
 
       stree->notheta_logpr   += (seqs-1)*0.6931471805599453;
       stree->notheta_sfactor += (seqs-1)*0.6931471805599453;
@@ -1302,26 +1589,22 @@ gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
   /* current epoch index */
   unsigned int e = 0;
 
+  /* allocate the gene tree nodes in one block. Note that hpath is also
+     allocated for tips, although they never pass through a hybridization
+     event, such that we do not need to check whether a node is inner when
+     accessing hpath */
+  gtree = gtree_arena_alloc((unsigned int)(msa->count),
+                            opt_msci ? stree->hybrid_count : 0);
+
   /* create a list of tip nodes for the target gene tree */
   gnode_t ** gtips = (gnode_t **)xcalloc((size_t)(msa->count),
                                          sizeof(gnode_t *));
   for (i = 0; i < (unsigned int)(msa->count); ++i)
   {
-    gtips[i] = (gnode_t *)xcalloc(1,sizeof(gnode_t));
+    gtips[i] = gtree->nodes[i];
     gtips[i]->pmatrix_index = i;
     gtips[i]->scaler_index = PLL_SCALE_BUFFER_NONE;
     gtips[i]->leaves = 1;
-
-    if (opt_msci)
-    {
-      /* TODO: Allocating hpath for tips is unnecessary, as they never pass
-         through a hybridization event. However, if we don't allocate hpath
-         we will need to check that a node is inner when accessing hpath */
-      gtips[i]->hpath = (int *)xmalloc((size_t)(stree->hybrid_count) *
-                                       sizeof(int));
-      for (j = 0; j < stree->hybrid_count; ++j)
-        gtips[i]->hpath[j] = BPP_HPATH_NONE;
-    }
   }
 
   /* fill each population with one gene tip node for each lineage */
@@ -1367,41 +1650,59 @@ gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
       tmax = -1;
     else
       tmax = epoch[e]->tau;
-      
+
+    if (event_driven && tmax)
+      epoch_rates(stree,
+                  pop,
+                  pop_count,
+                  ci,
+                  mrate,
+                  msrc,
+                  &ct,
+                  opt_migration ? &mt : NULL);
+    
     while (1)
     {
       if (!tmax) break;
 
-      /* calculate poisson rates: ci[j] is coalescent rate for population j */
-      for (j=0, csum=0; j < pop_count; ++j)
+      if (event_driven)
       {
-        k = pop[j].seq_count;
-
-        if (k >= 2)
+        csum = ct.w[1];
+        msum = opt_migration ? mt.w[1] : 0;
+      }
+      else
+      {
+        /* calculate poisson rates: ci[j] is coalescent rate for population j */
+        for (j=0, csum=0; j < pop_count; ++j)
         {
-          ci[j] = k*(k-1)/pop[j].snode->theta;
-          csum += ci[j];
+          k = pop[j].seq_count;
+
+          if (k >= 2)
+          {
+            ci[j] = k*(k-1)/pop[j].snode->theta;
+            csum += ci[j];
+          }
+          else
+            ci[j] = 0;
         }
-        else
-          ci[j] = 0;
-      }
 
-      if (opt_migration)
-      {
-        assert(!opt_msci);
-        msum = 0;
-        long matrix_span = stree->tip_count + stree->inner_count;
-        for (j = 0; j < pop_count; ++j)
+        if (opt_migration)
         {
-          for (k = 0, migrate[j] = 0; k < pop_count; ++k)
+          assert(!opt_msci);
+          msum = 0;
+          long matrix_span = stree->tip_count + stree->inner_count;
+          for (j = 0; j < pop_count; ++j)
           {
-            long mindexk = pop[k].snode->node_index;
-            long mindexj = pop[j].snode->node_index;
-            migrate[j] += pop[j].seq_count *
-                          opt_migration_matrix[mindexk * matrix_span + mindexj] /
-                          pop[j].snode->theta*4;
+            for (k = 0, migrate[j] = 0; k < pop_count; ++k)
+            {
+              long mindexk = pop[k].snode->node_index;
+              long mindexj = pop[j].snode->node_index;
+              migrate[j] += pop[j].seq_count *
+                            opt_migration_matrix[mindexk * matrix_span + mindexj] /
+                            pop[j].snode->theta*4;
+            }
+            msum += migrate[j];
           }
-          msum += migrate[j];
         }
       }
 
@@ -1427,11 +1728,16 @@ gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
       double r = legacy_rndu(thread_index)*(csum+msum);
       if (r < csum)
       {
-        double tmp = 0;
-        for (j = 0; j < pop_count; ++j)
+        if (event_driven)
+          j = rate_tree_find(&ct, &r);
+        else
         {
-          tmp += ci[j];
-          if (r < tmp) break;
+          double tmp = 0;
+          for (j = 0; j < pop_count; ++j)
+          {
+            tmp += ci[j];
+            if (r < tmp) break;
+          }
         }
 
         assert(j < pop_count);
@@ -1461,7 +1767,7 @@ gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
         
         /* allocate and fill new inner node as the parent of the gene tree nodes
            representing lineages k1 and k2 */
-        inner = (gnode_t *)xcalloc(1,sizeof(gnode_t));
+        inner = gtree->nodes[clv_index];
         inner->parent = NULL;
         inner->left  = pop[j].nodes[k1];
         inner->right = pop[j].nodes[k2];
@@ -1480,16 +1786,9 @@ gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
         inner->leaves = inner->left->leaves + inner->right->leaves;
         clv_index++;
 
-        if (opt_msci)
-        {
-          inner->hpath = (int*)xmalloc((size_t)(stree->hybrid_count)*sizeof(int));
-          for (i = 0; i < stree->hybrid_count; ++i)
-            inner->hpath[i] = BPP_HPATH_NONE;
-        }
-
-        pop[j].snode->event_count[msa_index]++;
-        dlist_item_t * dlitem = dlist_append(pop[j].snode->event[msa_index],inner);
-        inner->event = dlitem;
+        SNODE_LOCUS(pop[j].snode,msa_index)->event_count++;
+        dlist_item_append(SNODE_LOCUS(pop[j].snode,msa_index)->event,
+                          inner->event);
         if (!opt_est_theta)
           pop[j].snode->event_count_sum++;
 
@@ -1503,39 +1802,56 @@ gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
           pop[j].seq_indices[k2] = pop[j].seq_indices[pop[j].seq_count];
           pop[j].nodes[k2] = pop[j].nodes[pop[j].seq_count];
         }
+
+        if (event_driven)
+          pop_update_rates(pop, j, mrate, &ct, opt_migration ? &mt : NULL);
         
         /* break if this was the last available lineage in the current locus */
         if (--lineage_count == 1) break;
       }
       else
       {
+        long mindexk;
+        long mindexj;
+        long matrix_span = stree->tip_count + stree->inner_count;
+
         r -= csum;
-        double tmp = 0;
-        for (j = 0; j < pop_count; ++j)
+        if (event_driven)
         {
-          tmp += migrate[j];
-          if (r < tmp) break;
+          j = rate_tree_find(&mt, &r);
+          k = migration_source(msrc, j, pop_count, r / pop[j].seq_count);
+          mindexj = pop[j].snode->node_index;
         }
+        else
+        {
+          double tmp = 0;
+          for (j = 0; j < pop_count; ++j)
+          {
+            tmp += migrate[j];
+            if (r < tmp) break;
+          }
 
-        if (j == pop_count)
-          fatal("The impossible just happened! Report gree_simulate()");
-        tmp -= migrate[j];
+          if (j == pop_count)
+            fatal("The impossible just happened! Report gree_simulate()");
+          tmp -= migrate[j];
 
-        long mindexk = pop[0].snode->node_index;
-        long mindexj = pop[j].snode->node_index;
-        long matrix_span = stree->tip_count + stree->inner_count;
-        for (k = 0; k < pop_count-1; ++k)
-        {
-          mindexk = pop[k].snode->node_index;
-          tmp += pop[j].seq_count * 
-                 opt_migration_matrix[mindexk * matrix_span + mindexj] /
-                 pop[j].snode->theta*4;
-          if (r < tmp)
-            break;
+          mindexk = pop[0].snode->node_index;
+          mindexj = pop[j].snode->node_index;
+          for (k = 0; k < pop_count-1; ++k)
+          {
+            mindexk = pop[k].snode->node_index;
+            tmp += pop[j].seq_count * 
+                   opt_migration_matrix[mindexk * matrix_span + mindexj] /
+                   pop[j].snode->theta*4;
+            if (r < tmp)
+              break;
+          }
         }
         mindexk = pop[k].snode->node_index;
 
-        opt_migration_events[mindexk * matrix_span + mindexj] += 1;
+        /* each thread counts events in its own matrix */
+        opt_migration_events[thread_index * matrix_span * matrix_span +
+                             mindexk * matrix_span + mindexj] += 1;
 
         /* i is a migrant from population k to j */
         i = (long)(pop[j].seq_count * legacy_rndu(thread_index));
@@ -1548,6 +1864,12 @@ gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
           pop[j].seq_indices[i] = pop[j].seq_indices[pop[j].seq_count];
           pop[j].nodes[i] = pop[j].nodes[pop[j].seq_count];
         }
+
+        if (event_driven)
+        {
+          pop_update_rates(pop, j, mrate, &ct, &mt);
+          pop_update_rates(pop, k, mrate, &ct, &mt);
+        }
       }
     }
 
@@ -1570,6 +1892,16 @@ gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
 
   if (migrate)
     free(migrate);
+  if (event_driven)
+  {
+    free(ct.w);
+    if (opt_migration)
+    {
+      free(mt.w);
+      free(mrate);
+      free(msrc);
+    }
+  }
 
   for(i = 0; i < pop_count; ++i)
   {
@@ -1578,7 +1910,7 @@ gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
   }
 
   /* wrap the generated tree structure (made up of linked nodes) into gtree_t */
-  gtree_t * gtree = gtree_wraptree(inner, (unsigned int)(msa->count));
+  gtree_wraptree(gtree, inner);
 
   /* set path flags for gene tree root lineage if root coalesces before root
      population */
@@ -1651,8 +1983,8 @@ gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index)
       fprintf(stdout, "  %-*s : %-3d %-3d (age: %f)\n", 
               (int)(strlen(stree->root->label)),
               stree->nodes[i]->label,
-              stree->nodes[i]->event_count[msa_index],
-              stree->nodes[i]->seqin_count[msa_index],
+              SNODE_LOCUS(stree->nodes[i],msa_index)->event_count,
+              SNODE_LOCUS(stree->nodes[i],msa_index)->seqin_count,
               stree->nodes[i]->tau);
   }
 
@@ -1681,8 +2013,8 @@ static void reset_hybrid_gene_leaves_count(stree_t * stree,
     hnode = mnode->hybrid;
     assert(!node_is_mirror(hnode));
 
-    hnode->gene_leaves[msa_index] = 0;
-    mnode->gene_leaves[msa_index] = 0;
+    SNODE_LOCUS(hnode,msa_index)->gene_leaves = 0;
+    SNODE_LOCUS(mnode,msa_index)->gene_leaves = 0;
   }
 
   for (i = 0; i < stree->hybrid_count; ++i)
@@ -1707,19 +2039,19 @@ static void reset_hybrid_gene_leaves_count(stree_t * stree,
           {
             unsigned int hindex2 = GET_HINDEX(stree,mnode->parent);
             if (x->hpath[hindex2] == BPP_HPATH_NONE)
-              hnode->gene_leaves[msa_index]++;
+              SNODE_LOCUS(hnode,msa_index)->gene_leaves++;
           }
           else
-            hnode->gene_leaves[msa_index]++;
+            SNODE_LOCUS(hnode,msa_index)->gene_leaves++;
           break;
         }
         if (x->hpath[i] == BPP_HPATH_RIGHT)
         {
-          mnode->gene_leaves[msa_index]++;
+          SNODE_LOCUS(mnode,msa_index)->gene_leaves++;
           if (bidir)
           {
             assert(mnode->parent && mnode->parent->hybrid);
-            mnode->parent->gene_leaves[msa_index]++;
+            SNODE_LOCUS(mnode->parent,msa_index)->gene_leaves++;
           }
           break;
         }
@@ -1754,8 +2086,8 @@ static void reset_gene_leaves_count_recursive(snode_t * node, unsigned int locus
 
       for (j = 0; j < locus_count; ++j)
         if (!node_is_mirror(node))
-          assert((node->gene_leaves[j] + node->hybrid->gene_leaves[j]) ==
-                 node->left->gene_leaves[j]);
+          assert((SNODE_LOCUS(node,j)->gene_leaves + SNODE_LOCUS(node->hybrid,j)->gene_leaves) ==
+                 SNODE_LOCUS(node->left,j)->gene_leaves);
     }
     else
     {
@@ -1776,8 +2108,8 @@ static void reset_gene_leaves_count_recursive(snode_t * node, unsigned int locus
   }
 
   for (j = 0; j < locus_count; ++j)
-    node->gene_leaves[j] = node->left->gene_leaves[j] +
-                           node->right->gene_leaves[j];
+    SNODE_LOCUS(node,j)->gene_leaves = SNODE_LOCUS(node->left,j)->gene_leaves +
+                           SNODE_LOCUS(node->right,j)->gene_leaves;
 
 }
 void reset_gene_leaves_count(stree_t * stree, gtree_t ** gtree)
@@ -1795,7 +2127,7 @@ void reset_gene_leaves_count(stree_t * stree, gtree_t ** gtree)
   /* gene leaves is the same as sequences coming in for tip nodes */
   for (i = 0; i < stree->tip_count; ++i)
     for (j = 0; j < stree->locus_count; ++j)
-      stree->nodes[i]->gene_leaves[j] = stree->nodes[i]->seqin_count[j];
+      SNODE_LOCUS(stree->nodes[i],j)->gene_leaves = SNODE_LOCUS(stree->nodes[i],j)->seqin_count;
 
   reset_gene_leaves_count_recursive(stree->root, stree->locus_count);
 
@@ -1803,12 +2135,12 @@ void reset_gene_leaves_count(stree_t * stree, gtree_t ** gtree)
   if (stree->tip_count > 1)
   {
     for (j = 0; j < stree->locus_count; ++j)
-      stree->root->gene_leaves[j] = stree->root->left->gene_leaves[j] +
-                                    stree->root->right->gene_leaves[j];
+      SNODE_LOCUS(stree->root,j)->gene_leaves = SNODE_LOCUS(stree->root->left,j)->gene_leaves +
+                                    SNODE_LOCUS(stree->root->right,j)->gene_leaves;
   }
 }
 
-void gtree_alloc_internals(gtree_t ** gtree, long msa_count)
+void gtree_alloc_internals(stree_t * stree, gtree_t ** gtree, long msa_count)
 {
   long i;
   size_t minsize;
@@ -1819,30 +2151,11 @@ void gtree_alloc_internals(gtree_t ** gtree, long msa_count)
     if (gtree[i]->tip_count > max_count)
       max_count = gtree[i]->tip_count;
 
-  /* alloate buffer for sorting coalescent times plus two for the beginning
-     and end of epoch */
-  
-  #ifdef DEBUG_THREADS
-  if (opt_threads == 1)
-  {
-    opt_threads = DEBUG_THREADS_COUNT;
-    sortbuffer_r = (double **)xmalloc((size_t)(opt_threads) * sizeof(double *));
-    for (i = 0; i < opt_threads; ++i)
-      sortbuffer_r[i] = (double *)xmalloc((size_t)(max_count+2) * sizeof(double));
-    opt_threads = 1;
-  }
-  else
-  {
-    sortbuffer_r = (double **)xmalloc((size_t)(opt_threads) * sizeof(double *));
-    for (i = 0; i < opt_threads; ++i)
-      sortbuffer_r[i] = (double *)xmalloc((size_t)(max_count+2) * sizeof(double));
-  }
-  #else
-  sortbuffer_r = (double **)xmalloc((size_t)(opt_threads) * sizeof(double *));
-  for (i = 0; i < opt_threads; ++i)
-    sortbuffer_r[i] = (double *)xmalloc((size_t)(max_count+2) * sizeof(double));
-  #endif
-  
+  /* alloate per-thread scratch space, i.e. buffer for sorting coalescent times
+     plus two for the beginning and end of epoch, and the hx/mark arrays */
+  threads_scratch_alloc(stree->tip_count+stree->inner_count+stree->hybrid_count,
+                        max_count+2);
+
   /* allocate traversal buffers */
   travbuffer = (gnode_t ***)xmalloc((size_t)msa_count * sizeof(gnode_t **));
   for (i = 0; i < msa_count; ++i)
@@ -1915,7 +2228,7 @@ gtree_t ** gtree_init(stree_t * stree,
   /* generate random starting gene trees for each alignment */
   printf("Generating gene trees....");
   for (i = 0; i < msa_count; ++i)
-    gtree[i] = gtree_simulate(stree, msalist[i],i);
+    gtree[i] = gtree_simulate(stree, msalist[i],i,0);
   printf(" Done\n");
 
   /* destroy the hash tables */
@@ -1926,7 +2239,7 @@ gtree_t ** gtree_init(stree_t * stree,
   }
 
   /* allocate static internal arrays sortbuffer and travbuffer */
-  gtree_alloc_internals(gtree,msa_count);
+  gtree_alloc_internals(stree,gtree,msa_count);
 
   /* reset number of gene leaves associated with each species tree subtree */
   reset_gene_leaves_count(stree,gtree);
@@ -1934,6 +2247,32 @@ gtree_t ** gtree_init(stree_t * stree,
   return gtree;
 }
 
+/* generate new random starting gene trees on the copy of the species tree used
+   by an independent replicate chain, whose per-locus population state was
+   emptied with stree_init_replicate. The internal arrays allocated by
+   gtree_init are shared by all copies */
+gtree_t ** gtree_init_replicate(stree_t * stree,
+                                msa_t ** msalist,
+                                list_t * maplist,
+                                int msa_count)
+{
+  int i;
+  gtree_t ** gtree;
+
+  assert(msa_count > 0);
+
+  gtree = (gtree_t **)xmalloc((size_t)msa_count*sizeof(gtree_t *));
+
+  gtree_simulate_init(stree,maplist);
+  for (i = 0; i < msa_count; ++i)
+    gtree[i] = gtree_simulate(stree, msalist[i],i,0);
+  gtree_simulate_fini();
+
+  reset_gene_leaves_count(stree,gtree);
+
+  return gtree;
+}
+
 void gtree_update_branch_lengths(gtree_t ** gtree_list, int count)
 {
   unsigned int i,j;
@@ -1960,9 +2299,9 @@ static int cb_cmp_double_asc(const void * a, const void * b)
 
 void logprob_revert_notheta(snode_t * snode, long msa_index)
 {
-  snode->t2h_sum -= snode->t2h[msa_index];
-  snode->t2h[msa_index] = snode->old_t2h[msa_index];
-  snode->t2h_sum += snode->t2h[msa_index];
+  snode->t2h_sum -= SNODE_LOCUS(snode,msa_index)->t2h;
+  SNODE_LOCUS(snode,msa_index)->t2h = SNODE_LOCUS(snode,msa_index)->old_t2h;
+  snode->t2h_sum += SNODE_LOCUS(snode,msa_index)->t2h;
   snode->notheta_logpr_contrib = snode->notheta_old_logpr_contrib;
 }
 
@@ -1976,11 +2315,11 @@ double gtree_update_logprob_contrib(snode_t * snode,
     double T2h = 0;
     dlist_item_t * event;
 
-    double * sortbuffer = sortbuffer_r[thread_index];
+    double * sortbuffer = thread_scratch[thread_index].sortbuffer;
 
     sortbuffer[0] = snode->tau;
     j = 1;
-    for (event = snode->event[msa_index]->head; event; event = event->next)
+    for (event = SNODE_LOCUS(snode,msa_index)->event->head; event; event = event->next)
     {
       gnode_t * gnode = (gnode_t *)(event->data);
       sortbuffer[j++] = gnode->time;
@@ -2001,7 +2340,7 @@ double gtree_update_logprob_contrib(snode_t * snode,
     #if 0
     printf("Population: %s tau: %f theta: %f events: %d seqin_count: %d\n",
            snode->label, snode->tau, snode->theta,
-           snode->event_count[msa_index], snode->seqin_count[msa_index]);
+           SNODE_LOCUS(snode,msa_index)->event_count, SNODE_LOCUS(snode,msa_index)->seqin_count);
 
     if (snode->parent)
       n = j-1;
@@ -2018,8 +2357,8 @@ double gtree_update_logprob_contrib(snode_t * snode,
     #endif
 
     /* skip the last step in case the last value of n was supposed to be 1 */
-    if ((unsigned int)(snode->seqin_count[msa_index]) == j-1) --j;
-    for (k=1,n=snode->seqin_count[msa_index]; k < j; ++k, --n)
+    if ((unsigned int)(SNODE_LOCUS(snode,msa_index)->seqin_count) == j-1) --j;
+    for (k=1,n=SNODE_LOCUS(snode,msa_index)->seqin_count; k < j; ++k, --n)
     {
       T2h += n*(n-1)*(sortbuffer[k] - sortbuffer[k-1])/heredity;
     }
@@ -2027,33 +2366,35 @@ double gtree_update_logprob_contrib(snode_t * snode,
     if (opt_msci && snode->hybrid)
     {
       if (node_is_bidirection(snode) && !node_is_mirror(snode))
-        logpr += (snode->seqin_count[msa_index] - snode->right->seqin_count[msa_index]) * log(snode->hphi);
+        logpr += (SNODE_LOCUS(snode,msa_index)->seqin_count -
+                  SNODE_LOCUS(snode->right,msa_index)->seqin_count) *
+                 log(snode->hphi);
       else
-        logpr += snode->seqin_count[msa_index] * log(snode->hphi);
+        logpr += SNODE_LOCUS(snode,msa_index)->seqin_count * log(snode->hphi);
     }
 
     /* now distinguish between estimating theta and analytical computation */
     if (opt_est_theta)
     {
-      if (snode->event_count[msa_index])
-        logpr += snode->event_count[msa_index] * log(2.0/snode->theta);
+      if (SNODE_LOCUS(snode,msa_index)->event_count)
+        logpr += SNODE_LOCUS(snode,msa_index)->event_count * log(2.0/snode->theta);
 
       if (T2h)
         logpr -= T2h/snode->theta;
 
       /* TODO: Be careful about which functions update the logpr contribution 
          and which do not */
-      snode->old_logpr_contrib[msa_index] = snode->logpr_contrib[msa_index];
-      snode->logpr_contrib[msa_index] = logpr;
+      SNODE_LOCUS(snode,msa_index)->old_logpr_contrib = SNODE_LOCUS(snode,msa_index)->logpr_contrib;
+      SNODE_LOCUS(snode,msa_index)->logpr_contrib = logpr;
     }
     else
     {
-      snode->old_t2h[msa_index] = snode->t2h[msa_index];
+      SNODE_LOCUS(snode,msa_index)->old_t2h = SNODE_LOCUS(snode,msa_index)->t2h;
 
-      snode->t2h[msa_index] = T2h;
+      SNODE_LOCUS(snode,msa_index)->t2h = T2h;
 
-      snode->t2h_sum -= snode->old_t2h[msa_index];
-      snode->t2h_sum += snode->t2h[msa_index];
+      snode->t2h_sum -= SNODE_LOCUS(snode,msa_index)->old_t2h;
+      snode->t2h_sum += SNODE_LOCUS(snode,msa_index)->t2h;
       
 
       if (snode->event_count_sum)
@@ -2143,13 +2484,13 @@ void unlink_event(gnode_t * node, int msa_index)
   if (node->event->prev)
     node->event->prev->next = node->event->next;
   else
-    node->pop->event[msa_index]->head = node->event->next;
+    SNODE_LOCUS(node->pop,msa_index)->event->head = node->event->next;
 
   /* now re-link the event after the current node with the one before */
   if (node->event->next)
     node->event->next->prev = node->event->prev;
   else
-    node->pop->event[msa_index]->tail = node->event->prev;
+    SNODE_LOCUS(node->pop,msa_index)->event->tail = node->event->prev;
 }
 
 static void interchange_flags(stree_t * stree,
@@ -2557,7 +2898,7 @@ static void decrease_gene_leaves_count(stree_t * stree, gnode_t * x, int msa_ind
       if (x->hpath[hindex] == BPP_HPATH_RIGHT)
         start = start->hybrid;
     }
-    start->gene_leaves[msa_index] -= leaves_count;
+    SNODE_LOCUS(start,msa_index)->gene_leaves -= leaves_count;
   }
 }
 
@@ -2595,7 +2936,7 @@ static void increase_gene_leaves_count(stree_t * stree, gnode_t * x, int msa_ind
         start = start->hybrid;
     }
 
-    start->gene_leaves[msa_index] += leaves_count;
+    SNODE_LOCUS(start,msa_index)->gene_leaves += leaves_count;
   }
 }
 
@@ -2632,7 +2973,7 @@ static void decrease_seqin_count(stree_t * stree, gnode_t * x, int msa_index)
       if (x->hpath[hindex] == BPP_HPATH_RIGHT)
         start = start->hybrid;
     }
-    start->seqin_count[msa_index]--;
+    SNODE_LOCUS(start,msa_index)->seqin_count--;
   }
 }
 
@@ -2664,7 +3005,7 @@ static void increase_seqin_count(stree_t * stree, gnode_t * x, int msa_index)
         start = start->hybrid;
     }
 
-    start->seqin_count[msa_index]++;
+    SNODE_LOCUS(start,msa_index)->seqin_count++;
   }
 }
 
@@ -2731,8 +3072,8 @@ static long propose_ages(locus_t * locus,
          for which populations we need to recompute the MSC density */
       for (j = 0; j < stree_total_nodes; ++j)
       {
-        stree->nodes[j]->hx[thread_index] = stree->nodes[j]->event_count[msa_index] +
-                                            stree->nodes[j]->seqin_count[msa_index];
+        SNODE_HX(stree->nodes[j],thread_index) = SNODE_LOCUS(stree->nodes[j],msa_index)->event_count +
+                                            SNODE_LOCUS(stree->nodes[j],msa_index)->seqin_count;
       }
 
       /* TODO: The following loop corrects for bidirectional nodes */
@@ -2742,8 +3083,8 @@ static long propose_ages(locus_t * locus,
 
         if (node_is_bidirection(snode))
         {
-          assert(snode->event_count[msa_index] == 0);
-          snode->parent->hx[thread_index] -= snode->seqin_count[msa_index];
+          assert(SNODE_LOCUS(snode,msa_index)->event_count == 0);
+          SNODE_HX(snode->parent,thread_index) -= SNODE_LOCUS(snode,msa_index)->seqin_count;
         }
       }
       hphi_contrib = 0;
@@ -2900,7 +3241,7 @@ static long propose_ages(locus_t * locus,
       unlink_event(node,msa_index);
 
       /* decrease the number of coalescent events for the current population */
-      node->pop->event_count[msa_index]--;
+      SNODE_LOCUS(node->pop,msa_index)->event_count--;
       if (!opt_est_theta)
         node->pop->event_count_sum--;
         
@@ -2908,9 +3249,9 @@ static long propose_ages(locus_t * locus,
       node->pop = pop;
 
       /* now add the coalescent event to the new population, at the end */
-      dlist_item_append(node->pop->event[msa_index],node->event);
+      dlist_item_append(SNODE_LOCUS(node->pop,msa_index)->event,node->event);
 
-      node->pop->event_count[msa_index]++;
+      SNODE_LOCUS(node->pop,msa_index)->event_count++;
       if (!opt_est_theta)
         node->pop->event_count_sum++;
 
@@ -2923,7 +3264,7 @@ static long propose_ages(locus_t * locus,
         if (!opt_msci)
         {
           for (pop = oldpop; pop != node->pop; pop = pop->parent)
-            pop->parent->seqin_count[msa_index]++;
+            SNODE_LOCUS(pop->parent,msa_index)->seqin_count++;
         }
       }
       else  /* tnew < oldage */
@@ -2933,7 +3274,7 @@ static long propose_ages(locus_t * locus,
         if (!opt_msci)
         {
           for (pop = node->pop; pop != oldpop; pop = pop->parent)
-            pop->parent->seqin_count[msa_index]--;
+            SNODE_LOCUS(pop->parent,msa_index)->seqin_count--;
         }
       }
     }
@@ -2963,7 +3304,7 @@ static long propose_ages(locus_t * locus,
       increase_gene_leaves_count(stree,node->left,msa_index);
       increase_gene_leaves_count(stree,node->right,msa_index);
 
-      node->pop->hx[thread_index] = -1;
+      SNODE_HX(node->pop,thread_index) = -1;
     }
 
     /* quick recomputation  of logpr */
@@ -2986,7 +3327,7 @@ static long propose_ages(locus_t * locus,
       if (!opt_msci)
       {
         if (opt_est_theta)
-          logpr -= node->pop->logpr_contrib[msa_index];
+          logpr -= SNODE_LOCUS(node->pop,msa_index)->logpr_contrib;
         else
           logpr -= node->pop->notheta_logpr_contrib;
 
@@ -3005,18 +3346,19 @@ static long propose_ages(locus_t * locus,
           snode_t * x = stree->nodes[stree->tip_count+stree->inner_count+j];
 
           /* correct for bidirectional introgression non-mirror nodes */
-          if (node_is_bidirection(x) && x->parent->hx[thread_index] != -1)
-              x->parent->hx[thread_index] += x->seqin_count[msa_index];
+          if (node_is_bidirection(x) && SNODE_HX(x->parent,thread_index) != -1)
+              SNODE_HX(x->parent,thread_index) += SNODE_LOCUS(x,msa_index)->seqin_count;
 
-          if (x->seqin_count[msa_index] + x->event_count[msa_index] == x->hx[thread_index])
+          if (SNODE_LOCUS(x,msa_index)->seqin_count +
+              SNODE_LOCUS(x,msa_index)->event_count == SNODE_HX(x,thread_index))
           {
-            x->hx[thread_index] = 0;  /* MSC density is not changed */
+            SNODE_HX(x,thread_index) = 0;  /* MSC density is not changed */
           }
           else
           {
-            x->hx[thread_index] = 1;  /* MSC density has changed */
+            SNODE_HX(x,thread_index) = 1;  /* MSC density has changed */
             if (opt_est_theta)
-              logpr -= x->logpr_contrib[msa_index];
+              logpr -= SNODE_LOCUS(x,msa_index)->logpr_contrib;
             else
               logpr -= x->notheta_logpr_contrib;
 
@@ -3026,21 +3368,22 @@ static long propose_ages(locus_t * locus,
                                                   thread_index);
             /* correct for bidirectional introgression non-mirror nodes */
             if (node_is_bidirection(x))
-                x->parent->hx[thread_index] = -1;
+                SNODE_HX(x->parent,thread_index) = -1;
           }
         }
         for (j = 0; j < stree->tip_count + stree->inner_count; ++j)
         {
           snode_t * x = stree->nodes[j];
-          if (x->seqin_count[msa_index] + x->event_count[msa_index] == x->hx[thread_index])
+          if (SNODE_LOCUS(x,msa_index)->seqin_count +
+              SNODE_LOCUS(x,msa_index)->event_count == SNODE_HX(x,thread_index))
           {
-            x->hx[thread_index] = 0;  /* MSC density is not changed */
+            SNODE_HX(x,thread_index) = 0;  /* MSC density is not changed */
           }
           else
           {
-            x->hx[thread_index] = 1;  /* MSC density has changed */
+            SNODE_HX(x,thread_index) = 1;  /* MSC density has changed */
             if (opt_est_theta)
-              logpr -= x->logpr_contrib[msa_index];
+              logpr -= SNODE_LOCUS(x,msa_index)->logpr_contrib;
             else
               logpr -= x->notheta_logpr_contrib;
 
@@ -3078,18 +3421,19 @@ static long propose_ages(locus_t * locus,
           snode_t * x = stree->nodes[stree->tip_count+stree->inner_count+j];
 
           /* correct for bidirectional introgression non-mirror nodes */
-          if (node_is_bidirection(x) && x->parent->hx[thread_index] != -1)
-              x->parent->hx[thread_index] += x->seqin_count[msa_index];
+          if (node_is_bidirection(x) && SNODE_HX(x->parent,thread_index) != -1)
+              SNODE_HX(x->parent,thread_index) += SNODE_LOCUS(x,msa_index)->seqin_count;
 
-          if (x->seqin_count[msa_index] + x->event_count[msa_index] == x->hx[thread_index])
+          if (SNODE_LOCUS(x,msa_index)->seqin_count +
+              SNODE_LOCUS(x,msa_index)->event_count == SNODE_HX(x,thread_index))
           {
-            x->hx[thread_index] = 0;  /* MSC density is not changed */
+            SNODE_HX(x,thread_index) = 0;  /* MSC density is not changed */
           }
           else
           {
-            x->hx[thread_index] = 1;  /* MSC density has changed */
+            SNODE_HX(x,thread_index) = 1;  /* MSC density has changed */
             if (opt_est_theta)
-              logpr -= x->logpr_contrib[msa_index];
+              logpr -= SNODE_LOCUS(x,msa_index)->logpr_contrib;
             else
               logpr -= x->notheta_logpr_contrib;
 
@@ -3099,21 +3443,22 @@ static long propose_ages(locus_t * locus,
                                                   thread_index);
             /* correct for bidirectional introgression non-mirror nodes */
             if (node_is_bidirection(x))
-                x->parent->hx[thread_index] = -1;
+                SNODE_HX(x->parent,thread_index) = -1;
           }
         }
         for (j = 0; j < stree->tip_count+stree->inner_count; ++j)
         {
           snode_t * x = stree->nodes[j];
-          if (x->seqin_count[msa_index] + x->event_count[msa_index] == x->hx[thread_index])
+          if (SNODE_LOCUS(x,msa_index)->seqin_count +
+              SNODE_LOCUS(x,msa_index)->event_count == SNODE_HX(x,thread_index))
           {
-            x->hx[thread_index] = 0;  /* MSC density is not changed */
+            SNODE_HX(x,thread_index) = 0;  /* MSC density is not changed */
           }
           else
           {
-            x->hx[thread_index] = 1;  /* MSC density has changed */
+            SNODE_HX(x,thread_index) = 1;  /* MSC density has changed */
             if (opt_est_theta)
-              logpr -= x->logpr_contrib[msa_index];
+              logpr -= SNODE_LOCUS(x,msa_index)->logpr_contrib;
             else
               logpr -= x->notheta_logpr_contrib;
 
@@ -3129,7 +3474,7 @@ static long propose_ages(locus_t * locus,
         for (pop = start; pop != end; pop = pop->parent)
         {
           if (opt_est_theta)
-            logpr -= pop->logpr_contrib[msa_index];
+            logpr -= SNODE_LOCUS(pop,msa_index)->logpr_contrib;
           else
             logpr -= pop->notheta_logpr_contrib;
 
@@ -3275,10 +3620,11 @@ static long propose_ages(locus_t * locus,
           for (j = 0; j < stree_total_nodes; ++j)
           {
             snode_t * x = stree->nodes[j];
-            if (x->hx[thread_index])
+            if (SNODE_HX(x,thread_index))
             {
               if (opt_est_theta)
-                x->logpr_contrib[msa_index] = x->old_logpr_contrib[msa_index];
+                SNODE_LOCUS(x,msa_index)->logpr_contrib =
+                  SNODE_LOCUS(x,msa_index)->old_logpr_contrib;
               else
                 logprob_revert_notheta(x,msa_index);
             }
@@ -3287,7 +3633,8 @@ static long propose_ages(locus_t * locus,
         else
         {
           if (opt_est_theta)
-            node->pop->logpr_contrib[msa_index] = node->pop->old_logpr_contrib[msa_index];
+            SNODE_LOCUS(node->pop,msa_index)->logpr_contrib =
+              SNODE_LOCUS(node->pop,msa_index)->old_logpr_contrib;
           else
             logprob_revert_notheta(node->pop,msa_index);
         }
@@ -3300,7 +3647,7 @@ static long propose_ages(locus_t * locus,
         unlink_event(node,msa_index);
 
         /* decrease the number of coalescent events for the current population */
-        node->pop->event_count[msa_index]--;
+        SNODE_LOCUS(node->pop,msa_index)->event_count--;
         if (!opt_est_theta)
           node->pop->event_count_sum--;
 
@@ -3324,9 +3671,9 @@ static long propose_ages(locus_t * locus,
         }
 
         /* now add the coalescent event back to the old population, at the end */
-        dlist_item_append(node->pop->event[msa_index],node->event);
+        dlist_item_append(SNODE_LOCUS(node->pop,msa_index)->event,node->event);
 
-        node->pop->event_count[msa_index]++;
+        SNODE_LOCUS(node->pop,msa_index)->event_count++;
         if (!opt_est_theta)
           node->pop->event_count_sum++;
 
@@ -3344,7 +3691,7 @@ static long propose_ages(locus_t * locus,
                population, and node->pop is the old population, and so the for
                loop below is correct */
             for (pop=oldpop; pop != node->pop; pop = pop->parent)
-              pop->parent->seqin_count[msa_index]++;
+              SNODE_LOCUS(pop->parent,msa_index)->seqin_count++;
           }
         }
         else  /* tnew > oldage */
@@ -3354,7 +3701,7 @@ static long propose_ages(locus_t * locus,
           if (!opt_msci)
           {
             for (pop = node->pop; pop != oldpop; pop = pop->parent)
-              pop->parent->seqin_count[msa_index]--;
+              SNODE_LOCUS(pop->parent,msa_index)->seqin_count--;
           }
         }
 
@@ -3369,10 +3716,11 @@ static long propose_ages(locus_t * locus,
           for (j = 0; j < stree_total_nodes; ++j)
           {
             snode_t * x = stree->nodes[j];
-            if (x->hx[thread_index])
+            if (SNODE_HX(x,thread_index))
             {
               if (opt_est_theta)
-                x->logpr_contrib[msa_index] = x->old_logpr_contrib[msa_index];
+                SNODE_LOCUS(x,msa_index)->logpr_contrib =
+                  SNODE_LOCUS(x,msa_index)->old_logpr_contrib;
               else
                 logprob_revert_notheta(x,msa_index);
             }
@@ -3383,7 +3731,8 @@ static long propose_ages(locus_t * locus,
           for (pop = start; pop != end; pop = pop->parent)
           {
             if (opt_est_theta)
-              pop->logpr_contrib[msa_index] = pop->old_logpr_contrib[msa_index];
+              SNODE_LOCUS(pop,msa_index)->logpr_contrib =
+                SNODE_LOCUS(pop,msa_index)->old_logpr_contrib;
             else
               logprob_revert_notheta(pop,msa_index);
           }
@@ -3440,7 +3789,9 @@ double gtree_propose_ages_serial(locus_t ** locus,
     #ifdef DEBUG_THREADS
     accepted += propose_ages(locus[i],gtree[i],stree,i,indices[i]);
     #else
+    rng_locus_begin(0,i,THREAD_WORK_GTAGE);
     accepted += propose_ages(locus[i],gtree[i],stree,i,0);
+    rng_locus_end(0);
     #endif
   }
 
@@ -3474,7 +3825,9 @@ void gtree_propose_ages_parallel(locus_t ** locus,
   {
     /* TODO: Fix this to account mcmc.moveinnode in original bpp */
     proposal_count += gtree[i]->inner_count;
+    rng_locus_begin(thread_index,i,THREAD_WORK_GTAGE);
     accepted += propose_ages(locus[i],gtree[i],stree,i,thread_index);
+    rng_locus_end(thread_index);
   }
 
   *p_proposal_count = proposal_count;
@@ -3626,26 +3979,7 @@ void gtree_fini(int msa_count)
 
   /* free all module memory allocations */
 
-  #ifdef DEBUG_THREADS
-  if (opt_threads == 1)
-  {
-    opt_threads = DEBUG_THREADS_COUNT;
-    for (i = 0; i < opt_threads; ++i)
-      free(sortbuffer_r[i]);
-    free(sortbuffer_r);
-    opt_threads = 1;
-  }
-  else
-  {
-    for (i = 0; i < opt_threads; ++i)
-      free(sortbuffer_r[i]);
-    free(sortbuffer_r);
-  }
-  #else
-  for (i = 0; i < opt_threads; ++i)
-    free(sortbuffer_r[i]);
-  free(sortbuffer_r);
-  #endif
+  threads_scratch_free();
 
   for (i = 0; i < msa_count; ++i)
     free(travbuffer[i]);
@@ -3726,7 +4060,7 @@ static gnode_t * network_fill_targets(stree_t * stree,
   /* make sure no species tree node is 'marked' */
   snodes_count = stree->tip_count + stree->inner_count + stree->hybrid_count;
   for (j = 0; j < snodes_count; ++j)
-    assert(stree->nodes[j]->mark[thread_index] == 0);
+    assert(SNODE_MARK(stree->nodes[j],thread_index) == 0);
 
   /* mark all species tree nodes nodes ancestor to curnode population, and with
      branches that include tnew. */
@@ -3735,16 +4069,16 @@ static gnode_t * network_fill_targets(stree_t * stree,
     snode_t * x = stree->nodes[j];
 
     if (stree->pptable[curnode->pop->node_index][x->node_index] &&
-        //x->gene_leaves[msa_index] > curnode->leaves &&
+        //SNODE_LOCUS(x,msa_index)->gene_leaves > curnode->leaves &&
         (x->tau <= tnew) && (x->parent && x->parent->tau > tnew))
     {
-      x->mark[thread_index] = 1;
+      SNODE_MARK(x,thread_index) = 1;
       ptarget_count++;
     }
   }
   if (stree->root->tau <= tnew)
   {
-    stree->root->mark[thread_index] = 1;
+    SNODE_MARK(stree->root,thread_index) = 1;
     ptarget_count++;
   }
 
@@ -3752,9 +4086,9 @@ static gnode_t * network_fill_targets(stree_t * stree,
   ptarget_list = (snode_t **)xmalloc((size_t)ptarget_count*sizeof(snode_t *));
   for (k = 0, j = 0; j < snodes_count; ++j)
   {
-    if (stree->nodes[j]->mark[thread_index])
+    if (SNODE_MARK(stree->nodes[j],thread_index))
     {
-      stree->nodes[j]->mark[thread_index] = 0;
+      SNODE_MARK(stree->nodes[j],thread_index) = 0;
       ptarget_list[k++] = stree->nodes[j];
     }
   }
@@ -3942,22 +4276,26 @@ static gnode_t * network_fill_targets(stree_t * stree,
   return target;
 }
 
-/* Fisher-Yates shuffle */
+#define SHUFFLE_BATCH 64
+
+/* Fisher-Yates shuffle. Uniform variates are drawn in batches, in the same
+   order as one draw per element, including the last (redundant) draw for
+   x[0], such that the generator ends in the same state */
 static void shuffle(unsigned int * x, unsigned int n, long thread_index)
 {
-  unsigned int i,j;
+  unsigned int i,j,k,m;
+  double r[SHUFFLE_BATCH];
 
-  if (n > 1)
+  if (n < 2) return;
+
+  for (i = n; i > 0; i -= m)
   {
-    i = n-1;
-    while (1)
+    m = MIN(i,SHUFFLE_BATCH);
+    rndu_fill(thread_index, r, m);
+    for (k = 0; k < m; ++k)
     {
-      double r = legacy_rndu(thread_index);
-      j = (unsigned int)(r*(i+1));
-      SWAP(x[i],x[j]);
-
-      if (i == 0) break;
-      --i;
+      j = (unsigned int)(r[k]*(i-k));
+      SWAP(x[i-k-1],x[j]);
     }
   }
 }
@@ -4044,8 +4382,8 @@ static long propose_spr(locus_t * locus,
          for which populations we need to recompute the MSC density */
       for (j = 0; j < stree_total_nodes; ++j)
       {
-        stree->nodes[j]->hx[thread_index] = stree->nodes[j]->event_count[msa_index] +
-                                            stree->nodes[j]->seqin_count[msa_index];
+        SNODE_HX(stree->nodes[j],thread_index) = SNODE_LOCUS(stree->nodes[j],msa_index)->event_count +
+                                            SNODE_LOCUS(stree->nodes[j],msa_index)->seqin_count;
       }
       /* TODO: The following loop corrects for bidirectional nodes */
       for (j = 0; j < stree->hybrid_count; ++j)
@@ -4054,8 +4392,8 @@ static long propose_spr(locus_t * locus,
 
         if (node_is_bidirection(snode))
         {
-          assert(snode->event_count[msa_index] == 0);
-          snode->parent->hx[thread_index] -= snode->seqin_count[msa_index];
+          assert(SNODE_LOCUS(snode,msa_index)->event_count == 0);
+          SNODE_HX(snode->parent,thread_index) -= SNODE_LOCUS(snode,msa_index)->seqin_count;
         }
       }
       hphi_contrib = 0;
@@ -4068,22 +4406,22 @@ static long propose_spr(locus_t * locus,
       pop = stree->root;
 
       decrease_gene_leaves_count(stree,curnode,msa_index);
-      curnode->pop->gene_leaves[msa_index] -= curnode->leaves;
+      SNODE_LOCUS(curnode->pop,msa_index)->gene_leaves -= curnode->leaves;
 
       for (j = 0; j < stree_total_nodes; ++j)
       {
         snode_t * x = stree->nodes[j];
 
         if (stree->pptable[curnode->pop->node_index][x->node_index] &&
-           (x->gene_leaves[msa_index] > 0) && (x->tau < pop->tau))
+           (SNODE_LOCUS(x,msa_index)->gene_leaves > 0) && (x->tau < pop->tau))
           pop = x;
       }
-      curnode->pop->gene_leaves[msa_index] += curnode->leaves;
+      SNODE_LOCUS(curnode->pop,msa_index)->gene_leaves += curnode->leaves;
     }
     else
     {
       for (pop = curnode->pop;
-           pop->gene_leaves[msa_index] <= curnode->leaves; 
+           SNODE_LOCUS(pop,msa_index)->gene_leaves <= curnode->leaves; 
            pop = pop->parent)
         if (!pop->parent)
           break;
@@ -4288,7 +4626,7 @@ static long propose_spr(locus_t * locus,
       unlink_event(father,msa_index);
 
       /* decrease the number of coalescent events for the current population */
-      father->pop->event_count[msa_index]--;
+      SNODE_LOCUS(father->pop,msa_index)->event_count--;
       if (!opt_est_theta)
         father->pop->event_count_sum--;
         
@@ -4296,9 +4634,9 @@ static long propose_spr(locus_t * locus,
       father->pop = pop_target;
 
       /* now add the coalescent event to the new population, at the end */
-      dlist_item_append(father->pop->event[msa_index],father->event);
+      dlist_item_append(SNODE_LOCUS(father->pop,msa_index)->event,father->event);
 
-      father->pop->event_count[msa_index]++;
+      SNODE_LOCUS(father->pop,msa_index)->event_count++;
       if (!opt_est_theta)
         father->pop->event_count_sum++;
 
@@ -4312,7 +4650,7 @@ static long propose_spr(locus_t * locus,
         if (!opt_msci)
         {
           for (pop = oldpop; pop != father->pop; pop = pop->parent)
-            pop->parent->seqin_count[msa_index]++;
+            SNODE_LOCUS(pop->parent,msa_index)->seqin_count++;
         }
       }
       else
@@ -4322,7 +4660,7 @@ static long propose_spr(locus_t * locus,
         if (!opt_msci)
         {
           for (pop = father->pop; pop != oldpop; pop = pop->parent)
-            pop->parent->seqin_count[msa_index]--;
+            SNODE_LOCUS(pop->parent,msa_index)->seqin_count--;
         }
       }
     }
@@ -4403,7 +4741,7 @@ static long propose_spr(locus_t * locus,
       increase_gene_leaves_count(stree, curnode, msa_index);
 
       /* indicate we want to recompute the MSC density for this population */
-      father->pop->hx[thread_index] = -1;
+      SNODE_HX(father->pop,thread_index) = -1;
     }
 
     /* recompute logpr */
@@ -4424,18 +4762,19 @@ static long propose_spr(locus_t * locus,
           snode_t * x = stree->nodes[stree->tip_count+stree->inner_count+j];
 
           /* correct for bidirectional introgression non-mirror nodes */
-          if (node_is_bidirection(x) && x->parent->hx[thread_index] != -1)
-              x->parent->hx[thread_index] += x->seqin_count[msa_index];
+          if (node_is_bidirection(x) && SNODE_HX(x->parent,thread_index) != -1)
+              SNODE_HX(x->parent,thread_index) += SNODE_LOCUS(x,msa_index)->seqin_count;
 
-          if (x->seqin_count[msa_index] + x->event_count[msa_index] == x->hx[thread_index])
+          if (SNODE_LOCUS(x,msa_index)->seqin_count +
+              SNODE_LOCUS(x,msa_index)->event_count == SNODE_HX(x,thread_index))
           {
-            x->hx[thread_index] = 0;  /* MSC density is not changed */
+            SNODE_HX(x,thread_index) = 0;  /* MSC density is not changed */
           }
           else
           {
-            x->hx[thread_index] = 1;  /* MSC density has changed */
+            SNODE_HX(x,thread_index) = 1;  /* MSC density has changed */
             if (opt_est_theta)
-              logpr -= x->logpr_contrib[msa_index];
+              logpr -= SNODE_LOCUS(x,msa_index)->logpr_contrib;
             else
               logpr -= x->notheta_logpr_contrib;
 
@@ -4445,21 +4784,22 @@ static long propose_spr(locus_t * locus,
                                                   thread_index);
             /* correct for bidirectional introgression non-mirror nodes */
             if (node_is_bidirection(x))
-                x->parent->hx[thread_index] = -1;
+                SNODE_HX(x->parent,thread_index) = -1;
           }
         }
         for (j = 0; j < stree->tip_count+stree->inner_count; ++j)
         {
           snode_t * x = stree->nodes[j];
-          if (x->seqin_count[msa_index] + x->event_count[msa_index] == x->hx[thread_index])
+          if (SNODE_LOCUS(x,msa_index)->seqin_count +
+              SNODE_LOCUS(x,msa_index)->event_count == SNODE_HX(x,thread_index))
           {
-            x->hx[thread_index] = 0;  /* MSC density is not changed */
+            SNODE_HX(x,thread_index) = 0;  /* MSC density is not changed */
           }
           else
           {
-            x->hx[thread_index] = 1;  /* MSC density has changed */
+            SNODE_HX(x,thread_index) = 1;  /* MSC density has changed */
             if (opt_est_theta)
-              logpr -= x->logpr_contrib[msa_index];
+              logpr -= SNODE_LOCUS(x,msa_index)->logpr_contrib;
             else
               logpr -= x->notheta_logpr_contrib;
 
@@ -4473,7 +4813,7 @@ static long propose_spr(locus_t * locus,
       else
       {
         if (opt_est_theta)
-          logpr -= father->pop->logpr_contrib[msa_index];
+          logpr -= SNODE_LOCUS(father->pop,msa_index)->logpr_contrib;
         else
           logpr -= father->pop->notheta_logpr_contrib;
 
@@ -4511,18 +4851,19 @@ static long propose_spr(locus_t * locus,
           snode_t * x = stree->nodes[stree->tip_count+stree->inner_count+j];
 
           /* correct for bidirectional introgression non-mirror nodes */
-          if (node_is_bidirection(x) && x->parent->hx[thread_index] != -1)
-              x->parent->hx[thread_index] += x->seqin_count[msa_index];
+          if (node_is_bidirection(x) && SNODE_HX(x->parent,thread_index) != -1)
+              SNODE_HX(x->parent,thread_index) += SNODE_LOCUS(x,msa_index)->seqin_count;
 
-          if (x->seqin_count[msa_index] + x->event_count[msa_index] == x->hx[thread_index])
+          if (SNODE_LOCUS(x,msa_index)->seqin_count +
+              SNODE_LOCUS(x,msa_index)->event_count == SNODE_HX(x,thread_index))
           {
-            x->hx[thread_index] = 0;  /* MSC density is not changed */
+            SNODE_HX(x,thread_index) = 0;  /* MSC density is not changed */
           }
           else
           {
-            x->hx[thread_index] = 1;  /* MSC density has changed */
+            SNODE_HX(x,thread_index) = 1;  /* MSC density has changed */
             if (opt_est_theta)
-              logpr -= x->logpr_contrib[msa_index];
+              logpr -= SNODE_LOCUS(x,msa_index)->logpr_contrib;
             else
               logpr -= x->notheta_logpr_contrib;
 
@@ -4532,21 +4873,22 @@ static long propose_spr(locus_t * locus,
                                                   thread_index);
             /* correct for bidirectional introgression non-mirror nodes */
             if (node_is_bidirection(x))
-                x->parent->hx[thread_index] = -1;
+                SNODE_HX(x->parent,thread_index) = -1;
           }
         }
         for (j = 0; j < stree->tip_count+stree->inner_count; ++j)
         {
           snode_t * x = stree->nodes[j];
-          if (x->seqin_count[msa_index] + x->event_count[msa_index] == x->hx[thread_index])
+          if (SNODE_LOCUS(x,msa_index)->seqin_count +
+              SNODE_LOCUS(x,msa_index)->event_count == SNODE_HX(x,thread_index))
           {
-            x->hx[thread_index] = 0;  /* MSC density is not changed */
+            SNODE_HX(x,thread_index) = 0;  /* MSC density is not changed */
           }
           else
           {
-            x->hx[thread_index] = 1;  /* MSC density has changed */
+            SNODE_HX(x,thread_index) = 1;  /* MSC density has changed */
             if (opt_est_theta)
-              logpr -= x->logpr_contrib[msa_index];
+              logpr -= SNODE_LOCUS(x,msa_index)->logpr_contrib;
             else
               logpr -= x->notheta_logpr_contrib;
 
@@ -4562,7 +4904,7 @@ static long propose_spr(locus_t * locus,
         for (pop = start; pop != end; pop = pop->parent)
         {
           if (opt_est_theta)
-            logpr -= pop->logpr_contrib[msa_index];
+            logpr -= SNODE_LOCUS(pop,msa_index)->logpr_contrib;
           else
             logpr -= pop->notheta_logpr_contrib;
 
@@ -4800,10 +5142,11 @@ static long propose_spr(locus_t * locus,
           for (j = 0; j < stree_total_nodes; ++j)
           {
             snode_t * x = stree->nodes[j];
-            if (x->hx[thread_index])
+            if (SNODE_HX(x,thread_index))
             {
               if (opt_est_theta)
-                x->logpr_contrib[msa_index] = x->old_logpr_contrib[msa_index];
+                SNODE_LOCUS(x,msa_index)->logpr_contrib =
+                  SNODE_LOCUS(x,msa_index)->old_logpr_contrib;
               else
                 logprob_revert_notheta(x,msa_index);
             }
@@ -4812,13 +5155,14 @@ static long propose_spr(locus_t * locus,
         else
         {
           if (opt_est_theta)
-            father->pop->logpr_contrib[msa_index] = father->pop->old_logpr_contrib[msa_index];
+            SNODE_LOCUS(father->pop,msa_index)->logpr_contrib =
+              SNODE_LOCUS(father->pop,msa_index)->old_logpr_contrib;
           else
           {
             /* TODO: The below code is the same as calling logprob_revert_notheta(father->pop,msa_index) */
-            father->pop->t2h_sum -= father->pop->t2h[msa_index];
-            father->pop->t2h[msa_index] = father->pop->old_t2h[msa_index];
-            father->pop->t2h_sum += father->pop->t2h[msa_index];
+            father->pop->t2h_sum -= SNODE_LOCUS(father->pop,msa_index)->t2h;
+            SNODE_LOCUS(father->pop,msa_index)->t2h = SNODE_LOCUS(father->pop,msa_index)->old_t2h;
+            father->pop->t2h_sum += SNODE_LOCUS(father->pop,msa_index)->t2h;
             father->pop->notheta_logpr_contrib= father->pop->notheta_old_logpr_contrib;
           }
         }
@@ -4831,7 +5175,7 @@ static long propose_spr(locus_t * locus,
         unlink_event(father,msa_index);
 
         /* decrease the number of coalescent events for the current population */
-        father->pop->event_count[msa_index]--;
+        SNODE_LOCUS(father->pop,msa_index)->event_count--;
         if (!opt_est_theta)
           father->pop->event_count_sum--;
           
@@ -4853,9 +5197,9 @@ static long propose_spr(locus_t * locus,
         }
 
         /* now add the coalescent event back to the old population, at the end */
-        dlist_item_append(father->pop->event[msa_index],father->event);
+        dlist_item_append(SNODE_LOCUS(father->pop,msa_index)->event,father->event);
 
-        father->pop->event_count[msa_index]++;
+        SNODE_LOCUS(father->pop,msa_index)->event_count++;
         if (!opt_est_theta)
           father->pop->event_count_sum++;
 
@@ -4870,7 +5214,7 @@ static long propose_spr(locus_t * locus,
           if (!opt_msci)
           {
             for (pop=oldpop; pop != father->pop; pop = pop->parent)
-              pop->parent->seqin_count[msa_index]++;
+              SNODE_LOCUS(pop->parent,msa_index)->seqin_count++;
           }
         }
         else
@@ -4880,7 +5224,7 @@ static long propose_spr(locus_t * locus,
           if (!opt_msci)
           {
             for (pop = father->pop; pop != oldpop; pop = pop->parent)
-              pop->parent->seqin_count[msa_index]--;
+              SNODE_LOCUS(pop->parent,msa_index)->seqin_count--;
           }
         }
 
@@ -4895,10 +5239,11 @@ static long propose_spr(locus_t * locus,
           for (j = 0; j < stree_total_nodes; ++j)
           {
             snode_t * x = stree->nodes[j];
-            if (x->hx[thread_index])
+            if (SNODE_HX(x,thread_index))
             {
               if (opt_est_theta)
-                x->logpr_contrib[msa_index] = x->old_logpr_contrib[msa_index];
+                SNODE_LOCUS(x,msa_index)->logpr_contrib =
+                  SNODE_LOCUS(x,msa_index)->old_logpr_contrib;
               else
                 logprob_revert_notheta(x,msa_index);
             }
@@ -4909,7 +5254,8 @@ static long propose_spr(locus_t * locus,
           for (pop = start; pop != end; pop = pop->parent)
           {
             if (opt_est_theta)
-              pop->logpr_contrib[msa_index] = pop->old_logpr_contrib[msa_index];
+              SNODE_LOCUS(pop,msa_index)->logpr_contrib =
+                SNODE_LOCUS(pop,msa_index)->old_logpr_contrib;
             else
               logprob_revert_notheta(pop,msa_index);
           }
@@ -4980,7 +5326,9 @@ double gtree_propose_spr_serial(locus_t ** locus,
     #ifdef DEBUG_THREADS
     accepted += propose_spr(locus[i],gtree[i],stree,i,indices[i]);
     #else
+    rng_locus_begin(0,i,THREAD_WORK_GTSPR);
     accepted += propose_spr(locus[i],gtree[i],stree,i,0);
+    rng_locus_end(0);
     #endif
   }
 
@@ -5014,7 +5362,9 @@ void gtree_propose_spr_parallel(locus_t ** locus,
   {
     /* TODO: Fix this to account mcmc.moveinnode in original bpp */
     proposal_count += gtree[i]->edge_count;
+    rng_locus_begin(thread_index,i,THREAD_WORK_GTSPR);
     accepted += propose_spr(locus[i],gtree[i],stree,i,thread_index);
+    rng_locus_end(thread_index);
   }
 
   *p_proposal_count = proposal_count;
@@ -5132,8 +5482,8 @@ static long prop_locusrate(gtree_t ** gtree,
 
       if (opt_clock == BPP_CLOCK_CORR)
       {
-        stree->root->brate[i] = new_locrate;
-        stree->root->brate[ref] = new_refrate;
+        SNODE_LOCUS(stree->root,i)->brate = new_locrate;
+        SNODE_LOCUS(stree->root,ref)->brate = new_refrate;
       }
       new_locprior = lnprior_rates(gtree[i],stree,i);
       new_refprior = lnprior_rates(gtree[ref],stree,ref);
@@ -5171,8 +5521,8 @@ static long prop_locusrate(gtree_t ** gtree,
 
       if (opt_clock == BPP_CLOCK_CORR)
       {
-        stree->root->brate[i] = old_locrate;
-        stree->root->brate[ref] = old_refrate;
+        SNODE_LOCUS(stree->root,i)->brate = old_locrate;
+        SNODE_LOCUS(stree->root,ref)->brate = old_refrate;
       }
 
       if (opt_clock == BPP_CLOCK_GLOBAL)
@@ -5302,7 +5652,8 @@ static long prop_heredity(gtree_t ** gtree,
       for (j = 0; j < stree->tip_count + stree->inner_count; ++j)
       {
         if (opt_est_theta)
-          stree->nodes[j]->logpr_contrib[i] = stree->nodes[j]->old_logpr_contrib[i];
+          SNODE_LOCUS(stree->nodes[j],i)->logpr_contrib =
+            SNODE_LOCUS(stree->nodes[j],i)->old_logpr_contrib;
         else
           logprob_revert_notheta(stree->nodes[j],i);
       }
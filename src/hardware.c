@@ -21,6 +21,10 @@
 
 #include "bpp.h"
 
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
 /*
     Apple machines should always default to assembly code due to
     inconsistent versioning in LLVM/clang, see issue #138
@@ -225,6 +229,208 @@ void cpu_setarch()
     fatal("Internal error when setting arch");
 }
 
+/* NUMA topology. On Linux the nodes and their cores are read from sysfs;
+   elsewhere, or if sysfs is not available, the machine is treated as a single
+   node holding all cores */
+
+#define NUMA_QUERY_BATCH 256
+
+static long numa_nodes = 1;
+static long numa_cpus = 0;
+static long * numa_cpu_node = NULL;
+
+/* cores taken one from each node in turn, see numa_spread_core() */
+static long numa_order_count = 0;
+static long * numa_order = NULL;
+
+#if defined(__linux__)
+static long numa_parse_cpulist(FILE * fp, long node)
+{
+  long a,b,i;
+  int c;
+
+  while (fscanf(fp, "%ld", &a) == 1)
+  {
+    b = a;
+    c = fgetc(fp);
+    if (c == '-')
+    {
+      if (fscanf(fp, "%ld", &b) != 1) return 0;
+      c = fgetc(fp);
+    }
+
+    for (i = a; i <= b; ++i)
+    {
+      if (i >= numa_cpus)
+      {
+        long j;
+        long newsize = i+1 > 2*numa_cpus ? i+1 : 2*numa_cpus;
+        numa_cpu_node = (long *)xrealloc(numa_cpu_node,
+                                         (size_t)newsize * sizeof(long));
+        for (j = numa_cpus; j < newsize; ++j)
+          numa_cpu_node[j] = -1;
+        numa_cpus = newsize;
+      }
+      numa_cpu_node[i] = node;
+    }
+
+    if (c != ',') break;
+  }
+  return 1;
+}
+#endif
+
+void numa_detect()
+{
+  #if defined(__linux__)
+  long node;
+  long found = 0;
+  char path[64];
+
+  if (numa_cpu_node) return;
+
+  /* node directories need not be contiguous (offline nodes) */
+  for (node = 0; node < 1024; ++node)
+  {
+    snprintf(path, 64, "/sys/devices/system/node/node%ld/cpulist", node);
+
+    FILE * fp = fopen(path, "r");
+    if (!fp) continue;
+
+    if (numa_parse_cpulist(fp, node))
+      found = node+1;
+    fclose(fp);
+  }
+
+  numa_nodes = found ? found : 1;
+
+  /* order in which cores are given to threads that are spread over the
+     nodes: the first core of each node, then the second core of each node,
+     and so on. Nodes with fewer cores are skipped once exhausted */
+  if (numa_cpus)
+  {
+    long k,c;
+    long added = 1;
+
+    numa_order = (long *)xmalloc((size_t)numa_cpus * sizeof(long));
+    for (k = 0; added; ++k)
+    {
+      added = 0;
+      for (node = 0; node < numa_nodes; ++node)
+      {
+        long skip = k;
+
+        for (c = 0; c < numa_cpus; ++c)
+          if (numa_cpu_node[c] == node && skip-- == 0)
+            break;
+
+        if (c < numa_cpus)
+        {
+          numa_order[numa_order_count++] = c;
+          added = 1;
+        }
+      }
+    }
+  }
+  #endif
+}
+
+long numa_node_count()
+{
+  return numa_nodes;
+}
+
+/* return the NUMA node of a core, or 0 if unknown */
+long numa_node_of_cpu(long cpu)
+{
+  if (cpu < 0 || cpu >= numa_cpus || numa_cpu_node[cpu] < 0) return 0;
+  return numa_cpu_node[cpu];
+}
+
+/* core for the t-th thread when threads are spread over the NUMA nodes, i.e.
+   thread t runs on node t mod nodes (if all nodes have enough cores). Returns
+   t if the topology is unknown or there are fewer cores than threads */
+long numa_spread_core(long t)
+{
+  if (t < 0 || t >= numa_order_count) return t;
+  return numa_order[t];
+}
+
+/* return the NUMA node of the core the calling thread runs on */
+long numa_node_current()
+{
+  #if defined(__linux__)
+  return numa_node_of_cpu(sched_getcpu());
+  #else
+  return 0;
+  #endif
+}
+
+/* size of a memory page, i.e. the granularity of NUMA placement */
+size_t numa_page_size()
+{
+  #if (defined(_WIN32) || defined(_WIN64))
+  return 4096;
+  #else
+  long pagesize = sysconf(_SC_PAGESIZE);
+
+  return pagesize > 0 ? (size_t)pagesize : 4096;
+  #endif
+}
+
+/* add the number of bytes of the range [addr, addr+size) that reside on each
+   NUMA node to node_bytes, which must have numa_node_count() entries. Pages
+   not yet mapped are not counted. Returns 0 if the placement cannot be
+   queried */
+long numa_placement(const void * addr, size_t size, double * node_bytes)
+{
+  #if defined(__linux__) && defined(SYS_move_pages)
+  void * pages[NUMA_QUERY_BATCH];
+  int status[NUMA_QUERY_BATCH];
+  uintptr_t pagesize = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t start = (uintptr_t)addr;
+  uintptr_t end = start + size;
+  uintptr_t p = start & ~(pagesize-1);
+  long i,n;
+
+  if (!size) return 1;
+
+  while (p < end)
+  {
+    for (n = 0; n < NUMA_QUERY_BATCH && p < end; ++n, p += pagesize)
+      pages[n] = (void *)p;
+
+    /* move_pages() without target nodes only reports the current placement */
+    if (syscall(SYS_move_pages, 0, (unsigned long)n, pages, NULL, status, 0))
+      return 0;
+
+    for (i = 0; i < n; ++i)
+    {
+      uintptr_t lo = (uintptr_t)pages[i] > start ? (uintptr_t)pages[i] : start;
+      uintptr_t hi = (uintptr_t)pages[i]+pagesize < end ?
+                       (uintptr_t)pages[i]+pagesize : end;
+
+      if (status[i] >= 0 && status[i] < numa_nodes)
+        node_bytes[status[i]] += (double)(hi - lo);
+    }
+  }
+  return 1;
+  #else
+  return 0;
+  #endif
+}
+
+void numa_fini()
+{
+  free(numa_cpu_node);
+  free(numa_order);
+  numa_cpu_node = NULL;
+  numa_order = NULL;
+  numa_cpus = 0;
+  numa_order_count = 0;
+  numa_nodes = 1;
+}
+
 #ifdef _MSC_VER
 int pll_ctz(unsigned int x)
 {
@@ -47,41 +47,20 @@ static void alloc_gtree()
   /* allocate gene tree structures */
   for (i = 0; i < opt_locus_count; ++i)
   {
-    gtree[i] = (gtree_t *)xmalloc(sizeof(gtree_t));
-    gtree_t * gt = gtree[i];
-
-    gt->tip_count = 0;
+    unsigned int tip_count = 0;
 
     /* get number of gene tree tips by looking in the number of incoming
        sequences in the species tree tip nodes */
     for (j = 0; j < stree->tip_count; ++j)
-      gt->tip_count += stree->nodes[j]->seqin_count[i];
-
-    gt->inner_count = gt->tip_count-1;
-    gt->edge_count = 2*gt->tip_count-2;
-    gt->root = NULL;
-
-    gt->nodes = (gnode_t **)xmalloc((size_t)(2*gt->tip_count-1) *
-                                    sizeof(gnode_t *));
-    
-    for (j = 0; j < gt->tip_count + gt->inner_count; ++j)
-    {
-      gt->nodes[j] = (gnode_t *)xmalloc(sizeof(gnode_t));
-
-      gt->nodes[j]->node_index = j;
+      tip_count += SNODE_LOCUS(stree->nodes[j],i)->seqin_count;
 
-      if (stree->hybrid_count)
-        gt->nodes[j]->hpath = (int *)xmalloc((size_t)(stree->hybrid_count) *
-                                             sizeof(int));
-      else
-        gt->nodes[j]->hpath = NULL;
-
-    }
+    gtree[i] = gtree_arena_alloc(tip_count, stree->hybrid_count);
   }
 }
 
 void load_chk_header(FILE * fp)
 {
+  long i;
   long version_major;
   long version_minor;
   long version_patch;
@@ -116,6 +95,10 @@ void load_chk_header(FILE * fp)
                   (buffer[14] << 16) |
                   (buffer[15] << 24);
 
+  if (version_chkp != VERSION_CHKP)
+    fatal("Incompatible checkpoint format %ld (expected %d)",
+          version_chkp, VERSION_CHKP);
+
   #if 0
   printf(" Magic: %c%c%c%c\n", magic[0],magic[1],magic[2],magic[3]);
   printf(" Version: %ld.%ld.%ld\n", version_major, version_minor, version_patch);
@@ -126,8 +109,9 @@ void load_chk_header(FILE * fp)
     fatal("File %s is not a BPP checkpoint file...", opt_resume);
 
   if ((version_major != VERSION_MAJOR) || (version_minor != VERSION_MINOR) || (version_patch != VERSION_PATCH))
-    fatal("Incompatible CHKP: Checkpoint file version %ld, BPP version %ld",
-          version_chkp, VERSION_CHKP);
+    fatal("Incompatible checkpoint: written by BPP %ld.%ld.%ld, this is "
+          "BPP %d.%d.%d", version_major, version_minor, version_patch,
+          VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH);
 
   if (!LOAD(buffer,3,fp))
     fatal("Cannot read data type sizes");
@@ -163,12 +147,17 @@ void load_chk_header(FILE * fp)
   if (opt_threads > 1)
     threads_pin_master();
 
-  
-  unsigned int * rng = (unsigned int *)xmalloc((size_t)opt_threads *
-                                               sizeof(unsigned int));
-  if (!LOAD(rng,opt_threads,fp))
-    fatal("Cannot read RNG states");
-  set_legacy_rndu_array(rng);
+  if (!LOAD(&opt_rng,1,fp))
+    fatal("Cannot read RNG type");
+
+  rng_alloc(opt_threads);
+  for (i = 0; i < opt_threads; ++i)
+  {
+    uint64_t rng[RNG_STATE_WORDS];
+    if (!LOAD(rng,RNG_STATE_WORDS,fp))
+      fatal("Cannot read RNG states");
+    rng_set_state(i,rng);
+  }
 
   if (!LOAD(&sections,1,fp))
     fatal("Cannot read number of sections");
@@ -722,6 +711,7 @@ static void load_chk_section_1(FILE * fp,
 
   /* populate species tree */
   stree = (stree_t *)xmalloc(sizeof(stree_t));
+  stree->locus_state = NULL;
   
   stree->tip_count = stree_tip_count;
   stree->inner_count = stree_inner_count;
@@ -758,46 +748,19 @@ static void load_chk_section_1(FILE * fp,
   }
 
   /* allocate coalescent events */
-  for (i = 0; i < total_nodes; ++i)
-  {
-    snode_t * node = stree->nodes[i];
-
-    node->event_count = (int *)xmalloc((size_t)opt_locus_count * sizeof(int));
-    node->seqin_count = (int *)xmalloc((size_t)opt_locus_count * sizeof(int));
-    node->gene_leaves = (unsigned int *)xmalloc((size_t)opt_locus_count *
-                                                sizeof(unsigned int));
-    node->logpr_contrib = (double *)xmalloc((size_t)opt_locus_count *
-                                            sizeof(double));
-    node->old_logpr_contrib = (double *)xmalloc((size_t)opt_locus_count *
-                                                sizeof(double));
-    node->event = (dlist_t **)xmalloc((size_t)opt_locus_count *
-                                      sizeof(dlist_t *));
-
-    node->t2h = NULL;
-    node->old_t2h = NULL;
-    if (!opt_est_theta)
-    {
-      node->t2h = (double *)xcalloc((size_t)opt_locus_count,sizeof(double));
-      node->old_t2h = (double *)xcalloc((size_t)opt_locus_count,sizeof(double));
-      node->t2h_sum = 0;
-      node->event_count_sum = 0;
-    }
-
-    node->brate = NULL;  /* will be allocated during reading */
-  }
-
-  /* allocate hx */
-  if (opt_msci)
+  stree_alloc_locus_state(stree, opt_locus_count);
+  if (!opt_est_theta)
   {
     for (i = 0; i < total_nodes; ++i)
     {
-      stree->nodes[i]->hx = (long *)xcalloc((size_t)opt_threads,sizeof(long));
+      stree->nodes[i]->t2h_sum = 0;
+      stree->nodes[i]->event_count_sum = 0;
     }
   }
 
-  /* allocate re-entrant marks */
+  /* allocate marks (per-thread marks and hx live in the thread scratch space) */
   for (i = 0; i < total_nodes; ++i)
-    stree->nodes[i]->mark = (int *)xcalloc((size_t)opt_threads,sizeof(int));
+    stree->nodes[i]->mark = (int *)xcalloc(1,sizeof(int));
 
   stree->pptable = (int**)xcalloc((size_t)total_nodes,sizeof(int *));
   for (i = 0; i < total_nodes; ++i)
@@ -999,7 +962,8 @@ void load_chk_section_2(FILE * fp)
 
   /* read number of coalescent events */
   for (i = 0; i < total_nodes; ++i)
-    if (!LOAD(stree->nodes[i]->event_count,opt_locus_count,fp))
+    for (j = 0; j < opt_locus_count; ++j)
+      if (!LOAD(&(SNODE_LOCUS(stree->nodes[i],j)->event_count),1,fp))
         fatal("Cannot read species event counts");
 
   /* read branch rates */
@@ -1015,9 +979,10 @@ void load_chk_section_2(FILE * fp)
       if (!valid) continue;
 
       snode_t * node = stree->nodes[i];
-      node->brate = (double *)xmalloc((size_t)opt_locus_count * sizeof(double));
-      if (!LOAD(node->brate,opt_locus_count,fp))
-        fatal("Cannot read branch rates");
+      node->has_brate = 1;
+      for (j = 0; j < opt_locus_count; ++j)
+        if (!LOAD(&(SNODE_LOCUS(node,j)->brate),1,fp))
+          fatal("Cannot read branch rates");
     }
   }
 
@@ -1041,8 +1006,9 @@ void load_chk_section_2(FILE * fp)
 
     for (i = 0; i < total_nodes; ++i)
     {
-      if (!LOAD(stree->nodes[i]->t2h,opt_locus_count,fp))
-        fatal("Cannot read per-locus t2h contributions");
+      for (j = 0; j < opt_locus_count; ++j)
+        if (!LOAD(&(SNODE_LOCUS(stree->nodes[i],j)->t2h),1,fp))
+          fatal("Cannot read per-locus t2h contributions");
 
       if (!LOAD(&(stree->nodes[i]->t2h_sum),1,fp))
         fatal("Cannot read t2h sum");
@@ -1063,7 +1029,8 @@ void load_chk_section_2(FILE * fp)
 
   /* read number of incoming sequences for each node node */
   for (i = 0; i < total_nodes; ++i)
-    if (!LOAD(stree->nodes[i]->seqin_count,opt_locus_count,fp))
+    for (j = 0; j < opt_locus_count; ++j)
+      if (!LOAD(&(SNODE_LOCUS(stree->nodes[i],j)->seqin_count),1,fp))
         fatal("Cannot read incoming sequence counts");
 
   alloc_gtree();
@@ -1092,18 +1059,14 @@ void load_chk_section_2(FILE * fp)
 
     for (j = 0; j < opt_locus_count; ++j)
     {
-      snode->event[j] = dlist_create();
-
-      if (!LOAD(buffer,snode->event_count[j],fp))
+      if (!LOAD(buffer,SNODE_LOCUS(snode,j)->event_count,fp))
         fatal("Cannot read coalescent events");
 
-      for (k = 0; k < snode->event_count[j]; ++k)
+      for (k = 0; k < SNODE_LOCUS(snode,j)->event_count; ++k)
       {
         gnode_t * gt_node = gtree[j]->nodes[buffer[k]];
 
-        dlist_item_t * dlitem = dlist_append(snode->event[j], (void *)gt_node);
-
-        gt_node->event = dlitem;
+        dlist_item_append(SNODE_LOCUS(snode,j)->event, gt_node->event);
       }
     }
   }
@@ -1121,7 +1084,7 @@ static void load_gene_tree(FILE * fp, long index)
 
   /* get number of tips */
   for (i = 0; i < stree->tip_count; ++i)
-    gtree_tip_count += stree->nodes[i]->seqin_count[index]; 
+    gtree_tip_count += SNODE_LOCUS(stree->nodes[i],index)->seqin_count; 
 
   gt->tip_count = gtree_tip_count;
   gt->inner_count = gtree_tip_count-1;
@@ -1378,6 +1341,10 @@ static void load_locus(FILE * fp, long index)
     if (!LOAD(locus[index]->subst_params[i],((states-1)*states)/2,fp))
       fatal("Cannot read qmatrix rates");
 
+  /* amino-acid models share one eigen decomposition per model */
+  if (locus[index]->dtype == BPP_DATA_AA)
+    locus_share_eigen(locus[index]);
+
   /* load param indices */
   if (!LOAD(locus[index]->param_indices,locus[index]->rate_cats,fp))
     fatal("Cannot read param indices");
@@ -1440,14 +1407,47 @@ static void load_locus(FILE * fp, long index)
   }
     
 
-  /* load tip CLVs */
-  for (i = 0; i < gt->tip_count; ++i)
+  /* load packed tip states or tip CLVs */
+  if (locus[index]->attributes & PLL_ATTRIB_PATTERN_TIP)
   {
-    unsigned int clv_index = gt->nodes[i]->clv_index;
-    span = locus[index]->sites * locus[index]->states * locus[index]->rate_cats;
+    unsigned int j;
+    char inv_map[16];
+    unsigned char * packed = (unsigned char *)xmalloc((size_t)(sites+1)/2);
+    char * seq = (char *)xmalloc((size_t)sites+1);
+
+    /* map each 4-bit state code back to a nucleotide character */
+    memset(inv_map, 0, 16);
+    for (j = 255; j > 0; --j)
+      if (pll_map_nt[j])
+        inv_map[pll_map_nt[j]] = (char)j;
+
+    for (i = 0; i < gt->tip_count; ++i)
+    {
+      unsigned int clv_index = gt->nodes[i]->clv_index;
 
-    if (!LOAD(locus[index]->clv[clv_index],span,fp))
-      fatal("Cannot read gene tree %ld tip CLV", index);
+      if (!LOAD(packed,(sites+1)/2,fp))
+        fatal("Cannot read gene tree %ld tip states", index);
+
+      for (j = 0; j < sites; ++j)
+        seq[j] = inv_map[PLL_TIPCHAR_4X4(packed,j)];
+      seq[sites] = 0;
+
+      pll_set_tip_states(locus[index], clv_index, pll_map_nt, seq);
+    }
+    free(packed);
+    free(seq);
+  }
+  else
+  {
+    for (i = 0; i < gt->tip_count; ++i)
+    {
+      unsigned int clv_index = gt->nodes[i]->clv_index;
+      span = locus[index]->sites * locus[index]->states *
+             locus[index]->rate_cats;
+
+      if (!LOAD(locus[index]->clv[clv_index],span,fp))
+        fatal("Cannot read gene tree %ld tip CLV", index);
+    }
   }
 }
 
@@ -1544,8 +1544,6 @@ int checkpoint_load(gtree_t *** gtreep,
   /* load section 4 */
   load_chk_section_4(fp);
 
-  /* TODO: set tip sequences, charmap etc when using tipchars */
-
   /* update pmatrices and CLVs */
   for (i = 0; i < opt_locus_count; ++i)
   {
@@ -67,14 +67,25 @@ static void dealloc_locus_data(locus_t * locus)
   if (!locus->pattern_weights)
     free(locus->pattern_weights);
 
-  if (locus->scale_buffer)
-    for (i = 0; i < locus->scale_buffers; ++i)
-      free(locus->scale_buffer[i]);
+  /* tip data and pattern weights borrowed from another locus */
+  if (locus->shared_data)
+  {
+    locus->pattern_weights = NULL;
+    locus->tipchars = NULL;
+    locus->charmap = NULL;
+    locus->tipmap = NULL;
+    locus->diploid_mapping = NULL;
+    locus->diploid_resolution_count = NULL;
+  }
+
+  /* scale buffers are stored contiguously */
+  if (locus->scale_buffer && locus->scale_buffers)
+    free(locus->scale_buffer[0]);
   free(locus->scale_buffer);
 
   if (locus->tipchars)
     for (i = 0; i < locus->tips; ++i)
-      pll_aligned_free(locus->tipchars[i]);
+      free(locus->tipchars[i]);
   free(locus->tipchars);
 
   if (locus->ttlookup)
@@ -88,10 +99,12 @@ static void dealloc_locus_data(locus_t * locus)
 
   if (locus->clv)
   {
-    int start = (locus->attributes & PLL_ATTRIB_PATTERN_TIP) ?
-                    locus->tips : 0;
-    for (i = start; i < locus->clv_buffers + locus->tips; ++i)
-      pll_aligned_free(locus->clv[i]);
+    /* tip CLVs are allocated separately, inner CLVs are stored contiguously */
+    if (!(locus->attributes & PLL_ATTRIB_PATTERN_TIP) && !locus->shared_data)
+      for (i = 0; i < locus->tips; ++i)
+        pll_aligned_free(locus->clv[i]);
+    if (locus->clv_buffers)
+      pll_aligned_free(locus->clv[locus->tips]);
   }
   free(locus->clv);
 
@@ -107,17 +120,18 @@ static void dealloc_locus_data(locus_t * locus)
       pll_aligned_free(locus->subst_params[i]);
   free(locus->subst_params);
 
-  if (locus->eigenvecs)
+  /* eigen decompositions of amino-acid models are owned by the store */
+  if (locus->eigenvecs && !locus->shared_eigen)
     for (i = 0; i < locus->rate_matrices; ++i)
       pll_aligned_free(locus->eigenvecs[i]);
   free(locus->eigenvecs);
 
-  if (locus->inv_eigenvecs)
+  if (locus->inv_eigenvecs && !locus->shared_eigen)
     for (i = 0; i < locus->rate_matrices; ++i)
       pll_aligned_free(locus->inv_eigenvecs[i]);
   free(locus->inv_eigenvecs);
 
-  if (locus->eigenvals)
+  if (locus->eigenvals && !locus->shared_eigen)
     for (i = 0; i < locus->rate_matrices; ++i)
       pll_aligned_free(locus->eigenvals[i]);
   free(locus->eigenvals);
@@ -371,8 +385,9 @@ static int update_charmap(locus_t * locus, const unsigned int * map)
     size_t alloc_size = (1 << (2 * l2_maxstates)) *
                         (locus->states_padded * locus->rate_cats);
 
-    /* for AVX we do not need to reallocate ttlookup as it has fixed size */
-    if ((locus->states == 4) && (locus->attributes & PLL_ATTRIB_ARCH_AVX))
+    /* for 4 states we do not need to reallocate ttlookup as it has fixed
+       size */
+    if (locus->states == 4)
       return BPP_SUCCESS;
 
     free(locus->ttlookup);
@@ -409,12 +424,8 @@ static int create_charmap(locus_t * locus, const unsigned int * usermap)
   //memcpy(map, partition->map, PLL_ASCII_SIZE * sizeof(unsigned int));
   memcpy(map, usermap, ASCII_SIZE * sizeof(unsigned int));
 
-  if (!(locus->charmap = (unsigned char *)xcalloc(ASCII_SIZE,
-                                                  sizeof(unsigned char))))
-
-  if (!(locus->tipmap = (unsigned int *)xcalloc(ASCII_SIZE,
-                                                sizeof(unsigned int))))
-
+  locus->charmap = (unsigned char *)xcalloc(ASCII_SIZE,sizeof(unsigned char));
+  locus->tipmap = (unsigned int *)xcalloc(ASCII_SIZE,sizeof(unsigned int));
 
   /* create charmap (remapped table of ASCII characters to range 0,|states|)
      and tipmap which is a (1,|states|) -> state */
@@ -453,10 +464,9 @@ static int create_charmap(locus_t * locus, const unsigned int * usermap)
   size_t alloc_size = (1 << (2 * l2_maxstates)) *
                       (locus->states_padded * locus->rate_cats);
 
-  /* dedicated 4x4 function  - if AVX is not used we can allocate less space
-     in case not all 16 possible ambiguities are present */
-  if ((locus->states == 4) &&
-      (locus->attributes & PLL_ATTRIB_ARCH_AVX))
+  /* dedicated 4x4 functions index the lookup directly with the 4-bit state
+     codes, hence the table always holds all 16x16 pairs of ambiguities */
+  if (locus->states == 4)
   {
     locus->ttlookup = pll_aligned_alloc(1024 * locus->rate_cats *
                                         sizeof(double),
@@ -472,8 +482,12 @@ static int create_charmap(locus_t * locus, const unsigned int * usermap)
   locus->tipchars = (unsigned char **)xcalloc(locus->tips,
                                               sizeof(unsigned char *));
 
+  /* 4-state tips are packed two sites per byte (see PLL_TIPCHAR_4X4) */
+  if (locus->states == 4)
+    sites_alloc = (sites_alloc+1) / 2;
+
   for (i = 0; i < locus->tips; ++i)
-    locus->tipchars[i] = (unsigned char *)xmalloc(sites_alloc *
+    locus->tipchars[i] = (unsigned char *)xcalloc(sites_alloc,
                                                   sizeof(unsigned char));
 
   return BPP_SUCCESS;
@@ -485,6 +499,9 @@ static int set_tipchars_4x4(locus_t * locus,
 {
   unsigned int c;
   unsigned int i;
+  unsigned char * tipchars = locus->tipchars[tip_index];
+
+  memset(tipchars, 0, (locus->sites+1) / 2);
 
   /* iterate through sites */
   for (i = 0; i < locus->sites; ++i)
@@ -492,8 +509,8 @@ static int set_tipchars_4x4(locus_t * locus,
     if ((c = map[(int)sequence[i]]) == 0)
       fatal("Illegal state code in tip \"%c\"", sequence[i]);
 
-    /* store states as the remapped characters from charmap */
-    locus->tipchars[tip_index][i] = (unsigned char)c;
+    /* store the 4-bit state code, two sites per byte, low nibble first */
+    tipchars[i >> 1] |= (unsigned char)(c << ((i & 1) << 2));
   }
 
   /* tipmap is never used in the 4x4 case except create and update_charmap */
@@ -619,6 +636,30 @@ int pll_set_tip_clv(locus_t * locus,
 }
 
 
+static size_t locus_clv_size(locus_t * locus)
+{
+  return (size_t)(locus->sites) * locus->states_padded * locus->rate_cats *
+         sizeof(double);
+}
+
+static size_t locus_pmatrix_size(locus_t * locus)
+{
+  size_t displacement = (locus->states_padded - locus->states) *
+                        locus->states_padded * sizeof(double);
+
+  return (size_t)(locus->prob_matrices) * locus->states *
+         locus->states_padded * locus->rate_cats * sizeof(double) +
+         displacement;
+}
+
+static size_t locus_scaler_size(locus_t * locus)
+{
+  size_t scaler_size = (locus->attributes & PLL_ATTRIB_RATE_SCALERS) ?
+                         (size_t)(locus->sites) * locus->rate_cats :
+                         (size_t)(locus->sites);
+  return scaler_size * sizeof(unsigned int);
+}
+
 locus_t * locus_create(unsigned int dtype,
                        unsigned int model,
                        unsigned int tips,
@@ -655,6 +696,7 @@ locus_t * locus_create(unsigned int dtype,
   locus->diploid_mapping = NULL;
   locus->diploid_resolution_count = NULL;
   locus->likelihood_vector = NULL;
+  locus->shared_data = 0;
 
   if (attributes & PLL_ATTRIB_ARCH_SSE)
   {
@@ -718,6 +760,7 @@ locus_t * locus_create(unsigned int dtype,
   locus->tipchars = NULL;
   locus->charmap = NULL;
   locus->tipmap = NULL;
+  locus->shared_eigen = 0;
 
   /* param indices. By default we use the same frequencies/qmatrix for computing
      the pmatrices for each rate category */
@@ -735,18 +778,33 @@ locus_t * locus_create(unsigned int dtype,
 
   /* if tip pattern precomputation is enabled, then do not allocate CLV space
      for the tip nodes */
-  int start = (locus->attributes & PLL_ATTRIB_PATTERN_TIP) ? locus->tips : 0;
+  size_t clv_size = locus_clv_size(locus);
+  if (!(locus->attributes & PLL_ATTRIB_PATTERN_TIP))
+  {
+    for (i = 0; i < locus->tips; ++i)
+    {
+      locus->clv[i] = pll_aligned_alloc(clv_size, locus->alignment);
+      if (!locus->clv[i])
+        fatal("Cannot allocate memory for CLVs");
+      /* zero-out CLV vectors to avoid valgrind warnings when using odd number
+         of states with vectorized code */
+      memset(locus->clv[i], 0, clv_size);
+    }
+  }
 
-  for (i = start; i < locus->tips + locus->clv_buffers; ++i)
+  /* allocate the CLVs of inner nodes in contiguous space ordered by CLV index,
+     such that a postorder traversal of a gene tree sweeps through memory in
+     one direction. As states are padded to the vector width, each CLV starts
+     at an aligned address */
+  if (locus->clv_buffers)
   {
-    locus->clv[i] = pll_aligned_alloc(sites_alloc * states_padded * rate_cats *
-                                      sizeof(double),
-                                      locus->alignment);
-    /* zero-out CLV vectors to avoid valgrind warnings when using odd number of
-       states with vectorized code */
-    memset(locus->clv[i],
-           0,
-           (size_t)sites_alloc*states_padded*rate_cats*sizeof(double));
+    locus->clv[locus->tips] = pll_aligned_alloc(clv_size * locus->clv_buffers,
+                                                locus->alignment);
+    if (!locus->clv[locus->tips])
+      fatal("Cannot allocate memory for CLVs");
+    memset(locus->clv[locus->tips], 0, clv_size * locus->clv_buffers);
+    for (i = locus->tips+1; i < locus->tips + locus->clv_buffers; ++i)
+      locus->clv[i] = locus->clv[i-1] + clv_size / sizeof(double);
   }
 
   /* pmatrix */
@@ -853,12 +911,14 @@ locus_t * locus_create(unsigned int dtype,
   /* scale_buffer */
   locus->scale_buffer = (unsigned int **)xcalloc(locus->scale_buffers,
                                                  sizeof(unsigned int *));
-  for (i = 0; i < locus->scale_buffers; ++i)
+  if (locus->scale_buffers)
   {
-    size_t scaler_size = (attributes & PLL_ATTRIB_RATE_SCALERS) ?
-                             sites_alloc * rate_cats : sites_alloc;
-    locus->scale_buffer[i] = (unsigned int *)xcalloc(scaler_size,
-                                                     sizeof(unsigned int));
+    size_t scaler_size = locus_scaler_size(locus);
+    locus->scale_buffer[0] = (unsigned int *)xcalloc(locus->scale_buffers,
+                                                     scaler_size);
+    for (i = 1; i < locus->scale_buffers; ++i)
+      locus->scale_buffer[i] = locus->scale_buffer[i-1] +
+                               scaler_size / sizeof(unsigned int);
   }
 
   return locus;
@@ -869,6 +929,214 @@ void locus_destroy(locus_t * locus)
   dealloc_locus_data(locus);
 }
 
+/* Re-allocate the inner node CLVs, p-matrices and scalers of a locus from the
+   calling thread and copy their contents over. Used by the worker thread that
+   owns the locus, such that with the default first-touch policy the pages land
+   on the NUMA node of that worker. Tip CLVs and tip data are read-only and may
+   be shared with locus clones, and are therefore left in place. Returns the
+   number of bytes re-allocated */
+size_t locus_first_touch(locus_t * locus)
+{
+  unsigned int i;
+  size_t total = 0;
+  size_t size;
+  void * mem;
+
+  size = locus_clv_size(locus) * locus->clv_buffers;
+  if (size)
+  {
+    mem = pll_aligned_alloc(size, locus->alignment);
+    if (!mem)
+      fatal("Cannot allocate memory for CLVs");
+    memcpy(mem, locus->clv[locus->tips], size);
+    pll_aligned_free(locus->clv[locus->tips]);
+    locus->clv[locus->tips] = (double *)mem;
+    for (i = locus->tips+1; i < locus->tips + locus->clv_buffers; ++i)
+      locus->clv[i] = locus->clv[i-1] + locus_clv_size(locus)/sizeof(double);
+    total += size;
+  }
+
+  size = locus_pmatrix_size(locus);
+  mem = pll_aligned_alloc(size, locus->alignment);
+  if (!mem)
+    fatal("Cannot allocate memory for transition probability matrices");
+  memcpy(mem, locus->pmatrix[0], size);
+  pll_aligned_free(locus->pmatrix[0]);
+  locus->pmatrix[0] = (double *)mem;
+  for (i = 1; i < locus->prob_matrices; ++i)
+    locus->pmatrix[i] = locus->pmatrix[i-1] +
+                        locus->states*locus->states_padded*locus->rate_cats;
+  total += size;
+
+  size = locus_scaler_size(locus) * locus->scale_buffers;
+  if (size)
+  {
+    mem = xmalloc(size);
+    memcpy(mem, locus->scale_buffer[0], size);
+    free(locus->scale_buffer[0]);
+    locus->scale_buffer[0] = (unsigned int *)mem;
+    for (i = 1; i < locus->scale_buffers; ++i)
+      locus->scale_buffer[i] = locus->scale_buffer[i-1] +
+                               locus_scaler_size(locus)/sizeof(unsigned int);
+    total += size;
+  }
+
+  return total;
+}
+
+/* add the bytes of the buffers moved by locus_first_touch() residing on each
+   NUMA node to node_bytes. Returns 0 if the placement cannot be queried */
+long locus_numa_placement(locus_t * locus, double * node_bytes)
+{
+  if (locus->clv_buffers &&
+      !numa_placement(locus->clv[locus->tips],
+                      locus_clv_size(locus) * locus->clv_buffers,
+                      node_bytes))
+    return 0;
+
+  if (!numa_placement(locus->pmatrix[0], locus_pmatrix_size(locus), node_bytes))
+    return 0;
+
+  if (locus->scale_buffers &&
+      !numa_placement(locus->scale_buffer[0],
+                      locus_scaler_size(locus) * locus->scale_buffers,
+                      node_bytes))
+    return 0;
+
+  return 1;
+}
+
+/* create a copy of a locus that can be used with a cloned gene tree. Model
+   parameters, conditional likelihood vectors, scalers and transition
+   probability matrices are copied. Tip data, pattern weights and diploid
+   site mappings never change after the locus is set up, and are therefore
+   shared with the original locus, which must not be destroyed while the copy
+   is in use */
+locus_t * locus_clone(locus_t * locus)
+{
+  unsigned int i;
+  unsigned int states = locus->states;
+  unsigned int states_padded = locus->states_padded;
+  unsigned int rate_cats = locus->rate_cats;
+  size_t span = (size_t)(locus->sites) * states_padded * rate_cats;
+
+  locus_t * clone = locus_create(locus->dtype,
+                                 locus->model,
+                                 locus->tips,
+                                 locus->clv_buffers,
+                                 states,
+                                 locus->sites,
+                                 locus->rate_matrices,
+                                 locus->prob_matrices,
+                                 rate_cats,
+                                 locus->scale_buffers,
+                                 locus->attributes);
+
+  clone->rates_alpha = locus->rates_alpha;
+  clone->qrates_param_count = locus->qrates_param_count;
+  clone->freqs_param_count = locus->freqs_param_count;
+
+  memcpy(clone->rates, locus->rates, rate_cats*sizeof(double));
+  memcpy(clone->rate_weights, locus->rate_weights, rate_cats*sizeof(double));
+  memcpy(clone->param_indices,
+         locus->param_indices,
+         rate_cats*sizeof(unsigned int));
+
+  /* substitution model */
+  for (i = 0; i < locus->rate_matrices; ++i)
+  {
+    memcpy(clone->subst_params[i],
+           locus->subst_params[i],
+           ((states*states-states)/2)*sizeof(double));
+    memcpy(clone->frequencies[i],
+           locus->frequencies[i],
+           states_padded*sizeof(double));
+    if (locus->shared_eigen) continue;
+
+    memcpy(clone->eigenvecs[i],
+           locus->eigenvecs[i],
+           states*states_padded*sizeof(double));
+    memcpy(clone->inv_eigenvecs[i],
+           locus->inv_eigenvecs[i],
+           states*states_padded*sizeof(double));
+    memcpy(clone->eigenvals[i],
+           locus->eigenvals[i],
+           states_padded*sizeof(double));
+  }
+  memcpy(clone->eigen_decomp_valid,
+         locus->eigen_decomp_valid,
+         locus->rate_matrices*sizeof(int));
+  if (locus->shared_eigen)
+    locus_share_eigen(clone);
+  memcpy(clone->heredity, locus->heredity, locus->rate_matrices*sizeof(double));
+
+  clone->shared_data = 1;
+
+  /* pattern weights (for diploid loci these are the unphased site weights) */
+  free(clone->pattern_weights);
+  clone->pattern_weights = locus->pattern_weights;
+  clone->pattern_weights_sum = locus->pattern_weights_sum;
+  if (locus->diploid)
+  {
+    clone->diploid = 1;
+    clone->unphased_length = locus->unphased_length;
+    clone->diploid_resolution_count = locus->diploid_resolution_count;
+    clone->diploid_mapping = locus->diploid_mapping;
+    clone->likelihood_vector = (double *)xmalloc((size_t)(locus->sites) *
+                                                 sizeof(double));
+  }
+
+  /* tip data */
+  if (locus->attributes & PLL_ATTRIB_PATTERN_TIP)
+  {
+    unsigned int l2_maxstates = (unsigned int)ceil(log2(locus->maxstates));
+    size_t ttsize = (1 << (2 * l2_maxstates)) * (states_padded * rate_cats);
+
+    if (states == 4)
+      ttsize = MAX(ttsize, 1024 * rate_cats);
+
+    clone->maxstates = locus->maxstates;
+    clone->charmap = locus->charmap;
+    clone->tipmap = locus->tipmap;
+    clone->tipchars = locus->tipchars;
+
+    /* the tip-tip lookup table is recomputed at each partial update */
+    clone->ttlookup = pll_aligned_alloc(ttsize * sizeof(double),
+                                        clone->alignment);
+    memset(clone->ttlookup, 0, ttsize * sizeof(double));
+  }
+  else
+  {
+    /* tip vectors */
+    for (i = 0; i < locus->tips; ++i)
+    {
+      pll_aligned_free(clone->clv[i]);
+      clone->clv[i] = locus->clv[i];
+    }
+  }
+
+  /* conditional likelihood vectors of inner nodes */
+  for (i = locus->tips; i < locus->tips + locus->clv_buffers; ++i)
+    memcpy(clone->clv[i], locus->clv[i], span*sizeof(double));
+
+  for (i = 0; i < locus->scale_buffers; ++i)
+  {
+    size_t scaler_size = (locus->attributes & PLL_ATTRIB_RATE_SCALERS) ?
+                           locus->sites * rate_cats : locus->sites;
+    memcpy(clone->scale_buffer[i],
+           locus->scale_buffer[i],
+           scaler_size*sizeof(unsigned int));
+  }
+
+  /* transition probability matrices are stored contiguously */
+  memcpy(clone->pmatrix[0],
+         locus->pmatrix[0],
+         (size_t)(locus->prob_matrices) * states * states_padded * rate_cats *
+         sizeof(double));
+
+  return clone;
+}
+
 void pll_set_subst_params(locus_t * locus,
                           unsigned int param_index,
                           const double * params)
@@ -1089,6 +1357,92 @@ void locus_set_frequencies_and_rates(locus_t * locus)
 
   pll_set_frequencies(locus,0,freqs);
   pll_set_subst_params(locus,0,rates);
+
+  if (locus->dtype == BPP_DATA_AA)
+    locus_share_eigen(locus);
+}
+
+/* eigen decompositions of the empirical amino-acid models, computed once
+   from the first locus that uses each model */
+typedef struct eigen_store_s
+{
+  double * eigenvecs;
+  double * inv_eigenvecs;
+  double * eigenvals;
+  unsigned int states_padded;
+} eigen_store_t;
+
+static eigen_store_t eigen_store[BPP_AA_MODEL_MAX-BPP_AA_MODEL_MIN+1];
+
+/* replace the eigen decompositions of an amino-acid locus by the ones of the
+   model-level store. The rate matrices of these models and their frequencies
+   are fixed, hence all loci using the same model share one decomposition.
+   Must be called serially, after the frequencies and rates are set */
+void locus_share_eigen(locus_t * locus)
+{
+  unsigned int i;
+  unsigned int states = locus->states;
+  unsigned int states_padded = locus->states_padded;
+
+  assert(locus->dtype == BPP_DATA_AA);
+  assert(locus->model >= BPP_AA_MODEL_MIN && locus->model <= BPP_AA_MODEL_MAX);
+
+  eigen_store_t * e = eigen_store + (locus->model - BPP_AA_MODEL_MIN);
+
+  if (!e->eigenvecs)
+  {
+    e->states_padded = states_padded;
+    e->eigenvecs = pll_aligned_alloc(states*states_padded*sizeof(double),
+                                     locus->alignment);
+    e->inv_eigenvecs = pll_aligned_alloc(states*states_padded*sizeof(double),
+                                         locus->alignment);
+    e->eigenvals = pll_aligned_alloc(states_padded*sizeof(double),
+                                     locus->alignment);
+    if (!e->eigenvecs || !e->inv_eigenvecs || !e->eigenvals)
+      fatal("Cannot allocate memory for eigen decomposition");
+    memset(e->eigenvecs, 0, states*states_padded*sizeof(double));
+    memset(e->inv_eigenvecs, 0, states*states_padded*sizeof(double));
+    memset(e->eigenvals, 0, states_padded*sizeof(double));
+
+    pll_update_eigen(e->eigenvecs,
+                     e->inv_eigenvecs,
+                     e->eigenvals,
+                     locus->frequencies[0],
+                     locus->subst_params[0],
+                     states,
+                     states_padded);
+  }
+  assert(e->states_padded == states_padded);
+
+  for (i = 0; i < locus->rate_matrices; ++i)
+  {
+    if (!locus->shared_eigen)
+    {
+      pll_aligned_free(locus->eigenvecs[i]);
+      pll_aligned_free(locus->inv_eigenvecs[i]);
+      pll_aligned_free(locus->eigenvals[i]);
+    }
+    locus->eigenvecs[i] = e->eigenvecs;
+    locus->inv_eigenvecs[i] = e->inv_eigenvecs;
+    locus->eigenvals[i] = e->eigenvals;
+    locus->eigen_decomp_valid[i] = 1;
+  }
+  locus->shared_eigen = 1;
+}
+
+void locus_eigen_store_fini()
+{
+  unsigned int i;
+
+  for (i = 0; i < BPP_AA_MODEL_MAX-BPP_AA_MODEL_MIN+1; ++i)
+  {
+    if (!eigen_store[i].eigenvecs) continue;
+
+    pll_aligned_free(eigen_store[i].eigenvecs);
+    pll_aligned_free(eigen_store[i].inv_eigenvecs);
+    pll_aligned_free(eigen_store[i].eigenvals);
+    eigen_store[i].eigenvecs = NULL;
+  }
 }
 
 void locus_set_heredity_scalers(locus_t * locus, const double * heredity)
@@ -1132,10 +1486,10 @@ static double update_branchlength_relaxed_clock(stree_t * stree,
 
     /* skip using branch rates on horizontal edges in hybridization events */
     if (!(pop->hybrid && pop->htau == 0))
-      length += (start->tau - t)*pop->brate[msa_index];
+      length += (start->tau - t)*SNODE_LOCUS(pop,msa_index)->brate;
     t = start->tau;
   }
-  length += (node->parent->time - t) * node->parent->pop->brate[msa_index];
+  length += (node->parent->time - t) * SNODE_LOCUS(node->parent->pop,msa_index)->brate;
 
   return length;
 }
@@ -2377,26 +2731,20 @@ void locus_update_matrices(locus_t * locus,
 }
 
 
-static void locus_update_all_partials_recursive(locus_t * locus, gnode_t * root)
+/* update the CLV of an inner node from its two children. With tip patterns
+   the children that are tips have no CLV, and their states are read directly
+   from tipchars by the tip-tip and tip-inner kernels */
+static void locus_update_partial(locus_t * locus, gnode_t * node)
 {
   unsigned int * scaler;
   unsigned int * lscaler;
   unsigned int * rscaler;
-  gnode_t * lnode;
-  gnode_t * rnode;
-
-
-  if (!(root->left)) return;
-
-  locus_update_all_partials_recursive(locus,root->left);
-  locus_update_all_partials_recursive(locus,root->right);
-
-  lnode = root->left;
-  rnode = root->right;
+  gnode_t * lnode = node->left;
+  gnode_t * rnode = node->right;
 
   /* check if we use scalers */
-  scaler = (root->scaler_index == PLL_SCALE_BUFFER_NONE) ?
-             NULL : locus->scale_buffer[root->scaler_index];
+  scaler = (node->scaler_index == PLL_SCALE_BUFFER_NONE) ?
+             NULL : locus->scale_buffer[node->scaler_index];
 
   lscaler = (lnode->scaler_index == PLL_SCALE_BUFFER_NONE) ?
               NULL : locus->scale_buffer[lnode->scaler_index];
@@ -2404,10 +2752,61 @@ static void locus_update_all_partials_recursive(locus_t * locus, gnode_t * root)
   rscaler = (rnode->scaler_index == PLL_SCALE_BUFFER_NONE) ?
               NULL : locus->scale_buffer[rnode->scaler_index];
 
+  if (locus->attributes & PLL_ATTRIB_PATTERN_TIP)
+  {
+    if (!lnode->left && !rnode->left)
+    {
+      pll_core_create_lookup(locus->states,
+                             locus->rate_cats,
+                             locus->ttlookup,
+                             locus->pmatrix[lnode->pmatrix_index],
+                             locus->pmatrix[rnode->pmatrix_index],
+                             locus->tipmap,
+                             locus->maxstates,
+                             locus->attributes);
+      pll_core_update_partial_tt(locus->states,
+                                 locus->sites,
+                                 locus->rate_cats,
+                                 locus->clv[node->clv_index],
+                                 scaler,
+                                 locus->tipchars[lnode->clv_index],
+                                 locus->tipchars[rnode->clv_index],
+                                 locus->tipmap,
+                                 locus->maxstates,
+                                 locus->ttlookup,
+                                 locus->attributes);
+      return;
+    }
+
+    if (!lnode->left || !rnode->left)
+    {
+      /* the tip is passed as the left child */
+      if (rnode->left == NULL)
+      {
+        SWAP(lnode,rnode);
+        SWAP(lscaler,rscaler);
+      }
+      pll_core_update_partial_ti(locus->states,
+                                 locus->sites,
+                                 locus->rate_cats,
+                                 locus->clv[node->clv_index],
+                                 scaler,
+                                 locus->tipchars[lnode->clv_index],
+                                 locus->clv[rnode->clv_index],
+                                 locus->pmatrix[lnode->pmatrix_index],
+                                 locus->pmatrix[rnode->pmatrix_index],
+                                 rscaler,
+                                 locus->tipmap,
+                                 locus->maxstates,
+                                 locus->attributes);
+      return;
+    }
+  }
+
   pll_core_update_partial_ii(locus->states,
                              locus->sites,
                              locus->rate_cats,
-                             locus->clv[root->clv_index],
+                             locus->clv[node->clv_index],
                              scaler,
                              locus->clv[lnode->clv_index],
                              locus->clv[rnode->clv_index],
@@ -2418,6 +2817,16 @@ static void locus_update_all_partials_recursive(locus_t * locus, gnode_t * root)
                              locus->attributes);
 }
 
+static void locus_update_all_partials_recursive(locus_t * locus, gnode_t * root)
+{
+  if (!(root->left)) return;
+
+  locus_update_all_partials_recursive(locus,root->left);
+  locus_update_all_partials_recursive(locus,root->right);
+
+  locus_update_partial(locus,root);
+}
+
 void locus_update_all_partials(locus_t * locus, gtree_t * gtree)
 {
   if (!opt_usedata) return;
@@ -2428,44 +2837,11 @@ void locus_update_all_partials(locus_t * locus, gtree_t * gtree)
 void locus_update_partials(locus_t * locus, gnode_t ** traversal, unsigned int count)
 {
   unsigned int i;
-  unsigned int * scaler;
-  unsigned int * lscaler;
-  unsigned int * rscaler;
-  gnode_t * node;
-  gnode_t * lnode;
-  gnode_t * rnode;
 
   if (!opt_usedata) return;
 
   for (i = 0; i < count; ++i)
-  {
-    node  = traversal[i];
-    lnode = traversal[i]->left;
-    rnode = traversal[i]->right;
-
-    /* check if we use scalers */
-    scaler = (node->scaler_index == PLL_SCALE_BUFFER_NONE) ?
-               NULL : locus->scale_buffer[node->scaler_index];
-
-    lscaler = (lnode->scaler_index == PLL_SCALE_BUFFER_NONE) ?
-                NULL : locus->scale_buffer[lnode->scaler_index];
-
-    rscaler = (rnode->scaler_index == PLL_SCALE_BUFFER_NONE) ?
-                NULL : locus->scale_buffer[rnode->scaler_index];
-
-    pll_core_update_partial_ii(locus->states,
-                               locus->sites,
-                               locus->rate_cats,
-                               locus->clv[node->clv_index],
-                               scaler,
-                               locus->clv[lnode->clv_index],
-                               locus->clv[rnode->clv_index],
-                               locus->pmatrix[lnode->pmatrix_index],
-                               locus->pmatrix[rnode->pmatrix_index],
-                               lscaler,
-                               rscaler,
-                               locus->attributes);
-  }
+    locus_update_partial(locus,traversal[i]);
 }
 
 double locus_root_loglikelihood(locus_t * locus,
@@ -2494,21 +2870,13 @@ double locus_root_loglikelihood(locus_t * locus,
                                     freqs_indices,
                                     locus->likelihood_vector,
                                     locus->attributes);
-    
-    long i,j,k=0;
-    logl = 0;
 
-    for (i = 0; i < locus->unphased_length; ++i)
-    {
-      double meanl = 0;
-
-      for (j = 0; j < locus->diploid_resolution_count[i]; ++j)
-        meanl += locus->likelihood_vector[locus->diploid_mapping[k++]];
-
-      meanl /= locus->diploid_resolution_count[i];
-
-      logl += log(meanl) * locus->pattern_weights[i];
-    }
+    logl = pll_core_root_diploid_loglikelihood(locus->unphased_length,
+                                               locus->likelihood_vector,
+                                               locus->diploid_resolution_count,
+                                               locus->diploid_mapping,
+                                               locus->pattern_weights,
+                                               locus->attributes);
   }
   else
   {
@@ -2825,7 +3193,9 @@ double locus_propose_freqs_serial(stree_t * stree, locus_t ** locus, gtree_t **
   {
     if (locus[i]->freqs_param_count)
     {
+      rng_locus_begin(thread_index,i,THREAD_WORK_FREQS);
       propose_freqs(stree,locus[i],gtree[i],i,thread_index,&loc_acc,&loc_cand);
+      rng_locus_end(thread_index);
 
       accepted += loc_acc;
       candidates += loc_cand;
@@ -2862,7 +3232,9 @@ void locus_propose_freqs_parallel(stree_t * stree,
   {
     if (locus[i]->freqs_param_count)
     {
+      rng_locus_begin(thread_index,i,THREAD_WORK_FREQS);
       propose_freqs(stree,locus[i],gtree[i],i,thread_index,&loc_acc,&loc_cand);
+      rng_locus_end(thread_index);
       candidates += loc_cand;
       accepted += loc_acc;
     }
@@ -3265,7 +3637,9 @@ double locus_propose_qrates_serial(stree_t * stree,
   {
     if (locus[i]->qrates_param_count)
     {
+      rng_locus_begin(thread_index,i,THREAD_WORK_RATES);
       propose_qrates(stree,locus[i],gtree[i],i,thread_index,&loc_acc,&loc_cand);
+      rng_locus_end(thread_index);
 
       accepted += loc_acc;
       candidates += loc_cand;
@@ -3302,7 +3676,9 @@ void locus_propose_qrates_parallel(stree_t * stree,
   {
     if (locus[i]->qrates_param_count)
     {
+      rng_locus_begin(thread_index,i,THREAD_WORK_RATES);
       propose_qrates(stree,locus[i],gtree[i],i,thread_index,&loc_acc,&loc_cand);
+      rng_locus_end(thread_index);
       candidates += loc_cand;
       accepted += loc_acc;
     }
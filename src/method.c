@@ -56,6 +56,11 @@ static int prec_logpr = 8;
 
 static int prec_ft = 6;
 
+/* species tree (and delimitation) samples are summarized as they are taken,
+   instead of re-reading the MCMC file at the end of the run. For A00 this is
+   enabled with the 'onlinesummary' option */
+static int online_summary = 0;
+
 static long max_dirty_iters = 0;  /* stats on maxnumber of dirty SPR iters */
 static long sum_dirty_iters = 0;  /* sum for computing average */
 
@@ -983,7 +988,7 @@ static void mcmc_printheader_rates(FILE ** fp_locus,
               tab_required ? "\t" : "", stree->nodes[0]->label);
       tab_required = 1;
       for (j = 1; j < total_nodes; ++j)
-        if (stree->nodes[j]->brate)
+        if (stree->nodes[j]->has_brate)
           fprintf(fp_locus[i], "\tr_%s", stree->nodes[j]->label);
     }
 
@@ -1112,11 +1117,11 @@ static void print_rates(FILE ** fp_locus,
       /* first one is tip, it always have a branch rate */
       fprintf(fp_locus[i],
               "%s%.6f",
-              tab_required ? "\t" : "", stree->nodes[0]->brate[i]);
+              tab_required ? "\t" : "", SNODE_LOCUS(stree->nodes[0],i)->brate);
       tab_required = 1;
       for (j = 1; j < total_nodes; ++j)
-        if (stree->nodes[j]->brate)
-          fprintf(fp_locus[i], "\t%.6f", stree->nodes[j]->brate[i]);
+        if (stree->nodes[j]->has_brate)
+          fprintf(fp_locus[i], "\t%.6f", SNODE_LOCUS(stree->nodes[j],i)->brate);
     }
 
     if (opt_print_qmatrix)
@@ -1238,6 +1243,9 @@ static void mcmc_logsample(FILE * fp,
     char * newick = stree_export_newick(stree->root, cb_serialize_branch);
     fprintf(fp, "%s\n", newick);
     free(newick);
+
+    if (online_summary)
+      stree_summary_update(stree);
     return;
   }
 
@@ -1245,6 +1253,15 @@ static void mcmc_logsample(FILE * fp,
   {
     char * newick = stree_export_newick(stree->root, cb_serialize_branch);
     fprintf(fp, "%s %ld\n", newick, ndspecies);
+
+    /* summarize exactly what is logged in the MCMC file */
+    if (online_summary)
+    {
+      char * sample;
+      xasprintf(&sample, "%s %ld", newick, ndspecies);
+      mixed_summary_update(sample);
+      free(sample);
+    }
     free(newick);
     return;
   }
@@ -1315,6 +1332,9 @@ static void mcmc_logsample(FILE * fp,
   }
   else
     fprintf(fp, "\n");
+
+  if (opt_method == METHOD_00 && online_summary)
+    allfixed_online_update(stree,gtree);
 }
 
 static void print_gtree(FILE ** fp, gtree_t ** gtree)
@@ -1572,7 +1592,7 @@ static FILE * resume(stree_t ** ptr_stree,
   gtree_t ** gtree = *ptr_gtree;
   stree_t  * stree = *ptr_stree;
 
-  gtree_alloc_internals(gtree,opt_locus_count);
+  gtree_alloc_internals(stree,gtree,opt_locus_count);
   reset_gene_leaves_count(stree,gtree);
   stree_reset_pptable(stree);
 
@@ -1598,8 +1618,7 @@ static FILE * resume(stree_t ** ptr_stree,
       gtree[i]->nodes[j]->old_pop = NULL;
 
   for (j = 0; j < stree->tip_count + stree->inner_count; ++j)
-    for (i = 0; i < opt_threads; ++i)
-      stree->nodes[j]->mark[i] = 0;
+    stree->nodes[j]->mark[0] = 0;
 
 
   /* set method */
@@ -1700,6 +1719,410 @@ static FILE * resume(stree_t ** ptr_stree,
    NOTE: *ALL* parameters of this function are output parameters, therefore
    do not concentrate on them when reading this function - they are filled
    at the end of the routine */
+/* data shared by the per-locus steps of init() that run on multiple threads */
+typedef struct locus_init_s
+{
+  msa_t ** msa_list;
+  unsigned int ** weights;
+  unsigned int ** tmpwgt;
+  unsigned long ** mapping;
+  unsigned long ** resolution_count;
+  int * unphased_length;
+  stree_t * stree;
+  gtree_t ** gtree;
+  locus_t ** locus;
+  double * logl;
+} locus_init_t;
+
+/* select the character map and site pattern compression method of a locus */
+static int compress_method_select(msa_t * msa, const unsigned int ** pll_map)
+{
+  if (msa->dtype == BPP_DATA_DNA)
+  {
+    *pll_map = pll_map_nt;
+    if (msa->model == BPP_DNA_MODEL_JC69)
+      return COMPRESS_JC69;
+    else if (msa->model == BPP_DNA_MODEL_GTR)
+      return COMPRESS_GENERAL;
+
+    /* TODO: Custom compression routines for the various models */
+    return COMPRESS_GENERAL;
+  }
+  else if (msa->dtype == BPP_DATA_AA)
+  {
+    *pll_map = pll_map_aa;
+    return COMPRESS_GENERAL;
+  }
+
+  assert(0);
+  return COMPRESS_GENERAL;
+}
+
+/* remove or count ambiguous sites, compress site patterns and compute base
+   frequencies of locus i */
+static void cb_compress_locus(void * arg, long i)
+{
+  locus_init_t * li = (locus_init_t *)arg;
+  msa_t * msa = li->msa_list[i];
+  const unsigned int * pll_map;
+  int compress_method;
+
+  /* remove ambiguous sites */
+  if (opt_cleandata)
+  {
+    if (msa->dtype != BPP_DATA_AA && !msa_remove_ambiguous(msa))
+      fatal("All sites in locus %ld contain ambiguous characters",i);
+  }
+  else
+    msa_count_ambiguous_sites(msa, pll_map_amb);
+
+  compress_method = compress_method_select(msa,&pll_map);
+
+  msa->freqs = NULL;
+
+  /* NOTE: Original length is the length after opt_cleandata is applied */
+  msa->original_length = msa->length;
+  li->weights[i] = compress_site_patterns(msa->sequence,
+                                          pll_map,
+                                          msa->count,
+                                          &(msa->length),
+                                          compress_method);
+
+  /* compute base frequencies */
+  compute_base_freqs(msa, li->weights[i], pll_map);
+}
+
+/* compress the phased alignment of locus i and get the mapping of sites */
+static void cb_compress_diploid(void * arg, long i)
+{
+  locus_init_t * li = (locus_init_t *)arg;
+  msa_t * msa = li->msa_list[i];
+  const unsigned int * pll_map;
+  int compress_method;
+
+  assert(msa->dtype == BPP_DATA_DNA);
+  compress_method = compress_method_select(msa,&pll_map);
+
+  /* compress again for JC69 and get mappings */
+  li->mapping[i] = compress_site_patterns_diploid(msa->sequence,
+                                                  pll_map,
+                                                  msa->count,
+                                                  &(msa->length),
+                                                  li->tmpwgt+i,
+                                                  compress_method);
+}
+
+/* create the locus structure for alignment i and set its pattern weights and
+   tip states */
+static void cb_create_locus(void * arg, long i)
+{
+  long j;
+  int states = 0;
+  locus_init_t * li = (locus_init_t *)arg;
+  msa_t * msa = li->msa_list[i];
+  gtree_t * gtree = li->gtree[i];
+  stree_t * stree = li->stree;
+  const unsigned int * pll_map = NULL;
+  unsigned int pmatrix_count = gtree->edge_count;
+  unsigned int scale_buffers = opt_scaling ? 2*gtree->inner_count : 0;
+  unsigned int attributes = (unsigned int)opt_arch;
+  locus_t * locus;
+
+  /* activate twice as many transition probability matrices (for reverting in
+     locusrate, species tree SPR and mixing proposals)  */
+  pmatrix_count *= 2;               /* double to account for cloned */
+
+  /* TODO: In the future we can allocate double amount of p-matrices
+     for the other methods as well in order to speedup rollback when
+     rejecting proposals */
+
+  if (msa->dtype == BPP_DATA_DNA)
+  {
+    states = 4;
+    pll_map = pll_map_nt;
+  }
+  else if (msa->dtype == BPP_DATA_AA)
+  {
+    states = 20;
+    pll_map = pll_map_aa;
+  }
+  else
+    fatal("Internal error when setting states for locus %ld", i);
+
+  /* store DNA tips as packed state codes instead of CLVs. The rev_gspr
+     proposal reads tip CLVs directly and hence requires them */
+  if (states == 4 && gtree->tip_count > 1 && !opt_rev_gspr)
+    attributes |= PLL_ATTRIB_PATTERN_TIP;
+
+  /* create the locus structure */
+  locus = locus_create((unsigned int)(msa->dtype),   /* data type */
+                       (unsigned int)(msa->model),   /* subst model */
+                       gtree->tip_count,             /* # tip sequence */
+                       2*gtree->inner_count,         /* # CLV vectors */
+                       states,                       /* # states */
+                       msa->length,                  /* sequence length */
+                       rate_matrices,                /* subst matrices (1) */
+                       pmatrix_count,                /* # prob matrices */
+                       opt_alpha_cats,               /* # rate categories */
+                       scale_buffers,                /* # scale buffers */
+                       attributes);                  /* attributes */
+  li->locus[i] = locus;
+
+  if (opt_diploid)
+  {
+    for (j = 0; j < (long)(stree->tip_count); ++j)
+      if (stree->nodes[j]->diploid)
+      {
+        locus->diploid = 1;
+        break;
+      }
+  }
+
+  /* set pattern weights and free the weights array */
+  if (locus->diploid)
+  {
+    /* TODO: 1) pattern_weights_sum is not updated here, but it is not used in
+       the program, perhaps remove.
+       2) pattern_weights is allocated in locus_create with a size msa->length
+          equal to length of A3, but in reality we only need |A1| storage
+          space. Free and reallocate here. *UPDATE* Actually |A1| may be larger
+          than |A3| !! */
+
+    free(locus->pattern_weights);
+    locus->pattern_weights = (unsigned int *)xmalloc((size_t)
+                               (li->unphased_length[i])*sizeof(unsigned int));
+
+    locus->diploid_mapping = li->mapping[i];
+    locus->diploid_resolution_count = li->resolution_count[i];
+    /* since PLL does not support diploid sequences we make a small hack */
+    memcpy(locus->pattern_weights,
+           li->weights[i],
+           li->unphased_length[i]*sizeof(unsigned int));
+    free(li->weights[i]);
+    locus->likelihood_vector = (double *)xmalloc((size_t)(msa->length) *
+                                                 sizeof(double));
+    locus->unphased_length = li->unphased_length[i];
+  }
+  else
+  {
+    pll_set_pattern_weights(locus, li->weights[i]);
+    free(li->weights[i]);
+  }
+
+  /* set tip sequences */
+  for (j = 0; j < (int)(gtree->tip_count); ++j)
+    pll_set_tip_states(locus, j, pll_map, msa->sequence[j]);
+}
+
+/* compute the conditional probabilities for each inner node of gene tree i
+   and the log-likelihood of the gene tree */
+static void cb_locus_loglikelihood(void * arg, long i)
+{
+  locus_init_t * li = (locus_init_t *)arg;
+  locus_t * locus = li->locus[i];
+  gtree_t * gtree = li->gtree[i];
+
+  locus_update_matrices(locus,
+                        gtree,
+                        gtree->nodes,
+                        li->stree,
+                        i,
+                        gtree->edge_count);
+  locus_update_partials(locus,
+                        gtree->nodes+gtree->tip_count,
+                        gtree->inner_count);
+
+  li->logl[i] = locus_root_loglikelihood(locus,
+                                         gtree->root,
+                                         locus->param_indices,
+                                         NULL);
+}
+
+/* independent replicates are initialized by init(), see the MC3 section */
+static void replicates_init(stree_t * stree,
+                            gtree_t ** gtree,
+                            locus_t ** locus,
+                            msa_t ** msa_list,
+                            list_t * map_list,
+                            long msa_count,
+                            FILE * fp_out);
+
+/* draw initial heredity scalars around the mean of their prior */
+static void init_heredity(stree_t * stree, double * heredity)
+{
+  long i;
+
+  for (i = 0; i < opt_locus_count; ++i)
+    heredity[i] = opt_heredity_alpha /
+                  opt_heredity_beta*(0.8 + 0.4*legacy_rndu(0));
+
+  /* TODO: Perhaps we can avoid the check every 100-th term by using the log
+     of heredity scaler from the beginning. E.g. if this loop is replaced by
+     
+     for (j = 0; j < opt_locus_count; ++j)
+       logpr -= log(locus[j]->heredity[0]);
+
+     then we only need to add and subtract the two corresponding heredity
+     multipliers (the old and new)
+  */
+  if (!opt_est_theta)
+  {
+    double hfactor = 0;
+    double y = 1;
+    for (i = 0; i < opt_locus_count; ++i)
+    {
+      y *= heredity[i];
+      if ((i+1) % 100 == 0)
+      {
+        hfactor -= log(y);
+        y = 1;
+      }
+    }
+    hfactor -= log(y);
+    stree->notheta_hfactor = hfactor;
+  }
+}
+
+/* draw initial locus mutation rates with a mean of one */
+static void init_locusrate(double * locusrate)
+{
+  long i;
+  double mean = 0;
+
+  for (i = 0; i < opt_locus_count; ++i)
+  {
+    locusrate[i] = 0.8 + 0.4*legacy_rndu(thread_index_zero);
+    mean += locusrate[i];
+  }
+
+  mean /= opt_locus_count;
+
+  for (i = 0; i < opt_locus_count; ++i)
+    locusrate[i] /= mean;
+}
+
+/* draw the initial mutation rate of a locus under the hierarchical prior and
+   the initial branch rates of the relaxed clock */
+static void init_locus_rates(stree_t * stree, gtree_t * gtree, long msa_index)
+{
+  long j;
+
+  if (opt_est_locusrate == MUTRATE_ESTIMATE &&
+      opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL)
+  {
+    long thread_index = 0;
+
+    gtree->rate_mui  = stree->locusrate_mubar;
+    if (!opt_debug_rates)
+      gtree->rate_mui *= (.9 + .2*legacy_rndu(thread_index));
+  }
+
+  if (opt_clock != BPP_CLOCK_GLOBAL)
+  {
+    long thread_index = 0;
+
+    gtree->rate_nui = stree->locusrate_nubar;
+
+    /* TODO: Remove if condition after debugging */
+    if (!opt_debug_rates)
+      gtree->rate_nui *= (.9 + .2*legacy_rndu(thread_index));
+
+    for (j = 0; j < stree->tip_count+stree->inner_count+stree->hybrid_count; ++j)
+    {
+      snode_t * node = stree->nodes[j];
+
+      /* Mirror nodes in bidirectional introgression */
+      if (opt_msci && node->hybrid)
+      {
+        if (node_is_hybridization(node) && !node->htau) continue;
+        if (node_is_bidirection(node) && node_is_mirror(node)) continue;
+      }
+
+      /* set values around Log-Normal mean */
+      /* TODO: Keep only else after debugging */
+      if (opt_debug_rates)
+        SNODE_LOCUS(node,msa_index)->brate = gtree->rate_mui;
+      else
+      {
+        if (opt_clock == BPP_CLOCK_CORR && !node->parent)  /* root node */
+          SNODE_LOCUS(node,msa_index)->brate = gtree->rate_mui;
+        else
+          SNODE_LOCUS(node,msa_index)->brate = gtree->rate_mui *
+                           (.9+.2*legacy_rndu(thread_index));
+      }
+    }
+    gtree->lnprior_rates   = lnprior_rates(gtree,stree,msa_index);
+
+    stree->nui_sum += gtree->rate_nui;
+  }
+}
+
+/* compute the log-likelihood and the MSC density of the initial gene trees of
+   all loci, and return their sums */
+static void init_logl_logpr(stree_t * stree,
+                            gtree_t ** gtree,
+                            locus_t ** locus,
+                            long msa_count,
+                            double * ptr_logl_sum,
+                            double * ptr_logpr_sum)
+{
+  long i,j;
+  double logl,logpr;
+  double logl_sum = 0;
+  double logpr_sum = 0;
+  locus_init_t li;
+
+  memset(&li, 0, sizeof(locus_init_t));
+  li.stree = stree;
+  li.gtree = gtree;
+  li.locus = locus;
+
+  /* compute the log-likelihood of each locus on multiple threads */
+  li.logl = (double *)xmalloc((size_t)msa_count * sizeof(double));
+  threads_parallel_for(msa_count, cb_locus_loglikelihood, (void *)&li);
+
+  for (i = 0; i < msa_count; ++i)
+  {
+    logl = li.logl[i];
+    logl_sum += logl;
+    if (isinf(logl))
+      fatal("\n[ERROR] log-L for locus %ld is -inf.\n"
+            "Please run BPP with numerical scaling. This is enabled by adding the line:\n"
+            "\n  scaling = 1\n\nto the control file", i+1);
+
+    /* store current log-likelihood in each gene tree structure */
+    gtree[i]->logl = logl;
+    if (opt_est_theta)
+    {
+      logpr = gtree_logprob(stree,locus[i]->heredity[0],i,thread_index_zero);
+      gtree[i]->logpr = logpr;
+      logpr_sum += logpr;
+    }
+    else
+    {
+      for (j = 0; j < stree->tip_count + stree->inner_count; ++j)
+        logpr_sum += gtree_update_logprob_contrib(stree->nodes[j],
+                                                  locus[i]->heredity[0],
+                                                  i,
+                                                  thread_index_zero);
+    }
+  }
+  if (!opt_est_theta)
+  {
+    logpr_sum = 0;
+    for (j = 0; j < stree->tip_count + stree->inner_count; ++j)
+      logpr_sum += stree->nodes[j]->notheta_logpr_contrib;
+    stree->notheta_logpr += logpr_sum;
+    stree->notheta_old_logpr = 0;
+
+    logpr_sum = stree->notheta_logpr;
+  }
+  free(li.logl);
+
+  *ptr_logl_sum = logl_sum;
+  *ptr_logpr_sum = logpr_sum;
+}
+
 static FILE * init(stree_t ** ptr_stree,
                    gtree_t *** ptr_gtree,
                    locus_t *** ptr_locus,
@@ -1719,16 +2142,14 @@ static FILE * init(stree_t ** ptr_stree,
                    FILE *** ptr_fp_locus,
                    FILE ** ptr_fp_out)
 {
-  long i,j;
+  long i;
   long msa_count;
   long pindex;
-  double logl,logpr;
   double logl_sum = 0;
   double logpr_sum = 0;
   double * pjump;
   list_t * map_list = NULL;
   stree_t * stree;
-  const unsigned int * pll_map;
   FILE * fp_mcmc = NULL;
   FILE * fp_out;
   FILE ** fp_gtree;
@@ -1759,16 +2180,38 @@ static FILE * init(stree_t ** ptr_stree,
     print_network_table(stree);
   }
 
-  /* parse the phylip file */
-  phylip_t * fd = phylip_open(opt_msafile, pll_map_fasta);
-  assert(fd);
+  /* read preprocessed loci from the cache file if it matches the input */
+  cache_t * cache = NULL;
+  FILE * fp_cache = NULL;
+  uint64_t cache_key = 0;
+  unsigned int ** weights = NULL;
 
-  printf("Parsing phylip file...");
-  msa_list = phylip_parse_multisequential(fd, &msa_count);
-  assert(msa_list);
-  printf(" Done\n");
+  if (opt_cachefile)
+  {
+    cache_key = cache_hash(stree);
+    cache = cache_open(opt_cachefile, cache_key);
+  }
+
+  if (cache)
+  {
+    printf("Reading preprocessed loci from %s...", opt_cachefile);
+    msa_list = cache_read_msa(cache, &weights);
+    msa_count = cache->msa_count;
+    printf(" Done\n");
+  }
+  else
+  {
+    /* parse the phylip file */
+    phylip_t * fd = phylip_open(opt_msafile, pll_map_fasta);
+    assert(fd);
+
+    printf("Parsing phylip file...");
+    msa_list = phylip_parse_multisequential(fd, &msa_count);
+    assert(msa_list);
+    printf(" Done\n");
 
-  phylip_close(fd);
+    phylip_close(fd);
+  }
   if (opt_locus_count > msa_count)
     fatal("Expected %ld loci but found only %ld", opt_locus_count, msa_count);
 
@@ -1845,67 +2288,29 @@ static FILE * init(stree_t ** ptr_stree,
     }
   }
 
-  /* remove ambiguous sites */
-  if (opt_cleandata)
-  {
-    printf("Removing sites containing ambiguous characters...");
-    for (i = 0; i < msa_count; ++i)
-    {
-      if (msa_list[i]->dtype == BPP_DATA_AA)
-        continue;
-
-      if (!msa_remove_ambiguous(msa_list[i]))
-        fatal("All sites in locus %d contain ambiguous characters",i);
-    }
-    printf(" Done\n");
-  }
-  else
-  {
-    for (i = 0; i < msa_count; ++i)
-      msa_count_ambiguous_sites(msa_list[i], pll_map_amb);
-  }
+  /* remove ambiguous sites and compress the alignments */
+  locus_init_t li;
+  memset(&li, 0, sizeof(locus_init_t));
+  li.msa_list = msa_list;
+  li.stree = stree;
 
-  /* compress it */
-  unsigned int ** weights = (unsigned int **)xmalloc(msa_count *
-                                                     sizeof(unsigned int *));
-  for (i = 0; i < msa_count; ++i)
+  if (!cache)
   {
-    int compress_method;
-
-    if (msa_list[i]->dtype == BPP_DATA_DNA)
-    {
-      pll_map = pll_map_nt;
-      if (msa_list[i]->model == BPP_DNA_MODEL_JC69)
-        compress_method = COMPRESS_JC69;
-      else if (msa_list[i]->model == BPP_DNA_MODEL_GTR)
-        compress_method = COMPRESS_GENERAL;
-      else
-      {
-        /* TODO: Custom compression routines for the various models */
-        compress_method = COMPRESS_GENERAL;
-      }
-    }
-    else if (msa_list[i]->dtype == BPP_DATA_AA)
-    {
-      pll_map = pll_map_aa;
-      compress_method = COMPRESS_GENERAL;
-    }
-    else
-      assert(0);
+    weights = (unsigned int **)xmalloc(msa_count * sizeof(unsigned int *));
+    li.weights = weights;
 
-    msa_list[i]->freqs = NULL;
-
-    /* NOTE: Original length is the length after opt_cleandata is applied */
-    msa_list[i]->original_length = msa_list[i]->length;
-    weights[i] = compress_site_patterns(msa_list[i]->sequence,
-                                        pll_map,
-                                        msa_list[i]->count,
-                                        &(msa_list[i]->length),
-                                        compress_method);
+    if (opt_cleandata)
+      printf("Removing sites containing ambiguous characters...");
+    threads_parallel_for(msa_count, cb_compress_locus, (void *)&li);
+    if (opt_cleandata)
+      printf(" Done\n");
 
-    /* compute base frequencies */
-    compute_base_freqs(msa_list[i], weights[i], pll_map);
+    /* store the compressed alignments for later runs on the same data */
+    if (opt_cachefile &&
+        (fp_cache = cache_create(opt_cachefile, cache_key, msa_count)))
+      cache_write_msa(fp_cache, msa_list, weights, msa_count);
   }
+  li.weights = weights;
 
   msa_summary(msa_list,msa_count);
 
@@ -1987,59 +2392,48 @@ static FILE * init(stree_t ** ptr_stree,
     for (i = 0; i < msa_count; ++i)
       unphased_length[i] = msa_list[i]->length;
 
-    /* compute and replace msa_list with alignments A3. resolution_count
-       contains the number of resolved sites in A2 for each site in A1,
-       i.e. resolution_count[0][3] contains the number of resolved sites in A2
-       for the fourth site of locus 0 */
-    resolution_count = diploid_resolve(stree,
-                                       msa_list,
-                                       map_list,
-                                       weights,
-                                       msa_count);
-
-    /* TODO: KEEP WEIGHTS */
-    //for (i = 0; i < msa_count; ++i) free(weights[i]);
-
-    mapping = (unsigned long **)xmalloc((size_t)msa_count *
-                                        sizeof(unsigned long *));
-
-    /* allocate temporary array for storing pattern weights for alignment A3 */
-    unsigned int ** tmpwgt = (unsigned int **)xmalloc((size_t)(msa_count) *
-                                                      sizeof(unsigned int *));
-    for (i = 0; i < msa_count; ++i)
-    {
-      int compress_method;
-
-      assert(msa_list[i]->dtype == BPP_DATA_DNA);
-      if (msa_list[i]->dtype == BPP_DATA_DNA)
-      {
-        pll_map = pll_map_nt;
-        if (msa_list[i]->model == BPP_DNA_MODEL_JC69)
-          compress_method = COMPRESS_JC69;
-        else if (msa_list[i]->model == BPP_DNA_MODEL_GTR)
-          compress_method = COMPRESS_GENERAL;
-        else
-        {
-          /* TODO: Custom compression routines for the various models */
-          compress_method = COMPRESS_GENERAL;
-        }
-      }
-      else if (msa_list[i]->dtype == BPP_DATA_AA)
-      {
-        pll_map = pll_map_aa;
-        compress_method = COMPRESS_GENERAL;
-      }
-      else
-        assert(0);
+    /* temporary array for storing pattern weights for alignment A3 */
+    unsigned int ** tmpwgt;
 
-      /* compress again for JC69 and get mappings */
-      mapping[i] = compress_site_patterns_diploid(msa_list[i]->sequence,
-                                                  pll_map,
-                                                  msa_list[i]->count,
-                                                  &(msa_list[i]->length),
-                                                  tmpwgt+i,
-                                                  compress_method);
+    if (cache)
+    {
+      cache_read_diploid(cache, msa_list, &tmpwgt, &resolution_count, &mapping);
+      diploid_update_maplist(stree, map_list);
+    }
+    else
+    {
+      /* compute and replace msa_list with alignments A3. resolution_count
+         contains the number of resolved sites in A2 for each site in A1,
+         i.e. resolution_count[0][3] contains the number of resolved sites in
+         A2 for the fourth site of locus 0 */
+      resolution_count = diploid_resolve(stree,
+                                         msa_list,
+                                         map_list,
+                                         weights,
+                                         msa_count);
+
+      /* TODO: KEEP WEIGHTS */
+      //for (i = 0; i < msa_count; ++i) free(weights[i]);
+
+      mapping = (unsigned long **)xmalloc((size_t)msa_count *
+                                          sizeof(unsigned long *));
+
+      tmpwgt = (unsigned int **)xmalloc((size_t)(msa_count) *
+                                        sizeof(unsigned int *));
+      li.mapping = mapping;
+      li.tmpwgt = tmpwgt;
+      threads_parallel_for(msa_count, cb_compress_diploid, (void *)&li);
+
+      if (fp_cache)
+        cache_write_diploid(fp_cache,
+                            msa_list,
+                            tmpwgt,
+                            resolution_count,
+                            mapping,
+                            unphased_length,
+                            msa_count);
     }
+
     fprintf(fp_out, "COMPRESSED ALIGNMENTS AFTER PHASING OF DIPLOID SEQUENCES\n\n");
     msa_print_phylip(fp_out,msa_list,msa_count,tmpwgt);
 
@@ -2050,16 +2444,26 @@ static FILE * init(stree_t ** ptr_stree,
 
   }
 
+  if (cache)
+    cache_close(cache);
+  if (fp_cache)
+  {
+    printf("Writing preprocessed loci to %s...", opt_cachefile);
+    cache_finalize(fp_cache, opt_cachefile);
+    printf(" Done\n");
+  }
+
   /* Pin master thread for NUMA first policy touch
      TODO: Perhaps move this to an earlier point */
   if (opt_threads > 1)
     threads_pin_master();
 
 
-  /* allocate TLS mark variables on stree as they are used in delimitations_init
+  /* allocate mark variables on stree as they are used in delimitations_init.
+     Marks used by the parallel moves live in the per-thread scratch space
      TODO: Move this allocation somewhere else */
   for (i = 0; i < stree->tip_count+stree->inner_count+stree->hybrid_count; ++i)
-    stree->nodes[i]->mark = (int *)xcalloc((size_t)opt_threads,sizeof(int));
+    stree->nodes[i]->mark = (int *)xcalloc(1,sizeof(int));
 
   if (opt_method == METHOD_10)          /* species delimitation */
   {
@@ -2092,37 +2496,7 @@ static FILE * init(stree_t ** ptr_stree,
 
   /* initialize heredity scalars if estimation was selected */
   if (opt_est_heredity == HEREDITY_ESTIMATE)
-  {
-    for (i = 0; i < opt_locus_count; ++i)
-      heredity[i] = opt_heredity_alpha /
-                    opt_heredity_beta*(0.8 + 0.4*legacy_rndu(0));
-
-    /* TODO: Perhaps we can avoid the check every 100-th term by using the log
-       of heredity scaler from the beginning. E.g. if this loop is replaced by
-       
-       for (j = 0; j < opt_locus_count; ++j)
-         logpr -= log(locus[j]->heredity[0]);
-
-       then we only need to add and subtract the two corresponding heredity
-       multipliers (the old and new)
-    */
-    if (!opt_est_theta)
-    {
-      double hfactor = 0;
-      double y = 1;
-      for (i = 0; i < opt_locus_count; ++i)
-      {
-        y *= heredity[i];
-        if ((i+1) % 100 == 0)
-        {
-          hfactor -= log(y);
-          y = 1;
-        }
-      }
-      hfactor -= log(y);
-      stree->notheta_hfactor = hfactor;
-    }
-  }
+    init_heredity(stree,heredity);
   else if (opt_est_heredity == HEREDITY_FROMFILE)
   {
     long errcontext = 0;
@@ -2148,20 +2522,8 @@ static FILE * init(stree_t ** ptr_stree,
   if (opt_est_locusrate == MUTRATE_ESTIMATE &&
       (opt_locusrate_prior == BPP_LOCRATE_PRIOR_GAMMADIR ||
        opt_locusrate_prior == BPP_LOCRATE_PRIOR_DIR))
-  {
-    double mean = 0;
-    for (i = 0; i < opt_locus_count; ++i)
-    {
-      locusrate[i] = 0.8 + 0.4*legacy_rndu(thread_index_zero);
-      mean += locusrate[i];
-    }
-
-    mean /= opt_locus_count;
-
-    for (i = 0; i < opt_locus_count; ++i)
-      locusrate[i] /= mean;
-  }
-  else if (opt_est_locusrate == MUTRATE_FROMFILE)
+    init_locusrate(locusrate);
+  else if (opt_est_locusrate == MUTRATE_FROMFILE)
   {
     long errcontext = 0;
     int rc = parsefile_doubles(opt_locusrate_filename,
@@ -2242,315 +2604,1182 @@ static FILE * init(stree_t ** ptr_stree,
 
   stree->nui_sum = 0;
 
+  /* create the locus structures on multiple threads */
+  li.gtree = gtree;
+  li.locus = locus;
+  li.mapping = mapping;
+  li.resolution_count = resolution_count;
+  li.unphased_length = unphased_length;
+  threads_parallel_for(msa_count, cb_create_locus, (void *)&li);
+
+  /* initial values of parameters are drawn serially in locus order */
   for (i = 0, pindex=0; i < msa_count; ++i)
   {
-    int states = 0;
-    unsigned int pmatrix_count = gtree[i]->edge_count;
-    msa_t * msa = msa_list[i];
-    unsigned int scale_buffers = opt_scaling ?
-                                   2*gtree[i]->inner_count : 0;
+    /* set frequencies and substitution rates */
+    /* TODO: For GTR perhaps set to empirical frequencies */
+    locus_set_frequencies_and_rates(locus[i]);
+
+    /* set rate of evolution and heredity scalar for each locus */
+    gtree[i]->rate_mui = locusrate[i];
+    locus_set_heredity_scalers(locus[i],heredity+i);
+
+    init_locus_rates(stree,gtree[i],i);
+  }
+
+  init_logl_logpr(stree,gtree,locus,msa_count,&logl_sum,&logpr_sum);
+
+  /* Reading constraints file */
+  if (opt_constfile)
+  {
+    fprintf(stdout, "Reading constraint file %s\n", opt_constfile);
+    fprintf(fp_out, "Reading constraint file %s\n", opt_constfile);
+    parse_and_set_constraints(stree, fp_out);
+  }
 
-    /* activate twice as many transition probability matrices (for reverting in
-       locusrate, species tree SPR and mixing proposals)  */
-    pmatrix_count *= 2;               /* double to account for cloned */
+  /* deallocate unnecessary arrays */
+  free(locusrate);
+  free(heredity);
+  if (opt_diploid)
+  {
+    free(mapping);
+    free(unphased_length);
+    free(resolution_count);
+  }
 
-    /* TODO: In the future we can allocate double amount of p-matrices
-       for the other methods as well in order to speedup rollback when
-       rejecting proposals */
+  #if 0
+  debug_print_network_node_attribs(stree);
+  #endif
+
+  fprintf(stdout,"\nInitial MSC density and log-likelihood of observing data:\n");
+  fprintf(stdout,"log-PG0 = %f   log-L0 = %f\n\n", logpr_sum, logl_sum);
+  fprintf(fp_out,"\nInitial MSC density and log-likelihood of observing data:\n");
+  fprintf(fp_out,"log-PG0 = %f   log-L0 = %f\n\n", logpr_sum, logl_sum);
+
+  if (isinf(logl_sum))
+    fatal("\n[ERROR] The sum of log-L for all loci is -inf.\n"
+          "Please run BPP with numerical scaling. This is enabled by adding the line:\n"
+          "\n  scaling = 1\n\nto the control file");
 
-    if (msa_list[i]->dtype == BPP_DATA_DNA)
+  /* independent replicates draw their initial states from the alignments */
+  if (opt_replicates > 1 && !opt_onlysummary)
+    replicates_init(stree,gtree,locus,msa_list,map_list,msa_count,fp_out);
+
+  /* free weights array */
+  free(weights);
+
+  if (opt_est_delimit)          /* species delimitation */
+    rj_init(gtree,stree,msa_count);
+
+  /* initialize pjump and finetune rounds */
+  pjump = (double *)xcalloc(PROP_COUNT+GTR_PROP_COUNT+CLOCK_PROP_COUNT+1+1,
+                            sizeof(double));
+
+  /* TODO: Method 10 has a commented call to 'delimit_resetpriors()' */
+  //delimit_resetpriors();
+
+  /* if method 00 or 01 print corresponding header line in MCMC file */
+  if (!opt_onlysummary)
+  {
+    if (opt_method == METHOD_01)
+      mcmc_printinitial(fp_mcmc,stree);
+    else
     {
-      //assert(msa_list[i]->model == BPP_DNA_MODEL_JC69);
-      states = 4;
-      pll_map = pll_map_nt;
+      if (opt_method != METHOD_11)
+        mcmc_printheader(fp_mcmc,stree);
     }
-    else if (msa_list[i]->dtype == BPP_DATA_AA)
+
+    if (opt_print_locusfile)
+      mcmc_printheader_rates(fp_locus,stree,locus);
+  }
+
+  #if 0
+  unsigned long total_steps = opt_samples * opt_samplefreq + opt_burnin;
+  progress_init("Running MCMC...", total_steps);
+  #endif
+
+  /* TODO: This is only for species delimitation */
+  if (opt_est_delimit)          /* species delimitation */
+  {
+    dparam_count = 0;
+    for (i = 0; i < (int)(stree->tip_count + stree->inner_count); ++i)
     {
-      states = 20;
-      pll_map = pll_map_aa;
+      if (opt_est_theta && stree->nodes[i]->theta > 0)
+        dparam_count++;
+      if (stree->nodes[i]->tau > 0)
+        dparam_count++;
     }
+  }
+
+  *ptr_stree = stree;
+  *ptr_gtree = gtree;
+  *ptr_locus = locus;
+  *ptr_pjump = pjump;
+
+  *ptr_curstep = 0;
+  *ptr_ft_round = 0;
+
+  /* species delimitation relevant */
+  *ptr_ft_round_rj = 0;
+  *ptr_dparam_count = dparam_count;
+  *ptr_pjump_rj = 0;
+
+  /* species tree inference relevant */
+  *ptr_ft_round_spr = 0;
+  *ptr_pjump_slider = 0;
+  *ptr_mean_logl = 0;
+
+  *ptr_sclone = sclone;
+  *ptr_gclones = gclones;
+
+  /* deallocate maplist */
+  if (stree->tip_count > 1)
+  {
+    list_clear(map_list,map_dealloc);
+    free(map_list);
+  }
+
+  /* deallocate alignments */
+  for (i = 0; i < msa_count; ++i)
+    msa_destroy(msa_list[i]);
+  free(msa_list);
+
+  return fp_mcmc;
+
+}
+
+/* perform one MCMC iteration (all proposals) on the given species tree and
+   gene trees, and update the acceptance proportions in pjump */
+static void mcmc_proposals(stree_t ** ptr_stree,
+                           gtree_t *** ptr_gtree,
+                           stree_t ** ptr_sclone,
+                           gtree_t *** ptr_gclones,
+                           locus_t ** locus,
+                           long * ptr_ndspecies,
+                           long * ptr_dparam_count,
+                           double * pjump,
+                           long ft_round,
+                           long * ptr_ft_round_rj,
+                           double * ptr_pjump_rj,
+                           long * ptr_ft_round_spr,
+                           long * ptr_pjump_slider,
+                           long step)
+{
+  long j;
+  double ratio;
+  stree_t * stree = *ptr_stree;
+  gtree_t ** gtree = *ptr_gtree;
+
+  /* propose delimitation through merging/splitting of nodes */
+  if (opt_est_delimit)        /* species delimitation */
+  {
+    if (legacy_rndu(thread_index_zero) < 0.5)
+      j = prop_split(gtree,stree,locus,0.5,ptr_dparam_count,ptr_ndspecies);
     else
-      fatal("Internal error when setting states for locus %ld", i);
-
-    /* create the locus structure */
-    locus[i] = locus_create((unsigned int)(msa_list[i]->dtype),        /* data type */
-                            (unsigned int)(msa_list[i]->model),        /* subst model */
-                            gtree[i]->tip_count,        /* # tip sequence */
-                            2*gtree[i]->inner_count,    /* # CLV vectors */
-                            states,                     /* # states */
-                            msa->length,                /* sequence length */
-                            rate_matrices,              /* subst matrices (1) */
-                            pmatrix_count,              /* # prob matrices */
-                            opt_alpha_cats,             /* # rate categories */
-                            scale_buffers,              /* # scale buffers */
-                            (unsigned int)opt_arch);    /* attributes */
+      j = prop_join(gtree,stree,locus,0.5,ptr_dparam_count,ptr_ndspecies);
 
-    /* set frequencies and substitution rates */
-    /* TODO: For GTR perhaps set to empirical frequencies */
-    locus_set_frequencies_and_rates(locus[i]);
+    if (j != 2)
+    {
+      (*ptr_ft_round_rj)++;
+      *ptr_pjump_rj += j;
+    }
+  }
 
-    if (opt_diploid)
+  /* propose species tree topology using SPR */
+  if (*ptr_ndspecies > 2 && (opt_est_stree))
+  {
+    if (legacy_rndu(thread_index_zero) > 0)   /* bpp4 compatible results (RNG to next state) */
     {
-      for (j = 0; j < (long)(stree->tip_count); ++j)
-        if (stree->nodes[j]->diploid)
+      /* quick-and-dirty way of applying constraints on species tree */
+      long ret = 3;
+      long dirty_iters = DIRTY_ITERS;
+      while (ret == 3)
+      {
+        if (!dirty_iters) break;
+        ret = stree_propose_spr(&stree, &gtree, ptr_sclone, ptr_gclones, locus);
+        --dirty_iters;
+      }
+      if (ret == 1)
+      {
+        /* accepted */
+        /* swap the pointers of species tree and gene tree list with cloned */
+        SWAP(stree,*ptr_sclone);
+        SWAP(gtree,*ptr_gclones);
+        stree_label(stree);
+        (*ptr_pjump_slider)++;
+      }
+      if (ret < 2)
+        (*ptr_ft_round_spr)++;
+      /* keeping statistics for max dirty SPRs iters */
+      if (opt_constraint_count)
+      {
+        sum_dirty_iters += DIRTY_ITERS - (dirty_iters+1);
+        if (max_dirty_iters < (DIRTY_ITERS - (dirty_iters+1)))
         {
-          locus[i]->diploid = 1;
-          break;
+          max_dirty_iters = DIRTY_ITERS - (dirty_iters+1);
         }
+      }
     }
+  }
 
-    /* set rate of evolution and heredity scalar for each locus */
-    gtree[i]->rate_mui = locusrate[i];
-    locus_set_heredity_scalers(locus[i],heredity+i);
+  /* perform proposals sequentially */   
 
-    /* set pattern weights and free the weights array */
-    if (locus[i]->diploid)
-    {
-      /* TODO: 1) pattern_weights_sum is not updated here, but it is not used in
-         the program, perhaps remove.
-         2) pattern_weights is allocated in locus_create with a size msa->length
-            equal to length of A3, but in reality we only need |A1| storage
-            space. Free and reallocate here. *UPDATE* Actually |A1| may be larger
-            than |A3| !! */
-
-      free(locus[i]->pattern_weights);
-      locus[i]->pattern_weights = (unsigned int *)xmalloc((size_t)
-                                     (unphased_length[i])*sizeof(unsigned int));
-
-      locus[i]->diploid_mapping = mapping[i];
-      locus[i]->diploid_resolution_count = resolution_count[i];
-      /* since PLL does not support diploid sequences we make a small hack */
-      memcpy(locus[i]->pattern_weights,
-             weights[i],
-             unphased_length[i]*sizeof(unsigned int));
-      free(weights[i]);
-      locus[i]->likelihood_vector = (double *)xmalloc((size_t)(msa->length) *
-                                                      sizeof(double));
-      locus[i]->unphased_length = unphased_length[i];
+
+  /* propose gene tree ages */
+  if (opt_threads == 1)
+    ratio = gtree_propose_ages_serial(locus, gtree, stree);
+  else
+  {
+    td.locus = locus; td.gtree = gtree; td.stree = stree;
+    threads_wakeup(THREAD_WORK_GTAGE,&td);
+    ratio = td.accepted ? ((double)(td.accepted)/td.proposals) : 0;
+  }
+  pjump[BPP_MOVE_GTAGE_INDEX] = (pjump[BPP_MOVE_GTAGE_INDEX]*(ft_round-1)+ratio) /
+                                (double)ft_round;
+
+  /* propose gene tree topologies using SPR */
+  if (opt_threads == 1)
+    ratio = gtree_propose_spr_serial(locus,gtree,stree);
+  else
+  {
+    td.locus = locus; td.gtree = gtree; td.stree = stree;
+    threads_wakeup(THREAD_WORK_GTSPR,&td);
+    ratio = td.accepted ? ((double)(td.accepted)/td.proposals) : 0;
+  }
+  pjump[BPP_MOVE_GTSPR_INDEX] = (pjump[BPP_MOVE_GTSPR_INDEX]*(ft_round-1)+ratio) /
+                                (double)ft_round;
+
+
+  /* propose population sizes on species tree */
+  if (opt_est_theta)
+  {
+    ratio = stree_propose_theta(gtree,locus,stree);
+    pjump[BPP_MOVE_THETA_INDEX] = (pjump[BPP_MOVE_THETA_INDEX]*(ft_round-1)+ratio) /
+                                  (double)ft_round;
+  }
+
+  /* propose species tree taus */
+  if (stree->tip_count > 1 && stree->root->tau > 0)
+  {
+    ratio = stree_propose_tau(gtree,stree,locus);
+    pjump[BPP_MOVE_TAU_INDEX] = (pjump[BPP_MOVE_TAU_INDEX]*(ft_round-1)+ratio) /
+                                (double)ft_round;
+  }
+
+  /* mixing step */
+  ratio = proposal_mixing(gtree,stree,locus);
+  pjump[BPP_MOVE_MIX_INDEX] = (pjump[BPP_MOVE_MIX_INDEX]*(ft_round-1)+ratio) /
+                              (double)ft_round;
+
+  if ((opt_est_locusrate == MUTRATE_ESTIMATE &&
+       opt_locusrate_prior == BPP_LOCRATE_PRIOR_DIR) || opt_est_heredity)
+  {
+    ratio = prop_locusrate_and_heredity(gtree,stree,locus,thread_index_zero);
+    pjump[BPP_MOVE_LRHT_INDEX] = (pjump[BPP_MOVE_LRHT_INDEX]*(ft_round-1)+ratio) /
+                                 (double)ft_round;
+  }
+
+  /* phi proposal */
+  if (opt_msci)
+  {
+    ratio = stree_propose_phi(stree,gtree);
+    pjump[BPP_MOVE_PHI_INDEX] = (pjump[BPP_MOVE_PHI_INDEX]*(ft_round-1)+ratio) /
+                                (double)ft_round;
+  }
+
+  if (enabled_prop_freqs)
+  {
+    if (opt_threads == 1)
+      ratio = locus_propose_freqs_serial(stree,locus,gtree);
+    else
+    {
+      td.locus = locus; td.gtree = gtree;
+      threads_wakeup(THREAD_WORK_FREQS,&td);
+      ratio = td.proposals ? ((double)(td.accepted)/td.proposals) : 0;
     }
+    pjump[BPP_MOVE_FREQS_INDEX] = (pjump[BPP_MOVE_FREQS_INDEX]*(ft_round-1)+ratio) /
+                                  (double)ft_round;
+  }
+
+  if (enabled_prop_qrates)
+  {
+    if (opt_threads == 1)
+      ratio = locus_propose_qrates_serial(stree,locus,gtree);
     else
     {
-      pll_set_pattern_weights(locus[i], weights[i]);
-      free(weights[i]);
+      td.locus = locus; td.gtree = gtree;
+      threads_wakeup(THREAD_WORK_RATES,&td);
+      ratio = td.proposals ? ((double)(td.accepted)/td.proposals) : 0;
     }
+    pjump[BPP_MOVE_QRATES_INDEX] = (pjump[BPP_MOVE_QRATES_INDEX]*(ft_round-1)+ratio) /
+                                  (double)ft_round;
+  }
 
-    /* set tip sequences */
-    for (j = 0; j < (int)(gtree[i]->tip_count); ++j)
-      pll_set_tip_states(locus[i], j, pll_map, msa_list[i]->sequence[j]);
+  if (enabled_prop_alpha)
+  {
+    if (opt_threads == 1)
+      ratio = locus_propose_alpha_serial(stree,locus,gtree);
+    else
+    {
+      td.locus = locus; td.gtree = gtree;
+      threads_wakeup(THREAD_WORK_ALPHA,&td);
+      ratio = td.accepted ? ((double)(td.accepted)/td.proposals) : 0;
+    }
+    pjump[BPP_MOVE_ALPHA_INDEX] = (pjump[BPP_MOVE_ALPHA_INDEX]*(ft_round-1)+ratio) /
+                                  (double)ft_round;
+  }
 
-    if (opt_est_locusrate == MUTRATE_ESTIMATE &&
-        opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL)
+  /* TODO: Delete after debugging */
+  if (opt_debug_rates && step==0)
+  {
+    opt_seed = 1;
+    legacy_init();
+  }
+
+  if (opt_est_locusrate == MUTRATE_ESTIMATE &&
+      (opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL ||
+       opt_locusrate_prior == BPP_LOCRATE_PRIOR_GAMMADIR))
+  {
+    ratio = prop_locusrate_mui(gtree,stree,locus,thread_index_zero);
+    pjump[BPP_MOVE_MUI_INDEX] = (pjump[BPP_MOVE_MUI_INDEX]*(ft_round-1)+ratio) /
+                                (double)ft_round;
+
+    if (opt_est_mubar)
     {
-      long thread_index = 0;
+      ratio = prop_locusrate_mubar(stree,gtree);
+      pjump[BPP_MOVE_MUBAR_INDEX] = (pjump[BPP_MOVE_MUBAR_INDEX]*(ft_round-1)+ratio) /
+                                     (double)ft_round;
+    }
+  }
 
-      gtree[i]->rate_mui  = stree->locusrate_mubar;
-      if (!opt_debug_rates)
-        gtree[i]->rate_mui *= (.9 + .2*legacy_rndu(thread_index));
+  if (opt_clock != BPP_CLOCK_GLOBAL)
+  {
+
+    ratio = prop_locusrate_nui(gtree,stree,locus,thread_index_zero);
+    pjump[BPP_MOVE_NUI_INDEX] = (pjump[BPP_MOVE_NUI_INDEX]*(ft_round-1)+ratio) /
+                                      (double)ft_round;
+
+    if (opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL)
+    {
+      ratio = prop_locusrate_nubar(stree,gtree);
+      pjump[BPP_MOVE_NUBAR_INDEX] = (pjump[BPP_MOVE_NUBAR_INDEX]*(ft_round-1)+ratio) /
+                                        (double)ft_round;
     }
 
-    if (opt_clock != BPP_CLOCK_GLOBAL)
+    if (opt_threads == 1)
+      ratio = prop_branch_rates_serial(gtree,stree,locus);
+    else
     {
-      long thread_index = 0;
+      td.locus = locus; td.gtree = gtree;
+      threads_wakeup(THREAD_WORK_BRATE,&td);
+      ratio = td.proposals ? ((double)(td.accepted)/td.proposals) : 0;
+    }
+    pjump[BPP_MOVE_BRANCHRATE_INDEX] = (pjump[BPP_MOVE_BRANCHRATE_INDEX]*(ft_round-1)+ratio) /
+                                       (double)ft_round;
+  }
 
-      gtree[i]->rate_nui = stree->locusrate_nubar;
+  *ptr_stree = stree;
+  *ptr_gtree = gtree;
+}
 
-      /* TODO: Remove if condition after debugging */
-      if (!opt_debug_rates)
-        gtree[i]->rate_nui *= (.9 + .2*legacy_rndu(thread_index));
+/* Metropolis-coupled MCMC (MC3). Chain 0 is the cold chain, whose state lives
+   in cmd_run and is the only one logged. Chain k > 0 samples from the posterior
+   with the likelihood raised to the power beta = 1/(1+k*opt_mc3_heat), on top
+   of the 'BayesFactorBeta' power. Swaps exchange the states of two chains,
+   such that each chain keeps its temperature.
+
+   The same chains are used for estimating the marginal likelihood with the
+   'powerposterior' option. Chain k then runs at beta = ((K-k)/K)^(1/alpha),
+   k=0..K, no swaps are proposed, and the log-likelihood of each chain is
+   recorded at every sample for thermodynamic integration and stepping-stone
+   sampling.
+
+   Independent replicates ('replicates' option) are chains at beta = 1, each
+   with its own seed. Their initial gene trees and parameters are drawn by
+   replicates_init in the same way as those of chain 0, while the alignments
+   are still loaded. Chain 0 is logged as usual and chain k > 0 writes its
+   samples to the MCMC file name suffixed with .k. At the end of the run, every
+   column of the MCMC files (A00), or the log-likelihood and root age (A01 and
+   A11) are summarized for convergence diagnostics. Cloned loci share tip data
+   with the loci of chain 0, see locus_clone */
+typedef struct mc3_chain_s
+{
+  stree_t * stree;
+  gtree_t ** gtree;
+  locus_t ** locus;
+  stree_t * sclone;
+  gtree_t ** gclones;
+  long ndspecies;
+  double beta;
 
-      for (j = 0; j < stree->tip_count+stree->inner_count+stree->hybrid_count; ++j)
-      {
-        snode_t * node = stree->nodes[j];
+  /* acceptance statistics of heated chains (used only for averaging) */
+  double * pjump;
+  long ft_round;
+  long ft_round_rj;
+  double pjump_rj;
+  long ft_round_spr;
+  long pjump_slider;
+  long dparam_count;
 
-        /* Mirror nodes in bidirectional introgression */
-        if (opt_msci && node->hybrid)
-        {
-          if (node_is_hybridization(node) && !node->htau) continue;
-          if (node_is_bidirection(node) && node_is_mirror(node)) continue;
-        }
+  /* log-likelihood samples (power posterior) */
+  double * logl_samples;
+  long logl_count;
 
-        /* set values around Log-Normal mean */
-        /* TODO: Keep only else after debugging */
-        if (opt_debug_rates)
-          node->brate[i] = gtree[i]->rate_mui;
-        else
-        {
-          if (opt_clock == BPP_CLOCK_CORR && !node->parent)  /* root node */
-            node->brate[i] = gtree[i]->rate_mui;
-          else
-            node->brate[i] = gtree[i]->rate_mui *
-                             (.9+.2*legacy_rndu(thread_index));
-        }
-      }
-      gtree[i]->lnprior_rates   = lnprior_rates(gtree[i],stree,i);
-
-      stree->nui_sum += gtree[i]->rate_nui;
-    }
-
-    /* compute the conditional probabilities for each inner node */
-    locus_update_matrices(locus[i],
-                          gtree[i],
-                          gtree[i]->nodes,
-                          stree,
-                          i,
-                          gtree[i]->edge_count);
-    locus_update_partials(locus[i],
-                          gtree[i]->nodes+gtree[i]->tip_count,
-                          gtree[i]->inner_count);
-
-    /* now that we computed the CLVs, calculate the log-likelihood for the
-       current gene tree */
-    logl = locus_root_loglikelihood(locus[i],
-                                    gtree[i]->root,
-                                    locus[i]->param_indices,
-                                    NULL);
-    logl_sum += logl;
-    if (isinf(logl))
-      fatal("\n[ERROR] log-L for locus %d is -inf.\n"
-            "Please run BPP with numerical scaling. This is enabled by adding the line:\n"
-            "\n  scaling = 1\n\nto the control file", i+1);
+  /* seed, random number generator state, MCMC file and traces (replicates) */
+  long seed;
+  uint64_t * rng;
+  char * mcmcfile;
+  FILE * fp_mcmc;
+  stats_t * stats_logl;
+  stats_t * stats_root_age;
+} mc3_chain_t;
+
+static mc3_chain_t * mc3_chains = NULL;
+static long mc3_chain_count = 0;
+static long * mc3_swaps_proposed = NULL;
+static long * mc3_swaps_accepted = NULL;
+static long mc3_iter = 0;
+
+/* draw the initial state of each independent replicate k > 0 from its own seed,
+   with the same procedure used by init() for chain 0. Species trees are copied
+   for their structure only, and loci for their data and substitution model.
+   The generator state of chain 0 is kept and restored at the end */
+static void replicates_init(stree_t * stree,
+                            gtree_t ** gtree,
+                            locus_t ** locus,
+                            msa_t ** msa_list,
+                            list_t * map_list,
+                            long msa_count,
+                            FILE * fp_out)
+{
+  long i,k;
+  long n = opt_replicates;
+  double logl_sum,logpr_sum;
+  double * locusrate;
+  double * heredity;
+
+  /* species trees are copied with stree_clone_init, which ignores hybrid
+     nodes. MSCi models are rejected when parsing the control file */
+  assert(!opt_msci);
+
+  mc3_chain_count = n;
+  mc3_chains = (mc3_chain_t *)xcalloc((size_t)n, sizeof(mc3_chain_t));
+
+  for (k = 0; k < n; ++k)
+    mc3_chains[k].rng = (uint64_t *)xmalloc((size_t)(opt_threads *
+                                                     RNG_STATE_WORDS) *
+                                            sizeof(uint64_t));
+
+  for (i = 0; i < opt_threads; ++i)
+    rng_get_state(i, mc3_chains[0].rng + i*RNG_STATE_WORDS);
+  mc3_chains[0].seed = opt_seed;
+
+  locusrate = (double *)xmalloc((size_t)msa_count * sizeof(double));
+  heredity = (double *)xmalloc((size_t)msa_count * sizeof(double));
+
+  fprintf(stdout, "\nReplicates: %ld independent chains\n", n);
+  fprintf(fp_out, "\nReplicates: %ld independent chains\n", n);
+  fprintf(stdout, " Chain 0 : seed = %ld\n", opt_seed);
+  fprintf(fp_out, " Chain 0 : seed = %ld\n", opt_seed);
+  for (k = 1; k < n; ++k)
+  {
+    mc3_chain_t * c = mc3_chains+k;
 
-    /* store current log-likelihood in each gene tree structure */
-    gtree[i]->logl = logl;
-    if (opt_est_theta)
+    c->seed = rng_replicate_seed(k);
+    rng_seed(c->seed);
+
+    /* population sizes and speciation times */
+    c->stree = stree_clone_init(stree);
+    stree_init_replicate(c->stree);
+
+    /* heredity scalars and locus rates that are not estimated are those of
+       chain 0 */
+    for (i = 0; i < msa_count; ++i)
     {
-      logpr = gtree_logprob(stree,locus[i]->heredity[0],i,thread_index_zero);
-      gtree[i]->logpr = logpr;
-      logpr_sum += logpr;
+      heredity[i] = locus[i]->heredity[0];
+      locusrate[i] = gtree[i]->rate_mui;
     }
+    if (opt_est_heredity == HEREDITY_ESTIMATE)
+      init_heredity(c->stree,heredity);
+    if (opt_est_locusrate == MUTRATE_ESTIMATE &&
+        (opt_locusrate_prior == BPP_LOCRATE_PRIOR_GAMMADIR ||
+         opt_locusrate_prior == BPP_LOCRATE_PRIOR_DIR))
+      init_locusrate(locusrate);
+
+    /* gene trees */
+    c->gtree = gtree_init_replicate(c->stree,msa_list,map_list,msa_count);
+    gtree_update_branch_lengths(c->gtree, msa_count);
+
+    /* loci and rates */
+    c->stree->nui_sum = 0;
+    c->locus = (locus_t **)xmalloc((size_t)msa_count*sizeof(locus_t *));
+    for (i = 0; i < msa_count; ++i)
+    {
+      c->locus[i] = locus_clone(locus[i]);
+      c->gtree[i]->rate_mui = locusrate[i];
+      locus_set_heredity_scalers(c->locus[i],heredity+i);
+      init_locus_rates(c->stree,c->gtree[i],i);
+    }
+
+    init_logl_logpr(c->stree,c->gtree,c->locus,msa_count,&logl_sum,&logpr_sum);
+
+    fprintf(stdout, " Chain %ld : seed = %ld   log-PG0 = %f   log-L0 = %f\n",
+            k, c->seed, logpr_sum, logl_sum);
+    fprintf(fp_out, " Chain %ld : seed = %ld   log-PG0 = %f   log-L0 = %f\n",
+            k, c->seed, logpr_sum, logl_sum);
+
+    for (i = 0; i < opt_threads; ++i)
+      rng_get_state(i, c->rng + i*RNG_STATE_WORDS);
+  }
+  fprintf(stdout, "\n");
+  fprintf(fp_out, "\n");
+
+  for (i = 0; i < opt_threads; ++i)
+    rng_set_state(i, mc3_chains[0].rng + i*RNG_STATE_WORDS);
+
+  free(locusrate);
+  free(heredity);
+}
+
+static void mc3_init(stree_t * stree,
+                     gtree_t ** gtree,
+                     locus_t ** locus,
+                     long ndspecies,
+                     FILE * fp_out)
+{
+  long i,k;
+  long n = opt_mc3_chains;
+  int pjump_size = PROP_COUNT + 1+1 + GTR_PROP_COUNT + CLOCK_PROP_COUNT;
+
+  if (opt_powerposterior)
+    n = opt_powerposterior+1;
+  else if (opt_replicates > 1)
+    n = opt_replicates;
+
+  /* species trees are copied with stree_clone_init, which ignores hybrid
+     nodes. MSCi models are rejected when parsing the control file */
+  assert(!opt_msci);
+
+  /* the chains of independent replicates are allocated by replicates_init */
+  mc3_chain_count = n;
+  if (!mc3_chains)
+    mc3_chains = (mc3_chain_t *)xcalloc((size_t)n, sizeof(mc3_chain_t));
+  mc3_swaps_proposed = (long *)xcalloc((size_t)(n*n), sizeof(long));
+  mc3_swaps_accepted = (long *)xcalloc((size_t)(n*n), sizeof(long));
+  mc3_iter = 0;
+
+  mc3_chains[0].beta = 1;
+
+  /* heated chains start from a copy of the initial state of the cold chain,
+     and independent replicates from their own initial state */
+  for (k = 1; k < n; ++k)
+  {
+    mc3_chain_t * c = mc3_chains+k;
+
+    if (opt_powerposterior)
+      c->beta = pow((double)(n-1-k)/(n-1), 1/opt_powerposterior_alpha);
+    else if (opt_replicates > 1)
+      c->beta = 1;
     else
+      c->beta = 1 / (1 + k*opt_mc3_heat);
+    c->ndspecies = ndspecies;
+
+    if (opt_replicates == 1)
     {
-      for (j = 0; j < stree->tip_count + stree->inner_count; ++j)
-        logpr_sum += gtree_update_logprob_contrib(stree->nodes[j],
-                                                  locus[i]->heredity[0],
-                                                  i,
-                                                  thread_index_zero);
+      c->stree = stree_clone_with_gtrees(stree, gtree, &c->gtree);
+
+      c->locus = (locus_t **)xmalloc((size_t)opt_locus_count *
+                                     sizeof(locus_t *));
+      for (i = 0; i < opt_locus_count; ++i)
+      {
+        c->locus[i] = locus_clone(locus[i]);
+        c->gtree[i]->logl *= c->beta;
+      }
+    }
+
+    /* space for species tree SPR proposals */
+    c->sclone = stree_clone_init(c->stree);
+    c->gclones = (gtree_t **)xmalloc((size_t)opt_locus_count *
+                                     sizeof(gtree_t *));
+    for (i = 0; i < opt_locus_count; ++i)
+      c->gclones[i] = gtree_clone_init(c->gtree[i], c->sclone);
+
+    c->pjump = (double *)xcalloc((size_t)pjump_size, sizeof(double));
+
+    /* move the state of the chain to the NUMA nodes of the worker threads */
+    if (opt_threads > 1)
+    {
+      threads_first_touch(c->stree,c->gtree,c->locus);
+      threads_first_touch(c->sclone,c->gclones,NULL);
     }
   }
-  if (!opt_est_theta)
+
+  if (opt_powerposterior)
   {
-    logpr_sum = 0;
-    for (j = 0; j < stree->tip_count + stree->inner_count; ++j)
-      logpr_sum += stree->nodes[j]->notheta_logpr_contrib;
-    stree->notheta_logpr += logpr_sum;
-    stree->notheta_old_logpr = 0;
+    for (k = 0; k < n; ++k)
+      mc3_chains[k].logl_samples = (double *)xmalloc((size_t)opt_samples *
+                                                     sizeof(double));
+
+    fprintf(stdout, "\nPower posterior: %ld chains\n", n);
+    fprintf(fp_out, "\nPower posterior: %ld chains\n", n);
+  }
+  else if (opt_replicates > 1)
+  {
+    /* seeds and initial states were printed by replicates_init */
+    for (k = 0; k < n; ++k)
+    {
+      mc3_chain_t * c = mc3_chains+k;
+
+      c->stats_logl = stats_create(opt_samples);
+      c->stats_root_age = stats_create(opt_samples);
+
+      /* chain 0 is logged by cmd_run */
+      if (k == 0)
+      {
+        c->mcmcfile = xstrdup(opt_mcmcfile);
+        continue;
+      }
+
+      xasprintf(&c->mcmcfile, "%s.%ld", opt_mcmcfile, k);
+      if (!(c->fp_mcmc = fopen(c->mcmcfile, "w")))
+        fatal("Cannot open file %s for writing...", c->mcmcfile);
+
+      if (opt_method == METHOD_01)
+        mcmc_printinitial(c->fp_mcmc,c->stree);
+      else if (opt_method != METHOD_11)
+        mcmc_printheader(c->fp_mcmc,c->stree);
+
+      fprintf(stdout, " Chain %ld : samples written to %s\n", k, c->mcmcfile);
+      fprintf(fp_out, " Chain %ld : samples written to %s\n", k, c->mcmcfile);
+    }
+    return;
+  }
+  else
+  {
+    fprintf(stdout,
+            "\nMC3: %ld chains, swap proposed every %ld iteration(s)\n",
+            n, opt_mc3_swapfreq);
+    fprintf(fp_out,
+            "\nMC3: %ld chains, swap proposed every %ld iteration(s)\n",
+            n, opt_mc3_swapfreq);
+  }
+  for (k = 0; k < n; ++k)
+  {
+    fprintf(stdout, " Chain %ld : beta = %f\n", k, mc3_chains[k].beta);
+    fprintf(fp_out, " Chain %ld : beta = %f\n", k, mc3_chains[k].beta);
+  }
+  fprintf(stdout, "\n");
+  fprintf(fp_out, "\n");
+}
+
+static double mc3_chain_logl(mc3_chain_t * c)
+{
+  long i;
+  double logl = 0;
+
+  for (i = 0; i < opt_locus_count; ++i)
+    logl += c->gtree[i]->logl;
+
+  /* remove the chain's own heating, but keep the BayesFactorBeta power */
+  return logl / c->beta;
+}
+
+/* log-likelihood of the current state of a chain, recomputed from the root
+   CLVs if the chain samples from the prior */
+static double mc3_chain_rawlogl(mc3_chain_t * c)
+{
+  long i;
+  double logl = 0;
+  double bfbeta = opt_bfbeta;
+
+  if (c->beta > 0)
+    return mc3_chain_logl(c);
+
+  opt_bfbeta = 1;
+  for (i = 0; i < opt_locus_count; ++i)
+    logl += locus_root_loglikelihood(c->locus[i],
+                                     c->gtree[i]->root,
+                                     c->locus[i]->param_indices,
+                                     NULL);
+  opt_bfbeta = bfbeta;
+
+  return logl;
+}
+
+/* exchange the states of chains a and b */
+static void mc3_swap_states(mc3_chain_t * a, mc3_chain_t * b)
+{
+  long i;
+
+  SWAP(a->stree,b->stree);
+  SWAP(a->gtree,b->gtree);
+  SWAP(a->locus,b->locus);
+  SWAP(a->sclone,b->sclone);
+  SWAP(a->gclones,b->gclones);
+  SWAP(a->ndspecies,b->ndspecies);
+
+  /* stored log-likelihoods are scaled by the temperature of the chain */
+  for (i = 0; i < opt_locus_count; ++i)
+  {
+    a->gtree[i]->logl *= a->beta / b->beta;
+    b->gtree[i]->logl *= b->beta / a->beta;
+  }
+}
+
+static void mc3_propose_swap(void)
+{
+  long n = mc3_chain_count;
+  long a,b;
+  double lnacceptance;
+
+  /* select two distinct chains uniformly at random */
+  a = (long)(n*legacy_rndu(thread_index_zero));
+  b = (long)((n-1)*legacy_rndu(thread_index_zero));
+  if (b >= a) ++b;
+  if (a > b) SWAP(a,b);
+
+  mc3_chain_t * ca = mc3_chains+a;
+  mc3_chain_t * cb = mc3_chains+b;
+
+  lnacceptance = (ca->beta - cb->beta) *
+                 (mc3_chain_logl(cb) - mc3_chain_logl(ca));
+
+  mc3_swaps_proposed[a*n+b]++;
+  if (lnacceptance >= 0 ||
+      legacy_rndu(thread_index_zero) < exp(lnacceptance))
+  {
+    mc3_swap_states(ca,cb);
+    mc3_swaps_accepted[a*n+b]++;
+  }
+}
+
+/* exchange the random number generator state of a chain with the current
+   state of the generator */
+static void mc3_rng_exchange(uint64_t * state)
+{
+  long i;
+  uint64_t x[RNG_STATE_WORDS];
+
+  for (i = 0; i < opt_threads; ++i)
+  {
+    rng_get_state(i, x);
+    rng_set_state(i, state + i*RNG_STATE_WORDS);
+    memcpy(state + i*RNG_STATE_WORDS, x, RNG_STATE_WORDS*sizeof(uint64_t));
+  }
+}
+
+/* perform one iteration on each heated chain and propose a swap. The state of
+   the cold chain is passed in and out through the pointers */
+static void mc3_update(stree_t ** ptr_stree,
+                       gtree_t *** ptr_gtree,
+                       locus_t *** ptr_locus,
+                       stree_t ** ptr_sclone,
+                       gtree_t *** ptr_gclones,
+                       long * ptr_ndspecies,
+                       long step)
+{
+  long k;
+  double bfbeta = opt_bfbeta;
+  mc3_chain_t * cold = mc3_chains;
+
+  for (k = 1; k < mc3_chain_count; ++k)
+  {
+    mc3_chain_t * c = mc3_chains+k;
+
+    /* likelihood functions read the power from opt_bfbeta */
+    opt_bfbeta = bfbeta * c->beta;
+
+    /* replicates run with their own generator state, while the generator
+       holds the state of chain 0 outside this loop */
+    if (c->rng)
+      mc3_rng_exchange(c->rng);
+
+    c->ft_round++;
+    rng_set_step(k,step);
+    mcmc_proposals(&c->stree,
+                   &c->gtree,
+                   &c->sclone,
+                   &c->gclones,
+                   c->locus,
+                   &c->ndspecies,
+                   &c->dparam_count,
+                   c->pjump,
+                   c->ft_round,
+                   &c->ft_round_rj,
+                   &c->pjump_rj,
+                   &c->ft_round_spr,
+                   &c->pjump_slider,
+                   step);
+
+    if (c->rng)
+      mc3_rng_exchange(c->rng);
+  }
+  opt_bfbeta = bfbeta;
+
+  cold->stree = *ptr_stree;
+  cold->gtree = *ptr_gtree;
+  cold->locus = *ptr_locus;
+  cold->sclone = *ptr_sclone;
+  cold->gclones = *ptr_gclones;
+  cold->ndspecies = *ptr_ndspecies;
+
+  if (opt_powerposterior)
+  {
+    if (step >= 0 && (step+1) % opt_samplefreq == 0)
+      for (k = 0; k < mc3_chain_count; ++k)
+      {
+        mc3_chain_t * c = mc3_chains+k;
+        c->logl_samples[c->logl_count++] = mc3_chain_rawlogl(c);
+      }
+    return;
+  }
+
+  if (opt_replicates > 1)
+  {
+    if (step >= 0 && (step+1) % opt_samplefreq == 0)
+    {
+      /* the online summary is that of chain 0 only */
+      int online = online_summary;
+      online_summary = 0;
+
+      for (k = 0; k < mc3_chain_count; ++k)
+      {
+        mc3_chain_t * c = mc3_chains+k;
+        stats_update(c->stats_logl, mc3_chain_logl(c));
+        stats_update(c->stats_root_age, c->stree->root->tau);
+
+        if (k)
+          mcmc_logsample(c->fp_mcmc,
+                         step+1,
+                         c->stree,
+                         c->gtree,
+                         c->locus,
+                         c->dparam_count,
+                         c->ndspecies);
+      }
+      online_summary = online;
+    }
+    return;
+  }
+
+  if (++mc3_iter % opt_mc3_swapfreq) return;
+
+  mc3_propose_swap();
+
+  *ptr_stree = cold->stree;
+  *ptr_gtree = cold->gtree;
+  *ptr_locus = cold->locus;
+  *ptr_sclone = cold->sclone;
+  *ptr_gclones = cold->gclones;
+  *ptr_ndspecies = cold->ndspecies;
+}
+
+/* estimate the log marginal likelihood from the power posterior samples, using
+   thermodynamic integration with the trapezoid rule, and stepping-stone
+   sampling (Xie et al. 2011). Standard errors account for autocorrelation in
+   the samples through the batch means estimates of stats.c */
+static void powerposterior_summary(FILE * fp_out)
+{
+  long i,k;
+  long n = mc3_chain_count;
+  double ti = 0;
+  double ti_var = 0;
+  double ss = 0;
+  double ss_var = 0;
+
+  double * mean = (double *)xmalloc((size_t)n * sizeof(double));
+  double * var = (double *)xmalloc((size_t)n * sizeof(double));
+
+  fprintf(stdout, "\nPower posterior log-likelihood means:\n");
+  fprintf(fp_out, "\nPower posterior log-likelihood means:\n");
+  fprintf(stdout, "  beta        E_b(lnf(X))    S.E.\n");
+  fprintf(fp_out, "  beta        E_b(lnf(X))    S.E.\n");
+
+  /* chains are ordered by decreasing beta */
+  for (k = 0; k < n; ++k)
+  {
+    mc3_chain_t * c = mc3_chains+k;
+    stats_t * st = stats_create(c->logl_count);
+
+    for (i = 0; i < c->logl_count; ++i)
+      stats_update(st, c->logl_samples[i]);
+
+    mean[k] = stats_mean(st);
+    var[k] = stats_sd(st)*stats_sd(st) * stats_tint(st) / c->logl_count;
+    stats_destroy(st);
+
+    fprintf(stdout, "  %.6f  %13.4f  %8.4f\n", c->beta, mean[k], sqrt(var[k]));
+    fprintf(fp_out, "  %.6f  %13.4f  %8.4f\n", c->beta, mean[k], sqrt(var[k]));
+  }
+
+  /* thermodynamic integration */
+  for (k = 0; k < n; ++k)
+  {
+    double w = 0;
+
+    if (k > 0)
+      w += (mc3_chains[k-1].beta - mc3_chains[k].beta) / 2;
+    if (k < n-1)
+      w += (mc3_chains[k].beta - mc3_chains[k+1].beta) / 2;
+
+    ti += w*mean[k];
+    ti_var += w*w*var[k];
+  }
+
+  /* stepping-stone sampling, using the samples of the chain with the smaller
+     beta of each pair */
+  for (k = n-1; k > 0; --k)
+  {
+    mc3_chain_t * c = mc3_chains+k;
+    double delta = mc3_chains[k-1].beta - c->beta;
+    double lmax = c->logl_samples[0];
+    stats_t * st = stats_create(c->logl_count);
+
+    for (i = 1; i < c->logl_count; ++i)
+      lmax = MAX(lmax, c->logl_samples[i]);
+
+    for (i = 0; i < c->logl_count; ++i)
+      stats_update(st, exp(delta*(c->logl_samples[i] - lmax)));
 
-    logpr_sum = stree->notheta_logpr;
-  }
+    double r = stats_mean(st);
+    double sd = stats_sd(st);
 
-  /* Reading constraints file */
-  if (opt_constfile)
-  {
-    fprintf(stdout, "Reading constraint file %s\n", opt_constfile);
-    fprintf(fp_out, "Reading constraint file %s\n", opt_constfile);
-    parse_and_set_constraints(stree, fp_out);
+    ss += delta*lmax + log(r);
+    ss_var += sd*sd * stats_tint(st) / (c->logl_count * r * r);
+
+    stats_destroy(st);
   }
 
-  /* deallocate unnecessary arrays */
-  free(locusrate);
-  free(heredity);
-  if (opt_diploid)
+  fprintf(stdout,
+          "\nlog marginal likelihood (thermodynamic integration) = %.4f "
+          "S.E. = %.4f\n", ti, sqrt(ti_var));
+  fprintf(fp_out,
+          "\nlog marginal likelihood (thermodynamic integration) = %.4f "
+          "S.E. = %.4f\n", ti, sqrt(ti_var));
+  fprintf(stdout,
+          "log marginal likelihood (stepping-stone) = %.4f S.E. = %.4f\n",
+          ss, sqrt(ss_var));
+  fprintf(fp_out,
+          "log marginal likelihood (stepping-stone) = %.4f S.E. = %.4f\n",
+          ss, sqrt(ss_var));
+
+  free(mean);
+  free(var);
+}
+
+/* potential scale reduction factor (Gelman and Rubin 1992) of a quantity
+   traced by each replicate chain */
+static double replicates_rhat(stats_t ** st, long m)
+{
+  long k;
+  long n = st[0]->n;
+  double w = 0;
+  double bn;
+  double grand_mean = 0;
+  double mean_var = 0;
+
+  for (k = 0; k < m; ++k)
   {
-    free(mapping);
-    free(unphased_length);
-    free(resolution_count);
+    w += stats_sd(st[k])*stats_sd(st[k]);
+    grand_mean += stats_mean(st[k]);
   }
+  w /= m;
+  grand_mean /= m;
 
-  #if 0
-  debug_print_network_node_attribs(stree);
-  #endif
+  /* variance of chain means, i.e. B/n */
+  for (k = 0; k < m; ++k)
+    mean_var += (stats_mean(st[k]) - grand_mean) *
+                (stats_mean(st[k]) - grand_mean);
+  bn = mean_var / (m-1);
 
-  fprintf(stdout,"\nInitial MSC density and log-likelihood of observing data:\n");
-  fprintf(stdout,"log-PG0 = %f   log-L0 = %f\n\n", logpr_sum, logl_sum);
-  fprintf(fp_out,"\nInitial MSC density and log-likelihood of observing data:\n");
-  fprintf(fp_out,"log-PG0 = %f   log-L0 = %f\n\n", logpr_sum, logl_sum);
+  if (w <= 0)
+    return bn > 0 ? INFINITY : 1;
 
-  if (isinf(logl_sum))
-    fatal("\n[ERROR] The sum of log-L for all loci is -inf.\n"
-          "Please run BPP with numerical scaling. This is enabled by adding the line:\n"
-          "\n  scaling = 1\n\nto the control file");
+  return sqrt(((n-1)*w/n + bn) / w);
+}
 
-  /* free weights array */
-  free(weights);
+static void replicates_trace_summary(FILE * fp,
+                                     const char * label,
+                                     int width,
+                                     stats_t ** st,
+                                     long m)
+{
+  long k;
+  double ess = 0;
 
-  if (opt_est_delimit)          /* species delimitation */
-    rj_init(gtree,stree,msa_count);
+  fprintf(fp, " %-*s", width, label);
+  for (k = 0; k < m; ++k)
+  {
+    fprintf(fp, "  %12.6g", stats_mean(st[k]));
+    ess += st[k]->n / stats_tint(st[k]);
+  }
+  fprintf(fp, "  %8.4f  %8.1f\n", replicates_rhat(st,m), ess);
+}
 
-  /* initialize pjump and finetune rounds */
-  pjump = (double *)xcalloc(PROP_COUNT+GTR_PROP_COUNT+CLOCK_PROP_COUNT+1+1,
-                            sizeof(double));
+/* for A00 every column of the MCMC files of the replicates is summarized,
+   while for A01 and A11, which log species trees, the log-likelihood and root
+   age traced by mc3_update are */
+static void replicates_summary(FILE * fp_out)
+{
+  long i,k;
+  long m = mc3_chain_count;
+  long col_count = 2;
+  int width = 10;
+  FILE * fp[2] = {stdout, fp_out};
+  unsigned int j;
+  char ** labels = NULL;
+  stats_t *** st_chain = NULL;
 
-  /* TODO: Method 10 has a commented call to 'delimit_resetpriors()' */
-  //delimit_resetpriors();
+  if (!mc3_chains[0].stats_logl->n) return;
 
-  /* if method 00 or 01 print corresponding header line in MCMC file */
-  if (!opt_onlysummary)
+  stats_t ** st = (stats_t **)xmalloc((size_t)m * sizeof(stats_t *));
+
+  if (opt_method == METHOD_00)
   {
-    if (opt_method == METHOD_01)
-      mcmc_printinitial(fp_mcmc,stree);
-    else
+    st_chain = (stats_t ***)xmalloc((size_t)m * sizeof(stats_t **));
+    for (k = 0; k < m; ++k)
     {
-      if (opt_method != METHOD_11)
-        mcmc_printheader(fp_mcmc,stree);
+      char ** chain_labels;
+
+      col_count = allfixed_replicate_stats(mc3_chains[k].mcmcfile,
+                                           mc3_chains[0].stree,
+                                           &chain_labels,
+                                           st_chain+k);
+      if (k == 0)
+      {
+        labels = chain_labels;
+        continue;
+      }
+      for (i = 0; i < col_count; ++i)
+        free(chain_labels[i]);
+      free(chain_labels);
     }
 
-    if (opt_print_locusfile)
-      mcmc_printheader_rates(fp_locus,stree,locus);
+    for (i = 0; i < col_count; ++i)
+      width = MAX(width, (int)strlen(labels[i]));
   }
 
-  #if 0
-  unsigned long total_steps = opt_samples * opt_samplefreq + opt_burnin;
-  progress_init("Running MCMC...", total_steps);
-  #endif
-
-  /* TODO: This is only for species delimitation */
-  if (opt_est_delimit)          /* species delimitation */
+  for (j = 0; j < 2; ++j)
   {
-    dparam_count = 0;
-    for (i = 0; i < (int)(stree->tip_count + stree->inner_count); ++i)
+    fprintf(fp[j], "\nConvergence diagnostics of %ld replicates "
+                   "(%ld samples each):\n", m, mc3_chains[0].stats_logl->n);
+    fprintf(fp[j], " %-*s", width, "");
+    for (k = 0; k < m; ++k)
+      fprintf(fp[j], "  %10s%-2ld", "chain ", k);
+    fprintf(fp[j], "  %8s  %8s\n", "R-hat", "ESS");
+
+    for (i = 0; i < col_count; ++i)
     {
-      if (opt_est_theta && stree->nodes[i]->theta > 0)
-        dparam_count++;
-      if (stree->nodes[i]->tau > 0)
-        dparam_count++;
+      if (opt_method == METHOD_00)
+      {
+        for (k = 0; k < m; ++k)
+          st[k] = st_chain[k][i];
+        replicates_trace_summary(fp[j], labels[i], width, st, m);
+      }
+      else
+      {
+        for (k = 0; k < m; ++k)
+          st[k] = i ? mc3_chains[k].stats_root_age : mc3_chains[k].stats_logl;
+        replicates_trace_summary(fp[j], i ? "root age" : "lnL", width, st, m);
+      }
     }
   }
 
-  *ptr_stree = stree;
-  *ptr_gtree = gtree;
-  *ptr_locus = locus;
-  *ptr_pjump = pjump;
-
-  *ptr_curstep = 0;
-  *ptr_ft_round = 0;
+  if (opt_method == METHOD_00)
+  {
+    for (k = 0; k < m; ++k)
+    {
+      for (i = 0; i < col_count; ++i)
+        stats_destroy(st_chain[k][i]);
+      free(st_chain[k]);
+    }
+    free(st_chain);
+    for (i = 0; i < col_count; ++i)
+      free(labels[i]);
+    free(labels);
+  }
+  free(st);
+}
 
-  /* species delimitation relevant */
-  *ptr_ft_round_rj = 0;
-  *ptr_dparam_count = dparam_count;
-  *ptr_pjump_rj = 0;
+static void mc3_swap_summary(FILE * fp_out)
+{
+  long i,j;
+  long n = mc3_chain_count;
 
-  /* species tree inference relevant */
-  *ptr_ft_round_spr = 0;
-  *ptr_pjump_slider = 0;
-  *ptr_mean_logl = 0;
+  fprintf(stdout, "\nMC3 swap acceptance proportions (proposals):\n");
+  fprintf(fp_out, "\nMC3 swap acceptance proportions (proposals):\n");
+  for (i = 0; i < n; ++i)
+  {
+    fprintf(stdout, " Chain %ld :", i);
+    fprintf(fp_out, " Chain %ld :", i);
+    for (j = i+1; j < n; ++j)
+    {
+      long proposed = mc3_swaps_proposed[i*n+j];
+      double ratio = proposed ?
+                       (double)(mc3_swaps_accepted[i*n+j]) / proposed : 0;
+      fprintf(stdout, "  %ld: %.4f (%ld)", j, ratio, proposed);
+      fprintf(fp_out, "  %ld: %.4f (%ld)", j, ratio, proposed);
+    }
+    fprintf(stdout, "\n");
+    fprintf(fp_out, "\n");
+  }
+}
 
-  *ptr_sclone = sclone;
-  *ptr_gclones = gclones;
+static void mc3_fini(FILE * fp_out)
+{
+  long i,k;
+  long n = mc3_chain_count;
+
+  /* the MCMC files of replicates are read back by the summary */
+  for (k = 1; k < n; ++k)
+    if (mc3_chains[k].fp_mcmc)
+      fclose(mc3_chains[k].fp_mcmc);
+
+  if (opt_powerposterior)
+    powerposterior_summary(fp_out);
+  else if (opt_replicates > 1)
+    replicates_summary(fp_out);
+  else
+    mc3_swap_summary(fp_out);
 
-  /* deallocate maplist */
-  if (stree->tip_count > 1)
+  for (k = 0; k < n; ++k)
   {
-    list_clear(map_list,map_dealloc);
-    free(map_list);
+    mc3_chain_t * c = mc3_chains+k;
+
+    free(c->rng);
+    free(c->mcmcfile);
+    if (c->stats_logl)
+    {
+      stats_destroy(c->stats_logl);
+      stats_destroy(c->stats_root_age);
+    }
   }
 
-  /* deallocate alignments */
-  for (i = 0; i < msa_count; ++i)
-    msa_destroy(msa_list[i]);
-  free(msa_list);
+  free(mc3_chains[0].logl_samples);
 
-  return fp_mcmc;
+  /* chain 0 holds the state of the cold chain, deallocated by the caller */
+  for (k = 1; k < n; ++k)
+  {
+    mc3_chain_t * c = mc3_chains+k;
+
+    for (i = 0; i < opt_locus_count; ++i)
+    {
+      locus_destroy(c->locus[i]);
+      gtree_destroy(c->gtree[i],NULL);
+      gtree_destroy(c->gclones[i],NULL);
+    }
+    free(c->locus);
+    free(c->gtree);
+    free(c->gclones);
+    stree_destroy(c->stree,NULL);
+    stree_destroy(c->sclone,NULL);
+    free(c->pjump);
+    free(c->logl_samples);
+  }
 
+  free(mc3_chains);
+  free(mc3_swaps_proposed);
+  free(mc3_swaps_accepted);
+  mc3_chains = NULL;
 }
 
 void cmd_run()
@@ -2569,7 +3798,6 @@ void cmd_run()
   locus_t ** locus;
   long * gtree_offset = NULL;   /* for checkpointing when printing gene trees */
   long * rates_offset = NULL;
-  double ratio;
   long ndspecies;
 
   /* method 10 specific variables */
@@ -2740,10 +3968,13 @@ void cmd_run()
 
   assert(!(enabled_mui && enabled_lrht));
 
+  rng_locus_init(opt_locus_count);
 
   if (opt_threads > 1)
   {
-    threads_init(locus);
+    threads_init(stree,gtree,locus);
+    if (opt_est_stree)
+      threads_first_touch(sclone,gclones,NULL);
     memset(&td,0,sizeof(td));
   }
 
@@ -2795,6 +4026,39 @@ void cmd_run()
   if (!opt_resume)
     print_mcmc_headerline(fp_out,stree,gtree);
 
+  /* when resuming from a checkpoint, samples taken before the checkpoint are
+     only available in the MCMC file, and the summary is computed from it */
+  if (!opt_resume && !opt_onlysummary)
+  {
+    if (opt_method == METHOD_01)
+    {
+      char ** labels = (char **)xmalloc((size_t)(stree->tip_count) *
+                                        sizeof(char *));
+      for (j = 0; j < stree->tip_count; ++j)
+        labels[j] = stree->nodes[j]->label;
+      stree_summary_init(labels,stree->tip_count);
+      free(labels);
+
+      /* the starting tree is the first tree in the MCMC file */
+      stree_summary_update(stree);
+      online_summary = 1;
+    }
+    else if (opt_method == METHOD_11)
+    {
+      mixed_summary_init(stree->tip_count);
+      online_summary = 1;
+    }
+    else if (opt_method == METHOD_00 && opt_onlinesummary)
+    {
+      allfixed_online_init(stree);
+      online_summary = 1;
+    }
+  }
+
+  if ((opt_mc3_chains > 1 || opt_powerposterior || opt_replicates > 1) &&
+      !opt_onlysummary)
+    mc3_init(stree,gtree,locus,ndspecies,fp_out);
+
   /* *** start of MCMC loop *** */
   for (; i < opt_samples*opt_samplefreq; ++i)
   {
@@ -2842,213 +4106,24 @@ void cmd_run()
     
     ++ft_round;
 
-    /* propose delimitation through merging/splitting of nodes */
-    if (opt_est_delimit)        /* species delimitation */
-    {
-      if (legacy_rndu(thread_index_zero) < 0.5)
-        j = prop_split(gtree,stree,locus,0.5,&dparam_count,&ndspecies);
-      else
-        j = prop_join(gtree,stree,locus,0.5,&dparam_count,&ndspecies);
-
-      if (j != 2)
-      {
-        ft_round_rj++;
-        pjump_rj += j;
-      }
-    }
-
-    /* propose species tree topology using SPR */
-    if (ndspecies > 2 && (opt_est_stree))
-    {
-      if (legacy_rndu(thread_index_zero) > 0)   /* bpp4 compatible results (RNG to next state) */
-      {
-        /* quick-and-dirty way of applying constraints on species tree */
-        long ret = 3;
-        long dirty_iters = DIRTY_ITERS;
-        while (ret == 3)
-        {
-          if (!dirty_iters) break;
-          ret = stree_propose_spr(&stree, &gtree, &sclone, &gclones, locus);
-          --dirty_iters;
-        }
-        if (ret == 1)
-        {
-          /* accepted */
-          /* swap the pointers of species tree and gene tree list with cloned */
-          SWAP(stree,sclone);
-          SWAP(gtree,gclones);
-          stree_label(stree);
-          pjump_slider++;
-        }
-        if (ret < 2)
-          ft_round_spr++;
-        /* keeping statistics for max dirty SPRs iters */
-        if (opt_constraint_count)
-        {
-          sum_dirty_iters += DIRTY_ITERS - (dirty_iters+1);
-          if (max_dirty_iters < (DIRTY_ITERS - (dirty_iters+1)))
-          {
-            max_dirty_iters = DIRTY_ITERS - (dirty_iters+1);
-          }
-        }
-      }
-    }
-
-    /* perform proposals sequentially */   
-
-
-    /* propose gene tree ages */
-    if (opt_threads == 1)
-      ratio = gtree_propose_ages_serial(locus, gtree, stree);
-    else
-    {
-      td.locus = locus; td.gtree = gtree; td.stree = stree;
-      threads_wakeup(THREAD_WORK_GTAGE,&td);
-      ratio = td.accepted ? ((double)(td.accepted)/td.proposals) : 0;
-    }
-    pjump[BPP_MOVE_GTAGE_INDEX] = (pjump[BPP_MOVE_GTAGE_INDEX]*(ft_round-1)+ratio) /
-                                  (double)ft_round;
-
-    /* propose gene tree topologies using SPR */
-    if (opt_threads == 1)
-      ratio = gtree_propose_spr_serial(locus,gtree,stree);
-    else
-    {
-      td.locus = locus; td.gtree = gtree; td.stree = stree;
-      threads_wakeup(THREAD_WORK_GTSPR,&td);
-      ratio = td.accepted ? ((double)(td.accepted)/td.proposals) : 0;
-    }
-    pjump[BPP_MOVE_GTSPR_INDEX] = (pjump[BPP_MOVE_GTSPR_INDEX]*(ft_round-1)+ratio) /
-                                  (double)ft_round;
-
-
-    /* propose population sizes on species tree */
-    if (opt_est_theta)
-    {
-      ratio = stree_propose_theta(gtree,locus,stree);
-      pjump[BPP_MOVE_THETA_INDEX] = (pjump[BPP_MOVE_THETA_INDEX]*(ft_round-1)+ratio) /
-                                    (double)ft_round;
-    }
-
-    /* propose species tree taus */
-    if (stree->tip_count > 1 && stree->root->tau > 0)
-    {
-      ratio = stree_propose_tau(gtree,stree,locus);
-      pjump[BPP_MOVE_TAU_INDEX] = (pjump[BPP_MOVE_TAU_INDEX]*(ft_round-1)+ratio) /
-                                  (double)ft_round;
-    }
-
-    /* mixing step */
-    ratio = proposal_mixing(gtree,stree,locus);
-    pjump[BPP_MOVE_MIX_INDEX] = (pjump[BPP_MOVE_MIX_INDEX]*(ft_round-1)+ratio) /
-                                (double)ft_round;
-
-    if ((opt_est_locusrate == MUTRATE_ESTIMATE &&
-         opt_locusrate_prior == BPP_LOCRATE_PRIOR_DIR) || opt_est_heredity)
-    {
-      ratio = prop_locusrate_and_heredity(gtree,stree,locus,thread_index_zero);
-      pjump[BPP_MOVE_LRHT_INDEX] = (pjump[BPP_MOVE_LRHT_INDEX]*(ft_round-1)+ratio) /
-                                   (double)ft_round;
-    }
-
-    /* phi proposal */
-    if (opt_msci)
-    {
-      ratio = stree_propose_phi(stree,gtree);
-      pjump[BPP_MOVE_PHI_INDEX] = (pjump[BPP_MOVE_PHI_INDEX]*(ft_round-1)+ratio) /
-                                  (double)ft_round;
-    }
-
-    if (enabled_prop_freqs)
-    {
-      if (opt_threads == 1)
-        ratio = locus_propose_freqs_serial(stree,locus,gtree);
-      else
-      {
-        td.locus = locus; td.gtree = gtree;
-        threads_wakeup(THREAD_WORK_FREQS,&td);
-        ratio = td.proposals ? ((double)(td.accepted)/td.proposals) : 0;
-      }
-      pjump[BPP_MOVE_FREQS_INDEX] = (pjump[BPP_MOVE_FREQS_INDEX]*(ft_round-1)+ratio) /
-                                    (double)ft_round;
-    }
-
-    if (enabled_prop_qrates)
-    {
-      if (opt_threads == 1)
-        ratio = locus_propose_qrates_serial(stree,locus,gtree);
-      else
-      {
-        td.locus = locus; td.gtree = gtree;
-        threads_wakeup(THREAD_WORK_RATES,&td);
-        ratio = td.proposals ? ((double)(td.accepted)/td.proposals) : 0;
-      }
-      pjump[BPP_MOVE_QRATES_INDEX] = (pjump[BPP_MOVE_QRATES_INDEX]*(ft_round-1)+ratio) /
-                                    (double)ft_round;
-    }
-
-    if (enabled_prop_alpha)
-    {
-      if (opt_threads == 1)
-        ratio = locus_propose_alpha_serial(stree,locus,gtree);
-      else
-      {
-        td.locus = locus; td.gtree = gtree;
-        threads_wakeup(THREAD_WORK_ALPHA,&td);
-        ratio = td.accepted ? ((double)(td.accepted)/td.proposals) : 0;
-      }
-      pjump[BPP_MOVE_ALPHA_INDEX] = (pjump[BPP_MOVE_ALPHA_INDEX]*(ft_round-1)+ratio) /
-                                    (double)ft_round;
-    }
-
-    /* TODO: Delete after debugging */
-    if (opt_debug_rates && i==0)
-    {
-      opt_seed = 1;
-      legacy_init();
-    }
-
-    if (opt_est_locusrate == MUTRATE_ESTIMATE &&
-        (opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL ||
-         opt_locusrate_prior == BPP_LOCRATE_PRIOR_GAMMADIR))
-    {
-      ratio = prop_locusrate_mui(gtree,stree,locus,thread_index_zero);
-      pjump[BPP_MOVE_MUI_INDEX] = (pjump[BPP_MOVE_MUI_INDEX]*(ft_round-1)+ratio) /
-                                  (double)ft_round;
-
-      if (opt_est_mubar)
-      {
-        ratio = prop_locusrate_mubar(stree,gtree);
-        pjump[BPP_MOVE_MUBAR_INDEX] = (pjump[BPP_MOVE_MUBAR_INDEX]*(ft_round-1)+ratio) /
-                                       (double)ft_round;
-      }
-    }
-
-    if (opt_clock != BPP_CLOCK_GLOBAL)
-    {
-
-      ratio = prop_locusrate_nui(gtree,stree,locus,thread_index_zero);
-      pjump[BPP_MOVE_NUI_INDEX] = (pjump[BPP_MOVE_NUI_INDEX]*(ft_round-1)+ratio) /
-                                        (double)ft_round;
-
-      if (opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL)
-      {
-        ratio = prop_locusrate_nubar(stree,gtree);
-        pjump[BPP_MOVE_NUBAR_INDEX] = (pjump[BPP_MOVE_NUBAR_INDEX]*(ft_round-1)+ratio) /
-                                          (double)ft_round;
-      }
+    rng_set_step(0,i);
+    mcmc_proposals(&stree,
+                   &gtree,
+                   &sclone,
+                   &gclones,
+                   locus,
+                   &ndspecies,
+                   &dparam_count,
+                   pjump,
+                   ft_round,
+                   &ft_round_rj,
+                   &pjump_rj,
+                   &ft_round_spr,
+                   &pjump_slider,
+                   i);
 
-      if (opt_threads == 1)
-        ratio = prop_branch_rates_serial(gtree,stree,locus);
-      else
-      {
-        td.locus = locus; td.gtree = gtree;
-        threads_wakeup(THREAD_WORK_BRATE,&td);
-        ratio = td.proposals ? ((double)(td.accepted)/td.proposals) : 0;
-      }
-      pjump[BPP_MOVE_BRANCHRATE_INDEX] = (pjump[BPP_MOVE_BRANCHRATE_INDEX]*(ft_round-1)+ratio) /
-                                         (double)ft_round;
-    }
+    if (mc3_chains)
+      mc3_update(&stree,&gtree,&locus,&sclone,&gclones,&ndspecies,i);
 
     /* log sample into file (dparam_count is only used in method 10) */
     if ((i + 1) % (opt_samplefreq*5) == 0)
@@ -3443,7 +4518,10 @@ void cmd_run()
   }
   else if (opt_method == METHOD_11)
   {
-    mixed_summary(fp_out,stree->tip_count);
+    if (online_summary)
+      mixed_summary_print(fp_out);
+    else
+      mixed_summary(fp_out,stree->tip_count);
     delimitations_fini();
     rj_fini();
     free(pspecies);
@@ -3452,9 +4530,14 @@ void cmd_run()
     //assert(0);
   }
 
+  if (mc3_chains)
+    mc3_fini(fp_out);
+
+
   for (i = 0; i < opt_locus_count; ++i)
     locus_destroy(locus[i]);
   free(locus);
+  locus_eigen_store_fini();
 
   /* deallocate gene trees */
   for (i = 0; i < opt_locus_count; ++i)
@@ -3472,7 +4555,12 @@ void cmd_run()
   gtree_fini(opt_locus_count);
 
   if (opt_method == METHOD_00)
-    allfixed_summary(fp_out,stree);
+  {
+    if (online_summary)
+      allfixed_online_summary(fp_out,stree);
+    else
+      allfixed_summary(fp_out,stree);
+  }
 
   /* TODO: Perhaps we do not need 'species_count' as it should be equivalent
      to 'ndspecies' for the A01 method */
@@ -3500,7 +4588,10 @@ void cmd_run()
   {
     assert(species_count > 0);
 
-    stree_summary(fp_out,species_names,species_count);
+    if (online_summary)
+      stree_summary_print(fp_out,species_names,species_count);
+    else
+      stree_summary(fp_out,species_names,species_count);
 
     /* cleanup */
     for (i = 0; i < species_count; ++i)
@@ -98,10 +98,45 @@ static char * reallocline(phylip_t * fd, size_t newmaxsize)
   return temp;
 }
 
+/* read the next line from the memory region of fd */
+static char * getnextline_mem(phylip_t * fd)
+{
+  const char * start = fd->mem + fd->mem_pos;
+  const char * end;
+  size_t avail = fd->mem_size - fd->mem_pos;
+  size_t len;
+
+  fd->line_size = 0;
+
+  if (!avail)
+  {
+    free(fd->line);
+    fd->line = NULL;
+    return NULL;
+  }
+
+  end = (const char *)memchr(start, '\n', avail);
+  len = end ? (size_t)(end - start) : avail;
+  fd->mem_pos += end ? len+1 : len;
+
+  if (len+1 > fd->line_maxsize)
+    if (!reallocline(fd, len+1))
+      return NULL;
+
+  memcpy(fd->line, start, len);
+  fd->line[len] = 0;
+  fd->line_size = len;
+
+  return fd->line;
+}
+
 static char * getnextline(phylip_t * fd)
 {
   size_t len = 0;
 
+  if (fd->mem)
+    return getnextline_mem(fd);
+
   fd->line_size = 0;
 
   /* read from file until newline or eof */
@@ -277,8 +312,13 @@ phylip_t * phylip_open(const char * filename,
 
   fd->chrstatus = map;
 
-  /* open file */
-  fd->fp = fopen(filename, "r");
+  fd->mem = NULL;
+  fd->mem_size = 0;
+  fd->mem_pos = 0;
+
+  /* open file in binary mode, such that the size reported by ftell() is the
+     number of bytes that can be read or mapped (see xmapfile) */
+  fd->fp = fopen(filename, "rb");
   if (!(fd->fp))
     fatal("Unable to open file (%s)", filename);
 
@@ -626,7 +666,9 @@ msa_t * phylip_parse_sequential(phylip_t * fd)
   return msa;
 }
 
-msa_t ** phylip_parse_multisequential(phylip_t * fd, long * count)
+static msa_t ** parse_multisequential(phylip_t * fd,
+                                      long * count,
+                                      long maxcount)
 {
   long msa_slotalloc = 10;
   long msa_maxcount = 0;
@@ -655,7 +697,7 @@ msa_t ** phylip_parse_multisequential(phylip_t * fd, long * count)
 
     /* if 'nloci' option was specified, break when the respective number of loci
        was read */
-    if (*count == opt_locus_count) break;
+    if (*count == maxcount) break;
 
     /* skip empty lines */
 
@@ -679,3 +721,343 @@ msa_t ** phylip_parse_multisequential(phylip_t * fd, long * count)
 
   return msa;
 }
+
+/* return the end of the line starting at p, i.e. the newline or end */
+static const char * scan_eol(const char * p, const char * end)
+{
+  const char * eol = (const char *)memchr(p, '\n', (size_t)(end - p));
+
+  return eol ? eol : end;
+}
+
+/* check whether [p,end) consists of blanks only. Mapped files are not zero
+   terminated, hence strspn cannot be used */
+static int blankrange(const char * p, const char * end)
+{
+  for (; p < end; ++p)
+    if (!whitespace(*p))
+      return 0;
+
+  return 1;
+}
+
+/* Go through the characters of [p,end) using the chrstatus table. If dst is
+   given, legal characters are copied to it and stripped ones are counted in
+   fd. Returns the number of legal characters, or -1 if a fatal character is
+   found */
+static long scan_legal(phylip_t * fd,
+                       const unsigned int * chrstatus,
+                       const char * p,
+                       const char * end,
+                       char * dst,
+                       long dst_size)
+{
+  long n = 0;
+
+  for (; p < end; ++p)
+  {
+    unsigned char c = (unsigned char)*p;
+    unsigned int m = chrstatus[c];
+
+    if (m == 1)
+    {
+      if (dst)
+      {
+        if (n == dst_size) return -1;
+        dst[n] = (char)c;
+      }
+      ++n;
+    }
+    else if (m == 2)
+      return -1;
+    else if (m == 0 && dst)
+    {
+      fd->stripped_count++;
+      fd->stripped[c]++;
+    }
+  }
+  return n;
+}
+
+/* Walk one locus of a sequential PHYLIP file held in memory, starting at p,
+   following the line structure expected by phylip_parse_sequential. If
+   msa_ptr is NULL the locus is only validated, otherwise a new alignment is
+   created and the sequence data is copied directly from the mapped file into
+   it, without going through the line buffer. Returns the end of the locus,
+   or NULL at the first irregularity */
+static const char * walk_locus(phylip_t * fd,
+                               const unsigned int * chrstatus,
+                               const char * p,
+                               const char * end,
+                               msa_t ** msa_ptr)
+{
+  long i,n;
+  int seq_count, seq_len;
+  const char * eol;
+  const char * q;
+  char header[LINEALLOC];
+  char * seq = NULL;
+  msa_t * msa = NULL;
+
+  /* skip empty lines */
+  eol = scan_eol(p,end);
+  while (p < end && blankrange(p,eol))
+  {
+    p = eol + (eol < end);
+    eol = scan_eol(p,end);
+  }
+  if (p == end) return NULL;
+
+  /* header */
+  if ((size_t)(eol - p) >= LINEALLOC) return NULL;
+  memcpy(header, p, (size_t)(eol - p));
+  header[eol - p] = 0;
+  if (!parse_header(header, &seq_count, &seq_len, PHYLIP_SEQUENTIAL))
+    return NULL;
+  p = eol + (eol < end);
+
+  if (msa_ptr)
+  {
+    msa = (msa_t *)xcalloc(1,sizeof(msa_t));
+    msa->count = seq_count;
+    msa->length = seq_len;
+    msa->sequence = (char **)xcalloc((size_t)seq_count,sizeof(char *));
+    msa->label = (char **)xcalloc((size_t)seq_count,sizeof(char *));
+    for (i = 0; i < seq_count; ++i)
+    {
+      msa->sequence[i] = (char *)xmalloc((size_t)(seq_len+1) * sizeof(char));
+      msa->sequence[i][seq_len] = 0;
+    }
+  }
+
+  for (i = 0; i < seq_count && p < end; ++i)
+  {
+    /* skip empty lines */
+    eol = scan_eol(p,end);
+    while (p < end && blankrange(p,eol))
+    {
+      p = eol + (eol < end);
+      eol = scan_eol(p,end);
+    }
+    if (p == end) break;
+
+    /* sequence label ends at the first blank in the line */
+    while (whitespace(*p)) ++p;
+    if ((q = memchr(p, ' ', (size_t)(eol - p))) ||
+        (q = memchr(p, '\t', (size_t)(eol - p))) ||
+        (q = memchr(p, '\r', (size_t)(eol - p))))
+      ;
+    else
+      q = eol;
+
+    if (msa)
+    {
+      msa->label[i] = (char *)xmalloc((size_t)(q-p+1)*sizeof(char));
+      memcpy(msa->label[i], p, (size_t)(q-p));
+      msa->label[i][q-p] = 0;
+      seq = msa->sequence[i];
+    }
+    p = q;
+
+    /* sequence data, possibly spanning several lines */
+    n = scan_legal(fd, chrstatus, p, eol, seq, seq_len);
+    while (n >= 0 && n < seq_len && eol < end)
+    {
+      p = eol+1;
+      eol = scan_eol(p,end);
+      long m = scan_legal(fd,
+                          chrstatus,
+                          p,
+                          eol,
+                          seq ? seq+n : NULL,
+                          seq_len-n);
+      n = (m < 0) ? -1 : n + m;
+    }
+    if (n != seq_len) break;
+
+    p = eol + (eol < end);
+  }
+
+  if (i != seq_count)
+  {
+    if (msa)
+      msa_destroy(msa);
+    return NULL;
+  }
+
+  if (msa_ptr)
+    *msa_ptr = msa;
+  return p;
+}
+
+/* Find the boundaries of the loci of a sequential multi-locus PHYLIP file held
+   in memory, without copying any data. Stores in offsets[i] the start of locus
+   i and in offsets[i+1] its end. The scan stops at the first irregularity,
+   leaving the remainder to the serial parser for proper error reporting.
+   Returns the number of loci found */
+static long scan_loci(const char * mem,
+                      size_t size,
+                      const unsigned int * chrstatus,
+                      long maxcount,
+                      size_t ** offsets_ptr)
+{
+  long count = 0;
+  long alloc = 64;
+  const char * p = mem;
+  const char * end = mem + size;
+  size_t * offsets = (size_t *)xmalloc((size_t)(alloc+1) * sizeof(size_t));
+
+  offsets[0] = 0;
+
+  while (p < end && (!maxcount || count < maxcount))
+  {
+    if (!(p = walk_locus(NULL, chrstatus, p, end, NULL)))
+      break;
+
+    if (count == alloc)
+    {
+      alloc *= 2;
+      size_t * temp = (size_t *)xmalloc((size_t)(alloc+1) * sizeof(size_t));
+      memcpy(temp, offsets, (size_t)(count+1) * sizeof(size_t));
+      free(offsets);
+      offsets = temp;
+    }
+    offsets[++count] = (size_t)(p - mem);
+  }
+
+  *offsets_ptr = offsets;
+  return count;
+}
+
+/* state for parsing loci on multiple threads */
+typedef struct parse_data_s
+{
+  const char * mem;
+  const size_t * offsets;
+  const unsigned int * chrstatus;
+  msa_t ** msa;
+  phylip_t ** fds;
+} parse_data_t;
+
+static phylip_t * phylip_open_mem(const char * mem,
+                                  size_t size,
+                                  const unsigned int * map)
+{
+  phylip_t * fd = (phylip_t *)xcalloc(1,sizeof(phylip_t));
+
+  fd->fp = NULL;
+  fd->chrstatus = map;
+  fd->no = -1;
+  fd->filesize = (long)size;
+  fd->mem = mem;
+  fd->mem_size = size;
+  fd->mem_pos = 0;
+
+  /* cache line */
+  getnextline(fd);
+  fd->lineno = 1;
+
+  return fd;
+}
+
+static void cb_parse_locus(void * arg, long i)
+{
+  parse_data_t * pd = (parse_data_t *)arg;
+
+  /* only used for counting stripped characters */
+  pd->fds[i] = (phylip_t *)xcalloc(1,sizeof(phylip_t));
+
+  /* loci were validated by scan_loci() */
+  if (!walk_locus(pd->fds[i],
+                  pd->chrstatus,
+                  pd->mem + pd->offsets[i],
+                  pd->mem + pd->offsets[i+1],
+                  pd->msa+i))
+    pd->msa[i] = NULL;
+}
+
+/* Map the whole file in memory, find the locus boundaries with a quick scan,
+   and parse the loci on multiple threads directly from the mapped memory.
+   Loci are stored in file order */
+static msa_t ** parse_multisequential_mem(phylip_t * fd, long * count)
+{
+  long i,j;
+  long rest_count = 0;
+  int mapped;
+  size_t * offsets;
+  size_t size = (size_t)(fd->filesize);
+  msa_t ** msa;
+  msa_t ** rest = NULL;
+  parse_data_t pd;
+
+  char * mem = xmapfile(fd->fp, size, &mapped);
+
+  *count = scan_loci(mem,
+                     size,
+                     fd->chrstatus,
+                     opt_locus_count,
+                     &offsets);
+
+  pd.mem = mem;
+  pd.offsets = offsets;
+  pd.chrstatus = fd->chrstatus;
+  pd.msa = (msa_t **)xcalloc((size_t)(*count+1), sizeof(msa_t *));
+  pd.fds = (phylip_t **)xcalloc((size_t)(*count+1), sizeof(phylip_t *));
+
+  threads_parallel_for(*count, cb_parse_locus, (void *)&pd);
+
+  for (i = 0; i < *count; ++i)
+  {
+    if (!pd.msa[i])
+      fatal("Internal error while parsing locus %ld", i+1);
+
+    fd->stripped_count += pd.fds[i]->stripped_count;
+    for (j = 0; j < 256; ++j)
+      fd->stripped[j] += pd.fds[i]->stripped[j];
+
+    free(pd.fds[i]);
+  }
+  free(pd.fds);
+  msa = pd.msa;
+
+  /* parse anything the scan could not handle serially */
+  if ((!opt_locus_count || *count < opt_locus_count) &&
+      !blankrange(mem + offsets[*count], mem + size))
+  {
+    phylip_t * rfd = phylip_open_mem(mem + offsets[*count],
+                                     size - offsets[*count],
+                                     fd->chrstatus);
+    rfd->stripped_count = fd->stripped_count;
+    memcpy(rfd->stripped, fd->stripped, 256*sizeof(long));
+
+    rest = parse_multisequential(rfd,
+                                 &rest_count,
+                                 opt_locus_count ? opt_locus_count-*count : 0);
+
+    fd->stripped_count = rfd->stripped_count;
+    memcpy(fd->stripped, rfd->stripped, 256*sizeof(long));
+    free(rfd->line);
+    free(rfd);
+
+    msa = (msa_t **)xmalloc((size_t)(*count+rest_count) * sizeof(msa_t *));
+    memcpy(msa, pd.msa, (size_t)(*count) * sizeof(msa_t *));
+    memcpy(msa + *count, rest, (size_t)rest_count * sizeof(msa_t *));
+    free(pd.msa);
+    free(rest);
+    *count += rest_count;
+  }
+
+  free(offsets);
+  xunmapfile(mem, size, mapped);
+
+  return msa;
+}
+
+msa_t ** phylip_parse_multisequential(phylip_t * fd, long * count)
+{
+  /* read regular files through memory */
+  if (fd->fp && fd->filesize > 0)
+    return parse_multisequential_mem(fd, count);
+
+  return parse_multisequential(fd, count, opt_locus_count);
+}
@@ -184,7 +184,9 @@ double locus_propose_alpha_serial(stree_t * stree, locus_t ** locus, gtree_t **
     if (locus[i]->dtype == BPP_DATA_DNA && locus[i]->rate_cats > 1)
     {
       ++candidates;
+      rng_locus_begin(thread_index,i,THREAD_WORK_ALPHA);
       accepted += propose_alpha(stree,locus[i],gtree[i],i,thread_index);
+      rng_locus_end(thread_index);
     }
   }
 
@@ -215,7 +217,9 @@ void locus_propose_alpha_parallel(stree_t * stree,
     if (locus[i]->dtype == BPP_DATA_DNA && locus[i]->rate_cats > 1)
     {
       ++candidates;
+      rng_locus_begin(thread_index,i,THREAD_WORK_ALPHA);
       accepted += propose_alpha(stree,locus[i],gtree[i],i,thread_index);
+      rng_locus_end(thread_index);
     }
   }
 
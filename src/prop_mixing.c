@@ -362,7 +362,7 @@ long proposal_mixing(gtree_t ** gtree, stree_t * stree, locus_t ** locus)
       for (i = 0; i < nodes_count; ++i)
       {
         for (j = 0; j < stree->locus_count; ++j)
-          snodes[i]->logpr_contrib[j] = snodes[i]->old_logpr_contrib[j];
+          SNODE_LOCUS(snodes[i],j)->logpr_contrib = SNODE_LOCUS(snodes[i],j)->old_logpr_contrib;
 
         if (snodes[i]->theta <= 0) continue;
 
@@ -229,7 +229,7 @@ static int rubber_proportional(stree_t * stree,
   /* Go through all nodes of the snode population that have lineages coming
      from both child populations and have time <= tau_upper */
   dlist_item_t * event;
-  for (event = snode->event[msa_index]->head; event; event = event->next)
+  for (event = SNODE_LOCUS(snode,msa_index)->event->head; event; event = event->next)
   {
     gnode_t * tmp = (gnode_t *)(event->data);
 
@@ -281,7 +281,7 @@ static int rubber_proportional(stree_t * stree,
     y = 1;
     nwithin = 0;
 
-    for (event = snode->event[msa_index]->head; event; event = event->next)
+    for (event = SNODE_LOCUS(snode,msa_index)->event->head; event; event = event->next)
     {
       gnode_t * tmp = (gnode_t *)(event->data);
 
@@ -327,7 +327,7 @@ static int rubber_proportional(stree_t * stree,
         
         unlink_event(gnode, msa_index);
 
-        gnode->pop->event_count[msa_index]--;
+        SNODE_LOCUS(gnode->pop,msa_index)->event_count--;
         if (!opt_est_theta)
           gnode->pop->event_count_sum--;
 
@@ -335,13 +335,13 @@ static int rubber_proportional(stree_t * stree,
 
         gnode->pop = newpop;
 
-        dlist_item_append(gnode->pop->event[msa_index], gnode->event);
+        dlist_item_append(SNODE_LOCUS(gnode->pop,msa_index)->event, gnode->event);
 
-        gnode->pop->event_count[msa_index]++;
+        SNODE_LOCUS(gnode->pop,msa_index)->event_count++;
         if (!opt_est_theta)
           gnode->pop->event_count_sum++;
         
-        snode->seqin_count[msa_index]--;
+        SNODE_LOCUS(snode,msa_index)->seqin_count--;
       }
     }
   }
@@ -356,7 +356,7 @@ static int rubber_proportional(stree_t * stree,
       {
         unlink_event(gnode, msa_index);
 
-        gnode->pop->event_count[msa_index]--;
+        SNODE_LOCUS(gnode->pop,msa_index)->event_count--;
         if (!opt_est_theta)
           gnode->pop->event_count_sum--;
 
@@ -365,13 +365,13 @@ static int rubber_proportional(stree_t * stree,
         gnode->old_pop = gnode->pop;
         gnode->pop = snode;
 
-        dlist_item_append(gnode->pop->event[msa_index], gnode->event);
+        dlist_item_append(SNODE_LOCUS(gnode->pop,msa_index)->event, gnode->event);
 
-        gnode->pop->event_count[msa_index]++;
+        SNODE_LOCUS(gnode->pop,msa_index)->event_count++;
         if (!opt_est_theta)
           gnode->pop->event_count_sum++;
 
-        snode->seqin_count[msa_index]++;
+        SNODE_LOCUS(snode,msa_index)->seqin_count++;
       }
       
     }
@@ -582,7 +582,7 @@ long prop_split(gtree_t ** gtree,
 #if 1
     /* update log-pr */
     if (opt_est_theta)
-      logpr -= node->logpr_contrib[i];
+      logpr -= SNODE_LOCUS(node,i)->logpr_contrib;
     else
       logpr -= node->notheta_logpr_contrib;
 
@@ -592,7 +592,7 @@ long prop_split(gtree_t ** gtree,
                                           thread_index);
 
     if (opt_est_theta)
-      logpr -= node->left->logpr_contrib[i];
+      logpr -= SNODE_LOCUS(node->left,i)->logpr_contrib;
     else
       logpr -= node->left->notheta_logpr_contrib;
 
@@ -602,7 +602,7 @@ long prop_split(gtree_t ** gtree,
                                           thread_index);
 
     if (opt_est_theta)
-      logpr -= node->right->logpr_contrib[i];
+      logpr -= SNODE_LOCUS(node->right,i)->logpr_contrib;
     else
       logpr -= node->right->notheta_logpr_contrib;
 
@@ -678,19 +678,19 @@ long prop_split(gtree_t ** gtree,
         if (tmp->mark & MARK_POP_CHANGE)
         {
           unlink_event(tmp,i);
-          tmp->pop->event_count[i]--;
+          SNODE_LOCUS(tmp->pop,i)->event_count--;
           if (!opt_est_theta)
             tmp->pop->event_count_sum--;
 
           tmp->pop = node;
 
-          dlist_item_append(tmp->pop->event[i], tmp->event); /* equiv to snode->event[i] */
+          dlist_item_append(SNODE_LOCUS(tmp->pop,i)->event, tmp->event); /* equiv to SNODE_LOCUS(snode,i)->event */
 
-          tmp->pop->event_count[i]++;
+          SNODE_LOCUS(tmp->pop,i)->event_count++;
           if (!opt_est_theta)
             tmp->pop->event_count_sum++;
 
-          tmp->pop->seqin_count[i]++;
+          SNODE_LOCUS(tmp->pop,i)->seqin_count++;
         }
 
         tmp->mark = 0;
@@ -721,9 +721,9 @@ long prop_split(gtree_t ** gtree,
 
       if (opt_est_theta)
       {
-        node->logpr_contrib[i] = node->old_logpr_contrib[i];
-        node->left->logpr_contrib[i] = node->left->old_logpr_contrib[i];
-        node->right->logpr_contrib[i] = node->right->old_logpr_contrib[i];
+        SNODE_LOCUS(node,i)->logpr_contrib = SNODE_LOCUS(node,i)->old_logpr_contrib;
+        SNODE_LOCUS(node->left,i)->logpr_contrib = SNODE_LOCUS(node->left,i)->old_logpr_contrib;
+        SNODE_LOCUS(node->right,i)->logpr_contrib = SNODE_LOCUS(node->right,i)->old_logpr_contrib;
       }
       else
       {
@@ -987,7 +987,7 @@ long prop_join(gtree_t ** gtree,
 #if 1
     /* update log-pr */
     if (opt_est_theta)
-      logpr -= node->logpr_contrib[i];
+      logpr -= SNODE_LOCUS(node,i)->logpr_contrib;
     else
       logpr -= node->notheta_logpr_contrib;
 
@@ -997,7 +997,7 @@ long prop_join(gtree_t ** gtree,
                                           thread_index);
 
     if (opt_est_theta)
-      logpr -= node->left->logpr_contrib[i];
+      logpr -= SNODE_LOCUS(node->left,i)->logpr_contrib;
     else
       logpr -= node->left->notheta_logpr_contrib;
 
@@ -1007,7 +1007,7 @@ long prop_join(gtree_t ** gtree,
                                           thread_index);
 
     if (opt_est_theta)
-      logpr -= node->right->logpr_contrib[i];
+      logpr -= SNODE_LOCUS(node->right,i)->logpr_contrib;
     else
       logpr -= node->right->notheta_logpr_contrib;
 
@@ -1084,16 +1084,16 @@ long prop_join(gtree_t ** gtree,
         if (tmp->mark & MARK_POP_CHANGE)
         {
           unlink_event(tmp,i);
-          tmp->pop->event_count[i]--;
-          tmp->pop->seqin_count[i]--;
+          SNODE_LOCUS(tmp->pop,i)->event_count--;
+          SNODE_LOCUS(tmp->pop,i)->seqin_count--;
           if (!opt_est_theta)
             tmp->pop->event_count_sum--;
 
           tmp->pop = tmp->old_pop;
 
-          dlist_item_append(tmp->pop->event[i], tmp->event); /* equiv to snode->event[i] */
+          dlist_item_append(SNODE_LOCUS(tmp->pop,i)->event, tmp->event); /* equiv to SNODE_LOCUS(snode,i)->event */
 
-          tmp->pop->event_count[i]++;
+          SNODE_LOCUS(tmp->pop,i)->event_count++;
           if (!opt_est_theta)
             tmp->pop->event_count_sum++;
         }
@@ -1128,9 +1128,9 @@ long prop_join(gtree_t ** gtree,
 
       if (opt_est_theta)
       {
-        node->logpr_contrib[i] = node->old_logpr_contrib[i];
-        node->left->logpr_contrib[i] = node->left->old_logpr_contrib[i];
-        node->right->logpr_contrib[i] = node->right->old_logpr_contrib[i];
+        SNODE_LOCUS(node,i)->logpr_contrib = SNODE_LOCUS(node,i)->old_logpr_contrib;
+        SNODE_LOCUS(node->left,i)->logpr_contrib = SNODE_LOCUS(node->left,i)->old_logpr_contrib;
+        SNODE_LOCUS(node->right,i)->logpr_contrib = SNODE_LOCUS(node->right,i)->old_logpr_contrib;
       }
       else
       {
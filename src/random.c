@@ -24,15 +24,229 @@
 #define mBactrian  0.95
 #define sBactrian  sqrt(1-mBactrian*mBactrian)
 
-/* legacy random number generators */
-static unsigned int * z_rndu = NULL;
+/* Random number generators. Each thread owns one state record, padded to a
+   full cache line such that draws from different threads do not write to the
+   same cache line. Two generators are available, selected with opt_rng:
+
+   BPP_RNG_XOSHIRO  xoshiro256+ (Blackman and Vigna 2021). Thread 0 is seeded
+                    with splitmix64 and each subsequent thread starts 2^128
+                    draws further in the sequence, such that thread streams
+                    do not overlap.
+   BPP_RNG_LEGACY   the 32-bit multiplicative congruential generator of
+                    previous versions, with all threads seeded with the same
+                    value, for reproducing old runs.
+
+   The legacy_* sampling functions below draw uniform variates from the
+   selected generator.
+
+   Unless the legacy generator is selected, moves that update one locus at a
+   time (gene tree ages and SPR, alpha, frequencies, exchangeabilities and
+   branch rates) draw from a counter-based Philox4x32-10 stream (Salmon et al.
+   2011) instead. The stream is keyed on the seed, the chain and the locus,
+   and its counter is made of the MCMC step, the move, the number of moves
+   already applied to the locus in that step, and the draw index. The draws
+   of a locus therefore do not depend on which thread updates it, and results
+   are identical for any number of threads. Moves are bracketed with
+   rng_locus_begin() and rng_locus_end(), and the step is set with
+   rng_set_step() */
+
+#define RNG_CACHELINE   64
+
+#define PHILOX_M0       0xD2511F53u
+#define PHILOX_M1       0xCD9E8D57u
+#define PHILOX_W0       0x9E3779B9u
+#define PHILOX_W1       0xBB67AE85u
+
+typedef struct rng_state_s
+{
+  uint64_t s[4];                /* xoshiro256+ state */
+  unsigned int z;               /* legacy state */
+
+  /* active per-locus counter-based stream */
+  int locus_active;
+  uint32_t key[2];
+  uint32_t ctr[4];
+  uint32_t out[4];
+  long out_pos;
+
+  char pad[2*RNG_CACHELINE - 4*sizeof(uint64_t) - sizeof(unsigned int) -
+           sizeof(int) - 10*sizeof(uint32_t) - sizeof(long)];
+} rng_state_t;
+
+/* number of moves applied to a locus within the current step */
+typedef struct rng_locus_s
+{
+  long step;
+  long chain;
+  uint32_t seq;
+} rng_locus_t;
+
+static rng_state_t * rng_state = NULL;
+static long rng_state_count = 0;
+
+static rng_locus_t * rng_locus = NULL;
+static long rng_locus_count = 0;
+static long rng_step = 0;
+static long rng_chain = 0;
+
+static uint64_t splitmix64(uint64_t * x)
+{
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static inline uint64_t rotl(const uint64_t x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t xoshiro_next(uint64_t * s)
+{
+  const uint64_t result = s[0] + s[3];
+  const uint64_t t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl(s[3], 45);
+
+  return result;
+}
+
+/* advance the state by 2^128 draws */
+static void xoshiro_jump(uint64_t * s)
+{
+  static const uint64_t jump[] = { 0x180ec6d33cfd0abaULL,
+                                   0xd5a61266f0c9392cULL,
+                                   0xa9582618e03fc9aaULL,
+                                   0x39abdc4529b1661cULL };
+  uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  unsigned int i,b;
+
+  for (i = 0; i < sizeof(jump) / sizeof(*jump); ++i)
+    for (b = 0; b < 64; ++b)
+    {
+      if (jump[i] & (UINT64_C(1) << b))
+      {
+        s0 ^= s[0];
+        s1 ^= s[1];
+        s2 ^= s[2];
+        s3 ^= s[3];
+      }
+      xoshiro_next(s);
+    }
+
+  s[0] = s0;
+  s[1] = s1;
+  s[2] = s2;
+  s[3] = s3;
+}
+
+/* uniform variate in (0,1) from the 53 upper bits of a draw */
+static inline double xoshiro_rndu(uint64_t * s)
+{
+  return ((double)(xoshiro_next(s) >> 11) + 0.5) * 0x1.0p-53;
+}
+
+static inline double lcg_rndu(unsigned int * z)
+{
+/* 32-bit integer assumed.
+   From Ripley (1987) p. 46 or table 2.4 line 2. 
+   This may return 0 or 1, which can be a problem.
+*/
+
+   /* the below random number generator is the one used until v4.0.6.
+      Change if 0 to if 1 to use it */
+   #if 0
+   *z = *z*69069 + 1;
+   if(*z == 0 || *z == 4294967295)  *z = 13;
+   return *z/4294967295.0;
+   #else
+   *z = *z * 69069 + 1;
+   if (*z == 0)  *z = 12345671;
+   return ldexp((double)(*z), -32);
+   #endif
+}
+
+static inline uint32_t mulhilo32(uint32_t a, uint32_t b, uint32_t * hi)
+{
+  uint64_t p = (uint64_t)a * b;
+
+  *hi = (uint32_t)(p >> 32);
+  return (uint32_t)p;
+}
+
+static void philox4x32(const uint32_t * ctr,
+                       const uint32_t * key,
+                       uint32_t * out)
+{
+  uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+  uint32_t k0 = key[0], k1 = key[1];
+  uint32_t hi0,hi1,lo0,lo1;
+  int r;
+
+  for (r = 0; r < 10; ++r)
+  {
+    lo0 = mulhilo32(PHILOX_M0, c0, &hi0);
+    lo1 = mulhilo32(PHILOX_M1, c2, &hi1);
+
+    c0 = hi1 ^ c1 ^ k0;
+    c1 = lo1;
+    c2 = hi0 ^ c3 ^ k1;
+    c3 = lo0;
+
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+
+  out[0] = c0;
+  out[1] = c1;
+  out[2] = c2;
+  out[3] = c3;
+}
+
+/* uniform variate in (0,1) from two 32-bit words of the current block */
+static inline double philox_rndu(rng_state_t * r)
+{
+  if (r->out_pos == 4)
+  {
+    philox4x32(r->ctr, r->key, r->out);
+    r->ctr[0]++;
+    r->out_pos = 0;
+  }
+
+  uint32_t a = r->out[r->out_pos++] >> 5;
+  uint32_t b = r->out[r->out_pos++] >> 6;
+
+  return ((double)a*67108864.0 + b + 0.5) * 0x1.0p-53;
+}
+
+/* allocate zeroed states for count threads */
+void rng_alloc(long count)
+{
+  assert(count >= 1);
+
+  if (rng_state)
+    pll_aligned_free(rng_state);
+
+  rng_state = (rng_state_t *)pll_aligned_alloc((size_t)count *
+                                               sizeof(rng_state_t),
+                                               RNG_CACHELINE);
+  if (!rng_state)
+    fatal("Cannot allocate space for random number generator states");
+  memset(rng_state, 0, (size_t)count * sizeof(rng_state_t));
+  rng_state_count = count;
+}
 
 void legacy_init()
 {
    int seed = (int)opt_seed;
-   long i;
 
-   /* z_rndu = (unsigned int)opt_seed; */
    if (sizeof(int) != 4)
       fatal("oh-oh, we are in trouble.  int not 32-bit?  rndu() assumes 32-bit int.");
 
@@ -53,61 +267,186 @@ void legacy_init()
       if (fseed == NULL) fatal("can't open file SeedUsed.");
       fprintf(fseed, "%d\n", seed);
       fclose(fseed);
+
+      /* per-locus streams are keyed on the seed, which must be stored in
+         checkpoints */
+      opt_seed = seed;
    }
 
    assert(opt_threads >= 1);
 
-   if (z_rndu) free(z_rndu);
-   z_rndu = (unsigned int *)xmalloc((size_t)opt_threads * sizeof(unsigned int));
-   for (i = 0; i < opt_threads; ++i)
-     z_rndu[i] = (unsigned int)seed;
+   rng_alloc(opt_threads);
+
+   rng_seed(seed);
+}
+
+/* set the generators of all threads to their initial states for the given
+   seed */
+void rng_seed(long seed)
+{
+  long i;
+  uint64_t x = (uint64_t)seed;
+
+  if (opt_rng == BPP_RNG_LEGACY)
+  {
+    for (i = 0; i < rng_state_count; ++i)
+      rng_state[i].z = (unsigned int)seed;
+    return;
+  }
+
+  for (i = 0; i < 4; ++i)
+    rng_state[0].s[i] = splitmix64(&x);
+
+  for (i = 1; i < rng_state_count; ++i)
+  {
+    memcpy(rng_state[i].s, rng_state[i-1].s, 4*sizeof(uint64_t));
+    xoshiro_jump(rng_state[i].s);
+  }
+}
+
+/* seed of the independent replicate chain k, derived from the seed of the
+   run. Chain 0 uses the seed of the run, and the seeds of the remaining chains
+   are positive 31-bit integers like the seeds drawn by legacy_init */
+long rng_replicate_seed(long k)
+{
+  uint64_t x = (uint64_t)opt_seed ^ ((uint64_t)k << 32);
+
+  if (k == 0) return opt_seed;
+
+  return (long)(splitmix64(&x) % 2147483646) + 1;
 }
 
 void legacy_fini()
 {
-  free(z_rndu);
+  pll_aligned_free(rng_state);
+  rng_state = NULL;
+  rng_state_count = 0;
+
+  free(rng_locus);
+  rng_locus = NULL;
+  rng_locus_count = 0;
+}
+
+void rng_locus_init(long locus_count)
+{
+  long i;
+
+  free(rng_locus);
+  rng_locus = (rng_locus_t *)xcalloc((size_t)locus_count, sizeof(rng_locus_t));
+  rng_locus_count = locus_count;
+
+  for (i = 0; i < locus_count; ++i)
+    rng_locus[i].step = LONG_MIN;
 }
 
-unsigned int get_legacy_rndu_status(long index)
+/* set the chain and MCMC step used as part of the per-locus stream counters */
+void rng_set_step(long chain, long step)
 {
-  return z_rndu[index];
+  rng_chain = chain;
+  rng_step = step;
 }
 
-unsigned int * get_legacy_rndu_array()
+/* switch the draws of a thread to the stream of a locus, for applying the
+   given move (THREAD_WORK_*) to it */
+void rng_locus_begin(long index, long locus_index, long move)
 {
-  return z_rndu;
+  rng_state_t * r = rng_state+index;
+  rng_locus_t * l;
+  uint64_t x = (uint64_t)opt_seed;
+  uint64_t h;
+
+  if (opt_rng == BPP_RNG_LEGACY) return;
+
+  assert(locus_index < rng_locus_count);
+
+  l = rng_locus+locus_index;
+  if (l->step != rng_step || l->chain != rng_chain)
+  {
+    l->step = rng_step;
+    l->chain = rng_chain;
+    l->seq = 0;
+  }
+
+  h = splitmix64(&x) ^ ((uint64_t)rng_chain * 0x9e3779b97f4a7c15ULL);
+  r->key[0] = (uint32_t)h ^ (uint32_t)locus_index;
+  r->key[1] = (uint32_t)(h >> 32);
+
+  r->ctr[0] = 0;
+  r->ctr[1] = ((uint32_t)move << 24) | (l->seq++ & 0xFFFFFF);
+  r->ctr[2] = (uint32_t)((uint64_t)rng_step);
+  r->ctr[3] = (uint32_t)((uint64_t)rng_step >> 32);
+
+  r->out_pos = 4;
+  r->locus_active = 1;
 }
 
-void set_legacy_rndu_status(long index, unsigned int x)
+void rng_locus_end(long index)
 {
-  z_rndu[index] = x;
+  rng_state[index].locus_active = 0;
 }
 
-void set_legacy_rndu_array(unsigned int * x)
+/* copy the state of the generator of a thread into RNG_STATE_WORDS words */
+void rng_get_state(long index, uint64_t * x)
 {
-  if (z_rndu)
-    free(z_rndu);
-  z_rndu = x;
+  assert(index < rng_state_count);
+
+  if (opt_rng == BPP_RNG_LEGACY)
+  {
+    memset(x, 0, RNG_STATE_WORDS*sizeof(uint64_t));
+    x[0] = rng_state[index].z;
+  }
+  else
+    memcpy(x, rng_state[index].s, RNG_STATE_WORDS*sizeof(uint64_t));
+}
+
+void rng_set_state(long index, const uint64_t * x)
+{
+  assert(index < rng_state_count);
+
+  if (opt_rng == BPP_RNG_LEGACY)
+    rng_state[index].z = (unsigned int)x[0];
+  else
+    memcpy(rng_state[index].s, x, RNG_STATE_WORDS*sizeof(uint64_t));
 }
 
 double legacy_rndu(long index)
 {
-/* 32-bit integer assumed.
-   From Ripley (1987) p. 46 or table 2.4 line 2. 
-   This may return 0 or 1, which can be a problem.
-*/
+  if (rng_state[index].locus_active)
+    return philox_rndu(rng_state+index);
 
-   /* the below random number generator is the one used until v4.0.6.
-      Change if 0 to if 1 to use it */
-   #if 0
-   z_rndu[index] = z_rndu[index]*69069 + 1;
-   if(z_rndu[index] == 0 || z_rndu[index] == 4294967295)  z_rndu[index] = 13;
-   return z_rndu[index]/4294967295.0;
-   #else
-   z_rndu[index] = z_rndu[index] * 69069 + 1;
-   if (z_rndu[index] == 0)  z_rndu[index] = 12345671;
-   return ldexp((double)(z_rndu[index]), -32);
-   #endif
+  if (opt_rng == BPP_RNG_LEGACY)
+    return lcg_rndu(&rng_state[index].z);
+
+  return xoshiro_rndu(rng_state[index].s);
+}
+
+/* fill x with n uniform variates, in the same order as n calls to
+   legacy_rndu */
+void rndu_fill(long index, double * x, long n)
+{
+  long i;
+
+  if (rng_state[index].locus_active)
+  {
+    for (i = 0; i < n; ++i)
+      x[i] = philox_rndu(rng_state+index);
+  }
+  else if (opt_rng == BPP_RNG_LEGACY)
+  {
+    unsigned int z = rng_state[index].z;
+    for (i = 0; i < n; ++i)
+      x[i] = lcg_rndu(&z);
+    rng_state[index].z = z;
+  }
+  else
+  {
+    uint64_t s[4];
+
+    memcpy(s, rng_state[index].s, 4*sizeof(uint64_t));
+    for (i = 0; i < n; ++i)
+      x[i] = xoshiro_rndu(s);
+    memcpy(rng_state[index].s, s, 4*sizeof(uint64_t));
+  }
 }
 
 static double rndTriangle(long index)
@@ -29,10 +29,15 @@
 #define DNA_STATES_COUNT        4
 
 
-/* TODO: Simulation is at the moment single-threaded */
-static const long thread_index_zero = 0;
+/* number of loci simulated per thread before the output of a batch is
+   written */
+#define SIM_BATCH_PER_THREAD    64
+
+/* size of the stdio buffers of the sequence output files */
+#define SIM_OUTPUT_BUFFER       (1 << 20)
 
-static long * g_order = NULL;
+/* generator used by the master thread outside the simulation of a locus */
+static const long thread_index_zero = 0;
 
 static char charmap_nt_tcag[16] =
 {
@@ -152,7 +157,12 @@ static int MultiNomialAliasSetTable(int ncat, double * prob, double * F, int * L
    return(0);
 }
 
-static int MultiNomialAlias(int n, int ncat, double * F, int * L, int * nobs)
+static int MultiNomialAlias(int n,
+                            int ncat,
+                            double * F,
+                            int * L,
+                            int * nobs,
+                            long thread_index)
 {
    /* This generates multinomial samples using the F and L tables set up before,
       using the alias algorithm (Walker 1974; Kronmal & Peterson 1979).
@@ -165,7 +175,7 @@ static int MultiNomialAlias(int n, int ncat, double * F, int * L, int * nobs)
 
    for (i = 0; i < ncat; i++)  nobs[i] = 0;
    for (i = 0; i < n; i++) {
-      r = legacy_rndu(thread_index_zero)*ncat;
+      r = legacy_rndu(thread_index)*ncat;
       k = (int)r;
       r -= k;
       if (r <= F[k]) nobs[k]++;
@@ -442,7 +452,9 @@ static int DiscreteGamma(double freqK[], double rK[], double alpha, double beta,
    return (0);
 }
 
-static double * rates4sites(double locus_siterate_alpha, int cdf)
+static double * rates4sites(double locus_siterate_alpha,
+                            int cdf,
+                            long thread_index)
 {
   long i,j,k;
   double * rates = NULL;
@@ -464,7 +476,8 @@ static double * rates4sites(double locus_siterate_alpha, int cdf)
 
     DiscreteGamma(freqK,rK,gamma_a,gamma_b,opt_siterate_cats,BPP_FALSE);
     MultiNomialAliasSetTable(opt_siterate_cats, freqK, Falias, Lalias);
-    MultiNomialAlias(opt_locus_simlen,opt_siterate_cats,Falias,Lalias,counts);
+    MultiNomialAlias(opt_locus_simlen,opt_siterate_cats,Falias,Lalias,counts,
+                     thread_index);
 
     for (i = 0, k = 0; i < opt_siterate_cats; ++i)
       for (j = 0; j < counts[i]; ++j)
@@ -473,7 +486,7 @@ static double * rates4sites(double locus_siterate_alpha, int cdf)
   else
   {
     for (i = 0; i < opt_locus_simlen; ++i)
-      rates[i] = legacy_rndgamma(thread_index_zero,locus_siterate_alpha) /
+      rates[i] = legacy_rndgamma(thread_index,locus_siterate_alpha) /
                  locus_siterate_alpha;
   }
   if (cdf)
@@ -493,9 +506,30 @@ static double * rates4sites(double locus_siterate_alpha, int cdf)
   return rates;
 }
 
+/* return the first index k such that r < cdf[k], where cdf is the cumulative
+   distribution of the n site rates, in O(log n) */
+static long cdf_search(const double * cdf, long n, double r)
+{
+  long lo = 0;
+  long hi = n-1;
+
+  while (lo < hi)
+  {
+    long mid = lo + (hi-lo)/2;
+
+    if (r < cdf[mid])
+      hi = mid;
+    else
+      lo = mid+1;
+  }
+
+  return lo;
+}
+
 static void evolve_jc69_recursive(gnode_t * node,
                                   double locus_siterate_alpha,
-                                  double * site_rates)
+                                  double * site_rates,
+                                  long thread_index)
 {
   long i,k;
   double r;
@@ -518,21 +552,22 @@ static void evolve_jc69_recursive(gnode_t * node,
   memcpy(x,xparent,opt_locus_simlen * sizeof(char));
     
   /* generate number of mutations */
-  long mut_count = legacy_rndpoisson(thread_index_zero,
+  long mut_count = legacy_rndpoisson(thread_index,
                                      node->length * opt_locus_simlen);
 
   for (i = 0; i < mut_count; ++i)
   {
     /* get a position for the mutation */
     if (locus_siterate_alpha == 0)
-      k = (int)(legacy_rndu(thread_index_zero) * opt_locus_simlen);
+      k = (int)(legacy_rndu(thread_index) * opt_locus_simlen);
     else
-      for (k = 0, r = legacy_rndu(thread_index_zero); k < opt_locus_simlen; ++k)
-        if (r < site_rates[k])
-          break;
+    {
+      r = legacy_rndu(thread_index);
+      k = cdf_search(site_rates, opt_locus_simlen, r);
+    }
 
     /* generate new state */
-    int state = (int)(legacy_rndu(thread_index_zero) * 3);
+    int state = (int)(legacy_rndu(thread_index) * 3);
     if (state >= inverse[(int)x[k]])
       state++;
 
@@ -542,86 +577,135 @@ static void evolve_jc69_recursive(gnode_t * node,
 
   /* recursively process subtree */
   if (node->left)
-    evolve_jc69_recursive(node->left,  locus_siterate_alpha, site_rates);
+    evolve_jc69_recursive(node->left,  locus_siterate_alpha, site_rates,
+                          thread_index);
   if (node->right)
-    evolve_jc69_recursive(node->right, locus_siterate_alpha, site_rates);
+    evolve_jc69_recursive(node->right, locus_siterate_alpha, site_rates,
+                          thread_index);
 }
 
+/* Cumulative transition probability matrix for a branch of length t at site
+   rate r. Same arithmetic as pll_core_update_pmatrix(), without allocating
+   temporary buffers at each call as this is done once per branch and rate */
+static void cumulative_pmatrix(double * pmat,
+                               long states,
+                               double r,
+                               double t,
+                               const double * eigenvecs,
+                               const double * inv_eigenvecs,
+                               const double * eigenvals,
+                               double * expd,
+                               double * temp)
+{
+  long j,k,m;
+
+  if (!t)
+  {
+    for (j = 0; j < states; ++j)
+      for (k = 0; k < states; ++k)
+        pmat[j*states+k] = (j == k) ? 1 : 0;
+  }
+  else
+  {
+    for (j = 0; j < states; ++j)
+      expd[j] = expm1(eigenvals[j] * r * t);
+
+    for (j = 0; j < states; ++j)
+      for (k = 0; k < states; ++k)
+        temp[j*states+k] = inv_eigenvecs[j*states+k] * expd[k];
+
+    for (j = 0; j < states; ++j)
+    {
+      for (k = 0; k < states; ++k)
+      {
+        pmat[j*states+k] = (j==k) ? 1.0 : 0;
+        for (m = 0; m < states; ++m)
+          pmat[j*states+k] += temp[j*states+m] * eigenvecs[m*states+k];
+      }
+    }
+  }
+
+  /* make rows cumulative */
+  for (j = 0; j < states; ++j)
+    for (k = 1; k < states; ++k)
+      pmat[j*states+k] += pmat[j*states+k-1];
+}
+
+/* Evolve the sequence of node from its parent. Sites are processed in runs of
+   equal rate (the whole sequence without rate variation, one run per
+   category with discrete gamma), for which the transition matrix is computed
+   once, and the uniform variates of a run are drawn in one pass. Each row of
+   the cumulative matrix is the inverse CDF for the respective parent state */
 static void evolve_gtr_recursive(gnode_t * node,
-                                 double locus_siterate_alpha,
                                  double * site_rates,
                                  double * eigenvecs,
                                  double * inv_eigenvecs,
-                                 double * eigenvals)
+                                 double * eigenvals,
+                                 double * u,
+                                 long thread_index)
 {
-  long i,j,k;
+  long i,j,n;
   long states = 4;
-  double * srates = NULL;
-  double constrate[1] = {1};
+  double pmatrix[16];
+  double expd[4];
+  double temp[16];
   char dna[4] = "TCAG";
   int inverse[9] = { -1, 0, 1, -1, 2, -1, -1, -1, 3};
+  char code[4];
 
   /* See notes in make_root_seq(). inverse[9] is used to convert from unary code
      (T=1,C=2,A=4,G=8) back to 0,1,2,3 code for states */
 
-  double * pmatrix = (double *)xcalloc(16,sizeof(double));
+  assert(node->parent);
+
+  for (j = 0; j < states; ++j)
+    code[j] = pll_map_nt_tcag[(int)dna[j]];
 
-  if (!site_rates)
-    srates = constrate;
-  else
-    srates = site_rates;
-  
   char * xparent = (char *)(node->parent->data);  /* parent sequence */
   char * x = (char *)(node->data);                /* current sequence */
 
-  /* copy parent sequence to current node */
-  memcpy(x,xparent,opt_locus_simlen * sizeof(char));
-    
-
-  assert(node->parent);
-  for (i = 0; i < opt_locus_simlen; ++i)
+  for (i = 0; i < opt_locus_simlen; i += n)
   {
-    unsigned int matrix_indices[1] = {0};
-    unsigned int params_indices[1] = {0};
-    if (i == 0 || (site_rates && site_rates[i] != site_rates[i-1]))
+    /* find the run of sites with the same rate */
+    if (site_rates)
+      for (n = 1; i+n < opt_locus_simlen && site_rates[i+n] == site_rates[i]; ++n);
+    else
+      n = opt_locus_simlen;
+
+    cumulative_pmatrix(pmatrix,
+                       states,
+                       site_rates ? site_rates[i] : 1,
+                       node->length,
+                       eigenvecs,
+                       inv_eigenvecs,
+                       eigenvals,
+                       expd,
+                       temp);
+
+    rndu_fill(thread_index, u, n);
+
+    for (j = 0; j < n; ++j)
     {
-      /* calculate pmatrix using eigendecomposition */
-      pll_core_update_pmatrix(&pmatrix,
-                              4,
-                              1,
-                              srates + ((site_rates) ? i : 0),
-                              &(node->length),
-                              matrix_indices,
-                              params_indices,
-                              &eigenvals,
-                              &eigenvecs,
-                              &inv_eigenvecs,
-                              1,
-                              opt_arch);
-      /* make rows of pmatrix cumulative */
-      for (j = 0; j < states; ++j)
-        for (k = 1; k < states; ++k)
-          pmatrix[j*states+k] += pmatrix[j*states+k-1];
-    }
-    
-    double r = legacy_rndu(thread_index_zero);
-    for (j = 0; j < states-1; j++)
-      if (r < pmatrix[inverse[(int)x[i]]*states+j])
-        break;
+      const double * p = pmatrix + inverse[(int)xparent[i+j]]*states;
+      double r = u[j];
+      long k;
 
-    x[i] = pll_map_nt_tcag[(int)dna[j]];
-  }
+      for (k = 0; k < states-1; ++k)
+        if (r < p[k])
+          break;
 
-  free(pmatrix);
+      x[i+j] = code[k];
+    }
+  }
 
   /* recursively process subtree */
   if (node->left)
-    evolve_gtr_recursive(node->left,  locus_siterate_alpha, site_rates, eigenvecs, inv_eigenvecs, eigenvals);
+    evolve_gtr_recursive(node->left, site_rates, eigenvecs, inv_eigenvecs, eigenvals, u, thread_index);
   if (node->right)
-    evolve_gtr_recursive(node->right, locus_siterate_alpha, site_rates, eigenvecs, inv_eigenvecs, eigenvals);
+    evolve_gtr_recursive(node->right, site_rates, eigenvecs, inv_eigenvecs, eigenvals, u, thread_index);
 }
 
-static void make_root_seq(gnode_t * root, double * freqs)
+static void make_root_seq(gnode_t * root, double * freqs, long thread_index)
 {
   long i,j;
   double r;
@@ -638,7 +722,7 @@ static void make_root_seq(gnode_t * root, double * freqs)
   if (opt_model == BPP_DNA_MODEL_JC69)
   {
     for (i = 0; i < opt_locus_simlen; ++i)
-      x[i] = pll_map_nt_tcag[(int)dna[(int)(legacy_rndu(thread_index_zero)*4)]];
+      x[i] = pll_map_nt_tcag[(int)dna[(int)(legacy_rndu(thread_index)*4)]];
   }
   else
   {
@@ -647,7 +731,7 @@ static void make_root_seq(gnode_t * root, double * freqs)
 
     for (i = 0; i < opt_locus_simlen; ++i)
     {
-      for (j = 0, r = legacy_rndu(thread_index_zero); j < 4-1; ++j)
+      for (j = 0, r = legacy_rndu(thread_index); j < 4-1; ++j)
         if (r < p[j]) break;
       x[i] = pll_map_nt_tcag[(int)dna[j]];
     }
@@ -674,8 +758,12 @@ static list_t * create_maplist(stree_t * stree)
   return list;
 }
 
-/* correlated clock, lognormal */
-static void simulate_correlated_rates_logn_recursive(snode_t * node, gtree_t * gtree)
+/* correlated clock, lognormal. Branch rates are stored in rate[], indexed by
+   species tree node index */
+static void simulate_correlated_rates_logn_recursive(snode_t * node,
+                                                     gtree_t * gtree,
+                                                     double * rate,
+                                                     long thread_index)
 {
   /* We process inner nodes only. For each inner calculate y0 according to Eq. 3
      in Rannala & Yang 2007 and then the rates for the two daughter nodes.
@@ -684,7 +772,7 @@ static void simulate_correlated_rates_logn_recursive(snode_t * node, gtree_t * g
     return;
 
   if (node->tau == 0)
-    node->left->rate = node->right->rate = 0;
+    rate[node->left->node_index] = rate[node->right->node_index] = 0;
   else
   {
 
@@ -697,52 +785,58 @@ static void simulate_correlated_rates_logn_recursive(snode_t * node, gtree_t * g
     {
       /* y0 | yA ~ N(yA - tA*nui/2, tA*nui) */
       tA = (node->parent->tau - node->tau) / 2;
-      y0 = log(node->rate) - 0.5*tA*gtree->rate_nui +
-           sqrt(gtree->rate_nui*tA)*rndNormal(thread_index_zero);
+      y0 = log(rate[node->node_index]) - 0.5*tA*gtree->rate_nui +
+           sqrt(gtree->rate_nui*tA)*rndNormal(thread_index);
     }
 
     t1 = (node->tau - node->left->tau)/2;
     t2 = (node->tau - node->right->tau)/2;
 
     nv = y0 - 0.5*t1*gtree->rate_nui +
-         sqrt(gtree->rate_nui*t1)*rndNormal(thread_index_zero);
-    node->left->rate = exp(nv);
+         sqrt(gtree->rate_nui*t1)*rndNormal(thread_index);
+    rate[node->left->node_index] = exp(nv);
 
     nv = y0 - 0.5*t2*gtree->rate_nui +
-         sqrt(gtree->rate_nui*t2)*rndNormal(thread_index_zero);
-    node->right->rate = exp(nv);
+         sqrt(gtree->rate_nui*t2)*rndNormal(thread_index);
+    rate[node->right->node_index] = exp(nv);
   }
 
-  simulate_correlated_rates_logn_recursive(node->left,gtree);
-  simulate_correlated_rates_logn_recursive(node->right,gtree);
+  simulate_correlated_rates_logn_recursive(node->left,gtree,rate,thread_index);
+  simulate_correlated_rates_logn_recursive(node->right,gtree,rate,thread_index);
     
 }
 
 /* correlated clock, gamma */
-static void simulate_correlated_rates_gamma_recursive(snode_t * node, gtree_t * gtree)
+static void simulate_correlated_rates_gamma_recursive(snode_t * node,
+                                                      gtree_t * gtree,
+                                                      double * rate,
+                                                      long thread_index)
 {
   if (!node) return;
 
   assert(node->parent);
 
   if (node->parent->tau == 0)
-    node->rate = node->parent->rate;
+    rate[node->node_index] = rate[node->parent->node_index];
   else
   {
     /* gamma prior */
 
     double a = gtree->rate_mui * gtree->rate_mui / gtree->rate_nui;
-    node->rate = legacy_rndgamma(thread_index_zero,a) /
-                 a * node->parent->rate;
+    rate[node->node_index] = legacy_rndgamma(thread_index,a) /
+                             a * rate[node->parent->node_index];
   }
 
-  simulate_correlated_rates_gamma_recursive(node->left,gtree);
-  simulate_correlated_rates_gamma_recursive(node->right,gtree);
+  simulate_correlated_rates_gamma_recursive(node->left,gtree,rate,thread_index);
+  simulate_correlated_rates_gamma_recursive(node->right,gtree,rate,thread_index);
     
 }
 
 
-static void relaxed_clock_branch_lengths(stree_t * stree, gtree_t * gtree)
+static void relaxed_clock_branch_lengths(stree_t * stree,
+                                         gtree_t * gtree,
+                                         double * rate,
+                                         long thread_index)
 {
   /* TODO: Implement networks */
   long i;
@@ -762,8 +856,8 @@ static void relaxed_clock_branch_lengths(stree_t * stree, gtree_t * gtree)
       for (i = 0; i < total_nodes; ++i)
       {
         double nv = log(gtree->rate_mui) - 0.5*gtree->rate_nui +
-                    sqrt(gtree->rate_nui)*rndNormal(thread_index_zero);
-        stree->nodes[i]->rate = exp(nv);
+                    sqrt(gtree->rate_nui)*rndNormal(thread_index);
+        rate[i] = exp(nv);
       }
     }
     else
@@ -773,7 +867,7 @@ static void relaxed_clock_branch_lengths(stree_t * stree, gtree_t * gtree)
       double a = gtree->rate_mui * gtree->rate_mui / gtree->rate_nui;
       double b = gtree->rate_mui / gtree->rate_nui;
       for (i = 0; i < total_nodes; ++i)
-        stree->nodes[i]->rate = legacy_rndgamma(thread_index_zero,a) / b;
+        rate[i] = legacy_rndgamma(thread_index,a) / b;
     }
   }
   else
@@ -783,17 +877,26 @@ static void relaxed_clock_branch_lengths(stree_t * stree, gtree_t * gtree)
 
     /* correlated clock */
     
-    stree->root->rate = gtree->rate_mui;
+    rate[stree->root->node_index] = gtree->rate_mui;
 
     if (opt_rate_prior == BPP_BRATE_PRIOR_GAMMA)
     {
-      simulate_correlated_rates_gamma_recursive(stree->root->left,gtree);
-      simulate_correlated_rates_gamma_recursive(stree->root->right,gtree);
+      simulate_correlated_rates_gamma_recursive(stree->root->left,
+                                                gtree,
+                                                rate,
+                                                thread_index);
+      simulate_correlated_rates_gamma_recursive(stree->root->right,
+                                                gtree,
+                                                rate,
+                                                thread_index);
     }
     else
     {
       assert(opt_rate_prior == BPP_BRATE_PRIOR_LOGNORMAL);
-      simulate_correlated_rates_logn_recursive(stree->root,gtree);
+      simulate_correlated_rates_logn_recursive(stree->root,
+                                               gtree,
+                                               rate,
+                                               thread_index);
     }
   }
 
@@ -831,29 +934,30 @@ static void relaxed_clock_branch_lengths(stree_t * stree, gtree_t * gtree)
 
       /* skip using branch rates on horizontal edges in hybridization events */
       if (!(pop->hybrid && pop->htau == 0))
-        x->length += (start->tau - t)*pop->rate;
+        x->length += (start->tau - t)*rate[pop->node_index];
       t = start->tau;
     }
-    x->length += (x->parent->time - t) * x->parent->pop->rate;
+    x->length += (x->parent->time - t) * rate[x->parent->pop->node_index];
   }
 }
 
-static void randomize_order(long * order, long n)
+static void randomize_order(long * order, long n, long thread_index)
 {
   long i,k;
 
-  if (!g_order)
-    g_order = (long *)xmalloc((size_t)n * sizeof(long));
+  long * tmp = (long *)xmalloc((size_t)n * sizeof(long));
 
   for (i = 0; i < n; ++i)
-    g_order[i] = i;
+    tmp[i] = i;
 
   for (i = 0; i < n; ++i)
   {
-    k = (long)((n-i)*legacy_rndu(thread_index_zero));
-    order[i] = g_order[i+k];
-    g_order[i+k] = g_order[i];
+    k = (long)((n-i)*legacy_rndu(thread_index));
+    order[i] = tmp[i+k];
+    tmp[i+k] = tmp[i];
   }
+
+  free(tmp);
 }
 
 static char * consensus(const char * x, const char * y, long n)
@@ -938,37 +1042,82 @@ static void collapse_diploid(stree_t * stree, gtree_t * gtree, msa_t * msa, long
   msa->count = hets_count;
 }
 
-static void write_concat_seqs(FILE * fp, msa_t ** msa)
+/* format n states of a sequence starting at alignment column start into buf,
+   with a blank every 10 columns, and return the end of the written text */
+static char * format_seq(char * buf, const char * seq, long n, long start)
 {
-  long i,j,k;
+  long j;
+
+  for (j = 0; j < n; ++j)
+  {
+    if ((start+j) % 10 == 0) *buf++ = ' ';
+    *buf++ = charmap_nt_tcag[(int)seq[j]];
+  }
+
+  return buf;
+}
+
+/* Write the concatenated alignment from the temporary file fp_tmp, which
+   holds the count sequences of each locus (simulation codes, one byte per
+   site) in locus order. The file is mapped in memory where possible, and
+   otherwise read one locus sequence at a time, as it may not fit in memory */
+static void write_concat_seqs(FILE * fp,
+                              FILE * fp_tmp,
+                              char ** label,
+                              long count)
+{
+  long i,k;
+  size_t simlen = (size_t)opt_locus_simlen;
 
-  fprintf(fp,"\n\n%d %ld \n\n",msa[0]->count,opt_locus_simlen*opt_locus_count);
+  fprintf(fp,"\n\n%ld %ld \n\n",count,opt_locus_simlen*opt_locus_count);
 
-  char * x = (char *)xmalloc((size_t)(opt_locus_simlen * opt_locus_count) *
-                             sizeof(char));
+  fflush(fp_tmp);
 
-  for (i = 0; i < msa[0]->count; ++i)
+#if (defined(_WIN32) || defined(_WIN64))
+  char * seq = (char *)xmalloc(simlen * sizeof(char));
+#else
+  int mapped;
+  size_t size = (size_t)opt_locus_count * (size_t)count * simlen;
+  char * mem = xmapfile(fp_tmp, size, &mapped);
+#endif
+
+  char * buf = (char *)xmalloc((size_t)(2*opt_locus_simlen+2) * sizeof(char));
+
+  for (i = 0; i < count; ++i)
   {
-    /* concatenate sequences */
-    for (k = 0; k < opt_locus_count; ++k)
-      memcpy(x+k*opt_locus_simlen,msa[k]->sequence[i],opt_locus_simlen*sizeof(char));
+    fprintf(fp, "%s%-*s ", "", 10, label[i]);
 
-    fprintf(fp, "%s%-*s ", "", 10, msa[0]->label[i]);
-    for (j = 0; j < opt_locus_simlen*opt_locus_count; ++j)
+    /* append the sequence of each locus */
+    for (k = 0; k < opt_locus_count; ++k)
     {
-      if (j % 10 == 0) fprintf(fp, " ");
-      fprintf(fp,"%c", charmap_nt_tcag[(int)x[j]]);
+      size_t offset = ((size_t)k*(size_t)count + (size_t)i) * simlen;
+
+#if (defined(_WIN32) || defined(_WIN64))
+      if (_fseeki64(fp_tmp, (__int64)offset, SEEK_SET) ||
+          fread(seq, sizeof(char), simlen, fp_tmp) != simlen)
+        fatal("Unable to read temporary file of simulated sequences");
+#else
+      const char * seq = mem + offset;
+#endif
+
+      char * end = format_seq(buf, seq, opt_locus_simlen, k*opt_locus_simlen);
+      fwrite(buf, sizeof(char), (size_t)(end - buf), fp);
     }
     fprintf(fp, "\n");
   }
   fprintf(fp, "\n\n");
 
-  free(x);
+  free(buf);
+#if (defined(_WIN32) || defined(_WIN64))
+  free(seq);
+#else
+  xunmapfile(mem, size, mapped);
+#endif
 }
 
 static void write_seqs(FILE * fp, msa_t * msa, long species_count)
 {
-  long i,j;
+  long i;
 
   fprintf(fp, "\n\n%d %ld \n\n", msa->count, opt_locus_simlen);
 
@@ -977,23 +1126,25 @@ static void write_seqs(FILE * fp, msa_t * msa, long species_count)
     seq_sum += opt_sp_seqcount[i] / (opt_diploid[i] ? 2 : 1);
   //assert(seq_sum == msa->count);
 
+  char * buf = (char *)xmalloc((size_t)(2*opt_locus_simlen+2) * sizeof(char));
+
   for (i = 0; i < msa->count; ++i)
   {
 
     fprintf(fp, "%s%-*s ", "", 10, msa->label[i]);
-    for (j = 0; j < opt_locus_simlen; ++j)
-    {
-      if (j % 10 == 0) fprintf(fp, " ");
-      fprintf(fp,"%c", charmap_nt_tcag[(int)msa->sequence[i][j]]);
-    }
-    fprintf(fp, "\n");
+    char * end = format_seq(buf, msa->sequence[i], opt_locus_simlen, 0);
+    *end++ = '\n';
+    fwrite(buf, sizeof(char), (size_t)(end - buf), fp);
   }
   fprintf(fp, "\n\n");
+
+  free(buf);
 }
 
 static void write_diploid_rand_seqs(FILE * fp_seqrand,
                                     stree_t * stree,
-                                    msa_t * msa)
+                                    msa_t * msa,
+                                    long thread_index)
 {
   long i,j,k,m;
   char ** sequence;
@@ -1025,7 +1176,7 @@ static void write_diploid_rand_seqs(FILE * fp_seqrand,
         for (k = 0; k < msa->length; ++k)
 
         /* randomly resolve */
-        if (sequence[j][k] != sequence[j+1][k] && legacy_rndu(thread_index_zero)<0.5)
+        if (sequence[j][k] != sequence[j+1][k] && legacy_rndu(thread_index)<0.5)
           SWAP(sequence[j][k],sequence[j+1][k]);
       }
     }
@@ -1139,15 +1290,252 @@ static void set_migration_rates(stree_t * stree)
 }
 
 
+/* state shared by the threads simulating a batch of loci */
+typedef struct sim_data_s
+{
+  stree_t * stree;
+  double * mui_array;
+  double * vi_array;
+  long locus_seqcount;
+
+  /* current batch of loci */
+  long first;
+  long count;
+  long slots;
+
+  /* alignments, gene trees and parameters of each locus in the batch */
+  msa_t ** msa;
+  gtree_t ** gtree;
+  double * qrates;
+  double * freqs;
+  double * siterate_alpha;
+  double * brate;
+} sim_data_t;
+
+static void simulate_locus(sim_data_t * sd, long i, long thread_index)
+{
+  long j,k,m;
+  long b = i - sd->first;
+  long total_nodes;
+  stree_t * stree = sd->stree;
+  msa_t * msa;
+  gtree_t * gtree;
+  double * qrates = sd->qrates + b*DNA_QRATES_COUNT;
+  double * freqs = sd->freqs + b*DNA_STATES_COUNT;
+  double locus_siterate_alpha = opt_siterate_alpha;
+  double * siterates = NULL;
+
+  total_nodes = stree->tip_count + stree->inner_count + stree->hybrid_count;
+
+  msa = sd->msa[b] = (msa_t *)xcalloc(1,sizeof(msa_t));
+
+  /* all draws for this locus come from its own stream, such that the data do
+     not depend on the thread simulating the locus */
+  rng_locus_begin(thread_index, i, THREAD_WORK_SIMULATE);
+
+  if (opt_model == BPP_DNA_MODEL_GTR)
+  {
+    if (!opt_qrates_fixed)
+    {
+      legacy_rnddirichlet(thread_index,qrates,opt_qrates_params,6);
+      for (j = 0; j < 6; ++j)
+        qrates[j] /= qrates[5];
+    }
+    else
+      memcpy(qrates,opt_qrates_params,6*sizeof(double));
+
+    if (!opt_basefreqs_fixed)
+      legacy_rnddirichlet(thread_index,freqs,opt_basefreqs_params,4);
+    else
+      memcpy(freqs,opt_basefreqs_params,4*sizeof(double));
+  }
+
+  if (!opt_siterate_fixed)
+    locus_siterate_alpha = legacy_rndgamma(thread_index,opt_siterate_alpha) /
+                           opt_siterate_beta;
+  sd->siterate_alpha[b] = locus_siterate_alpha;
+
+  if (opt_msafile || opt_treefile)
+  {
+    msa->label    = (char**)xmalloc((size_t)sd->locus_seqcount*sizeof(char *));
+    msa->sequence = (char**)xmalloc((size_t)sd->locus_seqcount*sizeof(char *));
+
+    /* create sequence labels and populate msa structure */
+    for (j = 0, m = 0; j < stree->tip_count; ++j)
+    {
+      if (opt_diploid[j])
+        for (k = 0; k < opt_sp_seqcount[j]; ++k)
+          xasprintf(msa->label+m++,
+                    "%s%ld%c^%s",
+                    stree->nodes[j]->label, 
+                    k / 2 + 1,
+                    (char)('a' + k % 2),
+                    stree->nodes[j]->label);
+      else
+        for (k = 0; k < opt_sp_seqcount[j]; ++k)
+          xasprintf(msa->label+m++,
+                    "%s%ld^%s",
+                    stree->nodes[j]->label, 
+                    k + 1,
+                    stree->nodes[j]->label);
+
+      msa->count += opt_sp_seqcount[j];
+    }
+    msa->length = opt_locus_simlen;
+
+    /* change all sequence labels to lowercase */
+    for (j = 0; j < m; ++j)
+      for (k = 0; k < (long)strlen(msa->label[j]) && msa->label[j][k] != '^'; ++k)
+        msa->label[j][k] = xtolower(msa->label[j][k]);
+  }
+
+  /* simulate gene tree */
+  gtree = sd->gtree[b] = gtree_simulate(stree,msa,i,thread_index);
+
+  if (opt_est_locusrate)
+    gtree->rate_mui = sd->mui_array[i];
+  else
+    gtree->rate_mui = 1;
+
+  if (opt_clock != BPP_CLOCK_GLOBAL)
+    gtree->rate_nui = sd->vi_array[i];
+
+  /* set branch lengths */
+  for (j = 0; j < gtree->tip_count+gtree->inner_count; ++j)
+  {
+    if (!gtree->nodes[j]->parent) continue;
+
+    gtree->nodes[j]->length = gtree->nodes[j]->parent->time -
+                              gtree->nodes[j]->time;
+  }
+    
+  assert(sd->locus_seqcount == gtree->tip_count);
+
+  /* TODO: Count 3S trees */
+
+  /* if clock is assumed, compute species tree branch rates */
+  if (opt_clock == BPP_CLOCK_IND || opt_clock == BPP_CLOCK_CORR)
+    relaxed_clock_branch_lengths(stree,
+                                 gtree,
+                                 sd->brate + b*total_nodes,
+                                 thread_index);
+
+  /* multiply branches with locus rate */
+  if (opt_est_locusrate && opt_clock == BPP_CLOCK_GLOBAL)
+  {
+    for (j = 0; j < gtree->tip_count + gtree->inner_count; ++j)
+      gtree->nodes[j]->length *= sd->mui_array[i];
+  }
+
+  if (opt_msafile)
+  {
+    double * eigenvecs = NULL;
+    double * inv_eigenvecs = NULL;
+    double * eigenvals = NULL;
+
+    if (opt_model == BPP_DNA_MODEL_GTR)
+    {
+      eigenvecs = (double *)xmalloc(16*sizeof(double));
+      inv_eigenvecs = (double *)xmalloc(16*sizeof(double));
+      eigenvals = (double *)xmalloc(4*sizeof(double));
+      pll_update_eigen(eigenvecs,inv_eigenvecs,eigenvals,freqs,qrates,4,4);
+    }
+
+    /* calculate rates for each site */
+    if (locus_siterate_alpha)
+      siterates = rates4sites(locus_siterate_alpha,
+                              (opt_model == BPP_DNA_MODEL_JC69),
+                              thread_index);
+
+    /* allocate space for sequences and map each to a gene tree node */
+    char ** x = (char**)xmalloc((size_t)(gtree->tip_count+gtree->inner_count)*
+                                sizeof(char *));
+    for (j = 0; j < gtree->tip_count + gtree->inner_count; ++j)
+    {
+      x[j] = (char *)xmalloc((size_t)opt_locus_simlen * sizeof(char));
+      gtree->nodes[j]->data = (void *)(x[j]);
+    }
+
+    /* map also gene tree tip node sequences to the msa alignment structure,
+       and free the placeholder */
+    for (j = 0; j < gtree->tip_count; ++j)
+      msa->sequence[j] = x[j];
+    free(x);
+
+    /* generate a sequence at the root */
+    make_root_seq(gtree->root, freqs, thread_index);
+
+    /* recursively generate ancestral sequences and tip sequences */
+    if (opt_model == BPP_DNA_MODEL_JC69)
+    {
+      evolve_jc69_recursive(gtree->root->left, locus_siterate_alpha, siterates,
+                            thread_index);
+      evolve_jc69_recursive(gtree->root->right, locus_siterate_alpha, siterates,
+                            thread_index);
+    }
+    else
+    {
+      double * u = (double *)xmalloc((size_t)opt_locus_simlen *
+                                     sizeof(double));
+      evolve_gtr_recursive(gtree->root->left,siterates,
+                           eigenvecs,inv_eigenvecs,eigenvals,u,thread_index);
+      evolve_gtr_recursive(gtree->root->right,siterates,
+                           eigenvecs,inv_eigenvecs,eigenvals,u,thread_index);
+      free(u);
+    }
+
+    /* shuffle order of sites */
+    if (locus_siterate_alpha && opt_siterate_cats > 1)
+    {
+      long * siteorder = (long *)xmalloc((size_t)opt_locus_simlen *
+                                         sizeof(long));
+      randomize_order(siteorder, opt_locus_simlen, thread_index);
+      char * tmpseq = (char *)xmalloc((size_t)opt_locus_simlen * sizeof(char));
+      for (j = 0; j < gtree->tip_count + gtree->inner_count; ++j)
+      {
+        char * seq = (char *)(gtree->nodes[j]->data);   
+        memcpy(tmpseq, seq, opt_locus_simlen * sizeof(char));
+        for (k = 0; k < opt_locus_simlen; ++k)
+          seq[k] = tmpseq[siteorder[k]];
+      }
+      free(tmpseq);
+      free(siteorder);
+    }
+
+    /* TODO: Instead of freeing and allocating, create siterates once and
+       fill it with ones, and use rates4sites to alter it */
+    if (siterates)
+      free(siterates);
+
+    if (opt_model == BPP_DNA_MODEL_GTR)
+    {
+      free(eigenvecs);
+      free(inv_eigenvecs);
+      free(eigenvals);
+    }
+  }
+
+  rng_locus_end(thread_index);
+}
+
+/* simulate loci first+t, first+t+slots, ... of the current batch using the
+   random number generator of thread slot t */
+static void cb_simulate_slot(void * arg, long t)
+{
+  long i;
+  sim_data_t * sd = (sim_data_t *)arg;
+
+  for (i = sd->first + t; i < sd->first + sd->count; i += sd->slots)
+    simulate_locus(sd, i, t);
+}
+
 static void simulate(stree_t * stree)
 {
-  long i,j,k,m;
+  long i,j;
   long hets;
+  long batch_size;
+  long total_nodes;
   double tmrca = 0;
-  long * siteorder = NULL;
-  double * eigenvecs = NULL;
-  double * inv_eigenvecs = NULL;
-  double * eigenvals = NULL;
   FILE * fp_seq = NULL;
   FILE * fp_concat = NULL;
   FILE * fp_tree = NULL;
@@ -1155,12 +1543,23 @@ static void simulate(stree_t * stree)
   FILE * fp_map = NULL;
   FILE * fp_seqfull = NULL;
   FILE * fp_seqrand = NULL;
+  FILE * fp_concattmp = NULL;
+  char * concattmp = NULL;
+  char ** concat_label = NULL;
+  long concat_count = 0;
+  sim_data_t sd;
 
   /* open output files */
   if (opt_msafile)
+  {
     fp_seq = xopen(opt_msafile, "w");
+    setvbuf(fp_seq, NULL, _IOFBF, SIM_OUTPUT_BUFFER);
+  }
   if (opt_concatfile)
+  {
     fp_concat = xopen(opt_concatfile, "w");
+    setvbuf(fp_concat, NULL, _IOFBF, SIM_OUTPUT_BUFFER);
+  }
   if (opt_treefile)
     fp_tree = xopen(opt_treefile, "w");
   if (opt_modelparafile)
@@ -1217,27 +1616,10 @@ static void simulate(stree_t * stree)
     fprintf(fp_map, "%s\t%s\n", stree->nodes[i]->label, stree->nodes[i]->label);
 
 
-  /* allocate MSA structures */
-  msa_t ** msa = (msa_t **)xmalloc((size_t)opt_locus_count * sizeof(msa_t *));
-  for (i = 0; i < opt_locus_count; ++i)
-    msa[i] = (msa_t *)xcalloc(1,sizeof(msa_t));
-
-  /* allocate placeholder for gene trees */
-  gtree_t ** gtree = (gtree_t **)xmalloc((size_t)opt_locus_count *
-                                         sizeof(gtree_t *));
-
   long locus_seqcount;
-  double qrates[6];
-  double freqs[4];
-  double locus_siterate_alpha = opt_siterate_alpha;
-  double * siterates = NULL;
   double * mui_array = NULL;
   double * vi_array = NULL;
 
-  /* allocate array used for shuffling order of sites */
-  if (opt_msafile)
-    siteorder = (long *)xmalloc((size_t)opt_locus_simlen * sizeof(long));
-
 //  if (opt_siterate_fixed)
 //    locus_siterate_alpha = opt_siterate_alpha;
 
@@ -1246,6 +1628,15 @@ static void simulate(stree_t * stree)
   for (i = 0; i < stree->tip_count; ++i)
     locus_seqcount += opt_sp_seqcount[i];
 
+  /* the sequences of each locus are appended to a temporary file from which
+     the concatenated alignment is assembled at the end */
+  if (opt_concatfile)
+  {
+    xasprintf(&concattmp, "%s.tmp", opt_concatfile);
+    fp_concattmp = xopen(concattmp, "w+b");
+    setvbuf(fp_concattmp, NULL, _IOFBF, SIM_OUTPUT_BUFFER);
+  }
+
   if (opt_msafile)
   {
     if (hets < locus_seqcount)
@@ -1253,11 +1644,13 @@ static void simulate(stree_t * stree)
       char * filename = NULL;
       xasprintf(&filename, "%s.full", opt_msafile);
       fp_seqfull = xopen(filename,"w");
+      setvbuf(fp_seqfull, NULL, _IOFBF, SIM_OUTPUT_BUFFER);
       free(filename);
 
       filename = NULL;
       xasprintf(&filename, "%s.rand", opt_msafile);
       fp_seqrand = xopen(filename,"w");
+      setvbuf(fp_seqrand, NULL, _IOFBF, SIM_OUTPUT_BUFFER);
       free(filename);
     }
   }
@@ -1270,14 +1663,6 @@ static void simulate(stree_t * stree)
   list_clear(maplist,map_dealloc);
   free(maplist);
 
-  /* allocate eigendecomposition structures */
-  if (opt_model == BPP_DNA_MODEL_GTR)
-  {
-    eigenvecs = (double *)xmalloc(16*sizeof(double));
-    inv_eigenvecs = (double *)xmalloc(16*sizeof(double));
-    eigenvals = (double *)xmalloc(4*sizeof(double));
-  }
-
   /* pre-generate mu_i and v_i */
   if (opt_est_locusrate)
   {
@@ -1335,235 +1720,184 @@ static void simulate(stree_t * stree)
     }
   }
 
-  /* start generating */
-  for (i = 0; i < opt_locus_count; ++i)
+  for (j = 0; j < stree->tip_count; ++j)
+    if (opt_sp_seqcount[j] > 1 && stree->nodes[j]->theta == 0)
+      fatal("Missing theta value for species %s consisting of more than one "
+            "samples", stree->nodes[j]->label);
+
+  /* TODO: Check for hybridization nodes as well */
+  for (j = stree->tip_count; j < stree->tip_count+stree->inner_count; ++j)
+    if (stree->nodes[j]->theta == 0)
+      fatal("Missing theta values for some of the species tree inner nodes");
+
+  /* Loci are simulated in batches, in parallel, and each batch is then written
+     in locus order. Each locus draws from its own random stream, hence the
+     output does not depend on the number of threads. The legacy generator has
+     no per-locus streams, and loci are simulated one at a time in order to
+     reproduce the output of previous versions */
+  if (opt_rng == BPP_RNG_LEGACY)
+    batch_size = 1;
+  else
+    batch_size = opt_threads * SIM_BATCH_PER_THREAD;
+  batch_size = MIN(batch_size,opt_locus_count);
+
+  if (opt_rng != BPP_RNG_LEGACY)
+    rng_locus_init(opt_locus_count);
+
+  total_nodes = stree->tip_count + stree->inner_count + stree->hybrid_count;
+
+  sd.stree = stree;
+  sd.msa = (msa_t **)xmalloc((size_t)batch_size * sizeof(msa_t *));
+  sd.gtree = (gtree_t **)xmalloc((size_t)batch_size * sizeof(gtree_t *));
+  sd.mui_array = mui_array;
+  sd.vi_array = vi_array;
+  sd.locus_seqcount = locus_seqcount;
+  sd.qrates = (double *)xmalloc((size_t)(batch_size*DNA_QRATES_COUNT) *
+                                sizeof(double));
+  sd.freqs = (double *)xmalloc((size_t)(batch_size*DNA_STATES_COUNT) *
+                               sizeof(double));
+  sd.siterate_alpha = (double *)xmalloc((size_t)batch_size * sizeof(double));
+  sd.brate = NULL;
+  if (opt_clock == BPP_CLOCK_IND || opt_clock == BPP_CLOCK_CORR)
+    sd.brate = (double *)xmalloc((size_t)(batch_size*total_nodes) *
+                                 sizeof(double));
+
+  /* one migration events matrix per thread, summed after simulation */
+  if (opt_migration && batch_size > 1)
   {
-    if (opt_modelparafile)
-      fprintf(fp_param, "%ld", i+1);
+    free(opt_migration_events);
+    opt_migration_events = (double *)xcalloc((size_t)(opt_threads *
+                                                      opt_migration *
+                                                      opt_migration),
+                                             sizeof(double));
+  }
 
+  /* start generating */
+  for (sd.first = 0; sd.first < opt_locus_count; sd.first += batch_size)
+  {
+    sd.count = MIN(batch_size, opt_locus_count - sd.first);
+    sd.slots = MIN(opt_threads, sd.count);
+    threads_parallel_for(sd.slots, cb_simulate_slot, (void *)&sd);
 
-    if (opt_model == BPP_DNA_MODEL_GTR)
+    /* write the batch in locus order, and free each locus once written */
+    for (i = sd.first; i < sd.first + sd.count; ++i)
     {
-      if (!opt_qrates_fixed)
-      {
-        legacy_rnddirichlet(thread_index_zero,qrates,opt_qrates_params,6);
-        for (j = 0; j < 6; ++j)
-          qrates[j] /= qrates[5];
-      }
-      else
-        memcpy(qrates,opt_qrates_params,6*sizeof(double));
+      long b = i - sd.first;
+      msa_t * msa = sd.msa[b];
+      gtree_t * gtree = sd.gtree[b];
 
-      if (!opt_basefreqs_fixed)
-        legacy_rnddirichlet(thread_index_zero,freqs,opt_basefreqs_params,4);
-      else
-        memcpy(freqs,opt_basefreqs_params,4*sizeof(double));
-
-      /* print parameters in parameter file */
-      assert(opt_modelparafile);
-      for (j = 0; j < 6; ++j)
-        fprintf(fp_param," %9.6f", qrates[j]);
-      for (j = 0; j < 4; ++j)
-        fprintf(fp_param," %8.6f", freqs[j]);
-
-      pll_update_eigen(eigenvecs,inv_eigenvecs,eigenvals,freqs,qrates,4,4);
-    }
-
-    if (!opt_siterate_fixed)
-    {
-      locus_siterate_alpha = legacy_rndgamma(thread_index_zero,opt_siterate_alpha) /
-                             opt_siterate_beta;
       if (opt_modelparafile)
-        fprintf(fp_param, " %9.6f", locus_siterate_alpha);
-    }
-    if (opt_est_locusrate)
-      fprintf(fp_param, " %9.6f", mui_array[i]);
-    if (opt_clock != BPP_CLOCK_GLOBAL)
-      fprintf(fp_param, " %9.6f", vi_array[i]);
+        fprintf(fp_param, "%ld", i+1);
 
-    if (opt_msafile || opt_treefile)
-    {
-      msa[i]->label    = (char**)xmalloc((size_t)locus_seqcount*sizeof(char *));
-      msa[i]->sequence = (char**)xmalloc((size_t)locus_seqcount*sizeof(char *));
-
-      /* create sequence labels and populate msa structure */
-      for (j = 0, m = 0; j < stree->tip_count; ++j)
+      if (opt_model == BPP_DNA_MODEL_GTR)
       {
-        if (opt_diploid[j])
-          for (k = 0; k < opt_sp_seqcount[j]; ++k)
-            xasprintf(msa[i]->label+m++,
-                      "%s%ld%c^%s",
-                      stree->nodes[j]->label, 
-                      k / 2 + 1,
-                      (char)('a' + k % 2),
-                      stree->nodes[j]->label);
-        else
-          for (k = 0; k < opt_sp_seqcount[j]; ++k)
-            xasprintf(msa[i]->label+m++,
-                      "%s%ld^%s",
-                      stree->nodes[j]->label, 
-                      k + 1,
-                      stree->nodes[j]->label);
-
-        msa[i]->count += opt_sp_seqcount[j];
+        /* print parameters in parameter file */
+        assert(opt_modelparafile);
+        for (j = 0; j < 6; ++j)
+          fprintf(fp_param," %9.6f", sd.qrates[b*DNA_QRATES_COUNT+j]);
+        for (j = 0; j < 4; ++j)
+          fprintf(fp_param," %8.6f", sd.freqs[b*DNA_STATES_COUNT+j]);
       }
-      msa[i]->length = opt_locus_simlen;
-
-      /* change all sequence labels to lowercase */
-      for (j = 0; j < m; ++j)
-        for (k = 0; k < (long)strlen(msa[i]->label[j]) && msa[i]->label[j][k] != '^'; ++k)
-          msa[i]->label[j][k] = xtolower(msa[i]->label[j][k]);
-    }
-
-    for (j = 0; j < stree->tip_count; ++j)
-      if (opt_sp_seqcount[j] > 1 && stree->nodes[j]->theta == 0)
-        fatal("Missing theta value for species %s consisting of more than one "
-              "samples", stree->nodes[j]->label);
 
-    /* TODO: Check for hybridization nodes as well */
-    for (j = stree->tip_count; j < stree->tip_count+stree->inner_count; ++j)
-      if (stree->nodes[j]->theta == 0)
-        fatal("Missing theta values for some of the species tree inner nodes");
-
-    /* simulate gene tree */
-    gtree[i] = gtree_simulate(stree,msa[i],i);
-
-    if (opt_est_locusrate)
-      gtree[i]->rate_mui = mui_array[i];
-    else
-      gtree[i]->rate_mui = 1;
-
-    if (opt_clock != BPP_CLOCK_GLOBAL)
-      gtree[i]->rate_nui = vi_array[i];
-
-    tmrca += gtree[i]->root->time;
-
-    /* set branch lengths */
-    for (j = 0; j < gtree[i]->tip_count+gtree[i]->inner_count; ++j)
-    {
-      if (!gtree[i]->nodes[j]->parent) continue;
-
-      gtree[i]->nodes[j]->length = gtree[i]->nodes[j]->parent->time -
-                                   gtree[i]->nodes[j]->time;
-    }
-      
-    assert(locus_seqcount == gtree[i]->tip_count);
+      if (!opt_siterate_fixed && opt_modelparafile)
+        fprintf(fp_param, " %9.6f", sd.siterate_alpha[b]);
+      if (opt_est_locusrate)
+        fprintf(fp_param, " %9.6f", mui_array[i]);
+      if (opt_clock != BPP_CLOCK_GLOBAL)
+        fprintf(fp_param, " %9.6f", vi_array[i]);
 
-    /* TODO: Count 3S trees */
+      tmrca += gtree->root->time;
 
-    /* if clock is assumed, compute species tree branch rates and write them to
-       file */
-    if (opt_clock == BPP_CLOCK_IND || opt_clock == BPP_CLOCK_CORR)
-    {
-      relaxed_clock_branch_lengths(stree, gtree[i]);
-      assert(opt_modelparafile);
-      for (j = 0; j < stree->tip_count + stree->inner_count; ++j)
+      /* write species tree branch rates for relaxed clocks */
+      if (opt_clock == BPP_CLOCK_IND || opt_clock == BPP_CLOCK_CORR)
       {
-        fprintf(fp_param, " %.6f", stree->nodes[j]->rate);
+        assert(opt_modelparafile);
+        for (j = 0; j < total_nodes; ++j)
+          fprintf(fp_param, " %.6f", sd.brate[b*total_nodes+j]);
       }
-    }
-    if (opt_modelparafile)
-      fprintf(fp_param, "\n");
-
-    /* multiply branches with locus rate */
-    if (opt_est_locusrate && opt_clock == BPP_CLOCK_GLOBAL)
-    {
-      for (j = 0; j < gtree[i]->tip_count + gtree[i]->inner_count; ++j)
-        gtree[i]->nodes[j]->length *= mui_array[i];
-    }
-
-
-    if (opt_treefile)
-    {
-      char * newick = gtree_export_newick(gtree[i]->root, NULL);
-      fprintf(fp_tree, "%s [TH=%.6f]\n", newick, gtree[i]->root->time);
-      free(newick);
-    }
-
-    if (opt_msafile)
-    {
-      /* calculate rates for each site */
-      if (locus_siterate_alpha)
-        siterates = rates4sites(locus_siterate_alpha,
-                                (opt_model == BPP_DNA_MODEL_JC69));
-
-      /* allocate space for sequences and map each to a gene tree node */
-      char ** x = (char**)xmalloc((size_t)(gtree[i]->tip_count+gtree[i]->inner_count)*
-                                  sizeof(char *));
-      for (j = 0; j < gtree[i]->tip_count + gtree[i]->inner_count; ++j)
-      {
-        x[j] = (char *)xmalloc((size_t)opt_locus_simlen * sizeof(char));
-        gtree[i]->nodes[j]->data = (void *)(x[j]);
-      }
-
-      /* map also gene tree tip node sequences to the msa alignment structure,
-         and free the placeholder */
-      for (j = 0; j < gtree[i]->tip_count; ++j)
-        msa[i]->sequence[j] = x[j];
-      free(x);
-
-      /* generate a sequence at the root */
-      make_root_seq(gtree[i]->root, freqs);
+      if (opt_modelparafile)
+        fprintf(fp_param, "\n");
 
-      /* recursively generate ancestral sequences and tip sequences */
-      if (opt_model == BPP_DNA_MODEL_JC69)
-      {
-        evolve_jc69_recursive(gtree[i]->root->left, locus_siterate_alpha, siterates);
-        evolve_jc69_recursive(gtree[i]->root->right, locus_siterate_alpha, siterates);
-      }
-      else
+      if (opt_treefile)
       {
-        evolve_gtr_recursive(gtree[i]->root->left,locus_siterate_alpha,siterates,
-                             eigenvecs,inv_eigenvecs,eigenvals);
-        evolve_gtr_recursive(gtree[i]->root->right,locus_siterate_alpha,siterates,
-                             eigenvecs,inv_eigenvecs,eigenvals);
+        char * newick = gtree_export_newick(gtree->root, NULL);
+        fprintf(fp_tree, "%s [TH=%.6f]\n", newick, gtree->root->time);
+        free(newick);
       }
 
-      /* shuffle order of sites */
-      if (locus_siterate_alpha && opt_siterate_cats > 1)
+      if (opt_msafile)
       {
-        randomize_order(siteorder, opt_locus_simlen);
-        char * tmpseq = (char *)xmalloc((size_t)opt_locus_simlen * sizeof(char));
-        for (j = 0; j < gtree[i]->tip_count + gtree[i]->inner_count; ++j)
+        /* collapse diploid sequences */
+        if (hets < msa->count)
         {
-          char * seq = (char *)(gtree[i]->nodes[j]->data);   
-          memcpy(tmpseq, seq, opt_locus_simlen * sizeof(char));
-          for (k = 0; k < opt_locus_simlen; ++k)
-            seq[k] = tmpseq[siteorder[k]];
+          /* write full data first */
+          if (fp_seqfull)
+            write_seqs(fp_seqfull, msa, stree->tip_count);
+          if (fp_seqrand)
+          {
+            rng_locus_begin(thread_index_zero, i, THREAD_WORK_SIMULATE);
+            write_diploid_rand_seqs(fp_seqrand,stree,msa,thread_index_zero);
+            rng_locus_end(thread_index_zero);
+          }
+
+          /* then collapse sequences */
+          collapse_diploid(stree,gtree,msa,hets);
         }
-        free(tmpseq);
-      }
 
-      /* collapse diploid sequences */
-      if (hets < msa[i]->count)
-      {
-        /* write full data first */
-        if (fp_seqfull)
-          write_seqs(fp_seqfull, msa[i], stree->tip_count);
-        if (fp_seqrand)
-          write_diploid_rand_seqs(fp_seqrand,stree,msa[i]);
-
-        /* then collapse sequences */
-        collapse_diploid(stree,gtree[i],msa[i],hets);
+        /* write sequences */
+        write_seqs(fp_seq, msa, stree->tip_count);
+
+        if (fp_concattmp)
+        {
+          /* keep the labels of the first locus */
+          if (i == 0)
+          {
+            concat_count = msa->count;
+            concat_label = (char **)xmalloc((size_t)concat_count *
+                                            sizeof(char *));
+            for (j = 0; j < concat_count; ++j)
+              concat_label[j] = xstrdup(msa->label[j]);
+          }
+          for (j = 0; j < msa->count; ++j)
+            if (fwrite(msa->sequence[j], sizeof(char), (size_t)opt_locus_simlen,
+                       fp_concattmp) != (size_t)opt_locus_simlen)
+              fatal("Unable to write to %s", concattmp);
+        }
       }
 
-      /* write sequences */
-      write_seqs(fp_seq, msa[i], stree->tip_count);
+      if ((i+1) % 1000 == 0 || (opt_locus_count > 1000 && i == opt_locus_count-1))
+        printf("%10ld replicates done... mean tMRCA = %9.6f\n", i+1, tmrca/(i+1));
 
-      /* TODO: Instead of freeing and allocating, create siterates once and
-         fill it with ones, and use rates4sites to alter it */
-      if (siterates)
-        free(siterates);
+      /* deallocate gene tree and alignment. Sequences are freed as part of the
+         gene tree, as they are mapped to its nodes */
+      gtree_destroy(gtree,free);
+      for (j = 0; j < msa->count; ++j)
+        free(msa->label[j]);
+      free(msa->label);
+      free(msa->sequence);
+      free(msa);
     }
-
-    if ((i+1) % 1000 == 0 || (opt_locus_count > 1000 && i == opt_locus_count-1))
-      printf("%10ld replicates done... mean tMRCA = %9.6f\n", i+1, tmrca/(i+1));
-
   }  /* end of locus loop */
+
+  free(sd.msa);
+  free(sd.gtree);
+  free(sd.qrates);
+  free(sd.freqs);
+  free(sd.siterate_alpha);
+  if (sd.brate)
+    free(sd.brate);
   
   if (opt_concatfile)
   {
     fprintf(stdout, "Generating concatenated sequence alignment...\n");
-    write_concat_seqs(fp_concat, msa);
+    write_concat_seqs(fp_concat, fp_concattmp, concat_label, concat_count);
+
+    fclose(fp_concattmp);
+    remove(concattmp);
+    free(concattmp);
+    for (j = 0; j < concat_count; ++j)
+      free(concat_label[j]);
+    free(concat_label);
 
   }
 
@@ -1571,6 +1905,12 @@ static void simulate(stree_t * stree)
   {
     long matrix_size = opt_migration * opt_migration;
 
+    /* sum the counts of the threads */
+    if (batch_size > 1)
+      for (j = 1; j < opt_threads; ++j)
+        for (i = 0; i < matrix_size; ++i)
+          opt_migration_events[i] += opt_migration_events[j*matrix_size+i];
+
     for (i = 0; i < matrix_size; ++i)
       opt_migration_events[i] /= opt_locus_count;
 
@@ -1593,32 +1933,6 @@ static void simulate(stree_t * stree)
   /* deallocate hashtables used for mapping sequences to species */
   gtree_simulate_fini();
 
-  /* deallocate alignment structures and gene trees */
-  for (i = 0; i < opt_locus_count; ++i)
-  {
-    gtree_destroy(gtree[i],free);
-
-    for (j = 0; j < msa[i]->count; ++j)
-      free(msa[i]->label[j]);
-    free(msa[i]->label);
-
-    /* remember sequences were already freed as they are mapped to the gene tree */
-    free(msa[i]->sequence);
-    free(msa[i]);
-  }
-  free(msa);
-  free(gtree);
-
-
-
-  /* deallocate eigendecomposition structures */
-  if (opt_model == BPP_DNA_MODEL_GTR)
-  {
-    free(eigenvecs);
-    free(inv_eigenvecs);
-    free(eigenvals);
-  }
-
   /* close all open output files */
   if (opt_msafile)
     fclose(fp_seq);
@@ -1636,11 +1950,6 @@ static void simulate(stree_t * stree)
     fclose(fp_seqfull);
   if (fp_seqrand)
     fclose(fp_seqrand);
-
-  if (g_order)
-    free(g_order);
-  if (siteorder)
-    free(siteorder);
 }
 
 static void assign_thetas(stree_t * stree)
@@ -1857,33 +2166,14 @@ void cmd_simulate()
 
   /* allocate space for keeping track of coalescent events at each species tree
      node for each locus */
-  stree->locus_count = (unsigned int)opt_locus_count;
-  for (i = 0; i < stree->tip_count+stree->inner_count+stree->hybrid_count; ++i)
+  stree_alloc_locus_state(stree, opt_locus_count);
+  if (!opt_est_theta)
   {
-    snode_t * snode = stree->nodes[i];
-
-    snode->event = (dlist_t **)xcalloc(opt_locus_count, sizeof(dlist_t *));
-    snode->event_count = (int *)xcalloc(opt_locus_count, sizeof(int));
-    snode->seqin_count = (int *)xcalloc(opt_locus_count, sizeof(int));
-    snode->gene_leaves = (unsigned int *)xcalloc(opt_locus_count,sizeof(unsigned int));
-    /* TODO: The next two allocations might not be necessary when computing
-       theta analytically */
-    snode->logpr_contrib = (double*)xcalloc(opt_locus_count, sizeof(double));
-    snode->old_logpr_contrib = (double *)xcalloc(opt_locus_count, sizeof(double));
-
-    snode->t2h = NULL;
-    snode->old_t2h = NULL;
-    if (!opt_est_theta)
+    for (i = 0; i < stree->tip_count+stree->inner_count+stree->hybrid_count; ++i)
     {
-      snode->t2h = (double*)xcalloc((size_t)opt_locus_count, sizeof(double));
-      snode->old_t2h = (double*)xcalloc((size_t)opt_locus_count, sizeof(double));
-      snode->t2h_sum = 0;
-      snode->event_count_sum = 0;
+      stree->nodes[i]->t2h_sum = 0;
+      stree->nodes[i]->event_count_sum = 0;
     }
-
-    long j;
-    for (j = 0; j < stree->locus_count; ++j)
-      snode->event[j] = dlist_create();
   }
 
   process_subst_model();
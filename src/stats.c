@@ -0,0 +1,360 @@
+/*
+    Copyright (C) 2016-2019 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Single-pass accumulators for posterior summaries of a sampled parameter.
+
+   Mean and variance are computed with Welford's algorithm. Quantiles are
+   exact as long as the number of samples does not exceed STATS_BUFFER_SIZE.
+   After that, samples are merged into a t-digest (Dunning and Ertl 2019) with
+   compression STATS_COMPRESSION, and quantiles and HPD intervals are
+   interpolated from its centroids. The integrated autocorrelation time is
+   estimated with non-overlapping batch means, using sqrt(n) batches of
+   sqrt(n) samples, where n is the expected number of samples */
+
+#define STATS_BUFFER_SIZE       10000
+#define STATS_COMPRESSION       500
+#define STATS_HPD_GRID          1000
+
+typedef struct centroid_s
+{
+  double mean;
+  double weight;
+} centroid_t;
+
+static int cb_cmp_double(const void * a, const void * b)
+{
+  const double * x = (const double *)a;
+  const double * y = (const double *)b;
+
+  if (*x > *y) return 1;
+  if (*x < *y) return -1;
+  return 0;
+}
+
+static int cb_cmp_centroid(const void * a, const void * b)
+{
+  const centroid_t * x = (const centroid_t *)a;
+  const centroid_t * y = (const centroid_t *)b;
+
+  if (x->mean > y->mean) return 1;
+  if (x->mean < y->mean) return -1;
+  return 0;
+}
+
+stats_t * stats_create(long expected_samples)
+{
+  stats_t * s = (stats_t *)xcalloc(1,sizeof(stats_t));
+
+  s->batch_size = (long)sqrt((double)expected_samples);
+  if (s->batch_size < 1)
+    s->batch_size = 1;
+
+  s->buffer = (double *)xmalloc(STATS_BUFFER_SIZE * sizeof(double));
+
+  /* the k1 scale function bounds the number of centroids by the compression */
+  s->centroid_max = 2*STATS_COMPRESSION;
+  s->centroid_mean = (double *)xmalloc((size_t)(s->centroid_max) *
+                                       sizeof(double));
+  s->centroid_weight = (double *)xmalloc((size_t)(s->centroid_max) *
+                                         sizeof(double));
+
+  return s;
+}
+
+void stats_destroy(stats_t * s)
+{
+  free(s->buffer);
+  free(s->centroid_mean);
+  free(s->centroid_weight);
+  free(s);
+}
+
+static double scale_k1(double q)
+{
+  return STATS_COMPRESSION / (2*BPP_PI) * asin(2*q - 1);
+}
+
+/* merge buffered samples into the t-digest centroids */
+static void digest_merge(stats_t * s)
+{
+  long i,k;
+  long count = s->centroid_count + s->buffer_count;
+  double wsofar = 0;
+  double kprev;
+
+  if (!s->buffer_count) return;
+
+  centroid_t * c = (centroid_t *)xmalloc((size_t)count * sizeof(centroid_t));
+  for (i = 0; i < s->centroid_count; ++i)
+  {
+    c[i].mean   = s->centroid_mean[i];
+    c[i].weight = s->centroid_weight[i];
+  }
+  for (i = 0; i < s->buffer_count; ++i)
+  {
+    c[s->centroid_count+i].mean   = s->buffer[i];
+    c[s->centroid_count+i].weight = 1;
+  }
+  qsort(c, (size_t)count, sizeof(centroid_t), cb_cmp_centroid);
+
+  /* greedily merge neighbouring centroids as long as the merged centroid
+     spans at most one unit of the scale function */
+  k = 0;
+  kprev = scale_k1(0);
+  for (i = 1; i < count; ++i)
+  {
+    double q = (wsofar + c[k].weight + c[i].weight) / s->n;
+    if (scale_k1(MIN(q,1)) - kprev <= 1)
+    {
+      c[k].mean += (c[i].mean - c[k].mean) * c[i].weight /
+                   (c[k].weight + c[i].weight);
+      c[k].weight += c[i].weight;
+    }
+    else
+    {
+      wsofar += c[k].weight;
+      kprev = scale_k1(wsofar / s->n);
+      c[++k] = c[i];
+    }
+  }
+  ++k;
+
+  assert(k <= s->centroid_max);
+
+  for (i = 0; i < k; ++i)
+  {
+    s->centroid_mean[i]   = c[i].mean;
+    s->centroid_weight[i] = c[i].weight;
+  }
+  s->centroid_count = k;
+  s->buffer_count = 0;
+  s->merged = 1;
+
+  free(c);
+}
+
+void stats_update(stats_t * s, double x)
+{
+  double delta;
+
+  /* moments */
+  s->n++;
+  delta = x - s->mean;
+  s->mean += delta / s->n;
+  s->m2 += delta * (x - s->mean);
+
+  if (s->n == 1 || x < s->min) s->min = x;
+  if (s->n == 1 || x > s->max) s->max = x;
+
+  /* batch means */
+  s->batch_sum += x;
+  if (++s->batch_fill == s->batch_size)
+  {
+    double bmean = s->batch_sum / s->batch_size;
+
+    s->batch_count++;
+    delta = bmean - s->batch_mean;
+    s->batch_mean += delta / s->batch_count;
+    s->batch_m2 += delta * (bmean - s->batch_mean);
+
+    s->batch_sum = 0;
+    s->batch_fill = 0;
+  }
+
+  /* quantiles */
+  if (s->buffer_count == STATS_BUFFER_SIZE)
+    digest_merge(s);
+  s->buffer[s->buffer_count++] = x;
+  s->sorted = 0;
+}
+
+double stats_mean(stats_t * s)
+{
+  return s->mean;
+}
+
+double stats_sd(stats_t * s)
+{
+  return s->n > 1 ? sqrt(s->m2 / (s->n-1)) : 0;
+}
+
+/* returns the integrated autocorrelation time, such that ESS = n / tint */
+double stats_tint(stats_t * s)
+{
+  double sd = stats_sd(s);
+
+  if (sd/(fabs(s->mean)+1) < 1E-9)
+    return s->n;
+
+  if (s->batch_count < 2)
+    return 1;
+
+  return s->batch_size * (s->batch_m2 / (s->batch_count-1)) / (sd*sd);
+}
+
+static void exact_sort(stats_t * s)
+{
+  if (s->sorted) return;
+
+  qsort(s->buffer, (size_t)(s->buffer_count), sizeof(double), cb_cmp_double);
+  s->sorted = 1;
+}
+
+/* value at cumulative weight w of the t-digest, interpolating linearly
+   between centroid centers, and between the extreme centroids and the
+   minimum and maximum values */
+static double digest_value(stats_t * s, double w)
+{
+  long i;
+  double cum = 0;
+  double lcenter,rcenter;
+
+  if (s->centroid_count == 1)
+    return s->centroid_mean[0];
+
+  lcenter = s->centroid_weight[0] / 2;
+  if (w <= lcenter)
+    return s->min + (s->centroid_mean[0] - s->min) * w / lcenter;
+
+  for (i = 0; i < s->centroid_count-1; ++i)
+  {
+    lcenter = cum + s->centroid_weight[i] / 2;
+    rcenter = cum + s->centroid_weight[i] + s->centroid_weight[i+1] / 2;
+    if (w <= rcenter)
+      return s->centroid_mean[i] + (s->centroid_mean[i+1] -
+                                    s->centroid_mean[i]) *
+                                   (w - lcenter) / (rcenter - lcenter);
+    cum += s->centroid_weight[i];
+  }
+
+  lcenter = s->n - s->centroid_weight[i] / 2;
+  if (w >= s->n)
+    return s->max;
+
+  return s->centroid_mean[i] + (s->max - s->centroid_mean[i]) *
+                               (w - lcenter) / (s->n - lcenter);
+}
+
+/* value at position floor(n*q) of the sorted sample */
+double stats_quantile(stats_t * s, double q)
+{
+  assert(s->n);
+
+  if (!s->merged)
+  {
+    long index = MIN((long)(s->n*q), s->n-1);
+    exact_sort(s);
+    return s->buffer[index];
+  }
+
+  digest_merge(s);
+  return digest_value(s, q*s->n);
+}
+
+double stats_median(stats_t * s)
+{
+  assert(s->n);
+
+  if (!s->merged)
+  {
+    long mid = s->n / 2;
+    exact_sort(s);
+
+    if (s->n & 1)
+      return s->buffer[mid];
+
+    return (s->buffer[mid] + s->buffer[mid-1]) / 2;
+  }
+
+  digest_merge(s);
+  return digest_value(s, s->n / 2.0);
+}
+
+/* (1-alpha) highest posterior density interval, i.e. the shortest interval
+   containing a (1-alpha) proportion of the samples */
+void stats_hpd(stats_t * s, double alpha, double * lo, double * hi)
+{
+  long i;
+  double w;
+
+  assert(s->n);
+
+  if (!s->merged)
+  {
+    double * x = s->buffer;
+    long n = s->n;
+    long lrow = (long)(n*alpha/2);
+    long urow = (long)(n*(1-alpha/2));
+    long diffrow = urow - lrow;
+    long left = lrow;
+    long l,r;
+
+    exact_sort(s);
+    urow = MIN(urow,n-1);
+
+    *lo = x[lrow];
+    *hi = x[urow];
+
+    if (n <= 2) return;
+
+    w = x[urow] - x[lrow];
+    for (l=0,r=l+diffrow; r < n; l++,r++)
+    {
+      if (x[r] - x[l] < w)
+      {
+        left = l;
+        w = x[r] - x[l];
+      }
+    }
+
+    *lo = x[left];
+    *hi = x[left + diffrow];
+    return;
+  }
+
+  digest_merge(s);
+
+  *lo = digest_value(s, s->n*alpha/2);
+  *hi = digest_value(s, s->n*(1-alpha/2));
+  w = *hi - *lo;
+
+  for (i = 0; i <= STATS_HPD_GRID; ++i)
+  {
+    double ql = alpha * i / STATS_HPD_GRID;
+    double l = digest_value(s, s->n*ql);
+    double r = digest_value(s, s->n*(ql+1-alpha));
+
+    if (r - l < w)
+    {
+      w = r - l;
+      *lo = l;
+      *hi = r;
+    }
+  }
+}
+
+/* returns nonzero if quantiles are computed exactly */
+int stats_exact(stats_t * s)
+{
+  return !s->merged;
+}
@@ -246,9 +246,9 @@ void debug_print_network_node_attribs(stree_t * stree)
       s = NULL;
       xasprintf(&s,
                 "%d/%d/%d",
-                stree->nodes[i]->seqin_count[msa_index],
-                stree->nodes[i]->event_count[msa_index],
-                stree->nodes[i]->gene_leaves[msa_index]);
+                SNODE_LOCUS(stree->nodes[i],msa_index)->seqin_count,
+                SNODE_LOCUS(stree->nodes[i],msa_index)->event_count,
+                SNODE_LOCUS(stree->nodes[i],msa_index)->gene_leaves);
       if (strlen(s) > (size_t)pad)
       {
         for (j = 0; j < dots; ++j)
@@ -329,8 +329,8 @@ static void snode_clone(snode_t * snode, snode_t * clone, stree_t * clone_stree)
   clone->outgroup = snode->outgroup;
 
   if (!clone->mark)
-    clone->mark = (int *)xmalloc((size_t)opt_threads*sizeof(int));
-  memcpy(clone->mark, snode->mark, (size_t)opt_threads*sizeof(int));
+    clone->mark = (int *)xmalloc(sizeof(int));
+  clone->mark[0] = snode->mark[0];
   //clone->mark = snode->mark;
 
   /* points to relatives */
@@ -355,62 +355,22 @@ static void snode_clone(snode_t * snode, snode_t * clone, stree_t * clone_stree)
   else
     clone->label = NULL;
 
-  /* gene leaves */
-  if (!clone->gene_leaves)
-    clone->gene_leaves = (unsigned int *)xmalloc(msa_count * sizeof(unsigned int));
-  memcpy(clone->gene_leaves, snode->gene_leaves, msa_count * sizeof(unsigned int));
-
   /* data  - unused */
   clone->data = NULL;
 
-  /* event doubly-linked lists */
-  if (!clone->event)
-  {
-    clone->event = (dlist_t **)xcalloc(msa_count, sizeof(dlist_t *));
-    for (i = 0; i < msa_count; ++i)
-      clone->event[i] = dlist_create();
-  }
-  else
+  /* per-locus state (event counts, seqin counts, gene leaves, MSC density
+     contributions, t2h and branch rates). The coalescent event lists are
+     emptied and refilled by events_clone() */
+  for (i = 0; i < msa_count; ++i)
   {
-    for (i = 0; i < msa_count; ++i)
-      dlist_clear(clone->event[i], NULL);
-  }
-
-  /* event counts per locus */
-  if (!clone->event_count)
-    clone->event_count = (int *)xmalloc(msa_count * sizeof(int));
-  memcpy(clone->event_count, snode->event_count, msa_count * sizeof(int));
+    snode_locus_t * dst = SNODE_LOCUS(clone,i);
+    dlist_t * event = dst->event;
 
-  /* branch rate (per locus) */
-  if (snode->brate)
-  {
-    if (!clone->brate)
-      clone->brate = (double *)xmalloc(msa_count * sizeof(double));
-    memcpy(clone->brate, snode->brate, msa_count * sizeof(double));
+    memcpy(dst, SNODE_LOCUS(snode,i), sizeof(snode_locus_t));
+    dst->event = event;
+    dlist_reset(event);
   }
-    
-
-  /* seqin (incoming sequences to a population) counts per locus */
-  if (!clone->seqin_count)
-    clone->seqin_count = (int *)xmalloc(msa_count * sizeof(int));
-  memcpy(clone->seqin_count, snode->seqin_count, msa_count * sizeof(int));
-
-  /* per locus number of gene leaves at each clade */
-  if (!clone->gene_leaves)
-    clone->gene_leaves = (unsigned int*)xmalloc(msa_count*sizeof(unsigned int));
-  memcpy(clone->gene_leaves,snode->gene_leaves,msa_count*sizeof(unsigned int));
-
-  /* gene tree probability contributions for current population */
-  if (!clone->logpr_contrib)
-    clone->logpr_contrib = (double *)xmalloc(msa_count * sizeof(double));
-  memcpy(clone->logpr_contrib, snode->logpr_contrib, msa_count*sizeof(double));
-
-  /* old gene tree probability contributions for current population */
-  if (!clone->old_logpr_contrib)
-    clone->old_logpr_contrib = (double *)xmalloc(msa_count * sizeof(double));
-  memcpy(clone->old_logpr_contrib,
-         snode->old_logpr_contrib,
-         msa_count * sizeof(double));
+  clone->has_brate = snode->has_brate;
 
   if (!opt_est_theta)
   {
@@ -418,14 +378,6 @@ static void snode_clone(snode_t * snode, snode_t * clone, stree_t * clone_stree)
     clone->event_count_sum = snode->event_count_sum;
     clone->notheta_logpr_contrib = snode->notheta_logpr_contrib;
     clone->notheta_old_logpr_contrib = snode->notheta_old_logpr_contrib;
-
-    if (!clone->t2h)
-      clone->t2h = (double *)xmalloc((size_t)opt_locus_count * sizeof(double));
-    memcpy(clone->t2h, snode->t2h, opt_locus_count * sizeof(double));
-
-    if (!clone->old_t2h)
-      clone->old_t2h = (double*)xmalloc((size_t)opt_locus_count*sizeof(double));
-    memcpy(clone->old_t2h, snode->old_t2h, opt_locus_count * sizeof(double));
   }
 }
 
@@ -448,6 +400,10 @@ static void gnode_clone(gnode_t * gnode,
   clone->pmatrix_index = gnode->pmatrix_index;
   clone->mark = gnode->mark;
 
+  if (gnode->hpath && clone->hpath)
+    memcpy(clone->hpath,
+           gnode->hpath,
+           (size_t)(clone_stree->hybrid_count) * sizeof(int));
 
   /* points to relatives */
   if (gnode->parent)
@@ -529,6 +485,8 @@ stree_t * stree_clone_init(stree_t * stree)
   clone->nodes = (snode_t **)xmalloc(nodes_count * sizeof(snode_t *));
   for (i = 0; i < nodes_count; ++i)
     clone->nodes[i] = (snode_t *)xcalloc(1, sizeof(snode_t));
+  clone->locus_state = NULL;
+  stree_alloc_locus_state(clone, stree->locus_count);
   for (i = 0; i < nodes_count; ++i)
     snode_clone(stree->nodes[i], clone->nodes[i], clone);
 
@@ -571,14 +529,14 @@ gtree_t * gtree_clone_init(gtree_t * gtree, stree_t * clone_stree)
   unsigned int i;
   unsigned nodes_count = gtree->tip_count + gtree->inner_count;
   gtree_t * clone;
+  gnode_t ** nodes;
 
-  clone = (gtree_t *)xcalloc(1, sizeof(gtree_t));
+  /* create cloned gene tree nodes */
+  clone = gtree_arena_alloc(gtree->tip_count, clone_stree->hybrid_count);
+  nodes = clone->nodes;
   memcpy(clone, gtree, sizeof(gtree_t));
+  clone->nodes = nodes;
 
-  /* create cloned gene tree nodes */
-  clone->nodes = (gnode_t **)xmalloc(nodes_count * sizeof(gnode_t *));
-  for (i = 0; i < nodes_count; ++i)
-    clone->nodes[i] = (gnode_t *)xcalloc(1, sizeof(gnode_t));
   for (i = 0; i < nodes_count; ++i)
     gnode_clone(gtree->nodes[i], clone->nodes[i], clone, clone_stree);
 
@@ -602,21 +560,42 @@ static void events_clone(stree_t * stree,
     {
       gtree_t * clone_gtree = clone_gtree_list[j];
 
-      for (item = stree->nodes[i]->event[j]->head; item; item = item->next)
+      for (item = SNODE_LOCUS(stree->nodes[i],j)->event->head; item; item = item->next)
       {
         gnode_t * original_node = (gnode_t *)(item->data);
         unsigned int node_index = original_node->node_index;
         gnode_t * cloned_node = (gnode_t *)(clone_gtree->nodes[node_index]);
 
-        dlist_item_t * cloned = dlist_append(clone_stree->nodes[i]->event[j],
-          cloned_node);
-
-        cloned_node->event = cloned;
+        dlist_item_append(SNODE_LOCUS(clone_stree->nodes[i],j)->event,
+                          cloned_node->event);
       }
     }
   }
 }
 
+/* create an independent copy of the species tree and the gene trees, including
+   the coalescent events of each population */
+stree_t * stree_clone_with_gtrees(stree_t * stree,
+                                  gtree_t ** gtree,
+                                  gtree_t *** ptr_gtree_clones)
+{
+  unsigned int i;
+  stree_t * clone = stree_clone_init(stree);
+  gtree_t ** gclones;
+
+  gclones = (gtree_t **)xmalloc((size_t)(stree->locus_count) *
+                                sizeof(gtree_t *));
+  for (i = 0; i < stree->locus_count; ++i)
+  {
+    gclones[i] = gtree_clone_init(gtree[i], clone);
+    gtree_clone(gtree[i], gclones[i], clone);
+  }
+  events_clone(stree, clone, gclones);
+
+  *ptr_gtree_clones = gclones;
+  return clone;
+}
+
 static void stree_label_recursive(snode_t * node)
 {
   /* if node is a tip return */
@@ -1098,14 +1077,14 @@ static int propose_phi(stree_t * stree,
     {
       /* For bidirectional introgression we need to subtract the lineages
          coming from right. See issue #97 */
-      sequp_count = snode->seqin_count[i];
+      sequp_count = SNODE_LOCUS(snode,i)->seqin_count;
       if (node_is_bidirection(snode))
-        sequp_count -= snode->right->seqin_count[i];
+        sequp_count -= SNODE_LOCUS(snode->right,i)->seqin_count;
 
       old_logpr += gtree[i]->logpr;
       new_logpr += gtree[i]->logpr +
                    sequp_count*lnphiratio +
-                   snode->hybrid->seqin_count[i]*lnphiratio1;
+                   SNODE_LOCUS(snode->hybrid,i)->seqin_count*lnphiratio1;
     }
   }
   else
@@ -1116,12 +1095,12 @@ static int propose_phi(stree_t * stree,
     {
       /* For bidirectional introgression we need to subtract the lineages
          coming from right. See issue #97 */
-      sequp_count = snode->seqin_count[i];
+      sequp_count = SNODE_LOCUS(snode,i)->seqin_count;
       if (node_is_bidirection(snode))
-        sequp_count -= snode->right->seqin_count[i];
+        sequp_count -= SNODE_LOCUS(snode->right,i)->seqin_count;
 
       new_logpr += sequp_count*lnphiratio +
-                   snode->hybrid->seqin_count[i]*lnphiratio1;
+                   SNODE_LOCUS(snode->hybrid,i)->seqin_count*lnphiratio1;
     }
   }
 
@@ -1143,23 +1122,23 @@ static int propose_phi(stree_t * stree,
       for (i = 0; i < stree->locus_count; ++i)
       {
         /* subtract from gene tree log-density the old MSCi contributions */
-        gtree[i]->logpr -= snode->logpr_contrib[i] + 
-                           snode->hybrid->logpr_contrib[i];
+        gtree[i]->logpr -= SNODE_LOCUS(snode,i)->logpr_contrib + 
+                           SNODE_LOCUS(snode->hybrid,i)->logpr_contrib;
 
         /* For bidirectional introgression we need to subtract the lineages
            coming from right. See issue #97 */
-        sequp_count = snode->seqin_count[i];
+        sequp_count = SNODE_LOCUS(snode,i)->seqin_count;
         if (node_is_bidirection(snode))
-          sequp_count -= snode->right->seqin_count[i];
+          sequp_count -= SNODE_LOCUS(snode->right,i)->seqin_count;
 
         /* update log-density contributions for the two populations */
-        snode->logpr_contrib[i] += sequp_count*lnphiratio;
-        snode->hybrid->logpr_contrib[i] += snode->hybrid->seqin_count[i] *
+        SNODE_LOCUS(snode,i)->logpr_contrib += sequp_count*lnphiratio;
+        SNODE_LOCUS(snode->hybrid,i)->logpr_contrib += SNODE_LOCUS(snode->hybrid,i)->seqin_count *
                                            lnphiratio1;
 
         /* add to the gene tree log-density the new phi contributions */
-        gtree[i]->logpr += snode->logpr_contrib[i] +
-                           snode->hybrid->logpr_contrib[i];
+        gtree[i]->logpr += SNODE_LOCUS(snode,i)->logpr_contrib +
+                           SNODE_LOCUS(snode->hybrid,i)->logpr_contrib;
       }
     }
     else
@@ -1174,12 +1153,12 @@ static int propose_phi(stree_t * stree,
       {
         /* For bidirectional introgression we need to subtract the lineages
            coming from right. See issue #97 */
-        sequp_count = snode->seqin_count[i];
+        sequp_count = SNODE_LOCUS(snode,i)->seqin_count;
         if (node_is_bidirection(snode))
-          sequp_count -= snode->right->seqin_count[i];
+          sequp_count -= SNODE_LOCUS(snode->right,i)->seqin_count;
 
         snode->notheta_logpr_contrib += sequp_count*lnphiratio;
-        snode->hybrid->notheta_logpr_contrib += snode->hybrid->seqin_count[i] * 
+        snode->hybrid->notheta_logpr_contrib += SNODE_LOCUS(snode->hybrid,i)->seqin_count * 
                                                 lnphiratio1;
         
       }
@@ -1243,129 +1222,10 @@ static void stree_init_phi(stree_t * stree)
   }
 }
 
-static void stree_init_theta(stree_t * stree,
-                             msa_t ** msalist,
-                             list_t * maplist,
-                             int msa_count,
-                             FILE * fp_out,
-                             long thread_index)
+/* draw initial population sizes around the mean of the inverse gamma prior */
+static void stree_init_theta_values(stree_t * stree, long thread_index)
 {
-  long abort = 0;
-  long warn = 0;
-  unsigned int i, j;
-
-
-  /* initialize population sizes for extinct populations and populations
-     with more than one lineage at some locus */
-
-     /* get an array of per-locus number of sequences for each species (tip in
-        species tree) */
-  int ** seqcount = populations_seqcount(stree, msalist, maplist, msa_count);
-
-  /* Check number of sequences per locus with stated numbers from 'species&tree'
-     tag in control file. Assume the following:
-
-     X = specified max number of species in control file
-     Y = maximum number in sequence file
-
-     The behavious is the following:
-     if (X == 1 && Y > 1) abort with error message
-     if (X > 1 && Y <= 1) print warning on screen and in output file.Dont abort
-     if (X > 1 && Y > 1) no error or warning as the numbers do not affect run
-
-     See also issue #62 on GitHub
-  */
-
-  /* print table header on screen and in output file */
-  fprintf(stdout, "\nPer-locus sequences in data and 'species&tree' tag:\n");
-  fprintf(stdout, 
-          "C.File | Data |                Status                | Population\n");
-  fprintf(stdout,
-          "-------+------+--------------------------------------+-----------\n");
-  fprintf(fp_out, "\nPer-locus sequences in data and 'species&tree' tag:\n");
-  fprintf(fp_out,
-          "C.File | Data |                Status                | Population\n");
-  fprintf(fp_out,
-          "-------+------+--------------------------------------+-----------\n");
-
-  for (i = 0; i < stree->tip_count; ++i)
-  {
-    int maxseqcount = 0;
-    for (j = 0; j < opt_locus_count; ++j)
-      if (seqcount[i][j] > maxseqcount)
-        maxseqcount = seqcount[i][j];
-
-
-    /* distinguish between cases and print corresponding status message */
-    if (opt_sp_seqcount[i] == 1 && maxseqcount > 1)
-    {
-      abort = 1;
-      fprintf(stdout,
-              "%6ld | %4d | %-36s | %-10s\n",
-              opt_sp_seqcount[i], maxseqcount,
-              "[ERROR] Increase number in C.File",
-              stree->nodes[i]->label);
-      fprintf(fp_out,
-              "%6ld | %4d | %-36s | %-10s\n",
-              opt_sp_seqcount[i], maxseqcount,
-              "[ERROR] Increase number in C.File",
-              stree->nodes[i]->label);
-    }
-    else if (opt_sp_seqcount[i] > 1 && maxseqcount <= 1)
-    {
-      warn = 1;
-      fprintf(stdout,
-              "%6ld | %4d | %-36s | %-10s\n",
-              opt_sp_seqcount[i], maxseqcount,
-              "[WARNING] Parameter not identifiable",
-              stree->nodes[i]->label);
-      fprintf(fp_out,
-              "%6ld | %4d | %-36s | %-10s\n",
-              opt_sp_seqcount[i], maxseqcount,
-              "[WARNING] Parameter not identifiable",
-              stree->nodes[i]->label);
-    }
-    else
-    {
-      fprintf(stdout,
-              "%6ld | %4d | %-36s | %-10s\n",
-              opt_sp_seqcount[i], maxseqcount,
-              "[OK]",
-              stree->nodes[i]->label);
-      fprintf(fp_out,
-              "%6ld | %4d | %-36s | %-10s\n",
-              opt_sp_seqcount[i], maxseqcount,
-              "[OK]",
-              stree->nodes[i]->label);
-    }
-  }
-  fprintf(stdout, "\n");
-  fprintf(fp_out, "\n");
-  if (warn)
-  {
-    fprintf(stdout,
-            "[Warning] Some parameters are not identifiable because there are "
-            "0 or 1 sequences from some species, but the control file lists "
-            "different numbers.\nThose entries are indicated in the table "
-            "above. Posterior for theta parameters for those species will be "
-            "given by the prior.\n\n");
-    fprintf(fp_out,
-            "[Warning] Some parameters are not identifiable because there are "
-            "0 or 1 sequences from some species, but the control file lists "
-            "different numbers.\nThose entries are indicated in the table "
-            "above. Posterior for theta parameters for those species will be "
-            "given by the prior.\n\n");
-  }
-  if (abort)
-  {
-    fprintf(fp_out,
-            "[Error] Some populations consist of more than one sequence but "
-            "control file states only one.\nPlease amend control file according"
-            " to the table above.");
-    fatal("[Error] Some populations consist of more than one sequence but "
-          "control file states only one.\nPlease amend control file according "
-          "to the table above.");
-  }
+  unsigned int i;
 
   /* initialize 'has_theta' attribute */
   for (i = 0; i < stree->tip_count + stree->inner_count; ++i)
@@ -1406,10 +1266,6 @@ static void stree_init_theta(stree_t * stree,
    {
      snode_t * node = stree->nodes[i];
 
-     for (j = 0; j < (unsigned int)msa_count; ++j)
-       if (seqcount[i][j] >= 2)
-         break;
-
      /* if no loci exists with two or more sequences of such species then move
         to the next tip node */
      if (opt_sp_seqcount[i] < 2)
@@ -1488,11 +1344,6 @@ static void stree_init_theta(stree_t * stree,
     }
   }
 
-  /* deallocate seqcount */
-  for (i = 0; i < stree->tip_count; ++i)
-    free(seqcount[i]);
-  free(seqcount);
-
   /* TODO: Delete after debugging */
   if (opt_debug_rates)
   {
@@ -1506,6 +1357,138 @@ static void stree_init_theta(stree_t * stree,
   }
 }
 
+static void stree_init_theta(stree_t * stree,
+                             msa_t ** msalist,
+                             list_t * maplist,
+                             int msa_count,
+                             FILE * fp_out,
+                             long thread_index)
+{
+  long abort = 0;
+  long warn = 0;
+  unsigned int i, j;
+
+
+  /* initialize population sizes for extinct populations and populations
+     with more than one lineage at some locus */
+
+     /* get an array of per-locus number of sequences for each species (tip in
+        species tree) */
+  int ** seqcount = populations_seqcount(stree, msalist, maplist, msa_count);
+
+  /* Check number of sequences per locus with stated numbers from 'species&tree'
+     tag in control file. Assume the following:
+
+     X = specified max number of species in control file
+     Y = maximum number in sequence file
+
+     The behavious is the following:
+     if (X == 1 && Y > 1) abort with error message
+     if (X > 1 && Y <= 1) print warning on screen and in output file.Dont abort
+     if (X > 1 && Y > 1) no error or warning as the numbers do not affect run
+
+     See also issue #62 on GitHub
+  */
+
+  /* print table header on screen and in output file */
+  fprintf(stdout, "\nPer-locus sequences in data and 'species&tree' tag:\n");
+  fprintf(stdout, 
+          "C.File | Data |                Status                | Population\n");
+  fprintf(stdout,
+          "-------+------+--------------------------------------+-----------\n");
+  fprintf(fp_out, "\nPer-locus sequences in data and 'species&tree' tag:\n");
+  fprintf(fp_out,
+          "C.File | Data |                Status                | Population\n");
+  fprintf(fp_out,
+          "-------+------+--------------------------------------+-----------\n");
+
+  for (i = 0; i < stree->tip_count; ++i)
+  {
+    int maxseqcount = 0;
+    for (j = 0; j < opt_locus_count; ++j)
+      if (seqcount[i][j] > maxseqcount)
+        maxseqcount = seqcount[i][j];
+
+
+    /* distinguish between cases and print corresponding status message */
+    if (opt_sp_seqcount[i] == 1 && maxseqcount > 1)
+    {
+      abort = 1;
+      fprintf(stdout,
+              "%6ld | %4d | %-36s | %-10s\n",
+              opt_sp_seqcount[i], maxseqcount,
+              "[ERROR] Increase number in C.File",
+              stree->nodes[i]->label);
+      fprintf(fp_out,
+              "%6ld | %4d | %-36s | %-10s\n",
+              opt_sp_seqcount[i], maxseqcount,
+              "[ERROR] Increase number in C.File",
+              stree->nodes[i]->label);
+    }
+    else if (opt_sp_seqcount[i] > 1 && maxseqcount <= 1)
+    {
+      warn = 1;
+      fprintf(stdout,
+              "%6ld | %4d | %-36s | %-10s\n",
+              opt_sp_seqcount[i], maxseqcount,
+              "[WARNING] Parameter not identifiable",
+              stree->nodes[i]->label);
+      fprintf(fp_out,
+              "%6ld | %4d | %-36s | %-10s\n",
+              opt_sp_seqcount[i], maxseqcount,
+              "[WARNING] Parameter not identifiable",
+              stree->nodes[i]->label);
+    }
+    else
+    {
+      fprintf(stdout,
+              "%6ld | %4d | %-36s | %-10s\n",
+              opt_sp_seqcount[i], maxseqcount,
+              "[OK]",
+              stree->nodes[i]->label);
+      fprintf(fp_out,
+              "%6ld | %4d | %-36s | %-10s\n",
+              opt_sp_seqcount[i], maxseqcount,
+              "[OK]",
+              stree->nodes[i]->label);
+    }
+  }
+  fprintf(stdout, "\n");
+  fprintf(fp_out, "\n");
+  if (warn)
+  {
+    fprintf(stdout,
+            "[Warning] Some parameters are not identifiable because there are "
+            "0 or 1 sequences from some species, but the control file lists "
+            "different numbers.\nThose entries are indicated in the table "
+            "above. Posterior for theta parameters for those species will be "
+            "given by the prior.\n\n");
+    fprintf(fp_out,
+            "[Warning] Some parameters are not identifiable because there are "
+            "0 or 1 sequences from some species, but the control file lists "
+            "different numbers.\nThose entries are indicated in the table "
+            "above. Posterior for theta parameters for those species will be "
+            "given by the prior.\n\n");
+  }
+  if (abort)
+  {
+    fprintf(fp_out,
+            "[Error] Some populations consist of more than one sequence but "
+            "control file states only one.\nPlease amend control file according"
+            " to the table above.");
+    fatal("[Error] Some populations consist of more than one sequence but "
+          "control file states only one.\nPlease amend control file according "
+          "to the table above.");
+  }
+
+  /* deallocate seqcount */
+  for (i = 0; i < stree->tip_count; ++i)
+    free(seqcount[i]);
+  free(seqcount);
+
+  stree_init_theta_values(stree, thread_index);
+}
+
 /* bottom up filling of pptable */
 static void stree_reset_pptable_tree(stree_t * stree)
 {
@@ -1652,6 +1635,215 @@ void stree_reset_pptable(stree_t * stree)
     stree_reset_pptable_tree(stree);
 }
 
+/* Allocate the per-locus state of all populations as one block. In the
+   locus-major layout (default) the records of all populations for a locus are
+   contiguous, hence a thread working on its range of loci touches a single
+   contiguous range of memory. When loci are split across worker threads, the
+   range of each thread starts on a new page, such that the pages of a range
+   can be placed on the NUMA node of its thread (see
+   stree_locus_state_touch). The node-major layout keeps the records of one
+   population contiguous across loci, and the ranges of threads share pages */
+void stree_alloc_locus_state(stree_t * stree, long msa_count)
+{
+  long i,j,t;
+  long nodes_count = stree->tip_count + stree->inner_count +
+                     stree->hybrid_count;
+  size_t pagesize = numa_page_size();
+  size_t records = 0;
+  size_t size;
+
+  assert(!stree->locus_state);
+
+  stree->locus_count = (unsigned int)msa_count;
+  stree->locus_offset = (size_t *)xmalloc((size_t)(msa_count ? msa_count : 1) *
+                                          sizeof(size_t));
+  stree->locus_state_old = NULL;
+
+  if (opt_msc_layout == BPP_MSC_LAYOUT_LOCUS && opt_threads > 1 &&
+      msa_count == opt_locus_count && msa_count >= opt_threads)
+  {
+    /* smallest number of records spanning whole pages */
+    size_t unit = pagesize;
+    while (unit % sizeof(snode_locus_t))
+      unit += pagesize;
+    unit /= sizeof(snode_locus_t);
+
+    for (t = 0; t < opt_threads; ++t)
+    {
+      long first, count;
+
+      threads_locus_range(t, &first, &count);
+
+      if (records % unit)
+        records += unit - records % unit;
+
+      for (j = 0; j < count; ++j)
+        stree->locus_offset[first+j] = records + (size_t)(j*nodes_count);
+      records += (size_t)(count*nodes_count);
+    }
+  }
+  else
+  {
+    for (j = 0; j < msa_count; ++j)
+      stree->locus_offset[j] = (opt_msc_layout == BPP_MSC_LAYOUT_LOCUS) ?
+                                 (size_t)(j*nodes_count) : (size_t)j;
+    records = (size_t)nodes_count * (size_t)msa_count;
+  }
+
+  stree->locus_state_size = records;
+  size = records * sizeof(snode_locus_t);
+  stree->locus_state = (snode_locus_t *)pll_aligned_alloc(size ? size : 1,
+                                                          pagesize);
+  if (!stree->locus_state)
+    fatal("Cannot allocate memory for per-locus population state");
+  memset(stree->locus_state, 0, size);
+
+  for (i = 0; i < nodes_count; ++i)
+  {
+    snode_t * snode = stree->nodes[i];
+
+    if (opt_msc_layout == BPP_MSC_LAYOUT_LOCUS)
+      snode->locus_state = stree->locus_state + i;
+    else
+      snode->locus_state = stree->locus_state + (size_t)i*(size_t)msa_count;
+    snode->locus_offset = stree->locus_offset;
+
+    for (j = 0; j < msa_count; ++j)
+      SNODE_LOCUS(snode,j)->event = dlist_create();
+  }
+}
+
+void stree_free_locus_state(stree_t * stree)
+{
+  long i,j;
+  long nodes_count = stree->tip_count + stree->inner_count +
+                     stree->hybrid_count;
+
+  if (!stree->locus_state) return;
+
+  assert(!stree->locus_state_old);
+
+  for (i = 0; i < nodes_count; ++i)
+  {
+    snode_t * snode = stree->nodes[i];
+
+    for (j = 0; j < stree->locus_count; ++j)
+    {
+      /* event items are owned by the gene tree nodes */
+      dlist_reset(SNODE_LOCUS(snode,j)->event);
+      dlist_destroy(SNODE_LOCUS(snode,j)->event);
+    }
+    snode->locus_state = NULL;
+    snode->locus_offset = NULL;
+  }
+
+  pll_aligned_free(stree->locus_state);
+  free(stree->locus_offset);
+  stree->locus_state = NULL;
+  stree->locus_offset = NULL;
+}
+
+/* The per-locus state is written by the master thread while the initial gene
+   trees are generated, i.e. before the worker threads exist. It is moved to
+   the NUMA nodes of the workers in three steps: the master allocates a new
+   block which is not touched (stree_locus_state_move_begin), each worker
+   copies the records of its loci such that their pages are first touched on
+   its node (stree_locus_state_touch), and the master points the populations
+   to the new block (stree_locus_state_move_end) */
+void stree_locus_state_move_begin(stree_t * stree)
+{
+  size_t size = stree->locus_state_size * sizeof(snode_locus_t);
+
+  assert(!stree->locus_state_old);
+
+  stree->locus_state_old = stree->locus_state;
+  stree->locus_state = (snode_locus_t *)pll_aligned_alloc(size ? size : 1,
+                                                          numa_page_size());
+  if (!stree->locus_state)
+    fatal("Cannot allocate memory for per-locus population state");
+}
+
+/* copy the records of loci first..first+count-1 to the new block and return
+   the number of bytes copied */
+size_t stree_locus_state_touch(stree_t * stree, long first, long count)
+{
+  long i,j;
+  long nodes_count = stree->tip_count + stree->inner_count +
+                     stree->hybrid_count;
+  size_t span;
+
+  assert(stree->locus_state_old);
+
+  if (opt_msc_layout == BPP_MSC_LAYOUT_LOCUS)
+  {
+    span = (size_t)nodes_count * sizeof(snode_locus_t);
+    for (j = first; j < first+count; ++j)
+      memcpy(stree->locus_state + stree->locus_offset[j],
+             stree->locus_state_old + stree->locus_offset[j],
+             span);
+  }
+  else
+  {
+    span = (size_t)count * sizeof(snode_locus_t);
+    for (i = 0; i < nodes_count; ++i)
+    {
+      size_t base = (size_t)i*stree->locus_count + stree->locus_offset[first];
+
+      memcpy(stree->locus_state + base, stree->locus_state_old + base, span);
+    }
+  }
+
+  return (size_t)(count*nodes_count) * sizeof(snode_locus_t);
+}
+
+void stree_locus_state_move_end(stree_t * stree)
+{
+  long i;
+  long nodes_count = stree->tip_count + stree->inner_count +
+                     stree->hybrid_count;
+
+  assert(stree->locus_state_old);
+
+  for (i = 0; i < nodes_count; ++i)
+  {
+    snode_t * snode = stree->nodes[i];
+
+    snode->locus_state = stree->locus_state +
+                         (snode->locus_state - stree->locus_state_old);
+  }
+
+  pll_aligned_free(stree->locus_state_old);
+  stree->locus_state_old = NULL;
+}
+
+/* add the placement of the records of loci first..first+count-1 to
+   node_bytes (see numa_placement) */
+long stree_locus_state_placement(stree_t * stree,
+                                 long first,
+                                 long count,
+                                 double * node_bytes)
+{
+  long i;
+  long nodes_count = stree->tip_count + stree->inner_count +
+                     stree->hybrid_count;
+
+  if (!count) return 1;
+
+  if (opt_msc_layout == BPP_MSC_LAYOUT_LOCUS)
+    return numa_placement(stree->locus_state + stree->locus_offset[first],
+                          (size_t)(count*nodes_count) * sizeof(snode_locus_t),
+                          node_bytes);
+
+  for (i = 0; i < nodes_count; ++i)
+    if (!numa_placement(stree->locus_state + (size_t)i*stree->locus_count +
+                          stree->locus_offset[first],
+                        (size_t)count * sizeof(snode_locus_t),
+                        node_bytes))
+      return 0;
+
+  return 1;
+}
+
 void stree_alloc_internals(stree_t * stree, long * locus_seqcount, unsigned int gtree_inner_sum, long msa_count)
 {
   long i;
@@ -1744,38 +1936,6 @@ void stree_init_pptable(stree_t * stree)
 #endif
 }
 
-static void network_init_hx(stree_t * stree)
-{
-  long i;
-
-  #ifdef DEBUG_THREADS
-  if (opt_threads == 1)
-  {
-    opt_threads = DEBUG_THREADS_COUNT;
-    for (i = 0; i < stree->tip_count + stree->inner_count + stree->hybrid_count; ++i)
-    {
-      snode_t * node = stree->nodes[i];
-      node->hx = (long *)xcalloc((size_t)opt_threads,sizeof(long));
-    }
-    opt_threads = 1;
-  }
-  else
-  {
-    for (i = 0; i < stree->tip_count + stree->inner_count + stree->hybrid_count; ++i)
-    {
-      snode_t * node = stree->nodes[i];
-      node->hx = (long *)xcalloc((size_t)opt_threads,sizeof(long));
-    }
-  }
-  #else
-  for (i = 0; i < stree->tip_count + stree->inner_count + stree->hybrid_count; ++i)
-  {
-    snode_t * node = stree->nodes[i];
-    node->hx = (long *)xcalloc((size_t)opt_threads,sizeof(long));
-  }
-  #endif
-}
-
 static void stree_reset_leaves_network(stree_t * stree)
 {
   /* NOTE: Assumes that pptable is computed correctly */
@@ -1905,7 +2065,7 @@ void stree_init(stree_t * stree,
                 int msa_count,
                 FILE * fp_out)
 {
-  unsigned int i, j;
+  unsigned int i;
 
   long thread_index = 0;
 
@@ -1942,40 +2102,16 @@ void stree_init(stree_t * stree,
   if (opt_msci)
     stree_init_phi(stree);
 
-  /* TODO: Perhaps move the hx allocations into wraptree. The problem is that
-     species tree cloning functions do not call wraptree and that would require
-     duplicate code */
-  if (opt_msci)
-    network_init_hx(stree);
-
   /* allocate space for keeping track of coalescent events at each species tree
      node for each locus */
-  stree->locus_count = (unsigned int)msa_count;
-  for (i = 0; i < stree->tip_count+stree->inner_count+stree->hybrid_count; ++i)
+  stree_alloc_locus_state(stree, msa_count);
+  if (!opt_est_theta)
   {
-    snode_t * snode = stree->nodes[i];
-
-    snode->event = (dlist_t **)xcalloc(msa_count, sizeof(dlist_t *));
-    snode->event_count = (int *)xcalloc(msa_count, sizeof(int));
-    snode->seqin_count = (int *)xcalloc(msa_count, sizeof(int));
-    snode->gene_leaves = (unsigned int *)xcalloc(msa_count,sizeof(unsigned int));
-    /* TODO: The next two allocations might not be necessary when computing
-       theta analytically */
-    snode->logpr_contrib = (double*)xcalloc(msa_count, sizeof(double));
-    snode->old_logpr_contrib = (double *)xcalloc(msa_count, sizeof(double));
-
-    snode->t2h = NULL;
-    snode->old_t2h = NULL;
-    if (!opt_est_theta)
+    for (i=0; i < stree->tip_count+stree->inner_count+stree->hybrid_count; ++i)
     {
-      snode->t2h = (double*)xcalloc((size_t)msa_count, sizeof(double));
-      snode->old_t2h = (double*)xcalloc((size_t)msa_count, sizeof(double));
-      snode->t2h_sum = 0;
-      snode->event_count_sum = 0;
+      stree->nodes[i]->t2h_sum = 0;
+      stree->nodes[i]->event_count_sum = 0;
     }
-
-    for (j = 0; j < stree->locus_count; ++j)
-      snode->event[j] = dlist_create();
   }
 
   if (opt_clock != BPP_CLOCK_GLOBAL)
@@ -1983,14 +2119,14 @@ void stree_init(stree_t * stree,
     for (i=0; i < stree->tip_count+stree->inner_count+stree->hybrid_count; ++i)
     {
       snode_t * snode = stree->nodes[i];
-      snode->brate = NULL;
+      snode->has_brate = 0;
       
       if (opt_msci && snode->hybrid)
       {
         if (node_is_hybridization(snode) && !snode->htau) continue;
         if (node_is_bidirection(snode) && node_is_mirror(snode)) continue;
       }
-      snode->brate = (double *)xmalloc((size_t)msa_count*sizeof(double));
+      snode->has_brate = 1;
     }
   }
 
@@ -2006,6 +2142,49 @@ void stree_init(stree_t * stree,
   free(locus_seqcount);
 }
 
+/* draw new initial population sizes and speciation times for the copy of the
+   species tree used by an independent replicate chain (see stree_init), and
+   empty its per-locus population state such that new gene trees can be
+   simulated on it */
+void stree_init_replicate(stree_t * stree)
+{
+  long i,j;
+  long thread_index = 0;
+
+  assert(!opt_msci);
+
+  stree_init_theta_values(stree, thread_index);
+
+  if (stree->tip_count > 1)
+    stree_init_tau(stree, thread_index);
+  else
+    stree->nodes[0]->tau = 0;
+
+  for (i = 0; i < stree->tip_count + stree->inner_count; ++i)
+  {
+    snode_t * snode = stree->nodes[i];
+
+    for (j = 0; j < stree->locus_count; ++j)
+    {
+      dlist_t * event = SNODE_LOCUS(snode,j)->event;
+
+      dlist_reset(event);
+      memset(SNODE_LOCUS(snode,j), 0, sizeof(snode_locus_t));
+      SNODE_LOCUS(snode,j)->event = event;
+    }
+
+    snode->t2h_sum = 0;
+    snode->event_count_sum = 0;
+    snode->notheta_logpr_contrib = 0;
+    snode->notheta_old_logpr_contrib = 0;
+  }
+
+  stree->notheta_logpr = 0;
+  stree->notheta_old_logpr = 0;
+  stree->notheta_hfactor = 0;
+  stree->notheta_sfactor = 0;
+}
+
 void stree_fini()
 {
   free(__gt_nodes);
@@ -2054,9 +2233,9 @@ static int propose_theta(gtree_t ** gtree,
     /* save a copy of old logpr */
     gtree[i]->old_logpr = gtree[i]->logpr;
 
-    gtree[i]->logpr -= snode->logpr_contrib[i];
+    gtree[i]->logpr -= SNODE_LOCUS(snode,i)->logpr_contrib;
     gtree_update_logprob_contrib(snode, locus[i]->heredity[0], i, thread_index);
-    gtree[i]->logpr += snode->logpr_contrib[i];
+    gtree[i]->logpr += SNODE_LOCUS(snode,i)->logpr_contrib;
 
     lnacceptance += (gtree[i]->logpr - gtree[i]->old_logpr);
   }
@@ -2079,7 +2258,7 @@ static int propose_theta(gtree_t ** gtree,
 
   snode->theta = thetaold;
   for (i = 0; i < opt_locus_count; ++i)
-    snode->logpr_contrib[i] = snode->old_logpr_contrib[i];
+    SNODE_LOCUS(snode,i)->logpr_contrib = SNODE_LOCUS(snode,i)->old_logpr_contrib;
 
   return 0;
 }
@@ -2159,10 +2338,10 @@ void propose_tau_update_gtrees(locus_t ** loci,
     for (j = 0; j < paffected_count; ++j)
     {
       /* process events for current population */
-      if (affected[j]->seqin_count[i] > 1)
+      if (SNODE_LOCUS(affected[j],i)->seqin_count > 1)
       {
         dlist_item_t * event;
-        for (event = affected[j]->event[i]->head; event; event = event->next)
+        for (event = SNODE_LOCUS(affected[j],i)->event->head; event; event = event->next)
         {
           gnode_t * node = (gnode_t *)(event->data);
           //if (node->time < minage) continue;
@@ -2185,7 +2364,7 @@ void propose_tau_update_gtrees(locus_t ** loci,
         }
 
         if (opt_est_theta)
-          logpr -= affected[j]->logpr_contrib[i];
+          logpr -= SNODE_LOCUS(affected[j],i)->logpr_contrib;
 
         double xtmp = gtree_update_logprob_contrib(affected[j],
                                                    loci[i]->heredity[0],
@@ -2684,8 +2863,8 @@ static long propose_tau(locus_t ** loci,
         paffected_count = 0;
         for (i = 0; i < stree->locus_count; ++i)
         {
-          assert(snode->event_count[i] == 0);
-          assert(snode->hybrid->event_count[i] == 0);
+          assert(SNODE_LOCUS(snode,i)->event_count == 0);
+          assert(SNODE_LOCUS(snode->hybrid,i)->event_count == 0);
         }
 
         affected[paffected_count++] = snode->parent;
@@ -2716,10 +2895,10 @@ static long propose_tau(locus_t ** loci,
         /* assertions */
         if (!snode->htau)
           for (i = 0; i < stree->locus_count; ++i)
-            assert(snode->event_count[i] == 0);
+            assert(SNODE_LOCUS(snode,i)->event_count == 0);
         if (!snode->hybrid->htau)
           for (i = 0; i < stree->locus_count; ++i)
-            assert(snode->hybrid->event_count[i] == 0);
+            assert(SNODE_LOCUS(snode->hybrid,i)->event_count == 0);
 
         if (!snode->htau)
         {
@@ -2746,8 +2925,8 @@ static long propose_tau(locus_t ** loci,
       assert(node_is_bidirection(snode));
       for (i = 0; i < stree->locus_count; ++i)
       {
-        assert(snode->hybrid->event_count[i] == 0);
-        assert(snode->right->event_count[i] == 0);
+        assert(SNODE_LOCUS(snode->hybrid,i)->event_count == 0);
+        assert(SNODE_LOCUS(snode->right,i)->event_count == 0);
       }
 
       paffected_count = 0;
@@ -2916,7 +3095,7 @@ static long propose_tau(locus_t ** loci,
       {
         for (j = 0; j < paffected_count; ++j)
         {
-          if (affected[j]->seqin_count[i] > 1)
+          if (SNODE_LOCUS(affected[j],i)->seqin_count > 1)
             gtree_update_logprob_contrib(affected[j],
                                          loci[i]->heredity[0],
                                          i,
@@ -2926,7 +3105,7 @@ static long propose_tau(locus_t ** loci,
       else
       {
         for (j = 0; j < paffected_count; ++j)
-          if (affected[j]->seqin_count[i] > 1)
+          if (SNODE_LOCUS(affected[j],i)->seqin_count > 1)
             logprob_revert_notheta(affected[j], i);
       }
 
@@ -3747,25 +3926,25 @@ long stree_propose_spr(stree_t ** streeptr,
       /* remove  gene node from list of coalescent events of its old population */
       unlink_event(node, i);
 
-      node->pop->event_count[i]--;
-      if (!(node->pop->mark[thread_index] & FLAG_POP_UPDATE))
+      SNODE_LOCUS(node->pop,i)->event_count--;
+      if (!(SNODE_MARK(node->pop,thread_index) & FLAG_POP_UPDATE))
       {
-        node->pop->mark[thread_index] |= FLAG_POP_UPDATE;
+        SNODE_MARK(node->pop,thread_index) |= FLAG_POP_UPDATE;
         snode_contrib[snode_contrib_count[i]++] = node->pop;
       }
       if (!opt_est_theta)
         node->pop->event_count_sum--;
 
       node->pop = pop_cz;
-      if (!(node->pop->mark[thread_index] & FLAG_POP_UPDATE))
+      if (!(SNODE_MARK(node->pop,thread_index) & FLAG_POP_UPDATE))
       {
-        node->pop->mark[thread_index] |= FLAG_POP_UPDATE;
+        SNODE_MARK(node->pop,thread_index) |= FLAG_POP_UPDATE;
         snode_contrib[snode_contrib_count[i]++] = node->pop;
       }
 
-      dlist_item_append(node->pop->event[i], node->event);
+      dlist_item_append(SNODE_LOCUS(node->pop,i)->event, node->event);
 
-      node->pop->event_count[i]++;
+      SNODE_LOCUS(node->pop,i)->event_count++;
       if (!opt_est_theta)
         node->pop->event_count_sum++;
 
@@ -3790,25 +3969,25 @@ long stree_propose_spr(stree_t ** streeptr,
         /* remove  gene node from list of coalescent events of its old population */
         unlink_event(node, i);
 
-        node->pop->event_count[i]--;
-        if (!(node->pop->mark[thread_index] & FLAG_POP_UPDATE))
+        SNODE_LOCUS(node->pop,i)->event_count--;
+        if (!(SNODE_MARK(node->pop,thread_index) & FLAG_POP_UPDATE))
         {
-          node->pop->mark[thread_index] |= FLAG_POP_UPDATE;
+          SNODE_MARK(node->pop,thread_index) |= FLAG_POP_UPDATE;
           snode_contrib[snode_contrib_count[i]++] = node->pop;
         }
         if (!opt_est_theta)
           node->pop->event_count_sum--;
 
         node->pop = b;
-        if (!(node->pop->mark[thread_index] & FLAG_POP_UPDATE))
+        if (!(SNODE_MARK(node->pop,thread_index) & FLAG_POP_UPDATE))
         {
-          node->pop->mark[thread_index] |= FLAG_POP_UPDATE;
+          SNODE_MARK(node->pop,thread_index) |= FLAG_POP_UPDATE;
           snode_contrib[snode_contrib_count[i]++] = node->pop;
         }
 
-        dlist_item_append(node->pop->event[i], node->event);
+        dlist_item_append(SNODE_LOCUS(node->pop,i)->event, node->event);
 
-        node->pop->event_count[i]++;
+        SNODE_LOCUS(node->pop,i)->event_count++;
         if (!opt_est_theta)
           node->pop->event_count_sum++;
       }
@@ -3819,25 +3998,25 @@ long stree_propose_spr(stree_t ** streeptr,
         /* remove  gene node from list of coalescent events of its old population */
         unlink_event(node, i);
 
-        node->pop->event_count[i]--;
-        if (!(node->pop->mark[thread_index] & FLAG_POP_UPDATE))
+        SNODE_LOCUS(node->pop,i)->event_count--;
+        if (!(SNODE_MARK(node->pop,thread_index) & FLAG_POP_UPDATE))
         {
-          node->pop->mark[thread_index] |= FLAG_POP_UPDATE;
+          SNODE_MARK(node->pop,thread_index) |= FLAG_POP_UPDATE;
           snode_contrib[snode_contrib_count[i]++] = node->pop;
         }
         if (!opt_est_theta)
           node->pop->event_count_sum--;
 
         node->pop = y;
-        if (!(node->pop->mark[thread_index] & FLAG_POP_UPDATE))
+        if (!(SNODE_MARK(node->pop,thread_index) & FLAG_POP_UPDATE))
         {
-          node->pop->mark[thread_index] |= FLAG_POP_UPDATE;
+          SNODE_MARK(node->pop,thread_index) |= FLAG_POP_UPDATE;
           snode_contrib[snode_contrib_count[i]++] = node->pop;
         }
 
-        dlist_item_append(node->pop->event[i], node->event);
+        dlist_item_append(SNODE_LOCUS(node->pop,i)->event, node->event);
 
-        node->pop->event_count[i]++;
+        SNODE_LOCUS(node->pop,i)->event_count++;
         if (!opt_est_theta)
           node->pop->event_count_sum++;
       }
@@ -3854,10 +4033,10 @@ long stree_propose_spr(stree_t ** streeptr,
 
         unlink_event(node, i);
 
-        node->pop->event_count[i]--;
-        if (!(node->pop->mark[thread_index] & FLAG_POP_UPDATE))
+        SNODE_LOCUS(node->pop,i)->event_count--;
+        if (!(SNODE_MARK(node->pop,thread_index) & FLAG_POP_UPDATE))
         {
-          node->pop->mark[thread_index] |= FLAG_POP_UPDATE;
+          SNODE_MARK(node->pop,thread_index) |= FLAG_POP_UPDATE;
           snode_contrib[snode_contrib_count[i]++] = node->pop;
         }
         if (!opt_est_theta)
@@ -3868,15 +4047,15 @@ long stree_propose_spr(stree_t ** streeptr,
         else
           node->pop = pop;
 
-        if (!(node->pop->mark[thread_index] & FLAG_POP_UPDATE))
+        if (!(SNODE_MARK(node->pop,thread_index) & FLAG_POP_UPDATE))
         {
-          node->pop->mark[thread_index] |= FLAG_POP_UPDATE;
+          SNODE_MARK(node->pop,thread_index) |= FLAG_POP_UPDATE;
           snode_contrib[snode_contrib_count[i]++] = node->pop;
         }
 
-        dlist_item_append(node->pop->event[i], node->event);
+        dlist_item_append(SNODE_LOCUS(node->pop,i)->event, node->event);
 
-        node->pop->event_count[i]++;
+        SNODE_LOCUS(node->pop,i)->event_count++;
         if (!opt_est_theta)
           node->pop->event_count_sum++;
       }
@@ -3886,11 +4065,14 @@ long stree_propose_spr(stree_t ** streeptr,
          (a) they have not been already flagged in a previous step
          (b) there is more than one outgoing lineages (entering its parent population).
     */
-    if (!(y->mark[thread_index] & FLAG_POP_UPDATE) && (y->seqin_count[i] - y->event_count[i] > 1))
+    if (!(SNODE_MARK(y,thread_index) & FLAG_POP_UPDATE) &&
+        (SNODE_LOCUS(y,i)->seqin_count - SNODE_LOCUS(y,i)->event_count > 1))
       snode_contrib[snode_contrib_count[i]++] = y;
-    if (!(c->mark[thread_index] & FLAG_POP_UPDATE) && (c->seqin_count[i] - c->event_count[i] > 1))
+    if (!(SNODE_MARK(c,thread_index) & FLAG_POP_UPDATE) &&
+        (SNODE_LOCUS(c,i)->seqin_count - SNODE_LOCUS(c,i)->event_count > 1))
       snode_contrib[snode_contrib_count[i]++] = c;
-    if (!(b->mark[thread_index] & FLAG_POP_UPDATE) && (b->seqin_count[i] - b->event_count[i] > 1))
+    if (!(SNODE_MARK(b,thread_index) & FLAG_POP_UPDATE) &&
+        (SNODE_LOCUS(b,i)->seqin_count - SNODE_LOCUS(b,i)->event_count > 1))
       snode_contrib[snode_contrib_count[i]++] = b;
 
     moved_nodes += gtree->inner_count;
@@ -3932,7 +4114,7 @@ long stree_propose_spr(stree_t ** streeptr,
 
     /* reset species tree marks */
     for (j = 0; j < stree->tip_count + stree->inner_count; ++j)
-      stree->nodes[j]->mark[thread_index] = 0;
+      SNODE_MARK(stree->nodes[j],thread_index) = 0;
   } /* end of locus */
 
    /* update species tree */
@@ -4091,12 +4273,12 @@ long stree_propose_spr(stree_t ** streeptr,
         changed due to the reset_gene_leaves_count() call, but were previously
         not marked for log-probability contribution update */
     for (j = 0; j < snode_contrib_count[i]; ++j)
-      snode_contrib[j]->mark[thread_index] |= FLAG_POP_UPDATE;
+      SNODE_MARK(snode_contrib[j],thread_index) |= FLAG_POP_UPDATE;
     for (j = 0; j < stree->tip_count + stree->inner_count; ++j)
     {
       snode_t * snode = stree->nodes[j];
-      if (!(snode->mark[thread_index] & FLAG_POP_UPDATE) &&
-          (snode->seqin_count[i] != original_stree->nodes[j]->seqin_count[i]))
+      if (!(SNODE_MARK(snode,thread_index) & FLAG_POP_UPDATE) &&
+          (SNODE_LOCUS(snode,i)->seqin_count != SNODE_LOCUS(original_stree->nodes[j],i)->seqin_count))
         snode_contrib[snode_contrib_count[i]++] = snode;
     }
 
@@ -4105,14 +4287,14 @@ long stree_propose_spr(stree_t ** streeptr,
     for (j = 0; j < snode_contrib_count[i]; ++j)
     {
       if (opt_est_theta)
-        gtree_list[i]->logpr -= snode_contrib[j]->logpr_contrib[i];
+        gtree_list[i]->logpr -= SNODE_LOCUS(snode_contrib[j],i)->logpr_contrib;
       else
         logpr_notheta -= snode_contrib[j]->notheta_logpr_contrib;
 
       double xtmp = gtree_update_logprob_contrib(snode_contrib[j], loci[i]->heredity[0], i, thread_index);
 
       if (opt_est_theta)
-        gtree_list[i]->logpr += snode_contrib[j]->logpr_contrib[i];
+        gtree_list[i]->logpr += SNODE_LOCUS(snode_contrib[j],i)->logpr_contrib;
       else
         logpr_notheta += xtmp;
     }
@@ -4131,7 +4313,7 @@ long stree_propose_spr(stree_t ** streeptr,
 
     /* reset markings on affected populations */
     for (j = 0; j < snode_contrib_count[i]; ++j)
-      snode_contrib[j]->mark[thread_index] = 0;
+      SNODE_MARK(snode_contrib[j],thread_index) = 0;
 #endif
 
 
@@ -4202,13 +4384,13 @@ double lnprior_rates(gtree_t * gtree, stree_t * stree, long msa_index)
     {
       snode = stree->nodes[i];
       if (!snode->parent)
-        assert(snode->brate[msa_index] == gtree->rate_mui);
+        assert(SNODE_LOCUS(snode,msa_index)->brate == gtree->rate_mui);
 
-      double m = snode->brate[msa_index];
+      double m = SNODE_LOCUS(snode,msa_index)->brate;
       double alpha = m*m / v;
       double beta = alpha / m;
-      double r1 = snode->left->brate[msa_index];
-      double r2 = snode->right->brate[msa_index];
+      double r1 = SNODE_LOCUS(snode->left,msa_index)->brate;
+      double r2 = SNODE_LOCUS(snode->right,msa_index)->brate;
       logpr += -2 * lgamma(alpha) + 2 * alpha*log(beta) - beta*(r1 + r2) + (alpha - 1)*log(r1*r2);
     }
   }
@@ -4245,9 +4427,9 @@ double lnprior_rates(gtree_t * gtree, stree_t * stree, long msa_index)
       Tinv[3] = (tA+t1) / detT;
 
       /* root node should have mui anyway */
-      rA = snode->parent ? snode->brate[msa_index] : mui;
-      r1 = snode->left->brate[msa_index];
-      r2 = snode->right->brate[msa_index];
+      rA = snode->parent ? SNODE_LOCUS(snode,msa_index)->brate : mui;
+      r1 = SNODE_LOCUS(snode->left,msa_index)->brate;
+      r2 = SNODE_LOCUS(snode->right,msa_index)->brate;
       y1 = log(r1/rA) + (tA+t1)*nui / 2;
       y2 = log(r2/rA) + (tA+t2)*nui / 2;
       zz = (y1*y1*Tinv[0] + 2*y1*y2*Tinv[1] + y2*y2*Tinv[3]);
@@ -4285,7 +4467,7 @@ double lnprior_rates(gtree_t * gtree, stree_t * stree, long msa_index)
         if (node_is_bidirection(snode) && node_is_mirror(snode)) continue;
       }
 
-      r = snode->brate[msa_index];
+      r = SNODE_LOCUS(snode,msa_index)->brate;
       logpr += -beta*r + (alpha-1)*log(r);
 
       ++rates_count;
@@ -4322,7 +4504,7 @@ double lnprior_rates(gtree_t * gtree, stree_t * stree, long msa_index)
         if (node_is_bidirection(snode) && node_is_mirror(snode)) continue;
       }
 
-      double logr = log(snode->brate[msa_index]);
+      double logr = log(SNODE_LOCUS(snode,msa_index)->brate);
       z = logr - logmui + nui/2;
       logpr += -(z*z) / (2*nui) - logr;
 
@@ -4598,7 +4780,7 @@ double prop_locusrate_mui(gtree_t ** gtree,
     if (opt_clock == BPP_CLOCK_GLOBAL || opt_clock == BPP_CLOCK_CORR)
     {
       if (opt_clock == BPP_CLOCK_CORR)
-        stree->root->brate[i] = gtree[i]->rate_mui;
+        SNODE_LOCUS(stree->root,i)->brate = gtree[i]->rate_mui;
 
       /* if molecular clock then recompute pmatrices, CLVs and log-L */
       locus_update_all_matrices(locus[i],gtree[i],stree,i);
@@ -4660,7 +4842,7 @@ double prop_locusrate_mui(gtree_t ** gtree,
       /* rejected */
       gtree[i]->rate_mui = old_mui;
       if (opt_clock == BPP_CLOCK_CORR)
-        stree->root->brate[i] = old_mui;
+        SNODE_LOCUS(stree->root,i)->brate = old_mui;
 
       if (opt_clock == BPP_CLOCK_GLOBAL || opt_clock == BPP_CLOCK_CORR)
       {
@@ -4825,16 +5007,16 @@ static double prior_logratio_rates_corr_ln(snode_t * node_changed,
     /* now cycle through old and new rate */
     for (j = 0; j < 2; ++j)
     {
-      node_changed->brate[msa_index] = rates[j];
+      SNODE_LOCUS(node_changed,msa_index)->brate = rates[j];
 
       if (node->parent)
-        rA = node->brate[msa_index];
+        rA = SNODE_LOCUS(node,msa_index)->brate;
       else
-        rA = node->brate[msa_index];   /* we assume mu_i is in array, if node is root */
+        rA = SNODE_LOCUS(node,msa_index)->brate;   /* we assume mu_i is in array, if node is root */
         
       assert(node->left && node->right);
-      r1 = node->left->brate[msa_index];
-      r2 = node->right->brate[msa_index];
+      r1 = SNODE_LOCUS(node->left,msa_index)->brate;
+      r2 = SNODE_LOCUS(node->right,msa_index)->brate;
 
       y1 = log(r1/rA) + (tA+t1)*variance/2;
       y2 = log(r2/rA) + (tA+t2)*variance/2;
@@ -4880,7 +5062,7 @@ static double prior_logratio_rates_corr(snode_t * node,
     /* gamma */
 
     /**** Ziheng-2020-04-06 ****/
-    double m = node->parent->brate[msa_index];
+    double m = SNODE_LOCUS(node->parent,msa_index)->brate;
     double v = gtree->rate_nui;
     double alpha = m*m / v;
     double beta = alpha / m;
@@ -4894,8 +5076,8 @@ static double prior_logratio_rates_corr(snode_t * node,
       double beta = alpha / old_rate;
       double alphanew = new_rate*new_rate / v;
       double betanew = alphanew / new_rate;
-      double r1 = node->left->brate[msa_index];
-      double r2 = node->right->brate[msa_index];
+      double r1 = SNODE_LOCUS(node->left,msa_index)->brate;
+      double r2 = SNODE_LOCUS(node->right,msa_index)->brate;
 
       logratio += -2*lgamma(alphanew) + 2*alphanew*log(betanew) - betanew*(r1+r2) + (alphanew-1)*log(r1*r2);
       logratio -= -2*lgamma(alpha)    + 2*alpha*log(beta)       - beta*(r1+r2)    + (alpha-1)*log(r1*r2);
@@ -5041,13 +5223,13 @@ static long prop_branch_rates(gtree_t * gtree,
     }
     proposal_count++;
 
-    old_rate = node->brate[msa_index];
+    old_rate = SNODE_LOCUS(node,msa_index)->brate;
     old_lograte = log(old_rate);
 
     double r = old_lograte + opt_finetune_branchrate *
                legacy_rnd_symmetrical(thread_index);
     new_lograte = reflect(r,-99,99,thread_index);
-    node->brate[msa_index] = new_rate = exp(new_lograte);
+    SNODE_LOCUS(node,msa_index)->brate = new_rate = exp(new_lograte);
 
     lnacceptance = new_lograte - old_lograte;
 
@@ -5144,7 +5326,7 @@ static long prop_branch_rates(gtree_t * gtree,
       }
 
       /* now reset rate and pmatrices */
-      node->brate[msa_index] = old_rate;
+      SNODE_LOCUS(node,msa_index)->brate = old_rate;
     }
   }  /* end species tree loop */
   *prop_count = proposal_count;
@@ -5191,7 +5373,9 @@ double prop_branch_rates_serial(gtree_t ** gtree,
     #ifdef DEBUG_THREADS
     accepted += prop_branch_rates(gtree[i],stree,locus[i],i,&prop_count,indices[i]);
     #else
+    rng_locus_begin(0,i,THREAD_WORK_BRATE);
     accepted += prop_branch_rates(gtree[i],stree,locus[i],i,&prop_count,0);
+    rng_locus_end(0);
     #endif
     proposal_count += prop_count;
   }
@@ -5226,7 +5410,9 @@ void prop_branch_rates_parallel(gtree_t ** gtree,
   for (i = locus_start; i < locus_start+locus_count; ++i)
   {
     prop_count = 0;
+    rng_locus_begin(thread_index,i,THREAD_WORK_BRATE);
     accepted += prop_branch_rates(gtree[i],stree,locus[i],i,&prop_count,thread_index);
+    rng_locus_end(thread_index);
     proposal_count += prop_count;
   }
 
@@ -27,6 +27,11 @@ static long bitmask_elms;    /* how many unsigned long a bitmask is made of */
 
 static hashtable_t * ht_trivial = NULL;  /* tip node bitmasks */
 static hashtable_t * ht_biparts = NULL;  /* bipartitions */
+static hashtable_t * ht_topology = NULL; /* distinct tree topologies */
+
+static size_t sample_count = 0;          /* number of trees summarized */
+static unsigned long ** clade_list = NULL;
+static unsigned long * clade_key = NULL;
 
 struct bptrivial_s
 {
@@ -40,14 +45,23 @@ struct bipartition_s
   long count;
 };
 
-/* serialize hashtable of bipartitions to an array of bipartitions */
-static struct bipartition_s ** hashtable_serialize1p(hashtable_t * ht)
+/* a rooted topology is uniquely identified by its set of clades, which we
+   store as the lexicographically sorted list of clade bitmasks */
+struct topology_s
+{
+  unsigned long * key;
+  long clade_count;
+  char * newick;
+  size_t count;
+};
+
+/* serialize hashtable of bipartitions (or topologies) to an array */
+static void ** hashtable_serialize1p(hashtable_t * ht)
 {
   unsigned long i,k;
-  struct bipartition_s ** blist;
+  void ** blist;
 
-  blist = (struct bipartition_s **)xmalloc((ht->entries_count+1) *
-                                           sizeof(struct bipartition_s *));
+  blist = (void **)xmalloc((ht->entries_count+1) * sizeof(void *));
 
   for (i = 0, k = 0; i < ht->table_size; ++i)
   {
@@ -57,7 +71,7 @@ static struct bipartition_s ** hashtable_serialize1p(hashtable_t * ht)
     while (head)
     {
       ht_item_t * hi = (ht_item_t *)(head->data);
-      blist[k++] = (struct bipartition_s *)(hi->value);
+      blist[k++] = hi->value;
       head = head->next;
     }
   }
@@ -96,6 +110,19 @@ static int cb_cmp_bitmask(void * a, void * b)
 
   return 1;
 }
+static int cb_cmp_topology(void * a, void * b)
+{
+  struct topology_s * x = (struct topology_s *)a;
+  struct topology_s * y = (struct topology_s *)b;
+
+  if (x->clade_count != y->clade_count)
+    return 0;
+
+  return !memcmp(x->key,
+                 y->key,
+                 (size_t)(x->clade_count*bitmask_elms)*sizeof(unsigned long));
+}
+
 static int cb_cmp_trivial(void * a, void * b)
 {
   struct bptrivial_s * trivial = (struct bptrivial_s *)a;
@@ -239,14 +266,12 @@ static void assign_bitmasks(stree_t * stree)
   bitmask_update_recursive(stree->root);
 }
 
-/* updates counts in hashtable with bipartitions of current tree */
-void bipartitions_update(stree_t * stree)
+/* updates counts in hashtable with bipartitions of a tree with bitmasks */
+static void bipartitions_count(stree_t * stree)
 {
   long i;
   struct bipartition_s * bp;
 
-  assign_bitmasks(stree);
-
   for (i = stree->tip_count; i < stree->tip_count + stree->inner_count; ++i)
   {
     if (stree->nodes[i]->parent)
@@ -275,10 +300,164 @@ void bipartitions_update(stree_t * stree)
       }
     }
   }
+}
+
+static void bitmasks_free(stree_t * stree)
+{
+  long i;
 
   for (i = stree->tip_count; i < stree->tip_count + stree->inner_count; ++i)
+  {
     if (stree->nodes[i]->bitmask)
       free(stree->nodes[i]->bitmask);
+    stree->nodes[i]->bitmask = NULL;
+  }
+}
+
+/* updates counts in hashtable with bipartitions of current tree */
+void bipartitions_update(stree_t * stree)
+{
+  assign_bitmasks(stree);
+  bipartitions_count(stree);
+  bitmasks_free(stree);
+}
+
+static int cb_bitmask_cmp(const void * a, const void * b)
+{
+  long i;
+  const unsigned long * x = *((const unsigned long **)a);
+  const unsigned long * y = *((const unsigned long **)b);
+
+  for (i = 0; i < bitmask_elms; ++i)
+  {
+    if (x[i] < y[i]) return -1;
+    if (x[i] > y[i]) return 1;
+  }
+
+  return 0;
+}
+
+/* export newick string of the topology of the subtree rooted at node such that
+   the child with lexicographically smaller concatenation of (sorted) tip
+   labels is always printed first. The concatenation is returned in cat. The
+   tree itself is not modified, such that it can be called on the tree used
+   in the MCMC */
+static char * export_sorted_recursive(const snode_t * node, char ** cat)
+{
+  char * newick;
+  char * lnewick;
+  char * rnewick;
+  char * lcat;
+  char * rcat;
+
+  if (!node->left)
+  {
+    *cat = xstrdup(node->label);
+    return xstrdup(node->label);
+  }
+
+  lnewick = export_sorted_recursive(node->left,&lcat);
+  rnewick = export_sorted_recursive(node->right,&rcat);
+
+  if (strcmp(lcat,rcat) > 0)
+  {
+    SWAP(lnewick,rnewick);
+    SWAP(lcat,rcat);
+  }
+
+  xasprintf(cat, "%s%s", lcat, rcat);
+  xasprintf(&newick, "(%s, %s)", lnewick, rnewick);
+
+  free(lcat);
+  free(rcat);
+  free(lnewick);
+  free(rnewick);
+
+  return newick;
+}
+
+static char * export_sorted(const snode_t * root)
+{
+  char * cat;
+  char * newick;
+  char * temp;
+
+  temp = export_sorted_recursive(root,&cat);
+  xasprintf(&newick, "%s;", temp);
+  free(temp);
+  free(cat);
+
+  return newick;
+}
+
+/* hash the topology of a tree with bitmasks into the table of distinct
+   topologies. The canonical newick string is only created the first time a
+   topology is encountered */
+static void topology_count(stree_t * stree)
+{
+  long i;
+  long clade_count = 0;
+  unsigned long hash;
+  struct topology_s query;
+  struct topology_s * topo;
+
+  for (i = stree->tip_count; i < stree->tip_count + stree->inner_count; ++i)
+    if (stree->nodes[i]->parent)
+      clade_list[clade_count++] = stree->nodes[i]->bitmask;
+
+  qsort(clade_list,(size_t)clade_count,sizeof(unsigned long *),cb_bitmask_cmp);
+
+  for (i = 0; i < clade_count; ++i)
+    memcpy(clade_key+i*bitmask_elms,
+           clade_list[i],
+           (size_t)bitmask_elms*sizeof(unsigned long));
+
+  query.key = clade_key;
+  query.clade_count = clade_count;
+  hash = hash_fnv_long(clade_key,clade_count*bitmask_elms);
+
+  topo = hashtable_find(ht_topology,(void *)&query,hash,cb_cmp_topology);
+  if (topo)
+  {
+    topo->count++;
+    return;
+  }
+
+  topo = (struct topology_s *)xmalloc(sizeof(struct topology_s));
+  topo->clade_count = clade_count;
+  topo->key = (unsigned long *)xmalloc((size_t)(MAX(clade_count,1) *
+                                                bitmask_elms) *
+                                       sizeof(unsigned long));
+  memcpy(topo->key,
+         clade_key,
+         (size_t)(clade_count*bitmask_elms)*sizeof(unsigned long));
+  topo->newick = export_sorted(stree->root);
+  topo->count = 1;
+  hashtable_insert_force(ht_topology,(void *)topo,hash);
+}
+
+void stree_summary_init(char ** species, long species_count)
+{
+  bipartitions_init(species,species_count);
+
+  ht_topology = hashtable_create(100*(size_t)species_count);
+  clade_list = (unsigned long **)xmalloc((size_t)species_count *
+                                         sizeof(unsigned long *));
+  clade_key = (unsigned long *)xmalloc((size_t)(species_count*bitmask_elms) *
+                                       sizeof(unsigned long));
+  sample_count = 0;
+}
+
+/* add one species tree sample to the summary. Memory usage depends only on the
+   number of distinct topologies and splits, not on the number of samples */
+void stree_summary_update(stree_t * stree)
+{
+  assign_bitmasks(stree);
+  bipartitions_count(stree);
+  topology_count(stree);
+  bitmasks_free(stree);
+
+  sample_count++;
 }
 
 static void cb_bptrivial_dealloc(void * data)
@@ -355,10 +534,27 @@ static void print_stree_with_support(FILE * fp_out,
   stree_destroy(stree,NULL);
 }
 
+static void cb_topology_dealloc(void * data)
+{
+  struct topology_s * topo = data;
+  free(topo->key);
+  free(topo->newick);
+  free(topo);
+}
+
 void summary_dealloc_hashtables()
 {
   hashtable_destroy(ht_biparts,cb_bipartition_dealloc);
   hashtable_destroy(ht_trivial,cb_bptrivial_dealloc);
+  if (ht_topology)
+  {
+    hashtable_destroy(ht_topology,cb_topology_dealloc);
+    free(clade_list);
+    free(clade_key);
+    ht_topology = NULL;
+    clade_list = NULL;
+    clade_key = NULL;
+  }
 }
 
 static int cb_countcmp(const void * a, const void * b)
@@ -398,7 +594,9 @@ static void bipartitions_finalize(FILE * fp_out, size_t trees_count, char ** spe
   unsigned long i,j,k,entry;
   unsigned long majority = 0;
 
-  struct bipartition_s ** x = hashtable_serialize1p(ht_biparts);
+  struct bipartition_s ** x;
+
+  x = (struct bipartition_s **)hashtable_serialize1p(ht_biparts);
   fprintf(stdout, "\n(B) Best splits in the sample of trees (%ld splits in all)\n",
           ht_biparts->entries_count);
   fprintf(fp_out, "\n(B) Best splits in the sample of trees (%ld splits in all)\n",
@@ -529,26 +727,11 @@ static void bipartitions_finalize(FILE * fp_out, size_t trees_count, char ** spe
 
 
 
-/* TODO: New summary code */
-
-struct distinct_s 
-{
-  size_t start;
-  size_t count;
-};
-
 static char buffer[LINEALLOC];
 static char * line = NULL;
 static size_t line_size = 0;
 static size_t line_maxsize = 0;
 
-static char * cb_serialize_none(const snode_t * snode)
-{
-  if (!snode->left) return xstrdup(snode->label);
-
-  return xstrdup("");
-}
-
 static void reallocline(size_t newmaxsize)
 {
   char * temp = (char *)xmalloc((size_t)newmaxsize*sizeof(char));
@@ -628,43 +811,18 @@ static void strip_attributes(char * s)
   *p = 0;
 }
 
-static int cb_strcmp(const void * a, const void * b)
-{
-  const char ** pa = (const char **)a;
-  const char ** pb = (const char **)b;
-
-  return strcmp(*pa,*pb);
-}
-
-static void stree_sort_recursive(snode_t * node)
+static int cb_topology_strcmp(const void * a, const void * b)
 {
-  if (!node->left)
-    return;
+  const struct topology_s * pa = *((const struct topology_s **)a);
+  const struct topology_s * pb = *((const struct topology_s **)b);
 
-  stree_sort_recursive(node->left);
-  stree_sort_recursive(node->right);
-
-  if (strcmp(node->left->label, node->right->label) > 0)
-    SWAP(node->left,node->right);
-
-  node->label = (char *)xmalloc(strlen(node->left->label) +
-                                strlen(node->right->label) + 1);
-
-  /* concatenate species labels */
-  node->label[0] = 0;
-  strcat(node->label,node->left->label);
-  strcat(node->label,node->right->label);
-}
-
-static void stree_sort(stree_t * stree)
-{
-  stree_sort_recursive(stree->root); 
+  return strcmp(pa->newick,pb->newick);
 }
 
-static int cb_dtree_cmp(const void * a, const void * b)
+static int cb_topology_countcmp(const void * a, const void * b)
 {
-  const struct distinct_s * pa = (const struct distinct_s *)a;
-  const struct distinct_s * pb = (const struct distinct_s *)b;
+  const struct topology_s * pa = *((const struct topology_s **)a);
+  const struct topology_s * pb = *((const struct topology_s **)b);
 
   if (pa->count < pb->count) return 1;
   else if (pa->count > pb->count) return -1;
@@ -672,41 +830,14 @@ static int cb_dtree_cmp(const void * a, const void * b)
   return 0;
 }
 
-void stree_summary(FILE * fp_out, char ** species_names, long species_count)
+/* print summary of all trees added with stree_summary_update() and deallocate
+   the summary tables */
+void stree_summary_print(FILE * fp_out, char ** species_names, long species_count)
 {
   size_t i,distinct;
-  size_t line_count = 0;
-  FILE * fp_mcmc;
-  char ** treelist;
-  struct distinct_s * dtree;
-
-  /* allocate space for holding all species tree samples */
-  treelist = (char **)xmalloc((size_t)(opt_samples+1)*sizeof(char *));
-
-  /* open mcmc file */
-  #ifndef DEBUG_MAJORITY
-  fp_mcmc = xopen(opt_mcmcfile,"r");
-  #else
-  fp_mcmc = xopen("test.txt","r");
-  #endif
-
-  bipartitions_init(species_names,species_count);
-
-  /* read each line from the file, and strip all thetas and branch lengths
-     such that only the tree topology and tip names remain, and store them
-     in treelist */
-  while (getnextline(fp_mcmc))
-  {
-    strip_attributes(line);
-    stree_t * t = bpp_parse_newick_string(line);
-    stree_sort(t);
-    treelist[line_count++] = stree_export_newick(t->root,cb_serialize_none);
-
-    bipartitions_update(t);
-    stree_destroy(t,NULL);
-  }
-  assert(line_count);
+  struct topology_s ** dtree;
 
+  assert(sample_count);
 
   fprintf(stdout, "Species in order:\n");
   fprintf(fp_out, "Species in order:\n");
@@ -718,44 +849,29 @@ void stree_summary(FILE * fp_out, char ** species_names, long species_count)
   fprintf(stdout, "\n");
   fprintf(fp_out, "\n");
 
-  qsort(treelist,(size_t)line_count,sizeof(char *), cb_strcmp);
-
-  distinct = 1;
-  size_t * uniquepos = (size_t *)xmalloc(line_count*sizeof(size_t));
-  uniquepos[0] = 0;
-  for (i = 1; i < line_count; ++i)
-  {
-    if (strcmp(treelist[i],treelist[i-1]))
-    {
-      uniquepos[distinct++] = i;
-    }
-  }
-
+  /* serialize distinct topologies, order them by their newick strings and then
+     by frequency */
+  distinct = ht_topology->entries_count;
   assert(distinct > 0);
 
-  dtree = (struct distinct_s *)xmalloc(distinct * sizeof(struct distinct_s));
-  for (i = 0; i < distinct; ++i)
-  {
-    dtree[i].start = uniquepos[i];
-    dtree[i].count = (i == distinct - 1) ?
-                      line_count - uniquepos[i] : uniquepos[i+1] - uniquepos[i];
-  }
+  dtree = (struct topology_s **)hashtable_serialize1p(ht_topology);
+  qsort(dtree, distinct, sizeof(struct topology_s *), cb_topology_strcmp);
+  qsort(dtree, distinct, sizeof(struct topology_s *), cb_topology_countcmp);
 
-  qsort(dtree, distinct, sizeof(struct distinct_s), cb_dtree_cmp);
   fprintf(stdout, "(A) Best trees in the sample (%ld distinct trees in all)\n", distinct);
   fprintf(fp_out, "(A) Best trees in the sample (%ld distinct trees in all)\n", distinct);
   double cdf = 0;
   for (i = 0; i < distinct; ++i)
   {
-    double pdf = dtree[i].count / (double)line_count;
+    double pdf = dtree[i]->count / (double)sample_count;
     cdf += pdf;
     fprintf(stdout, " %8ld %8.5f %8.5f %s\n",
-            dtree[i].count, pdf, cdf, treelist[dtree[i].start]);
+            dtree[i]->count, pdf, cdf, dtree[i]->newick);
     fprintf(fp_out, " %8ld %8.5f %8.5f %s\n",
-            dtree[i].count, pdf, cdf, treelist[dtree[i].start]);
+            dtree[i]->count, pdf, cdf, dtree[i]->newick);
   }
 
-  bipartitions_finalize(fp_out,line_count,species_names);
+  bipartitions_finalize(fp_out,sample_count,species_names);
 
   fprintf(stdout, "\n(D) Best tree (or trees from the mastertree file) "
           "with support values\n");
@@ -763,23 +879,45 @@ void stree_summary(FILE * fp_out, char ** species_names, long species_count)
           "with support values\n");
   for (i = 0; i < distinct; ++i)
   {
-    if (i && dtree[i].count != dtree[i-1].count)
+    if (i && dtree[i]->count != dtree[i-1]->count)
       break;
 
     print_stree_with_support(fp_out,
-                             treelist[dtree[i].start],
-                             dtree[i].count,
-                             line_count);
+                             dtree[i]->newick,
+                             dtree[i]->count,
+                             sample_count);
   }
 
-  summary_dealloc_hashtables();
-  free(uniquepos);
   free(dtree);
- 
-  /* deallocate list of trees */
-  for (i = 0; i < line_count; ++i)
-    free(treelist[i]);
-  free(treelist);
+  summary_dealloc_hashtables();
+}
+
+/* summarize the species tree samples stored in the MCMC file. Each sample is
+   parsed and added to the summary tables as it is read */
+void stree_summary(FILE * fp_out, char ** species_names, long species_count)
+{
+  FILE * fp_mcmc;
+
+  /* open mcmc file */
+  #ifndef DEBUG_MAJORITY
+  fp_mcmc = xopen(opt_mcmcfile,"r");
+  #else
+  fp_mcmc = xopen("test.txt","r");
+  #endif
+
+  stree_summary_init(species_names,species_count);
+
+  /* read each line from the file, and strip all thetas and branch lengths
+     such that only the tree topology and tip names remain */
+  while (getnextline(fp_mcmc))
+  {
+    strip_attributes(line);
+    stree_t * t = bpp_parse_newick_string(line);
+    stree_summary_update(t);
+    stree_destroy(t,NULL);
+  }
+
+  stree_summary_print(fp_out,species_names,species_count);
 
   fclose(fp_mcmc);
 }
@@ -141,15 +141,14 @@ static void cb_stringfreq_dealloc(void * data)
   free(sf);
 }
 
-/* serialize hashtable of string frequencies into an array */
-static stringfreq_t ** hashtable_serialize(hashtable_t * ht)
+/* serialize hashtable of string frequencies (or models) into an array */
+static void ** hashtable_serialize(hashtable_t * ht)
 {
   unsigned long i,k;
-  stringfreq_t ** sflist;
+  void ** sflist;
 
   /* allocate the array to hold all items in the hash table */
-  sflist = (stringfreq_t **)xmalloc((size_t)(ht->entries_count+1) *
-                                   sizeof(stringfreq_t *));
+  sflist = (void **)xmalloc((size_t)(ht->entries_count+1) * sizeof(void *));
 
   /* go through all entries of the hashtable and serialize */
   for (i = 0, k = 0; i < ht->table_size; ++i)
@@ -160,7 +159,7 @@ static stringfreq_t ** hashtable_serialize(hashtable_t * ht)
     while (head)
     {
       ht_item_t * hi = (ht_item_t *)(head->data);
-      sflist[k++] = (stringfreq_t *)(hi->value);
+      sflist[k++] = hi->value;
       head = head->next;
     }
   }
@@ -401,39 +400,6 @@ static void recursive_age(snode_t * node)
   node->tau = node->left->tau + node->left->length;
 }
 
-static int cb_stree_count(const void * pa, const void * pb)
-{
-  const db_stree_t * a = (const db_stree_t *)pa;
-  const db_stree_t * b = (const db_stree_t *)pb;
-
-  if (a->count < b->count) return 1;
-  else if (a->count > b->count) return -1;
-
-  return 0;
-}
-static int cb_stree_species(const void * pa, const void * pb)
-{
-  db_stree_t * a = (db_stree_t *)pa;
-  db_stree_t * b = (db_stree_t *)pb;
-
-  if (a->species > b->species) return 1;
-  if (a->species < b->species) return -1;
-
-  return 0;
-  //return (int)(a->species - b->species);
-}
-
-static int cb_stree_strcmp(const void * pa, const void * pb)
-{
-  const db_stree_t * sa = (db_stree_t *)pa;
-  const db_stree_t * sb = (db_stree_t *)pb;
-
-  const char * a = sa->newick;
-  const char * b = sb->newick;
-
-  return strcmp(a, b);
-}
-
 static int cb_cmp_label(void * a, void * b)
 {
   stringfreq_t * sf = (stringfreq_t *)a;
@@ -520,30 +486,63 @@ static stree_t * parse_tree(const char * s)
   return t;
 }
 
-static void replace(db_stree_t * treelist,
-                    int64_t index,
-                    int64_t start,
-                    int64_t freq)
+static hashtable_t * ht_models = NULL;  /* distinct delimited species trees */
+static unsigned int models_sp_count = 0;
+static int64_t models_samples = 0;
+
+static int cb_cmp_model(void * a, void * b)
 {
-  if (index != start)
-  {
-    if (treelist[index].newick)
-      free(treelist[index].newick);
-    treelist[index].newick = treelist[start].newick;
-    treelist[start].newick = NULL;
+  db_stree_t * x = (db_stree_t *)a;
+  db_stree_t * y = (db_stree_t *)b;
 
-    treelist[index].species = treelist[start].species;
-  }
-  treelist[index].count = freq;
+  return (x->species == y->species && !strcmp(x->newick,y->newick));
 }
 
-void mixed_summary(FILE * fp_out, unsigned int sp_count)
+static void cb_model_dealloc(void * data)
 {
-  int64_t line_count = 0;
-  int64_t i,j;
-  FILE * fp_mcmc;
-  db_stree_t * treelist;
-  snode_t ** inner;
+  db_stree_t * model = data;
+  free(model->newick);
+  free(model);
+}
+
+/* comparator for sorting models by number of species and then by newick */
+static int cb_model_speciescmp(const void * pa, const void * pb)
+{
+  const db_stree_t * a = *((const db_stree_t **)pa);
+  const db_stree_t * b = *((const db_stree_t **)pb);
+
+  if (a->species > b->species) return 1;
+  if (a->species < b->species) return -1;
+
+  return strcmp(a->newick,b->newick);
+}
+
+static int cb_model_countcmp(const void * pa, const void * pb)
+{
+  const db_stree_t * a = *((const db_stree_t **)pa);
+  const db_stree_t * b = *((const db_stree_t **)pb);
+
+  if (a->count < b->count) return 1;
+  else if (a->count > b->count) return -1;
+
+  return 0;
+}
+
+void mixed_summary_init(unsigned int sp_count)
+{
+  ht_models = hashtable_create(100*(unsigned long)sp_count);
+  models_sp_count = sp_count;
+  models_samples = 0;
+}
+
+/* add one sample to the summary, given in the MCMC file format, i.e. newick
+   string followed by the number of delimited species. The line is modified.
+   Only one record per distinct delimited species tree is kept in memory */
+void mixed_summary_update(char * line)
+{
+  int64_t i;
+  db_stree_t query;
+  db_stree_t * model;
 
   /* TODO: Ugly hack to make bpp_parse_newick_string. The issue is that if
      opt_diploid is set, the program checks whether opt_diploid_size matches
@@ -553,122 +552,105 @@ void mixed_summary(FILE * fp_out, unsigned int sp_count)
      bpp_parse_newick_string, but we should come up with a better solution */
   long * debug_opt_diploid = opt_diploid; opt_diploid = NULL;
 
-  /* open MCMC file for reading */
-  fp_mcmc = xopen(opt_mcmcfile,"r");
-
-  /* allocate space for storing inner nodes */
-  inner = (snode_t **)xmalloc((size_t)opt_max_species_count*sizeof(snode_t *));
-
-  /* allocate space for reading trees from MCMC file */
-  treelist = (db_stree_t *)xmalloc((size_t)(opt_samples+1)*sizeof(db_stree_t));
-
-  /* read trees and species counts from MCMC file */
-  while (getnextline(fp_mcmc))
+  /* separate line into two zero-terminated strings, the first one (line)
+     contains the newick tree string and the second (tmp) holds the species
+     count */
+  char * tmp =  strchr(line,';');
+  tmp++;
+  *tmp = 0;
+  tmp++;
+
+  /* parse newick string and unambiguously sort tree by its labels */
+  if (opt_est_theta)
+    strip_theta_attributes(line);
+  stree_t * t = bpp_parse_newick_string(line);
+  stree_sort(t);
+
+  int64_t species_count;
+  if (!get_int64(tmp,&species_count))
+    fatal("Cannot read number of species; line %ld of %s",
+          models_samples+1,opt_mcmcfile);
+
+  /* In case the number of delimited species in the sample log is equal to the
+     number of species we add a small number to the branch lengths of tips in
+     order to avoid zero-branch lengths due to truncation and result to a
+     smaller number of species (backwards compatibility with BPP 3.4)
+  */
+  if (species_count == models_sp_count)
   {
-    /* separate line into two zero-terminated strings, the first one (line)
-       contains the newick tree string and the second (tmp) holds the species
-       count */
-    char * tmp =  strchr(line,';');
-    tmp++;
-    *tmp = 0;
-    tmp++;
-
-    /* parse newick string and unambiguously sort tree by its labels */
-    if (opt_est_theta)
-      strip_theta_attributes(line);
-    stree_t * t = bpp_parse_newick_string(line);
-    stree_sort(t);
-
-    int64_t species_count;
-    if (!get_int64(tmp,&species_count))
-      fatal("Cannot read number of species; line %ld of %s",line_count+1,opt_mcmcfile);
-
-    /* In case the number of delimited species in the sample log is equal to the
-       number of species we add a small number to the branch lengths of tips in
-       order to avoid zero-branch lengths due to truncation and result to a
-       smaller number of species (backwards compatibility with BPP 3.4)
-    */
-    if (species_count == sp_count)
-    {
-      for (i = 0; i < t->tip_count; ++i)
-        t->nodes[i]->length += 0.1;
-    }
-
-    /* convert expanded tree into delimited tree, e.g.:
-
-       ((A:0,B:0):0.02,(C:0.01,D:0.01):0.01); -> (AB,(C,D)); */
-    char * dnewick = get_delimit_string(t);
-
+    for (i = 0; i < t->tip_count; ++i)
+      t->nodes[i]->length += 0.1;
+  }
 
-    /* count the number of delimited species in current species tree when the
-       logged number of species does not equal the species count.
-       The number of species may not match the logged number due to trancation
-       (we print only six decimal digits, which causes zero-branch lengths for
-       branches with very small length. For backwards-compatibility with BPP 3.4
-       we use the logged number of species when it's equal to the number of
-       species
-      */
-    if (species_count != sp_count)
-    {
-      species_count = 1;
-      for (i = t->tip_count; i < t->tip_count+t->inner_count; ++i)
-        if (t->nodes[i]->tau > 0)
-          ++species_count;
-    }
+  /* convert expanded tree into delimited tree, e.g.:
 
-    treelist[line_count].newick = dnewick;
-    treelist[line_count].species = species_count;
-    treelist[line_count].count = 1;
-    line_count++;
+     ((A:0,B:0):0.02,(C:0.01,D:0.01):0.01); -> (AB,(C,D)); */
+  char * dnewick = get_delimit_string(t);
 
-   // if (species_count > max_species_count)
-   //   max_species_count = species_count;
 
-    stree_destroy(t,NULL);
+  /* count the number of delimited species in current species tree when the
+     logged number of species does not equal the species count.
+     The number of species may not match the logged number due to trancation
+     (we print only six decimal digits, which causes zero-branch lengths for
+     branches with very small length. For backwards-compatibility with BPP 3.4
+     we use the logged number of species when it's equal to the number of
+     species
+    */
+  if (species_count != models_sp_count)
+  {
+    species_count = 1;
+    for (i = t->tip_count; i < t->tip_count+t->inner_count; ++i)
+      if (t->nodes[i]->tau > 0)
+        ++species_count;
   }
-  assert(line_count);
 
-  /* sort by number of species (ascending order - not relevant) */
-  qsort(treelist,(size_t)line_count, sizeof(db_stree_t), cb_stree_species);
+  stree_destroy(t,NULL);
 
-  /* now sort by newick each range of trees having the same number of species */
-  int64_t start = 0;
-  int64_t freq = 1; 
-  for (i = 1; i < line_count; ++i)
+  query.newick = dnewick;
+  query.species = species_count;
+  model = hashtable_find(ht_models,
+                         (void *)&query,
+                         hash_fnv(dnewick),
+                         cb_cmp_model);
+  if (model)
   {
-    if (treelist[i].species == treelist[i-1].species)
-      ++freq;
-    else
-    {
-      qsort(treelist+start,(size_t)freq,sizeof(db_stree_t),cb_stree_strcmp);
-      start = i;
-      freq = 1;
-    }
+    model->count++;
+    free(dnewick);
   }
-  if (freq > 1)
-    qsort(treelist+start,(size_t)freq,sizeof(db_stree_t),cb_stree_strcmp);
-
-  /* now keep only the unique trees in treelist */
-  int64_t index = 0;
-  start = 0; freq = 1;
-  for (i = 1; i < line_count; ++i)
+  else
   {
-    if (!strcmp(treelist[i].newick,treelist[i-1].newick))
-    {
-      ++freq;
-    }
-    else
-    {
-      replace(treelist,index,start,freq);
-      ++index;
+    model = (db_stree_t *)xmalloc(sizeof(db_stree_t));
+    model->newick = dnewick;
+    model->species = species_count;
+    model->count = 1;
+    hashtable_insert_force(ht_models,(void *)model,hash_fnv(dnewick));
+  }
 
-      start = i;
-      freq = 1;
+  models_samples++;
 
-    }
-  }
-  replace(treelist,index,start,freq);
-  ++index;
+  opt_diploid = debug_opt_diploid;
+}
+
+/* print summary of all samples added with mixed_summary_update() and
+   deallocate the table of models */
+void mixed_summary_print(FILE * fp_out)
+{
+  int64_t i,j;
+  int64_t index;
+  int64_t min_species;
+  db_stree_t ** treelist;
+
+  /* see mixed_summary_update() */
+  long * debug_opt_diploid = opt_diploid; opt_diploid = NULL;
+
+  assert(models_samples);
+
+  /* serialize the distinct models and order them by number of species and
+     newick string, and then by frequency */
+  index = ht_models->entries_count;
+  treelist = (db_stree_t **)hashtable_serialize(ht_models);
+  qsort(treelist,(size_t)index,sizeof(db_stree_t *),cb_model_speciescmp);
+  min_species = treelist[0]->species;
 
   /* Print summary statistics (A) with the following columns: 
   
@@ -682,39 +664,38 @@ void mixed_summary(FILE * fp_out, unsigned int sp_count)
   
   /* create two hashtables for indexing species (ht_species) and delimitations
      (ht_delims) */
-  hashtable_t * ht_species = hashtable_create(100*treelist[0].species);
-  hashtable_t * ht_delims  = hashtable_create(100*treelist[0].species);
+  hashtable_t * ht_species = hashtable_create(100*min_species);
+  hashtable_t * ht_delims  = hashtable_create(100*min_species);
 
-  qsort(treelist,(size_t)index,sizeof(db_stree_t),cb_stree_count);
+  qsort(treelist,(size_t)index,sizeof(db_stree_t *),cb_model_countcmp);
 
-  int maxlen = logint64_len(treelist[0].count);
+  int maxlen = logint64_len(treelist[0]->count);
   double prob;
   double cum = 0;
-  start = 0; freq = 1;
   fprintf(stdout,
           "\n(A) List of best models (count postP #species SpeciesTree)\n");
   fprintf(fp_out,
           "\n(A) List of best models (count postP #species SpeciesTree)\n");
   for (i = 0; i < index; ++i)
   {
-    stree_t * t = parse_tree(treelist[i].newick);
+    stree_t * t = parse_tree(treelist[i]->newick);
 
     /* create delimitation string */
     char * delim = create_delim_string(t);
 
     /* print summary statistics */
-    cum += treelist[i].count / (double)opt_samples;
-    prob = treelist[i].count / (double)opt_samples;
+    cum += treelist[i]->count / (double)opt_samples;
+    prob = treelist[i]->count / (double)opt_samples;
     fprintf(stdout,
             "%*ld %f %f %ld ",
-            maxlen,treelist[i].count,prob,cum,treelist[i].species);
+            maxlen,treelist[i]->count,prob,cum,treelist[i]->species);
     fprintf(fp_out,
             "%*ld %f %f %ld ",
-            maxlen,treelist[i].count,prob,cum,treelist[i].species);
+            maxlen,treelist[i]->count,prob,cum,treelist[i]->species);
     fprintf(stdout, " (%s) ", delim);
     fprintf(fp_out, " (%s) ", delim);
-    fprintf(stdout, " %s\n", treelist[i].newick);
-    fprintf(fp_out, " %s\n", treelist[i].newick);
+    fprintf(stdout, " %s\n", treelist[i]->newick);
+    fprintf(fp_out, " %s\n", treelist[i]->newick);
 
 
     /* query delimitation string against hash table */
@@ -725,14 +706,14 @@ void mixed_summary(FILE * fp_out, unsigned int sp_count)
     if (query)
     {
       /* delimitation found; increase frequency counter and deallocate delim */
-      query->count += treelist[i].count;
+      query->count += treelist[i]->count;
       free(delim);
     }
     else
     {
       /* delimitation was not found in hashtable; create a new record */
       query = (stringfreq_t *)xmalloc(sizeof(stringfreq_t));
-      query->count = treelist[i].count;
+      query->count = treelist[i]->count;
       query->label = delim;
       query->word_count = t->tip_count;
       hashtable_insert_force(ht_delims,
@@ -749,12 +730,12 @@ void mixed_summary(FILE * fp_out, unsigned int sp_count)
                                          cb_cmp_label);
       if (sf)
       {
-        sf->count += treelist[i].count;
+        sf->count += treelist[i]->count;
       }
       else
       {
         sf = (stringfreq_t *)xmalloc(sizeof(stringfreq_t));
-        sf->count = treelist[i].count;
+        sf->count = treelist[i]->count;
         sf->label = xstrdup(t->nodes[j]->label);
         hashtable_insert_force(ht_species,
                                (void *)sf,
@@ -763,12 +744,9 @@ void mixed_summary(FILE * fp_out, unsigned int sp_count)
     }
     stree_destroy(t,NULL);
   }
-  for (i = 0; i < line_count; ++i)
-  {
-    if (treelist[i].newick)
-      free(treelist[i].newick);
-  }
   free(treelist);
+  hashtable_destroy(ht_models,cb_model_dealloc);
+  ht_models = NULL;
 
   /* Print delimitation summary statistics (B) with the following columns:
   
@@ -779,7 +757,7 @@ void mixed_summary(FILE * fp_out, unsigned int sp_count)
   */
 
   /* serialize hashtable of delimitation frequencies into an array */
-  stringfreq_t ** dfreqs = hashtable_serialize(ht_delims);
+  stringfreq_t ** dfreqs = (stringfreq_t **)hashtable_serialize(ht_delims);
 
   /* sort delimitations by frequency count (descending order) */
   qsort(dfreqs,ht_delims->entries_count,sizeof(stringfreq_t *),cb_countcmp);
@@ -826,7 +804,7 @@ void mixed_summary(FILE * fp_out, unsigned int sp_count)
   */
 
   /* serialize hashtable of delimited species frequencies into an array */
-  dfreqs = hashtable_serialize(ht_species);
+  dfreqs = (stringfreq_t **)hashtable_serialize(ht_species);
 
   /* sort delimited species labels by frequency count (descending order) */
   qsort(dfreqs,ht_species->entries_count,sizeof(stringfreq_t *),cb_countcmp);
@@ -884,9 +862,26 @@ void mixed_summary(FILE * fp_out, unsigned int sp_count)
                  
   hashtable_destroy(ht_species,cb_stringfreq_dealloc);
   hashtable_destroy(ht_delims,cb_stringfreq_dealloc);
-                 
-  free(inner);   
-  fclose(fp_mcmc);
 
   opt_diploid = debug_opt_diploid;
+}
+
+/* summarize the samples stored in the MCMC file. Each line is added to the
+   summary as it is read */
+void mixed_summary(FILE * fp_out, unsigned int sp_count)
+{
+  FILE * fp_mcmc;
+
+  /* open MCMC file for reading */
+  fp_mcmc = xopen(opt_mcmcfile,"r");
+
+  mixed_summary_init(sp_count);
+
+  /* read trees and species counts from MCMC file */
+  while (getnextline(fp_mcmc))
+    mixed_summary_update(line);
+
+  mixed_summary_print(fp_out);
+
+  fclose(fp_mcmc);
 }                
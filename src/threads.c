@@ -34,6 +34,11 @@ typedef struct thread_info_s
   long locus_first;
   long locus_count;
 
+  /* core, NUMA node and bytes of locus buffers allocated by the worker */
+  long cpu;
+  long numa_node;
+  size_t touched_bytes;
+
   thread_data_t td;
 
 } thread_info_t;
@@ -41,6 +46,17 @@ typedef struct thread_info_s
 static thread_info_t * ti;
 static pthread_attr_t attr;
 
+#define SCRATCH_CACHELINE 64
+
+thread_scratch_t * thread_scratch = NULL;
+static long scratch_count = 0;
+
+/* round size up to a multiple of the cache line size */
+static size_t scratch_roundup(size_t size)
+{
+  return (size + SCRATCH_CACHELINE - 1) & ~(size_t)(SCRATCH_CACHELINE - 1);
+}
+
 #if (defined(__linux__) && !defined(DISABLE_COREPIN))
 static void pin_to_core(long t)
 {
@@ -53,15 +69,107 @@ static void pin_to_core(long t)
     fatal("Error while pinning thread to core. "
           "Probably used more threads than available cores?");
 }
+
+/* core on which thread t is pinned (thread 0 shares its core with the master
+   thread). Unless the first core and step were given in the control file,
+   threads are spread over the NUMA nodes, such that loci and their memory are
+   balanced across the memory controllers */
+static long thread_core(long t)
+{
+  if (!opt_threads_step)
+    return numa_spread_core(t);
+
+  return (opt_threads_start-1) + t*opt_threads_step;
+}
 #endif
 
+/* re-allocate the buffers and gene trees of the loci assigned to the worker
+   from within the worker, and copy their population state into the new block
+   of the species tree, such that all are placed on its NUMA node */
+static void first_touch(thread_info_t * tip)
+{
+  long i;
+  long first = tip->locus_first;
+
+  tip->touched_bytes = stree_locus_state_touch(tip->td.stree,
+                                               first,
+                                               tip->locus_count);
+  for (i = first; i < first + tip->locus_count; ++i)
+  {
+    if (tip->td.gtree)
+      tip->touched_bytes += gtree_first_touch(tip->td.gtree+i,
+                                              tip->td.stree,
+                                              i);
+    if (tip->td.locus)
+      tip->touched_bytes += locus_first_touch(tip->td.locus[i]);
+  }
+
+  #if defined(__linux__)
+  tip->cpu = sched_getcpu();
+  #else
+  tip->cpu = -1;
+  #endif
+  tip->numa_node = numa_node_current();
+}
+
+static void numa_report(stree_t * stree, gtree_t ** gtree, locus_t ** locus)
+{
+  long i,t,n;
+  long nodes = numa_node_count();
+  double * node_bytes = (double *)xmalloc((size_t)nodes * sizeof(double));
+
+  printf("\nLocus buffers allocated by worker threads (%ld NUMA node%s):\n",
+         nodes, nodes > 1 ? "s" : "");
+  for (t = 0; t < opt_threads; ++t)
+  {
+    thread_info_t * tip = ti + t;
+    long valid = 1;
+    double total = 0;
+
+    for (n = 0; n < nodes; ++n)
+      node_bytes[n] = 0;
+
+    valid = stree_locus_state_placement(stree,
+                                        tip->locus_first,
+                                        tip->locus_count,
+                                        node_bytes);
+    for (i = tip->locus_first; i < tip->locus_first+tip->locus_count; ++i)
+    {
+      if (valid)
+        valid = gtree_numa_placement(gtree[i], stree, node_bytes);
+      if (valid)
+        valid = locus_numa_placement(locus[i], node_bytes);
+    }
+
+    printf(" Thread %ld : core %ld, node %ld, %.2f MB",
+           t, tip->cpu, tip->numa_node, tip->touched_bytes / 1048576.0);
+
+    for (n = 0; n < nodes; ++n)
+      total += node_bytes[n];
+
+    if (!valid || total == 0)
+    {
+      printf(", placement unknown\n");
+      continue;
+    }
+
+    printf(", resident on");
+    for (n = 0; n < nodes; ++n)
+      if (node_bytes[n] > 0)
+        printf(" node %ld (%.1f%%)", n, 100*node_bytes[n]/total);
+    printf("\n");
+  }
+
+  free(node_bytes);
+}
+
 static void * threads_worker(void * vp)
 {
   long t = (long)vp;
   thread_info_t * tip = ti + t;
 
 #if (defined(__linux__) && !defined(DISABLE_COREPIN))
-  pin_to_core((opt_threads_start-1)+(t*opt_threads_step));
+  pin_to_core(thread_core(t));
 #endif
 
   pthread_mutex_lock(&tip->mutex);
@@ -169,6 +277,9 @@ static void * threads_worker(void * vp)
                                      &tip->td.proposals,
                                      &tip->td.accepted);
           break;
+        case THREAD_WORK_FIRSTTOUCH:
+          first_touch(tip);
+          break;
         default:
           fatal("Unknown work function assigned to thread worker %ld", t);
                              
@@ -186,11 +297,35 @@ static void * threads_worker(void * vp)
 void threads_pin_master()
 {
   #if (defined(__linux__) && !defined(DISABLE_COREPIN))
-    pin_to_core(opt_threads_start-1);
+    numa_detect();
+    pin_to_core(thread_core(0));
   #endif
 }
 
-void threads_init(locus_t ** locus)
+/* range of loci assigned to thread t, which is fixed for the whole run. The
+   range is also used for placing the per-locus population state (see
+   stree_alloc_locus_state) before the threads are started */
+void threads_locus_range(long t, long * first, long * count)
+{
+  /* static load allocation */
+  /* TODO: We discussed with Ziheng better ways to allocate loci on threads. One
+     idea was to use some weights on the site count of each locus, i.e.
+     sites^{2/3} as we need to account for the MSC density computation time and
+     not only on the phylogenetic likelihood.
+
+     For now we only distrubute an equal number of loci to each thread and
+     cyclically distribute the overflow */
+
+  long loci_per_thread = opt_locus_count / opt_threads;
+  long loci_remaining = opt_locus_count % opt_threads;
+
+  assert(t >= 0 && t < opt_threads);
+
+  *first = t*loci_per_thread + MIN(t,loci_remaining);
+  *count = loci_per_thread + (t < loci_remaining ? 1 : 0);
+}
+
+void threads_init(stree_t * stree, gtree_t ** gtree, locus_t ** locus)
 {
   long i;
   long t;
@@ -198,8 +333,10 @@ void threads_init(locus_t ** locus)
 
   assert(opt_threads <= opt_locus_count);
 
+  numa_detect();
+
 #if (defined(__linux__) && !defined(DISABLE_COREPIN))
-  pin_to_core(opt_threads_start-1);
+  pin_to_core(thread_core(0));
 #endif
 
   pthread_attr_init(&attr);
@@ -208,20 +345,6 @@ void threads_init(locus_t ** locus)
   /* allocate memory for thread info */
   ti = (thread_info_t *)xmalloc((size_t)opt_threads * sizeof(thread_info_t));
 
-  /* static load allocation */
-  /* TODO: We discussed with Ziheng better ways to allocate loci on threads. One
-     idea was to use some weights on the site count of each locus, i.e.
-     sites^{2/3} as we need to account for the MSC density computation time and
-     not only on the phylogenetic likelihood.
-
-     For now we only distrubute an equal number of loci to each thread and
-     cyclically distribute the overflow */
-
-  long loci_per_thread = opt_locus_count / opt_threads;
-  long loci_remaining = opt_locus_count % opt_threads;
-  long loci_start = 0;
-
-
   /* init and create worker threads */
   printf("\nDistributing workload to threads:\n");
   for (t = 0; t < opt_threads; ++t)
@@ -233,12 +356,7 @@ void threads_init(locus_t ** locus)
     tip->td.stree = NULL;
 
     /* allocate loci for thread t */
-    tip->locus_first = loci_start;
-    tip->locus_count = loci_per_thread + (loci_remaining > 0 ? 1 : 0);
-
-    if (loci_remaining)
-      --loci_remaining;
-    loci_start += tip->locus_count;
+    threads_locus_range(t, &tip->locus_first, &tip->locus_count);
 
     /* calculate number of site patterns send to current thread */
     patterns = 0;
@@ -253,6 +371,29 @@ void threads_init(locus_t ** locus)
     if (pthread_create(&tip->thread, &attr, threads_worker, (void *)(long)t))
       fatal("Cannot create thread");
   }
+
+  /* locus buffers, gene trees and population state were allocated by the
+     master thread; have each worker move those of its loci to its own NUMA
+     node */
+  threads_first_touch(stree, gtree, locus);
+  numa_report(stree, gtree, locus);
+}
+
+/* have each worker move the per-locus population state, and the gene trees
+   and locus buffers (if not NULL) of its loci to its own NUMA node, see
+   first_touch() */
+void threads_first_touch(stree_t * stree, gtree_t ** gtree, locus_t ** locus)
+{
+  thread_data_t td;
+
+  memset(&td, 0, sizeof(thread_data_t));
+  td.stree = stree;
+  td.gtree = gtree;
+  td.locus = locus;
+
+  stree_locus_state_move_begin(stree);
+  threads_wakeup(THREAD_WORK_FIRSTTOUCH, &td);
+  stree_locus_state_move_end(stree);
 }
 
 void threads_wakeup(int work_type, thread_data_t * data)
@@ -334,7 +475,7 @@ void threads_wakeup(int work_type, thread_data_t * data)
       data->lnacceptance += tip->td.lnacceptance;
     }
   }
-  else
+  else if (work_type != THREAD_WORK_FIRSTTOUCH)
     assert(0);
 }
 
@@ -362,4 +503,127 @@ void threads_exit()
 
   free(ti);
   pthread_attr_destroy(&attr);
+
+  numa_fini();
+}
+
+void threads_scratch_alloc(long snodes_count, long sortbuffer_size)
+{
+  long t;
+  size_t hx_size = scratch_roundup((size_t)snodes_count * sizeof(long));
+  size_t mark_size = scratch_roundup((size_t)snodes_count * sizeof(int));
+  size_t sort_size = scratch_roundup((size_t)sortbuffer_size * sizeof(double));
+
+  assert(!thread_scratch);
+  assert(sizeof(thread_scratch_t) == SCRATCH_CACHELINE);
+
+  scratch_count = opt_threads;
+  #ifdef DEBUG_THREADS
+  if (opt_threads == 1)
+    scratch_count = DEBUG_THREADS_COUNT;
+  #endif
+
+  thread_scratch = (thread_scratch_t *)pll_aligned_alloc((size_t)scratch_count *
+                                                         sizeof(thread_scratch_t),
+                                                         SCRATCH_CACHELINE);
+  if (!thread_scratch)
+    fatal("Cannot allocate memory for thread scratch space");
+
+  /* one contiguous block per thread starting at a cache line boundary, with
+     each array padded to a whole number of lines */
+  for (t = 0; t < scratch_count; ++t)
+  {
+    char * mem = (char *)pll_aligned_alloc(hx_size + mark_size + sort_size,
+                                           SCRATCH_CACHELINE);
+    if (!mem)
+      fatal("Cannot allocate memory for thread scratch space");
+    memset(mem, 0, hx_size + mark_size + sort_size);
+
+    thread_scratch[t].hx = (long *)mem;
+    thread_scratch[t].mark = (int *)(mem + hx_size);
+    thread_scratch[t].sortbuffer = (double *)(mem + hx_size + mark_size);
+  }
+}
+
+void threads_scratch_free()
+{
+  long t;
+
+  if (!thread_scratch) return;
+
+  for (t = 0; t < scratch_count; ++t)
+    pll_aligned_free(thread_scratch[t].hx);
+  pll_aligned_free(thread_scratch);
+
+  thread_scratch = NULL;
+  scratch_count = 0;
+}
+
+/* state shared by the threads of threads_parallel_for() */
+typedef struct parallel_for_s
+{
+  void (*cb)(void *, long);
+  void * arg;
+  long count;
+  long next;
+  pthread_mutex_t mutex;
+} parallel_for_t;
+
+static void * parallel_for_worker(void * vp)
+{
+  parallel_for_t * pf = (parallel_for_t *)vp;
+  long i;
+
+  while (1)
+  {
+    pthread_mutex_lock(&pf->mutex);
+    i = pf->next++;
+    pthread_mutex_unlock(&pf->mutex);
+
+    if (i >= pf->count) break;
+
+    pf->cb(pf->arg,i);
+  }
+
+  return NULL;
+}
+
+/* Call cb(arg,i) for i = 0..count-1 on up to opt_threads threads, including
+   the calling one. Used for per-locus work at startup, before the worker
+   threads are created by threads_init(). Indices are handed out one at a time
+   as threads become idle, hence cb must only write to per-index slots for the
+   results not to depend on scheduling */
+void threads_parallel_for(long count, void (*cb)(void *, long), void * arg)
+{
+  long i,t;
+  long thread_count = MIN(opt_threads,count);
+  pthread_t * threads;
+  parallel_for_t pf;
+
+  if (thread_count <= 1)
+  {
+    for (i = 0; i < count; ++i)
+      cb(arg,i);
+    return;
+  }
+
+  pf.cb = cb;
+  pf.arg = arg;
+  pf.count = count;
+  pf.next = 0;
+  pthread_mutex_init(&pf.mutex, NULL);
+
+  threads = (pthread_t *)xmalloc((size_t)(thread_count-1)*sizeof(pthread_t));
+  for (t = 0; t < thread_count-1; ++t)
+    if (pthread_create(threads+t, NULL, parallel_for_worker, (void *)&pf))
+      fatal("Cannot create thread");
+
+  parallel_for_worker((void *)&pf);
+
+  for (t = 0; t < thread_count-1; ++t)
+    if (pthread_join(threads[t], NULL))
+      fatal("Cannot join thread");
+
+  free(threads);
+  pthread_mutex_destroy(&pf.mutex);
 }
@@ -163,6 +163,49 @@ void pll_aligned_free(void * ptr)
 #endif
 }
 
+/* Map the first size bytes of file fp, opened for reading in binary mode, in
+   memory. Where mapping is not available, or fails, the file is read into a
+   buffer; in text mode line endings would be translated on some platforms and
+   fewer than size bytes read. The flag mapped must be passed to
+   xunmapfile() */
+char * xmapfile(FILE * fp, size_t size, int * mapped)
+{
+  char * mem;
+
+  *mapped = 0;
+
+#if !(defined(_WIN32) || defined(_WIN64))
+  mem = (char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+  if (mem != MAP_FAILED)
+  {
+    /* files are read once from start to end */
+    madvise(mem, size, MADV_SEQUENTIAL);
+    *mapped = 1;
+    return mem;
+  }
+#endif
+
+  mem = (char *)xmalloc(size);
+  rewind(fp);
+  if (fread(mem, 1, size, fp) != size)
+    fatal("Unable to read file");
+
+  return mem;
+}
+
+void xunmapfile(char * mem, size_t size, int mapped)
+{
+#if !(defined(_WIN32) || defined(_WIN64))
+  if (mapped)
+  {
+    munmap(mem, size);
+    return;
+  }
+#endif
+
+  free(mem);
+}
+
 #ifdef _MSC_VER
 static int vasprintf(char **strp, const char *fmt, va_list ap)
 {
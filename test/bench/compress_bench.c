@@ -0,0 +1,135 @@
+/*
+    Copyright (C) 2016-2019 Tomas Flouri, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+/* Benchmark of site pattern compression (compress_site_patterns with
+   COMPRESS_GENERAL) on random DNA alignments.
+
+   The alignment has the given number of sequences and sites. Each site is a
+   copy of one of the given number of random columns, chosen uniformly, so the
+   number of unique patterns is at most that number. The program prints the
+   time spent in compression, the number of patterns, and a checksum of the
+   compressed alignment and its weights, such that two builds of compress.c
+   can be checked for identical output.
+
+   Build against the objects of a compiled source tree:
+
+     make -C ../../src
+     cc -O3 -I../../src -o compress_bench compress_bench.c \
+        ../../src/compress.o ../../src/maps.o ../../src/util.o -lm
+
+   Usage: compress_bench SEQUENCES SITES COLUMNS [SEED] */
+
+#include "bpp.h"
+#include <time.h>
+
+long opt_quiet = 0;
+
+static uint64_t checksum(uint64_t h, const void * x, size_t size)
+{
+  const unsigned char * p = (const unsigned char *)x;
+
+  while (size--)
+  {
+    h ^= *p++;
+    h *= UINT64_C(1099511628211);
+  }
+  return h;
+}
+
+static double elapsed(struct timespec * start, struct timespec * end)
+{
+  return (double)(end->tv_sec - start->tv_sec) +
+         (double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char * argv[])
+{
+  long i,j;
+  long count,length,columns;
+  unsigned int seed = 1;
+  const char * nt = "ACGT";
+  struct timespec start,end;
+
+  if (argc < 4)
+  {
+    fprintf(stderr, "usage: %s SEQUENCES SITES COLUMNS [SEED]\n", argv[0]);
+    return 1;
+  }
+
+  count = atol(argv[1]);
+  length = atol(argv[2]);
+  columns = atol(argv[3]);
+  if (argc > 4)
+    seed = (unsigned int)atol(argv[4]);
+
+  if (count < 1 || length < 1 || columns < 1 || length > INT_MAX)
+  {
+    fprintf(stderr, "Invalid alignment dimensions\n");
+    return 1;
+  }
+
+  srand(seed);
+
+  /* random columns from which sites are drawn */
+  char * source = (char *)xmalloc((size_t)(columns*count) * sizeof(char));
+  for (i = 0; i < columns*count; ++i)
+    source[i] = nt[rand() % 4];
+
+  char ** sequence = (char **)xmalloc((size_t)count * sizeof(char *));
+  for (i = 0; i < count; ++i)
+    sequence[i] = (char *)xmalloc((size_t)(length+1) * sizeof(char));
+
+  for (j = 0; j < length; ++j)
+  {
+    const char * col = source + (rand() % columns)*count;
+    for (i = 0; i < count; ++i)
+      sequence[i][j] = col[i];
+  }
+  for (i = 0; i < count; ++i)
+    sequence[i][length] = 0;
+
+  int compressed_length = (int)length;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  unsigned int * weight = compress_site_patterns(sequence,
+                                                 pll_map_nt,
+                                                 (int)count,
+                                                 &compressed_length,
+                                                 COMPRESS_GENERAL);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  uint64_t h = UINT64_C(14695981039346656037);
+  for (i = 0; i < count; ++i)
+    h = checksum(h, sequence[i], (size_t)compressed_length);
+  h = checksum(h, weight, (size_t)compressed_length * sizeof(unsigned int));
+
+  printf("%ld x %ld sites, %d patterns: %.3f s (checksum %016llx)\n",
+         count, length, compressed_length, elapsed(&start,&end),
+         (unsigned long long)h);
+
+  for (i = 0; i < count; ++i)
+    free(sequence[i]);
+  free(sequence);
+  free(source);
+  free(weight);
+
+  return 0;
+}
@@ -23,6 +23,7 @@ from subprocess import Popen, PIPE, call
 
 import sys, stat, os
 import time
+import shutil
 
 # define path to BPP binary
 
@@ -218,11 +219,39 @@ opt_testsuite_ziheng = [                 # [path-to-test,description]
    ["testbed/ziheng/3",  "ziheng-3"],
    ["testbed/ziheng/4",  "ziheng-4"]
 ]
+
+# consistency tests run a list of steps with the default random number
+# generator, and pass if all steps succeed and all runs produce identical MCMC
+# files. Steps:
+#   run <ctl>       run bpp with control file <path-to-test>/data/<ctl>
+#   build <ctl>     as run, and require that loci are not read from the cache
+#   load <ctl>      as run, and require that loci are read from the cache
+#   setup <ctl>     run bpp and discard its MCMC file
+#   fail <ctl>      require that bpp exits with an error
+#   truncate <file> truncate <path-to-test>/out/<file> to half its size
+
+opt_testsuite_consistency_desc = "Consistency between runs"
+opt_testsuite_consistency = [           # [path-to-test,description,steps]
+   ["testbed/consistency/threads-A00", "threads-1-3-A00",
+    ["run threads1.ctl", "run threads3.ctl"]],
+   ["testbed/consistency/threads-A01", "threads-1-3-A01",
+    ["run threads1.ctl", "run threads3.ctl"]],
+   ["testbed/consistency/cache-A00", "cache-A00",
+    ["run nocache.ctl", "build cache.ctl", "load cache.ctl"]],
+   ["testbed/consistency/cache-A00-phased", "cache-A00-phased",
+    ["run nocache.ctl", "build cache.ctl", "load cache.ctl"]],
+   ["testbed/consistency/cache-A00", "cache-stale-A00",
+    ["run nocache.ctl", "setup clean.ctl", "build cache.ctl", "load cache.ctl"]],
+   ["testbed/consistency/cache-A00", "cache-corrupt-A00",
+    ["build cache.ctl", "truncate cache.bin", "fail cache.ctl"]]
+]
+
 # define test collections
 
 opt_testbeds = [
    [opt_testsuite_small,opt_testsuite_small_desc],
-   [opt_testsuite_ziheng,opt_testsuite_ziheng_desc]
+   [opt_testsuite_ziheng,opt_testsuite_ziheng_desc],
+   [opt_testsuite_consistency,opt_testsuite_consistency_desc]
 ]
 
 ## define architectures to test
@@ -306,7 +335,7 @@ def testf(curtest,numtest,t,desc,arch):
     os.makedirs(outdir)
 
   ctl = t + "/data/bpp.ctl"
-  cmd = opt_bpp_bin + " --cfile " + ctl + " --arch "  + arch + " 2>tmperr >tmp"
+  cmd = opt_bpp_bin + " --cfile " + ctl + " --arch "  + arch + " --rng legacy 2>tmperr >tmp"
 
   now = time.strftime("  %H:%M:%S")
 
@@ -335,6 +364,83 @@ def testf(curtest,numtest,t,desc,arch):
   os.remove(outdir + "/out.txt")
   os.rmdir(outdir)
    
+def consistencytest(t,steps,arch):
+  outdir = t + "/out"
+  mcmcfile = outdir + "/mcmc.txt"
+  results = []
+
+  for step in steps:
+    action,arg = step.split()
+
+    if action == "truncate":
+      f = open(outdir + "/" + arg, "r+b")
+      f.seek(0, os.SEEK_END)
+      f.truncate(f.tell() // 2)
+      f.close()
+      continue
+
+    ctl = t + "/data/" + arg
+    cmd = opt_bpp_bin + " --cfile " + ctl + " --arch " + arch + " 2>tmperr >tmp"
+    rc = call(cmd, shell=True)
+
+    if action == "fail":
+      if rc == 0:
+        return False
+      continue
+
+    if rc != 0:
+      return False
+
+    if action == "setup":
+      os.remove(mcmcfile)
+      continue
+
+    loaded = "Reading preprocessed loci" in open("tmp").read()
+    if (action == "build" and loaded) or (action == "load" and not loaded):
+      return False
+
+    # keep the MCMC file of each run
+    result = mcmcfile + "." + str(len(results))
+    os.rename(mcmcfile, result)
+    results.append(result)
+
+  for result in results[1:]:
+    p = Popen(["diff","-q",results[0],result], stdout=PIPE)
+    if p.communicate()[0]:
+      return False
+
+  return True
+
+def testc(curtest,numtest,t,desc,steps,arch):
+
+  # create output directory
+  outdir = t + "/out";
+  if not os.path.exists(outdir):
+    os.makedirs(outdir)
+
+  now = time.strftime("  %H:%M:%S")
+
+  tstart = time.time()
+
+  result = consistencytest(t,steps,arch)
+
+  tend = time.time()
+  runtime = tend - tstart
+
+  ansiprint("-", "{:>3}/{:<3} ".format(curtest,numtest) + now)
+  ansiprint("cyan", " {:<39} ".format(desc))
+
+  runtime = "%.2f" % runtime
+  ansiprint("cyan", "{:<14} ".format(runtime))
+  if result:
+    test_ok()
+  else:
+    test_fail()
+  print
+
+  # delete output directory and files
+  shutil.rmtree(outdir)
+
 def runtests():
   total = 0;
   for tb in opt_testbeds:
@@ -358,7 +464,10 @@ def runtests():
         test = t[0]
         testdesc = t[1];
         current = current+1
-        testf(current,total,test,testdesc,arch)
+        if len(t) > 2:
+          testc(current,total,test,testdesc,t[2],arch)
+        else:
+          testf(current,total,test,testdesc,arch)
 
 if __name__ == "__main__":
   